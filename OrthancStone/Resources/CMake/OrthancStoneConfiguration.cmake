@@ -200,6 +200,7 @@ endif()
 if (NOT ORTHANC_SANDBOXED AND ENABLE_THREADS AND ENABLE_WEB_CLIENT)
   list(APPEND ORTHANC_STONE_SOURCES
     ${ORTHANC_STONE_ROOT}/Loaders/GenericLoadersContext.cpp
+    ${ORTHANC_STONE_ROOT}/Messages/ConcurrentMessageDelivery.cpp
     ${ORTHANC_STONE_ROOT}/Oracle/GenericOracleRunner.cpp
     ${ORTHANC_STONE_ROOT}/Oracle/ThreadedOracle.cpp
     )
@@ -238,6 +239,7 @@ list(APPEND ORTHANC_STONE_SOURCES
 
   ${ORTHANC_STONE_ROOT}/Loaders/BasicFetchingItemsSorter.cpp
   ${ORTHANC_STONE_ROOT}/Loaders/BasicFetchingStrategy.cpp
+  ${ORTHANC_STONE_ROOT}/Loaders/DicomResourcesDiskCache.cpp
   ${ORTHANC_STONE_ROOT}/Loaders/DicomResourcesLoader.cpp
   ${ORTHANC_STONE_ROOT}/Loaders/DicomSource.cpp
   ${ORTHANC_STONE_ROOT}/Loaders/DicomStructureSetLoader.cpp
@@ -252,6 +254,7 @@ list(APPEND ORTHANC_STONE_SOURCES
   ${ORTHANC_STONE_ROOT}/Loaders/SeriesOrderedFrames.cpp
   ${ORTHANC_STONE_ROOT}/Loaders/SeriesThumbnailsLoader.cpp
 
+  ${ORTHANC_STONE_ROOT}/Messages/IMessage.cpp
   ${ORTHANC_STONE_ROOT}/Messages/IObservable.cpp
 
   ${ORTHANC_STONE_ROOT}/Oracle/GetOrthancImageCommand.cpp
@@ -295,6 +298,7 @@ list(APPEND ORTHANC_STONE_SOURCES
   ${ORTHANC_STONE_ROOT}/Scene2D/Internals/CairoTextRenderer.cpp
   ${ORTHANC_STONE_ROOT}/Scene2D/Internals/CompositorHelper.cpp
   ${ORTHANC_STONE_ROOT}/Scene2D/Internals/FixedPointAligner.cpp
+  ${ORTHANC_STONE_ROOT}/Scene2D/Internals/FloatTexturePacker.cpp
   ${ORTHANC_STONE_ROOT}/Scene2D/Internals/MacroLayerRenderer.cpp
   
   ${ORTHANC_STONE_ROOT}/Scene2DViewport/AngleMeasureTool.cpp
@@ -328,6 +332,7 @@ list(APPEND ORTHANC_STONE_SOURCES
   ${ORTHANC_STONE_ROOT}/Toolbox/DebugDrawing2D.cpp
   ${ORTHANC_STONE_ROOT}/Toolbox/DicomInstanceParameters.cpp
   ${ORTHANC_STONE_ROOT}/Toolbox/DicomStructureSet.cpp
+  ${ORTHANC_STONE_ROOT}/Toolbox/DicomWebStreamingParser.cpp
   ${ORTHANC_STONE_ROOT}/Toolbox/DynamicBitmap.cpp
   ${ORTHANC_STONE_ROOT}/Toolbox/Extent2D.cpp
   ${ORTHANC_STONE_ROOT}/Toolbox/FiniteProjectiveCamera.cpp
@@ -339,6 +344,7 @@ list(APPEND ORTHANC_STONE_SOURCES
   ${ORTHANC_STONE_ROOT}/Toolbox/Internals/OrientedIntegerLine2D.cpp
   ${ORTHANC_STONE_ROOT}/Toolbox/Internals/RectanglesIntegerProjection.cpp
   ${ORTHANC_STONE_ROOT}/Toolbox/LinearAlgebra.cpp
+  ${ORTHANC_STONE_ROOT}/Toolbox/PixelHistogram.cpp
   ${ORTHANC_STONE_ROOT}/Toolbox/SegmentTree.cpp
   ${ORTHANC_STONE_ROOT}/Toolbox/ShearWarpProjectiveTransform.cpp
   ${ORTHANC_STONE_ROOT}/Toolbox/SlicesSorter.cpp
@@ -381,6 +387,13 @@ list(APPEND ORTHANC_STONE_SOURCES
   )
 
 
+if (ENABLE_THREADS)
+  list(APPEND ORTHANC_STONE_SOURCES
+    ${ORTHANC_STONE_ROOT}/Toolbox/Internals/WorkersPool.cpp
+    )
+endif()
+
+
 if (ENABLE_OPENGL)
   list(APPEND ORTHANC_STONE_SOURCES
     ${ORTHANC_STONE_ROOT}/Fonts/OpenGLTextCoordinates.cpp
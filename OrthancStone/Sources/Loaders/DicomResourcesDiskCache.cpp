@@ -0,0 +1,505 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "DicomResourcesDiskCache.h"
+
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+
+#if ORTHANC_SANDBOXED != 1
+#  include <SystemToolbox.h>
+#  include <boost/filesystem.hpp>
+#endif
+
+
+namespace OrthancStone
+{
+  static const char MAGIC[] = "STONEDCM";
+  static const size_t MAGIC_SIZE = 8;
+  static const uint32_t VERSION = 1;
+
+  enum ValueType
+  {
+    ValueType_Null = 0,
+    ValueType_String = 1,
+    ValueType_Binary = 2
+  };
+
+
+  static void WriteUInt8(std::string& target,
+                         uint8_t value)
+  {
+    target.push_back(static_cast<char>(value));
+  }
+
+
+  static void WriteUInt16(std::string& target,
+                          uint16_t value)
+  {
+    // Little-endian, whatever the architecture
+    target.push_back(static_cast<char>(value & 0xffu));
+    target.push_back(static_cast<char>(value >> 8));
+  }
+
+
+  static void WriteUInt32(std::string& target,
+                          uint32_t value)
+  {
+    WriteUInt16(target, static_cast<uint16_t>(value & 0xffffu));
+    WriteUInt16(target, static_cast<uint16_t>(value >> 16));
+  }
+
+
+  static void WriteString(std::string& target,
+                          const std::string& value)
+  {
+    if (static_cast<size_t>(static_cast<uint32_t>(value.size())) != value.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
+    }
+
+    WriteUInt32(target, static_cast<uint32_t>(value.size()));
+    target.append(value);
+  }
+
+
+  namespace
+  {
+    class BinaryReader : public boost::noncopyable
+    {
+    private:
+      const std::string&  source_;
+      size_t              position_;
+
+    public:
+      explicit BinaryReader(const std::string& source) :
+        source_(source),
+        position_(0)
+      {
+      }
+
+      bool IsEnd() const
+      {
+        return position_ == source_.size();
+      }
+
+      bool ReadUInt8(uint8_t& value)
+      {
+        if (position_ + 1 > source_.size())
+        {
+          return false;
+        }
+        else
+        {
+          value = static_cast<uint8_t>(source_[position_]);
+          position_ += 1;
+          return true;
+        }
+      }
+
+      bool ReadUInt16(uint16_t& value)
+      {
+        uint8_t a, b;
+        if (ReadUInt8(a) &&
+            ReadUInt8(b))
+        {
+          value = static_cast<uint16_t>(a) | static_cast<uint16_t>(static_cast<uint16_t>(b) << 8);
+          return true;
+        }
+        else
+        {
+          return false;
+        }
+      }
+
+      bool ReadUInt32(uint32_t& value)
+      {
+        uint16_t a, b;
+        if (ReadUInt16(a) &&
+            ReadUInt16(b))
+        {
+          value = static_cast<uint32_t>(a) | (static_cast<uint32_t>(b) << 16);
+          return true;
+        }
+        else
+        {
+          return false;
+        }
+      }
+
+      bool ReadString(std::string& value)
+      {
+        uint32_t size;
+        if (!ReadUInt32(size) ||
+            size > source_.size() - position_)
+        {
+          return false;
+        }
+        else
+        {
+          value.assign(source_, position_, size);
+          position_ += size;
+          return true;
+        }
+      }
+
+      bool ReadMagic()
+      {
+        if (source_.size() < MAGIC_SIZE ||
+            source_.compare(0, MAGIC_SIZE, MAGIC) != 0)
+        {
+          return false;
+        }
+        else
+        {
+          position_ = MAGIC_SIZE;
+          return true;
+        }
+      }
+    };
+  }
+
+
+  DicomResourcesDiskCache::DicomResourcesDiskCache(const std::string& directory)
+  {
+#if ORTHANC_SANDBOXED == 1
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+                                    "The disk cache is not available in sandboxed environments");
+#else
+    // The path must be absolute, as the oracle resolves the relative
+    // paths of "ReadFileCommand" against its own root directory
+    directory_ = boost::filesystem::absolute(directory).string();
+    Orthanc::SystemToolbox::MakeDirectory(directory_);
+#endif
+  }
+
+
+  std::string DicomResourcesDiskCache::GetPath(const DicomSource& source,
+                                               const std::string& resource) const
+  {
+    std::string key;
+    Orthanc::Toolbox::ComputeSHA1(key, source.GetServerIdentifier() + "|" + resource);
+
+#if ORTHANC_SANDBOXED == 1
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+#else
+    return (boost::filesystem::path(directory_) / (key + ".dcm-cache")).string();
+#endif
+  }
+
+
+  bool DicomResourcesDiskCache::HasEntry(const std::string& path) const
+  {
+#if ORTHANC_SANDBOXED == 1
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+#else
+    return Orthanc::SystemToolbox::IsRegularFile(path);
+#endif
+  }
+
+
+  void DicomResourcesDiskCache::Store(const std::string& path,
+                                      const std::string& validator,
+                                      LoadedDicomResources& resources) const
+  {
+#if ORTHANC_SANDBOXED == 1
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+#else
+    std::string content;
+    Serialize(content, validator, resources);
+
+    // Write to a temporary file, then rename it, so that the oracle
+    // never reads a partially written entry
+    const std::string tmp = path + ".tmp";
+    Orthanc::SystemToolbox::WriteFile(content, tmp);
+
+    try
+    {
+      boost::filesystem::rename(tmp, path);
+    }
+    catch (boost::filesystem::filesystem_error&)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                      "Cannot write to the disk cache: " + path);
+    }
+#endif
+  }
+
+
+  void DicomResourcesDiskCache::Serialize(std::string& target,
+                                          const std::string& validator,
+                                          LoadedDicomResources& resources)
+  {
+    target.clear();
+    target.append(MAGIC, MAGIC_SIZE);
+    WriteUInt32(target, VERSION);
+    WriteString(target, validator);
+    WriteUInt32(target, static_cast<uint32_t>(resources.GetSize()));
+
+    for (size_t i = 0; i < resources.GetSize(); i++)
+    {
+      const Orthanc::DicomMap& dicom = resources.GetResource(i);
+
+      std::set<Orthanc::DicomTag> tags;
+      dicom.GetTags(tags);
+
+      WriteUInt32(target, static_cast<uint32_t>(tags.size()));
+
+      for (std::set<Orthanc::DicomTag>::const_iterator it = tags.begin(); it != tags.end(); ++it)
+      {
+        const Orthanc::DicomValue& value = dicom.GetValue(*it);
+
+        WriteUInt16(target, it->GetGroup());
+        WriteUInt16(target, it->GetElement());
+
+        if (value.IsNull())
+        {
+          WriteUInt8(target, ValueType_Null);
+        }
+        else
+        {
+          WriteUInt8(target, value.IsBinary() ? ValueType_Binary : ValueType_String);
+          WriteString(target, value.GetContent());
+        }
+      }
+
+      if (resources.HasSourceJson(i))
+      {
+        std::string json;
+        Orthanc::Toolbox::WriteFastJson(json, resources.GetSourceJson(i));
+
+        WriteUInt8(target, 1);
+        WriteString(target, json);
+      }
+      else
+      {
+        WriteUInt8(target, 0);
+      }
+    }
+  }
+
+
+  bool DicomResourcesDiskCache::Unserialize(std::string& validator,
+                                            LoadedDicomResources& target,
+                                            const std::string& source)
+  {
+    BinaryReader reader(source);
+
+    uint32_t version, count;
+    std::string v;
+    if (!reader.ReadMagic() ||
+        !reader.ReadUInt32(version) ||
+        version != VERSION ||
+        !reader.ReadString(v) ||
+        !reader.ReadUInt32(count))
+    {
+      return false;
+    }
+
+    // Parse everything before modifying "target", as the entry might be truncated
+    LoadedDicomResources resources(target.GetIndexedTag());
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+      uint32_t tagsCount;
+      if (!reader.ReadUInt32(tagsCount))
+      {
+        return false;
+      }
+
+      Orthanc::DicomMap dicom;
+
+      for (uint32_t j = 0; j < tagsCount; j++)
+      {
+        uint16_t group, element;
+        uint8_t type;
+        if (!reader.ReadUInt16(group) ||
+            !reader.ReadUInt16(element) ||
+            !reader.ReadUInt8(type))
+        {
+          return false;
+        }
+
+        Orthanc::DicomTag tag(group, element);
+
+        if (type == ValueType_Null)
+        {
+          dicom.SetNullValue(tag);
+        }
+        else if (type == ValueType_String ||
+                 type == ValueType_Binary)
+        {
+          std::string value;
+          if (!reader.ReadString(value))
+          {
+            return false;
+          }
+
+          dicom.SetValue(tag, value, (type == ValueType_Binary));
+        }
+        else
+        {
+          return false;
+        }
+      }
+
+      uint8_t hasSourceJson;
+      if (!reader.ReadUInt8(hasSourceJson))
+      {
+        return false;
+      }
+      else if (hasSourceJson)
+      {
+        std::string s;
+        Json::Value json;
+        if (!reader.ReadString(s) ||
+            !Orthanc::Toolbox::ReadJson(json, s))
+        {
+          return false;
+        }
+
+        resources.AddResource(dicom, json);
+      }
+      else
+      {
+        resources.AddResource(dicom);
+      }
+    }
+
+    if (!reader.IsEnd())
+    {
+      return false;
+    }
+
+    validator.swap(v);
+    target.AddResources(resources);
+    return true;
+  }
+
+
+  bool DicomResourcesDiskCache::LoadDicomWebAnswer(LoadedDicomResources& target,
+                                                   const LoadedDicomResources* cached,
+                                                   const std::string& answer,
+                                                   Orthanc::HttpStatus status)
+  {
+    if (status == Orthanc::HttpStatus_304_NotModified)
+    {
+      if (cached == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                        "Answer \"304 Not Modified\" to a request that was not conditional");
+      }
+      else
+      {
+        target.AddResources(*cached);
+        return false;
+      }
+    }
+    else if (status == Orthanc::HttpStatus_204_NoContent)
+    {
+      // No matching resource
+      return true;
+    }
+    else
+    {
+      // Streaming parsing, without building the JSON tree of the whole answer
+      target.AddFromDicomWebAnswer(answer);
+      return true;
+    }
+  }
+
+
+  bool DicomResourcesDiskCache::ComputeOrthancValidator(std::string& validator,
+                                                        Orthanc::ResourceType level,
+                                                        const Json::Value& resource)
+  {
+    static const char* const IS_STABLE = "IsStable";
+    static const char* const LAST_UPDATE = "LastUpdate";
+
+    const char* children = NULL;
+
+    switch (level)
+    {
+      case Orthanc::ResourceType_Patient:
+        children = "Studies";
+        break;
+
+      case Orthanc::ResourceType_Study:
+        children = "Series";
+        break;
+
+      case Orthanc::ResourceType_Series:
+        children = "Instances";
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    if (resource.type() != Json::objectValue ||
+        !resource.isMember(IS_STABLE) ||
+        !resource.isMember(LAST_UPDATE) ||
+        !resource.isMember(children) ||
+        resource[IS_STABLE].type() != Json::booleanValue ||
+        resource[LAST_UPDATE].type() != Json::stringValue ||
+        resource[children].type() != Json::arrayValue ||
+        !resource[IS_STABLE].asBool())
+    {
+      return false;
+    }
+
+    std::vector<std::string> ids;
+    ids.reserve(resource[children].size());
+
+    for (Json::Value::ArrayIndex i = 0; i < resource[children].size(); i++)
+    {
+      if (resource[children][i].type() == Json::stringValue)
+      {
+        ids.push_back(resource[children][i].asString());
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    std::sort(ids.begin(), ids.end());
+
+    std::string s;
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+      s += ids[i] + "\n";
+    }
+
+    std::string sha1;
+    Orthanc::Toolbox::ComputeSHA1(sha1, s);
+
+    validator = (resource[LAST_UPDATE].asString() + "-" +
+                 boost::lexical_cast<std::string>(ids.size()) + "-" + sha1);
+    return true;
+  }
+}
@@ -0,0 +1,109 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "DicomSource.h"
+#include "LoadedDicomResources.h"
+
+#include <Enumerations.h>
+
+
+namespace OrthancStone
+{
+  /**
+   * Persistent cache of the DICOM tags of the resources that are
+   * loaded by "DicomResourcesLoader", stored on the filesystem. Each
+   * entry corresponds to one request against one DICOM source, and is
+   * stored in a compact binary format together with a validator (the
+   * "ETag" of DICOMweb answers, or the "LastUpdate" of Orthanc
+   * resources) that is used to check whether the entry is up-to-date.
+   *
+   * The entries are read by the oracle (as a "ReadFileCommand"), and
+   * written by the loader. This class is not available in sandboxed
+   * environments (WebAssembly).
+   **/
+  class DicomResourcesDiskCache : public boost::noncopyable
+  {
+  private:
+    std::string  directory_;
+
+  public:
+    explicit DicomResourcesDiskCache(const std::string& directory);
+
+    const std::string& GetDirectory() const
+    {
+      return directory_;
+    }
+
+    // The "resource" is typically the URI that is used to load the resources
+    std::string GetPath(const DicomSource& source,
+                        const std::string& resource) const;
+
+    bool HasEntry(const std::string& path) const;
+
+    void Store(const std::string& path,
+               const std::string& validator,
+               LoadedDicomResources& resources) const;
+
+    static void Serialize(std::string& target,
+                          const std::string& validator,
+                          LoadedDicomResources& resources);
+
+    /**
+     * Returns "false" if the content is not a valid cache entry (for
+     * instance, if it was written by another version of Stone). In
+     * this case, "target" is left unchanged.
+     **/
+    static bool Unserialize(std::string& validator,
+                            LoadedDicomResources& target,
+                            const std::string& source);
+
+    /**
+     * Adds the answer to a DICOMweb request to "target". If the
+     * request was conditional, "cached" is the cached content it was
+     * issued against (NULL otherwise). Only the "304 Not Modified"
+     * status reuses the cached content, as a valid answer can be
+     * empty (e.g. "204 No Content" for a QIDO-RS request without
+     * match). Returns "false" iff the cached content was used.
+     **/
+    static bool LoadDicomWebAnswer(LoadedDicomResources& target,
+                                   const LoadedDicomResources* cached,
+                                   const std::string& answer,
+                                   Orthanc::HttpStatus status);
+
+    /**
+     * Computes the validator of the cache entries below an Orthanc
+     * resource, from the JSON answer to "GET /{patients|studies|series}/{id}".
+     * The "LastUpdate" has a resolution of one second, and is not
+     * modified if a child is deleted: The validator also contains the
+     * sorted identifiers of the children. Returns "false" if the
+     * resource is not stable yet (i.e. it can still receive
+     * instances), in which case it must not be cached.
+     **/
+    static bool ComputeOrthancValidator(std::string& validator,
+                                        Orthanc::ResourceType level,
+                                        const Json::Value& resource);
+  };
+}
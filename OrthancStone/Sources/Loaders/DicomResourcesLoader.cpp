@@ -23,6 +23,8 @@
 
 #include "DicomResourcesLoader.h"
 
+#include "DicomResourcesDiskCache.h"
+
 #if !defined(ORTHANC_ENABLE_DCMTK)
 #  error The macro ORTHANC_ENABLE_DCMTK must be defined
 #endif
@@ -61,6 +63,132 @@ namespace OrthancStone
   }
 
 
+  class DicomResourcesLoader::DiskCacheEntry : public boost::noncopyable
+  {
+  private:
+    boost::shared_ptr<DicomResourcesDiskCache>  cache_;
+    std::string                                 path_;
+    boost::shared_ptr<LoadedDicomResources>     target_;
+    std::string                                 validator_;
+    std::unique_ptr<LoadedDicomResources>       cachedContent_;
+    std::string                                 cachedValidator_;
+
+  public:
+    DiskCacheEntry(boost::shared_ptr<DicomResourcesDiskCache> cache,
+                   const std::string& path,
+                   boost::shared_ptr<LoadedDicomResources> target) :
+      cache_(cache),
+      path_(path),
+      target_(target)
+    {
+      if (!cache ||
+          !target)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+      }
+    }
+
+    const std::string& GetPath() const
+    {
+      return path_;
+    }
+
+    bool HasEntry() const
+    {
+      return cache_->HasEntry(path_);
+    }
+
+    boost::shared_ptr<LoadedDicomResources> GetTarget() const
+    {
+      return target_;
+    }
+
+    // The resources are first loaded into a temporary target, that
+    // has the same configuration as the actual target
+    LoadedDicomResources* CreateTemporaryTarget() const
+    {
+      std::unique_ptr<LoadedDicomResources> result(new LoadedDicomResources(target_->GetIndexedTag()));
+
+      if (target_->IsSourceJsonRestricted())
+      {
+        result->RestrictSourceJson(target_->GetSourceJsonTags());
+      }
+
+      return result.release();
+    }
+
+    // Validator of the content that is being loaded from the network
+    void SetValidator(const std::string& validator)
+    {
+      validator_ = validator;
+    }
+
+    const std::string& GetValidator() const
+    {
+      return validator_;
+    }
+
+    void LoadCachedContent(const std::string& content)
+    {
+      std::unique_ptr<LoadedDicomResources> cached(CreateTemporaryTarget());
+
+      std::string validator;
+      if (DicomResourcesDiskCache::Unserialize(validator, *cached, content))
+      {
+        cachedContent_.reset(cached.release());
+        cachedValidator_ = validator;
+      }
+      else
+      {
+        LOG(WARNING) << "Ignoring invalid entry in the disk cache: " << path_;
+      }
+    }
+
+    bool HasCachedContent() const
+    {
+      return cachedContent_.get() != NULL;
+    }
+
+    const LoadedDicomResources& GetCachedContent() const
+    {
+      if (cachedContent_.get() == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+      }
+      else
+      {
+        return *cachedContent_;
+      }
+    }
+
+    const std::string& GetCachedValidator() const
+    {
+      return cachedValidator_;
+    }
+
+    // Stores the loaded resources into the disk cache (if a validator
+    // is available), then adds them to the actual target
+    void Commit(LoadedDicomResources& loaded)
+    {
+      if (!validator_.empty())
+      {
+        try
+        {
+          // The writing is not done by the oracle, as it has no command
+          // for this purpose. This is only a small file per request.
+          cache_->Store(path_, validator_, loaded);
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          LOG(WARNING) << "Cannot write to the disk cache: " << e.What();
+        }
+      }
+
+      target_->AddResources(loaded);
+    }
+  };
+
+
   class DicomResourcesLoader::Handler : public Orthanc::IDynamicObject
   {
   private:
@@ -69,6 +197,7 @@ namespace OrthancStone
     int                                         priority_;
     DicomSource                                 source_;
     boost::shared_ptr<Orthanc::IDynamicObject>  userPayload_;
+    boost::shared_ptr<DiskCacheEntry>           diskCacheEntry_;
 
   public:
     Handler(boost::shared_ptr<DicomResourcesLoader> loader,
@@ -95,8 +224,34 @@ namespace OrthancStone
 
     void BroadcastSuccess()
     {
-      SuccessMessage message(*loader_, target_, priority_, source_, userPayload_.get());
-      loader_->BroadcastMessage(message);
+      if (diskCacheEntry_)
+      {
+        // The resources were loaded into a temporary target
+        diskCacheEntry_->Commit(*target_);
+
+        SuccessMessage message(*loader_, diskCacheEntry_->GetTarget(), priority_, source_, userPayload_.get());
+        loader_->BroadcastMessage(message);
+      }
+      else
+      {
+        SuccessMessage message(*loader_, target_, priority_, source_, userPayload_.get());
+        loader_->BroadcastMessage(message);
+      }
+    }
+
+    /**
+     * If a disk cache entry is set, "target_" is a temporary target
+     * whose content is written to the disk cache, then added to the
+     * actual target of the entry, once the loading is complete.
+     **/
+    void SetDiskCacheEntry(boost::shared_ptr<DiskCacheEntry> entry)
+    {
+      diskCacheEntry_ = entry;
+    }
+
+    boost::shared_ptr<DiskCacheEntry> GetDiskCacheEntry() const
+    {
+      return diskCacheEntry_;
     }
 
     boost::shared_ptr<DicomResourcesLoader> GetLoader()
@@ -154,9 +309,33 @@ namespace OrthancStone
         throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
       }
     }
+
+    virtual void HandleHttpAnswer(const std::string& body,
+                                  const HttpCommand::HttpHeaders& answerHeaders,
+                                  Orthanc::HttpStatus status)
+    {
+      HandleString(body);
+    }
   };
 
 
+  static std::string LookupETag(const HttpCommand::HttpHeaders& headers)
+  {
+    for (HttpCommand::HttpHeaders::const_iterator it = headers.begin(); it != headers.end(); ++it)
+    {
+      std::string s;
+      Orthanc::Toolbox::ToLowerCase(s, it->first);
+
+      if (s == "etag")
+      {
+        return it->second;
+      }
+    }
+
+    return "";
+  }
+
+
   class DicomResourcesLoader::DicomWebHandler : public StringHandler
   {
   public:
@@ -174,6 +353,30 @@ namespace OrthancStone
       GetTarget()->AddFromDicomWeb(body);
       BroadcastSuccess();
     }
+
+    virtual void HandleHttpAnswer(const std::string& body,
+                                  const HttpCommand::HttpHeaders& answerHeaders,
+                                  Orthanc::HttpStatus status) ORTHANC_OVERRIDE
+    {
+      boost::shared_ptr<DiskCacheEntry> entry = GetDiskCacheEntry();
+
+      const LoadedDicomResources* cached = NULL;
+      if (entry &&
+          entry->HasCachedContent())
+      {
+        cached = &entry->GetCachedContent();
+      }
+
+      // If the cached content is used ("304 Not Modified"), it is not
+      // written again to the disk cache, as no new validator is set
+      if (DicomResourcesDiskCache::LoadDicomWebAnswer(*GetTarget(), cached, body, status) &&
+          entry)
+      {
+        entry->SetValidator(LookupETag(answerHeaders));
+      }
+
+      BroadcastSuccess();
+    }
   };
 
 
@@ -273,7 +476,8 @@ namespace OrthancStone
               body[0][ID].type() == Json::stringValue)
           {
             GetLoader()->ScheduleLoadOrthancInstanceTags
-              (GetTarget(), GetPriority(), GetSource(), body[0][ID].asString(), GetRemainingCommands(), GetUserPayload());
+              (GetTarget(), GetPriority(), GetSource(), body[0][ID].asString(), GetRemainingCommands(),
+               GetUserPayload(), GetDiskCacheEntry());
             CloseCommand();
           }
           else
@@ -327,7 +531,7 @@ namespace OrthancStone
               {
                 GetLoader()->ScheduleLoadOrthancOneChildInstance
                   (GetTarget(), GetPriority(), GetSource(), bottomLevel_,
-                   body[i][ID].asString(), GetRemainingCommands(), GetUserPayload());
+                   body[i][ID].asString(), GetRemainingCommands(), GetUserPayload(), GetDiskCacheEntry());
               }
               else
               {
@@ -350,7 +554,8 @@ namespace OrthancStone
                   {
                     GetLoader()->ScheduleLoadOrthancInstanceTags
                       (GetTarget(), GetPriority(), GetSource(),
-                       body[i][INSTANCES][0].asString(), GetRemainingCommands(), GetUserPayload());
+                       body[i][INSTANCES][0].asString(), GetRemainingCommands(), GetUserPayload(),
+                       GetDiskCacheEntry());
                   }
                   else
                   {
@@ -368,7 +573,7 @@ namespace OrthancStone
               {
                 GetLoader()->ScheduleLoadOrthancInstanceTags
                   (GetTarget(), GetPriority(), GetSource(),
-                   body[i][ID].asString(), GetRemainingCommands(), GetUserPayload());
+                   body[i][ID].asString(), GetRemainingCommands(), GetUserPayload(), GetDiskCacheEntry());
               }
               else
               {
@@ -388,6 +593,177 @@ namespace OrthancStone
   };
 
 
+  class DicomResourcesLoader::DiskCacheReadHandler : public StringHandler
+  {
+  private:
+    boost::shared_ptr<DiskCacheEntry>  entry_;
+
+  public:
+    DiskCacheReadHandler(boost::shared_ptr<DicomResourcesLoader> loader,
+                         boost::shared_ptr<LoadedDicomResources> target,
+                         int priority,
+                         const DicomSource& source,
+                         boost::shared_ptr<Orthanc::IDynamicObject> userPayload,
+                         boost::shared_ptr<DiskCacheEntry> entry) :
+      StringHandler(loader, target, priority, source, userPayload),
+      entry_(entry)
+    {
+      if (!entry)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+      }
+    }
+
+    boost::shared_ptr<DiskCacheEntry> GetEntry() const
+    {
+      return entry_;
+    }
+
+    // Continues the loading, once the disk cache has been read (or has failed to be read)
+    virtual void Resume() = 0;
+
+    virtual void HandleJson(const Json::Value& body) ORTHANC_OVERRIDE
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+
+    virtual void HandleString(const std::string& body) ORTHANC_OVERRIDE
+    {
+      entry_->LoadCachedContent(body);
+      Resume();
+    }
+  };
+
+
+  class DicomResourcesLoader::DicomWebDiskCacheReadHandler : public DiskCacheReadHandler
+  {
+  private:
+    std::string                         uri_;
+    std::map<std::string, std::string>  arguments_;
+
+  public:
+    DicomWebDiskCacheReadHandler(boost::shared_ptr<DicomResourcesLoader> loader,
+                                 boost::shared_ptr<LoadedDicomResources> target,
+                                 int priority,
+                                 const DicomSource& source,
+                                 boost::shared_ptr<Orthanc::IDynamicObject> userPayload,
+                                 boost::shared_ptr<DiskCacheEntry> entry,
+                                 const std::string& uri,
+                                 const std::map<std::string, std::string>& arguments) :
+      DiskCacheReadHandler(loader, target, priority, source, userPayload, entry),
+      uri_(uri),
+      arguments_(arguments)
+    {
+    }
+
+    virtual void Resume() ORTHANC_OVERRIDE
+    {
+      // Always revalidate the cached content against the DICOMweb server
+      GetLoader()->ScheduleDicomWebRequest(GetTarget(), GetPriority(), GetSource(), uri_,
+                                           arguments_, GetUserPayload(), GetEntry());
+    }
+  };
+
+
+  class DicomResourcesLoader::OrthancDiskCacheReadHandler : public DiskCacheReadHandler
+  {
+  private:
+    Orthanc::ResourceType  topLevel_;
+    std::string            topId_;
+    Orthanc::ResourceType  bottomLevel_;
+
+  public:
+    OrthancDiskCacheReadHandler(boost::shared_ptr<DicomResourcesLoader> loader,
+                                boost::shared_ptr<LoadedDicomResources> target,
+                                int priority,
+                                const DicomSource& source,
+                                boost::shared_ptr<Orthanc::IDynamicObject> userPayload,
+                                boost::shared_ptr<DiskCacheEntry> entry,
+                                Orthanc::ResourceType topLevel,
+                                const std::string& topId,
+                                Orthanc::ResourceType bottomLevel) :
+      DiskCacheReadHandler(loader, target, priority, source, userPayload, entry),
+      topLevel_(topLevel),
+      topId_(topId),
+      bottomLevel_(bottomLevel)
+    {
+    }
+
+    virtual void Resume() ORTHANC_OVERRIDE
+    {
+      boost::shared_ptr<DiskCacheEntry> entry = GetEntry();
+
+      if (entry->HasCachedContent() &&
+          entry->GetCachedValidator() == entry->GetValidator())
+      {
+        // The resource was not modified since the cache entry was written
+        GetTarget()->AddResources(entry->GetCachedContent());
+        BroadcastSuccess();
+      }
+      else
+      {
+        GetLoader()->ScheduleLoadOrthancResourcesInternal(GetTarget(), GetPriority(), GetSource(), topLevel_,
+                                                          topId_, bottomLevel_, GetUserPayload(), entry);
+      }
+    }
+  };
+
+
+  class DicomResourcesLoader::OrthancLastUpdateHandler : public StringHandler
+  {
+  private:
+    boost::shared_ptr<DiskCacheEntry>  entry_;
+    Orthanc::ResourceType              topLevel_;
+    std::string                        topId_;
+    Orthanc::ResourceType              bottomLevel_;
+
+  public:
+    OrthancLastUpdateHandler(boost::shared_ptr<DicomResourcesLoader> loader,
+                             boost::shared_ptr<LoadedDicomResources> target,
+                             int priority,
+                             const DicomSource& source,
+                             boost::shared_ptr<Orthanc::IDynamicObject> userPayload,
+                             boost::shared_ptr<DiskCacheEntry> entry,
+                             Orthanc::ResourceType topLevel,
+                             const std::string& topId,
+                             Orthanc::ResourceType bottomLevel) :
+      StringHandler(loader, target, priority, source, userPayload),
+      entry_(entry),
+      topLevel_(topLevel),
+      topId_(topId),
+      bottomLevel_(bottomLevel)
+    {
+      if (!entry)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+      }
+    }
+
+    virtual void HandleJson(const Json::Value& body) ORTHANC_OVERRIDE
+    {
+      // No validator (hence no caching) if the resource is not stable
+      std::string validator;
+      if (DicomResourcesDiskCache::ComputeOrthancValidator(validator, topLevel_, body))
+      {
+        entry_->SetValidator(validator);
+      }
+
+      if (!entry_->GetValidator().empty() &&
+          entry_->HasEntry())
+      {
+        GetLoader()->ScheduleReadDiskCache(GetPriority(), new OrthancDiskCacheReadHandler(
+                                             GetLoader(), GetTarget(), GetPriority(), GetSource(), GetUserPayload(),
+                                             entry_, topLevel_, topId_, bottomLevel_));
+      }
+      else
+      {
+        GetLoader()->ScheduleLoadOrthancResourcesInternal(GetTarget(), GetPriority(), GetSource(), topLevel_,
+                                                          topId_, bottomLevel_, GetUserPayload(), entry_);
+      }
+    }
+  };
+
+
 #if ORTHANC_ENABLE_DCMTK == 1
   static void ExploreDicomDir(LoadedDicomResources& instances,
                               const Orthanc::ParsedDicomDir& dicomDir,
@@ -503,7 +879,8 @@ namespace OrthancStone
   {
     if (message.GetOrigin().HasPayload())
     {
-      dynamic_cast<StringHandler&>(message.GetOrigin().GetPayload()).HandleString(message.GetAnswer());
+      dynamic_cast<StringHandler&>(message.GetOrigin().GetPayload()).HandleHttpAnswer(
+        message.GetAnswer(), message.GetAnswerHeaders(), message.GetHttpStatus());
     }
   }
 
@@ -512,7 +889,8 @@ namespace OrthancStone
   {
     if (message.GetOrigin().HasPayload())
     {
-      dynamic_cast<StringHandler&>(message.GetOrigin().GetPayload()).HandleString(message.GetAnswer());
+      dynamic_cast<StringHandler&>(message.GetOrigin().GetPayload()).HandleHttpAnswer(
+        message.GetAnswer(), message.GetAnswerHeaders(), message.GetHttpStatus());
     }
   }
 
@@ -554,6 +932,23 @@ namespace OrthancStone
 
   void DicomResourcesLoader::Handle(const OracleCommandExceptionMessage& message)
   {
+    if (message.GetOrigin().GetType() == IOracleCommand::Type_ReadFile)
+    {
+      const ReadFileCommand& command = dynamic_cast<const ReadFileCommand&>(message.GetOrigin());
+
+      if (command.HasPayload())
+      {
+        DiskCacheReadHandler* handler = dynamic_cast<DiskCacheReadHandler*>(&command.GetPayload());
+        if (handler != NULL)
+        {
+          // Not a fatal error, the resources will be loaded from the network
+          LOG(WARNING) << "Cannot read from the disk cache: " << command.GetPath();
+          handler->Resume();
+          return;
+        }
+      }
+    }
+
     // TODO
     LOG(ERROR) << "Exception: " << message.GetException().What();
   }
@@ -564,12 +959,17 @@ namespace OrthancStone
                                                              const DicomSource& source,
                                                              const std::string& instanceId,
                                                              boost::shared_ptr<unsigned int> remainingCommands,
-                                                             boost::shared_ptr<Orthanc::IDynamicObject> userPayload)
+                                                             boost::shared_ptr<Orthanc::IDynamicObject> userPayload,
+                                                             boost::shared_ptr<DiskCacheEntry> diskCacheEntry)
   {
+    std::unique_ptr<OrthancInstanceTagsHandler> handler(new OrthancInstanceTagsHandler(
+                                                          shared_from_this(), target, priority,
+                                                          source, remainingCommands, userPayload));
+    handler->SetDiskCacheEntry(diskCacheEntry);
+
     std::unique_ptr<OrthancRestApiCommand> command(new OrthancRestApiCommand);
     command->SetUri("/instances/" + instanceId + "/tags");
-    command->AcquirePayload(new OrthancInstanceTagsHandler(shared_from_this(), target, priority,
-                                                           source, remainingCommands, userPayload));
+    command->AcquirePayload(handler.release());
 
     {
       std::unique_ptr<ILoadersContext::ILock> lock(context_.Lock());
@@ -584,12 +984,17 @@ namespace OrthancStone
                                                                  Orthanc::ResourceType level,
                                                                  const std::string& id,
                                                                  boost::shared_ptr<unsigned int> remainingCommands,
-                                                                 boost::shared_ptr<Orthanc::IDynamicObject> userPayload)
+                                                                 boost::shared_ptr<Orthanc::IDynamicObject> userPayload,
+                                                                 boost::shared_ptr<DiskCacheEntry> diskCacheEntry)
   {
+    std::unique_ptr<OrthancOneChildInstanceHandler> handler(new OrthancOneChildInstanceHandler(
+                                                              shared_from_this(), target, priority,
+                                                              source, remainingCommands, userPayload));
+    handler->SetDiskCacheEntry(diskCacheEntry);
+
     std::unique_ptr<OrthancRestApiCommand> command(new OrthancRestApiCommand);
     command->SetUri("/" + GetUri(level) + "/" + id + "/instances");
-    command->AcquirePayload(new OrthancOneChildInstanceHandler(shared_from_this(), target, priority,
-                                                               source, remainingCommands, userPayload));
+    command->AcquirePayload(handler.release());
 
     {
       std::unique_ptr<ILoadersContext::ILock> lock(context_.Lock());
@@ -658,6 +1063,105 @@ namespace OrthancStone
   }
   
   
+  void DicomResourcesLoader::ScheduleReadDiskCache(int priority,
+                                                   DiskCacheReadHandler* handler)
+  {
+    std::unique_ptr<DiskCacheReadHandler> protection(handler);
+
+    if (handler == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+    }
+
+    // Local read of the cache entry, through the oracle
+    std::unique_ptr<ReadFileCommand> command(new ReadFileCommand(handler->GetEntry()->GetPath()));
+    command->AcquirePayload(protection.release());
+
+    {
+      std::unique_ptr<ILoadersContext::ILock> lock(context_.Lock());
+      lock->Schedule(GetSharedObserver(), priority, command.release());
+    }
+  }
+
+
+  void DicomResourcesLoader::ScheduleDicomWebRequest(boost::shared_ptr<LoadedDicomResources> target,
+                                                     int priority,
+                                                     const DicomSource& source,
+                                                     const std::string& uri,
+                                                     const std::map<std::string, std::string>& arguments,
+                                                     boost::shared_ptr<Orthanc::IDynamicObject> userPayload,
+                                                     boost::shared_ptr<DiskCacheEntry> diskCacheEntry)
+  {
+    std::map<std::string, std::string> headers;
+    std::unique_ptr<DicomWebHandler> handler;
+
+    if (diskCacheEntry)
+    {
+      if (diskCacheEntry->HasCachedContent())
+      {
+        // Conditional request, the oracle reports "304 Not Modified" as
+        // an empty answer, together with its HTTP status
+        headers["If-None-Match"] = diskCacheEntry->GetCachedValidator();
+      }
+
+      boost::shared_ptr<LoadedDicomResources> loaded(diskCacheEntry->CreateTemporaryTarget());
+      handler.reset(new DicomWebHandler(shared_from_this(), loaded, priority, source, userPayload));
+      handler->SetDiskCacheEntry(diskCacheEntry);
+    }
+    else
+    {
+      handler.reset(new DicomWebHandler(shared_from_this(), target, priority, source, userPayload));
+    }
+
+    std::unique_ptr<IOracleCommand> command(
+      source.CreateDicomWebCommand(uri, arguments, headers, handler.release()));
+
+    {
+      std::unique_ptr<ILoadersContext::ILock> lock(context_.Lock());
+      lock->Schedule(GetSharedObserver(), priority, command.release());
+    }
+  }
+
+
+  void DicomResourcesLoader::ScheduleDicomWeb(boost::shared_ptr<LoadedDicomResources> target,
+                                              int priority,
+                                              const DicomSource& source,
+                                              const std::string& uri,
+                                              const std::map<std::string, std::string>& arguments,
+                                              boost::shared_ptr<Orthanc::IDynamicObject> userPayload)
+  {
+    boost::shared_ptr<DiskCacheEntry> diskCacheEntry;
+
+    /**
+     * The disk cache is only used with direct connections to the
+     * DICOMweb server, as the "ETag" and "If-None-Match" HTTP headers
+     * are not forwarded by the Orthanc DICOMweb plugin.
+     **/
+    if (diskCache_ &&
+        source.GetType() == DicomSourceType_DicomWeb)
+    {
+      std::string key = uri;
+      for (std::map<std::string, std::string>::const_iterator
+             it = arguments.begin(); it != arguments.end(); ++it)
+      {
+        key += (it == arguments.begin() ? "?" : "&") + it->first + "=" + it->second;
+      }
+
+      diskCacheEntry.reset(new DiskCacheEntry(diskCache_, diskCache_->GetPath(source, key), target));
+
+      if (diskCacheEntry->HasEntry())
+      {
+        ScheduleReadDiskCache(priority, new DicomWebDiskCacheReadHandler(
+                                shared_from_this(), target, priority, source, userPayload,
+                                diskCacheEntry, uri, arguments));
+        return;
+      }
+    }
+
+    ScheduleDicomWebRequest(target, priority, source, uri, arguments, userPayload, diskCacheEntry);
+  }
+
+
   void DicomResourcesLoader::ScheduleGetDicomWeb(boost::shared_ptr<LoadedDicomResources> target,
                                                  int priority,
                                                  const DicomSource& source,
@@ -672,17 +1176,10 @@ namespace OrthancStone
       throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls, "Not a DICOMweb source");
     }
 
-    std::map<std::string, std::string> arguments, headers;
+    std::map<std::string, std::string> arguments;
     SetIncludeTags(arguments, includeTags);
   
-    std::unique_ptr<IOracleCommand> command(
-      source.CreateDicomWebCommand(uri, arguments, headers, 
-                                   new DicomWebHandler(shared_from_this(), target, priority, source, protection)));
-      
-    {
-      std::unique_ptr<ILoadersContext::ILock> lock(context_.Lock());
-      lock->Schedule(GetSharedObserver(), priority, command.release());
-    }
+    ScheduleDicomWeb(target, priority, source, uri, arguments, protection);
   }
   
 
@@ -723,7 +1220,7 @@ namespace OrthancStone
     std::set<Orthanc::DicomTag> tags;
     filter.GetTags(tags);
 
-    std::map<std::string, std::string> arguments, headers;
+    std::map<std::string, std::string> arguments;
 
     for (std::set<Orthanc::DicomTag>::const_iterator it = tags.begin(); it != tags.end(); ++it)
     {
@@ -738,15 +1235,7 @@ namespace OrthancStone
 
     SetIncludeTags(arguments, includeTags);
 
-    std::unique_ptr<IOracleCommand> command(
-      source.CreateDicomWebCommand(uri, arguments, headers, 
-                                   new DicomWebHandler(shared_from_this(), target, priority, source, protection)));
-
-
-    {
-      std::unique_ptr<ILoadersContext::ILock> lock(context_.Lock());
-      lock->Schedule(GetSharedObserver(), priority, command.release());
-    }
+    ScheduleDicomWeb(target, priority, source, uri, arguments, protection);
   }
 
     
@@ -800,23 +1289,75 @@ namespace OrthancStone
       throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
 
+    if (diskCache_ &&
+        topLevel != Orthanc::ResourceType_Instance)
+    {
+      /**
+       * Retrieve the "LastUpdate" and the children of the top-level
+       * resource, which validate the entry of the disk cache.
+       * Instances have no "LastUpdate", but only need one request
+       * without the cache.
+       **/
+      const std::string uri = "/" + GetUri(topLevel) + "/" + topId;
+
+      boost::shared_ptr<DiskCacheEntry> entry(
+        new DiskCacheEntry(diskCache_, diskCache_->GetPath(source, uri + "/" + GetUri(bottomLevel)), target));
+
+      std::unique_ptr<OrthancRestApiCommand> command(new OrthancRestApiCommand);
+      command->SetUri(uri);
+      command->AcquirePayload(new OrthancLastUpdateHandler(shared_from_this(), target, priority, source,
+                                                           protection, entry, topLevel, topId, bottomLevel));
+
+      {
+        std::unique_ptr<ILoadersContext::ILock> lock(context_.Lock());
+        lock->Schedule(GetSharedObserver(), priority, command.release());
+      }
+    }
+    else
+    {
+      ScheduleLoadOrthancResourcesInternal(target, priority, source, topLevel, topId, bottomLevel,
+                                           protection, boost::shared_ptr<DiskCacheEntry>());
+    }
+  }
+
+
+  void DicomResourcesLoader::ScheduleLoadOrthancResourcesInternal(boost::shared_ptr<LoadedDicomResources> target,
+                                                                  int priority,
+                                                                  const DicomSource& source,
+                                                                  Orthanc::ResourceType topLevel,
+                                                                  const std::string& topId,
+                                                                  Orthanc::ResourceType bottomLevel,
+                                                                  boost::shared_ptr<Orthanc::IDynamicObject> userPayload,
+                                                                  boost::shared_ptr<DiskCacheEntry> diskCacheEntry)
+  {
+    if (diskCacheEntry)
+    {
+      // Load into a temporary target, that will be written to the disk cache
+      target.reset(diskCacheEntry->CreateTemporaryTarget());
+    }
+
     boost::shared_ptr<unsigned int> remainingCommands(new unsigned int(0));
 
     if (topLevel == Orthanc::ResourceType_Instance)
     {
-      ScheduleLoadOrthancInstanceTags(target, priority, source, topId, remainingCommands, protection);
+      ScheduleLoadOrthancInstanceTags(target, priority, source, topId, remainingCommands,
+                                      userPayload, diskCacheEntry);
     }
     else if (topLevel == bottomLevel)
     {
-      ScheduleLoadOrthancOneChildInstance(target, priority, source, topLevel, topId, remainingCommands, protection);
+      ScheduleLoadOrthancOneChildInstance(target, priority, source, topLevel, topId, remainingCommands,
+                                          userPayload, diskCacheEntry);
     }
     else 
     {
+      std::unique_ptr<OrthancAllChildrenInstancesHandler> handler(
+        new OrthancAllChildrenInstancesHandler(shared_from_this(), target, priority, source,
+                                               remainingCommands, bottomLevel, userPayload));
+      handler->SetDiskCacheEntry(diskCacheEntry);
+
       std::unique_ptr<OrthancRestApiCommand> command(new OrthancRestApiCommand);
       command->SetUri("/" + GetUri(topLevel) + "/" + topId + "/" + GetUri(bottomLevel));
-      command->AcquirePayload(new OrthancAllChildrenInstancesHandler
-                              (shared_from_this(), target, priority, source,
-                               remainingCommands, bottomLevel, protection));
+      command->AcquirePayload(handler.release());
 
       {
         std::unique_ptr<ILoadersContext::ILock> lock(context_.Lock());
@@ -50,6 +50,8 @@ namespace OrthancStone
 #if ORTHANC_ENABLE_DCMTK == 1
   class ParseDicomFromFileCommand;
 #endif
+
+  class DicomResourcesDiskCache;
   
   class DicomResourcesLoader :
     public ObserverBase<DicomResourcesLoader>,
@@ -63,6 +65,11 @@ namespace OrthancStone
     class OrthancInstanceTagsHandler;    
     class OrthancOneChildInstanceHandler;
     class OrthancAllChildrenInstancesHandler;
+    class DiskCacheEntry;
+    class DiskCacheReadHandler;
+    class DicomWebDiskCacheReadHandler;
+    class OrthancDiskCacheReadHandler;
+    class OrthancLastUpdateHandler;
 
 #if ORTHANC_ENABLE_DCMTK == 1
     class DicomDirHandler;
@@ -85,7 +92,8 @@ namespace OrthancStone
                                          const DicomSource& source,
                                          const std::string& instanceId,
                                          boost::shared_ptr<unsigned int> remainingCommands,
-                                         boost::shared_ptr<Orthanc::IDynamicObject> userPayload);
+                                         boost::shared_ptr<Orthanc::IDynamicObject> userPayload,
+                                         boost::shared_ptr<DiskCacheEntry> diskCacheEntry);
 
     void ScheduleLoadOrthancOneChildInstance(boost::shared_ptr<LoadedDicomResources> target,
                                              int priority,
@@ -93,14 +101,43 @@ namespace OrthancStone
                                              Orthanc::ResourceType level,
                                              const std::string& id,
                                              boost::shared_ptr<unsigned int> remainingCommands,
-                                             boost::shared_ptr<Orthanc::IDynamicObject> userPayload);
+                                             boost::shared_ptr<Orthanc::IDynamicObject> userPayload,
+                                             boost::shared_ptr<DiskCacheEntry> diskCacheEntry);
+
+    void ScheduleLoadOrthancResourcesInternal(boost::shared_ptr<LoadedDicomResources> target,
+                                              int priority,
+                                              const DicomSource& source,
+                                              Orthanc::ResourceType topLevel,
+                                              const std::string& topId,
+                                              Orthanc::ResourceType bottomLevel,
+                                              boost::shared_ptr<Orthanc::IDynamicObject> userPayload,
+                                              boost::shared_ptr<DiskCacheEntry> diskCacheEntry);
+
+    void ScheduleDicomWeb(boost::shared_ptr<LoadedDicomResources> target,
+                          int priority,
+                          const DicomSource& source,
+                          const std::string& uri,
+                          const std::map<std::string, std::string>& arguments,
+                          boost::shared_ptr<Orthanc::IDynamicObject> userPayload);
+
+    void ScheduleDicomWebRequest(boost::shared_ptr<LoadedDicomResources> target,
+                                 int priority,
+                                 const DicomSource& source,
+                                 const std::string& uri,
+                                 const std::map<std::string, std::string>& arguments,
+                                 boost::shared_ptr<Orthanc::IDynamicObject> userPayload,
+                                 boost::shared_ptr<DiskCacheEntry> diskCacheEntry);
+
+    void ScheduleReadDiskCache(int priority,
+                               DiskCacheReadHandler* handler /* takes ownership */);
     
     explicit DicomResourcesLoader(ILoadersContext& context) :
       context_(context)
     {
     }
 
-    ILoadersContext&  context_;
+    ILoadersContext&                            context_;
+    boost::shared_ptr<DicomResourcesDiskCache>  diskCache_;
 
 
   public:
@@ -164,6 +201,21 @@ namespace OrthancStone
 
     static boost::shared_ptr<DicomResourcesLoader> Create(const ILoadersContext::ILock& stone);
 
+    /**
+     * Enables the persistent disk cache, which is used by the
+     * requests to DICOMweb servers that provide "ETag" HTTP headers,
+     * and by the loading of stable Orthanc resources above the
+     * instance level (validated by their "LastUpdate" and their
+     * children). The cache is read
+     * through the oracle, which must support "ReadFileCommand" (this
+     * is not the case in WebAssembly). A NULL pointer disables the
+     * cache.
+     **/
+    void SetDiskCache(boost::shared_ptr<DicomResourcesDiskCache> cache)
+    {
+      diskCache_ = cache;
+    }
+
     void ScheduleGetDicomWeb(boost::shared_ptr<LoadedDicomResources> target,
                              int priority,
                              const DicomSource& source,
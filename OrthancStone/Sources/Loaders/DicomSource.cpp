@@ -111,6 +111,29 @@ namespace OrthancStone
   }
 
 
+  std::string DicomSource::GetServerIdentifier() const
+  {
+    switch (type_)
+    {
+      case DicomSourceType_Orthanc:
+        return "orthanc|" + webService_.GetUrl() + "|" + webService_.GetUsername();
+
+      case DicomSourceType_DicomWeb:
+        return "dicomweb|" + webService_.GetUrl() + "|" + webService_.GetUsername();
+
+      case DicomSourceType_DicomWebThroughOrthanc:
+        return ("dicomweb-orthanc|" + webService_.GetUrl() + "|" + webService_.GetUsername() +
+                "|" + orthancDicomWebRoot_ + "|" + serverName_);
+
+      case DicomSourceType_DicomDir:
+        return "dicomdir";
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+
+
   void DicomSource::SetOrthancSource()
   {
     Orthanc::WebServiceParameters parameters;
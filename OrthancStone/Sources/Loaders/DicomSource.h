@@ -61,6 +61,14 @@ namespace OrthancStone
     // Makes a rough comparison to test whether these two sources match
     bool IsSameSource(const DicomSource& other) const;
 
+    /**
+     * Returns a string that identifies the server behind this source,
+     * for use in the keys of persistent caches. The password and the
+     * HTTP headers (that typically contain short-lived tokens) are
+     * not taken into consideration.
+     **/
+    std::string GetServerIdentifier() const;
+
     DicomSourceType GetType() const
     {
       return type_;
@@ -29,17 +29,35 @@ namespace OrthancStone
   {
   private:
     GenericLoadersContext& that_;
+    std::unique_ptr<ConcurrentMessageDelivery::ExclusiveLock>  exclusive_;
     boost::recursive_mutex::scoped_lock lock_;
 
   public:
     explicit Locker(GenericLoadersContext& that) :
       that_(that),
-      lock_(that.mutex_)
+      lock_(that.mutex_, boost::defer_lock)
     {
       if (!that_.scheduler_)
       {
         throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
       }
+
+      if (that_.concurrentDelivery_)
+      {
+        // Wait for the message handlers in progress, and block the
+        // other ones. This must be done before locking "mutex_",
+        // which is needed by the deliveries to look up their
+        // callables.
+        exclusive_.reset(new ConcurrentMessageDelivery::ExclusiveLock(that_.delivery_));
+      }
+
+      lock_.lock();
+    }
+
+    virtual ~Locker()
+    {
+      lock_.unlock();
+      exclusive_.reset(NULL);
     }
       
     virtual ILoadersContext& GetContext() const ORTHANC_OVERRIDE
@@ -86,16 +104,53 @@ namespace OrthancStone
   void GenericLoadersContext::EmitMessage(boost::weak_ptr<IObserver> observer,
                                           const IMessage& message)
   {
-    boost::recursive_mutex::scoped_lock lock(mutex_);
-    //LOG(INFO) << "  inside emit lock: " << message.GetIdentifier().AsString();
-    oracleObservable_.EmitMessage(observer, message);
-    //LOG(INFO) << "  outside emit lock";
+    if (!concurrentDelivery_)
+    {
+      boost::recursive_mutex::scoped_lock lock(mutex_);
+      //LOG(INFO) << "  inside emit lock: " << message.GetIdentifier().AsString();
+      oracleObservable_.EmitMessage(observer, message);
+      //LOG(INFO) << "  outside emit lock";
+      return;
+    }
+
+    // Keep the receiver alive during the delivery
+    boost::shared_ptr<IObserver> receiver(observer.lock());
+    if (!receiver)
+    {
+      return;
+    }
+
+    std::vector<ICallable*> callables;
+
+    {
+      // The registrations of the loaders are protected by "mutex_"
+      boost::recursive_mutex::scoped_lock lock(mutex_);
+      oracleObservable_.LookupCallables(callables, *receiver, message.GetIdentifier());
+    }
+
+    if (callables.empty())
+    {
+      return;
+    }
+
+    if (receiver.get() == static_cast<IObserver*>(scheduler_.get()))
+    {
+      // The scheduler is protected by its own mutex, and must be able
+      // to forward the answers of the oracle concurrently
+      delivery_.DeliverUnordered(callables, message);
+    }
+    else
+    {
+      delivery_.Deliver(*receiver, callables, message);
+    }
   }
 
 
   GenericLoadersContext::GenericLoadersContext(unsigned int maxHighPriority,
                                                unsigned int maxStandardPriority,
-                                               unsigned int maxLowPriority)
+                                               unsigned int maxLowPriority) :
+    concurrentDelivery_(false),
+    oracleStarted_(false)
   {
     oracle_.reset(new ThreadedOracle(*this));
     scheduler_ = OracleScheduler::Create(*oracle_, oracleObservable_, *this,
@@ -138,9 +193,24 @@ namespace OrthancStone
   }
 
   
+  void GenericLoadersContext::SetConcurrentDelivery(bool enabled)
+  {
+    boost::recursive_mutex::scoped_lock lock(mutex_);
+
+    if (oracleStarted_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls,
+                                      "The delivery mode must be set before starting the oracle");
+    }
+
+    concurrentDelivery_ = enabled;
+  }
+
+  
   void GenericLoadersContext::StartOracle()
   {
     boost::recursive_mutex::scoped_lock lock(mutex_);
+    oracleStarted_ = true;
     oracle_->Start();
     //LOG(INFO) << "STARTED ORACLE";
   }
@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include "../Messages/ConcurrentMessageDelivery.h"
 #include "../Messages/IMessageEmitter.h"
 #include "../Oracle/ThreadedOracle.h"
 #include "ILoadersContext.h"
@@ -44,6 +45,17 @@ namespace OrthancStone
     // "EmitMessage()"
     boost::recursive_mutex  mutex_;
 
+    /**
+     * Concurrent delivery of the messages (disabled by default). The
+     * messages to different observers are handled concurrently, but
+     * the messages to one given observer are handled one at a time,
+     * in the order of their emission. "mutex_" is then only held to
+     * look up the callables.
+     **/
+    bool                       concurrentDelivery_;
+    bool                       oracleStarted_;
+    ConcurrentMessageDelivery  delivery_;
+
     IObservable                         oracleObservable_;
     std::unique_ptr<ThreadedOracle>     oracle_;
     boost::shared_ptr<OracleScheduler>  scheduler_;
@@ -71,6 +83,23 @@ namespace OrthancStone
     
     void SetDicomCacheSize(size_t size);
 
+    /**
+     * Enables the concurrent delivery of the messages, which must be
+     * done before starting the oracle. In this mode, "Lock()" waits
+     * for the message handlers in progress, and excludes all the
+     * other handlers until the lock is released, including if called
+     * from within a message handler. The handlers only run
+     * concurrently outside of "Lock()", so the loaders that share
+     * data outside of "Lock()" must protect it by themselves, and the
+     * message handlers must not wait for each other.
+     **/
+    void SetConcurrentDelivery(bool enabled);
+
+    bool IsConcurrentDelivery() const
+    {
+      return concurrentDelivery_;
+    }
+
     void StartOracle();
 
     void StopOracle();
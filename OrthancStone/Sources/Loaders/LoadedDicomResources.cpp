@@ -23,6 +23,8 @@
 
 #include "LoadedDicomResources.h"
 
+#include "../Toolbox/DicomWebStreamingParser.h"
+
 #include <OrthancException.h>
 
 #include <cassert>
@@ -66,6 +68,40 @@ namespace OrthancStone
   }
 
 
+  void LoadedDicomResources::Resource::TakeSourceJson(Json::Value& json)
+  {
+    sourceJson_.reset(new Json::Value);
+    sourceJson_->swap(json);
+  }
+
+
+  class LoadedDicomResources::DicomWebVisitor : public DicomWebStreamingParser::IVisitor
+  {
+  private:
+    LoadedDicomResources&  that_;
+
+  public:
+    explicit DicomWebVisitor(LoadedDicomResources& that) :
+      that_(that)
+    {
+    }
+
+    virtual void VisitResource(const Orthanc::DicomMap& dicom,
+                               Json::Value& sourceJson) ORTHANC_OVERRIDE
+    {
+      std::unique_ptr<Resource> resource(new Resource(dicom));
+
+      if (!that_.isSourceJsonRestricted_ ||
+          !that_.sourceJsonTags_.empty())
+      {
+        resource->TakeSourceJson(sourceJson);
+      }
+
+      that_.AddResourceInternal(resource.release());
+    }
+  };
+
+
   void LoadedDicomResources::AddResourceInternal(Resource* resource)
   {
     std::unique_ptr<Resource> protection(resource);
@@ -113,6 +149,37 @@ namespace OrthancStone
   }
 
 
+  void LoadedDicomResources::SetSourceJsonInternal(Resource& resource,
+                                                   const Json::Value& json) const
+  {
+    if (!isSourceJsonRestricted_)
+    {
+      resource.SetSourceJson(json);
+    }
+    else if (!sourceJsonTags_.empty())
+    {
+      Json::Value filtered = Json::objectValue;
+
+      if (json.type() == Json::objectValue)
+      {
+        Json::Value::Members members = json.getMemberNames();
+
+        for (size_t i = 0; i < members.size(); i++)
+        {
+          Orthanc::DicomTag tag(0, 0);
+          if (Orthanc::DicomTag::ParseHexadecimal(tag, members[i].c_str()) &&
+              sourceJsonTags_.find(tag) != sourceJsonTags_.end())
+          {
+            filtered[members[i]] = json[members[i]];
+          }
+        }
+      }
+
+      resource.TakeSourceJson(filtered);
+    }
+  }
+
+
   void LoadedDicomResources::AddFromDicomWebInternal(const Json::Value& dicomweb)
   {
     assert(dicomweb.type() == Json::objectValue);
@@ -120,14 +187,16 @@ namespace OrthancStone
     dicom.FromDicomWeb(dicomweb);
 
     std::unique_ptr<Resource> resource(new Resource(dicom));
-    resource->SetSourceJson(dicomweb);
+    SetSourceJsonInternal(*resource, dicomweb);
     AddResourceInternal(resource.release());
   }
 
   
   LoadedDicomResources::LoadedDicomResources(const LoadedDicomResources& other,
                                              const Orthanc::DicomTag& indexedTag) :
-    indexedTag_(indexedTag)
+    indexedTag_(indexedTag),
+    isSourceJsonRestricted_(other.isSourceJsonRestricted_),
+    sourceJsonTags_(other.sourceJsonTags_)
   {
     for (Resources::const_iterator it = other.resources_.begin();
          it != other.resources_.end(); ++it)
@@ -191,13 +260,40 @@ namespace OrthancStone
   }
 
 
+  void LoadedDicomResources::AddResource(const Orthanc::DicomMap& dicom,
+                                         const Json::Value& sourceJson)
+  {
+    std::unique_ptr<Resource> resource(new Resource(dicom));
+    SetSourceJsonInternal(*resource, sourceJson);
+    AddResourceInternal(resource.release());
+  }
+
+
+  void LoadedDicomResources::AddResources(const LoadedDicomResources& other)
+  {
+    for (Resources::const_iterator it = other.resources_.begin(); it != other.resources_.end(); ++it)
+    {
+      assert(it->second != NULL);
+
+      if (it->second->HasSourceJson())
+      {
+        AddResource(it->second->GetDicom(), it->second->GetSourceJson());
+      }
+      else
+      {
+        AddResource(it->second->GetDicom());
+      }
+    }
+  }
+
+
   void LoadedDicomResources::AddFromOrthanc(const Json::Value& tags)
   {
     Orthanc::DicomMap dicom;
     dicom.FromDicomAsJson(tags);
 
     std::unique_ptr<Resource> resource(new Resource(dicom));
-    resource->SetSourceJson(tags);
+    SetSourceJsonInternal(*resource, tags);
     AddResourceInternal(resource.release());
   }
 
@@ -229,6 +325,31 @@ namespace OrthancStone
   }
 
 
+  void LoadedDicomResources::AddFromDicomWebAnswer(const std::string& answer)
+  {
+    DicomWebStreamingParser parser;
+
+    if (isSourceJsonRestricted_)
+    {
+      parser.AddSourceJsonTags(sourceJsonTags_);
+    }
+    else
+    {
+      parser.SetKeepAllSourceJson(true);
+    }
+
+    DicomWebVisitor visitor(*this);
+    parser.Parse(visitor, answer);
+  }
+
+
+  void LoadedDicomResources::RestrictSourceJson(const std::set<Orthanc::DicomTag>& tags)
+  {
+    isSourceJsonRestricted_ = true;
+    sourceJsonTags_ = tags;
+  }
+
+
   bool LoadedDicomResources::LookupTagValueConsensus(std::string& target,
                                                      const Orthanc::DicomTag& tag) const
   {
@@ -25,6 +25,8 @@
 
 #include <DicomFormat/DicomMap.h>
 
+#include <set>
+
 
 namespace OrthancStone
 {
@@ -59,23 +61,34 @@ namespace OrthancStone
       const Json::Value& GetSourceJson() const;
 
       void SetSourceJson(const Json::Value& json);
+
+      // Avoids a copy of the source JSON, whose content is swapped
+      void TakeSourceJson(Json::Value& json);
     };
+
+    class DicomWebVisitor;
     
     typedef std::map<std::string, Resource*>  Resources;
 
-    Orthanc::DicomTag       indexedTag_;
-    Resources               resources_;
-    std::vector<Resource*>  flattened_;
+    Orthanc::DicomTag            indexedTag_;
+    Resources                    resources_;
+    std::vector<Resource*>       flattened_;
+    bool                         isSourceJsonRestricted_;
+    std::set<Orthanc::DicomTag>  sourceJsonTags_;
 
     void AddResourceInternal(Resource* resource);
 
     const Resource& GetResourceInternal(size_t index);
 
+    void SetSourceJsonInternal(Resource& resource,
+                               const Json::Value& json) const;
+
     void AddFromDicomWebInternal(const Json::Value& dicomweb);
 
   public:
     explicit LoadedDicomResources(const Orthanc::DicomTag& indexedTag) :
-      indexedTag_(indexedTag)
+      indexedTag_(indexedTag),
+      isSourceJsonRestricted_(false)
     {
     }
 
@@ -130,10 +143,42 @@ namespace OrthancStone
 
     void AddResource(const Orthanc::DicomMap& dicom);
 
+    void AddResource(const Orthanc::DicomMap& dicom,
+                     const Json::Value& sourceJson);
+
+    // Copies the resources of another set (that can use another indexed tag)
+    void AddResources(const LoadedDicomResources& other);
+
     void AddFromOrthanc(const Json::Value& tags);
   
     void AddFromDicomWeb(const Json::Value& dicomweb);
 
+    /**
+     * Adds the resources of a raw DICOMweb answer, using a streaming
+     * parser that doesn't build the JSON tree of the whole answer.
+     **/
+    void AddFromDicomWebAnswer(const std::string& answer);
+
+    /**
+     * By default, the full source JSON of each resource is stored. If
+     * this method is called, only the given tags are kept in the
+     * source JSON of the resources that are added afterwards (which
+     * saves a lot of memory on large answers). An empty set discards
+     * the source JSON altogether, in which case "GetSourceJson()" is
+     * not available.
+     **/
+    void RestrictSourceJson(const std::set<Orthanc::DicomTag>& tags);
+
+    bool IsSourceJsonRestricted() const
+    {
+      return isSourceJsonRestricted_;
+    }
+
+    const std::set<Orthanc::DicomTag>& GetSourceJsonTags() const
+    {
+      return sourceJsonTags_;
+    }
+
     bool LookupTagValueConsensus(std::string& target,
                                  const Orthanc::DicomTag& tag) const;
 
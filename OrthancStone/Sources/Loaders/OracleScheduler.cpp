@@ -23,11 +23,12 @@
 
 #include "OracleScheduler.h"
 
+#include "../Oracle/IForwardingPayload.h"
 #include "../Oracle/ParseDicomFromFileCommand.h"
 
 namespace OrthancStone
 {
-  class OracleScheduler::ReceiverPayload : public Orthanc::IDynamicObject
+  class OracleScheduler::ReceiverPayload : public IForwardingPayload
   {
   private:
     Priority   priority_;
@@ -63,6 +64,11 @@ namespace OrthancStone
       assert(command_.get() != NULL);
       return *command_;
     }
+
+    virtual bool IsFinalReceiverExpired() const ORTHANC_OVERRIDE
+    {
+      return receiver_.expired();
+    }
   }; 
 
 
@@ -228,6 +234,7 @@ namespace OrthancStone
     Queue::iterator item = queue.begin();
     assert(item != queue.end());
 
+    const int commandPriority = item->first;
     std::unique_ptr<ScheduledCommand> command(dynamic_cast<ScheduledCommand*>(item->second));
     queue.erase(item);
 
@@ -242,7 +249,7 @@ namespace OrthancStone
       {
         ModifyNumberOfActiveCommands(priority, 1);
         
-        if (oracle_.Schedule(GetSharedObserver(), command->WrapCommand(priority)))
+        if (oracle_.ScheduleWithPriority(GetSharedObserver(), command->WrapCommand(priority), commandPriority))
         {
           /**
            * Executing this code if "Schedule()" returned "false"
@@ -262,6 +269,11 @@ namespace OrthancStone
           totalProcessed_ ++;
         }
       }
+      else
+      {
+        // The receiver is gone, the command is dropped (as in "RemoveReceiverFromQueue()")
+        totalProcessed_ ++;
+      }
     }
     else
     {
@@ -330,6 +342,10 @@ namespace OrthancStone
 
   void OracleScheduler::RemoveActiveCommand(const ReceiverPayload& payload)
   {
+#if ORTHANC_ENABLE_THREADS == 1
+    boost::recursive_mutex::scoped_lock lock(mutex_);
+#endif
+
     CheckInvariants();
 
     totalProcessed_ ++;
@@ -379,7 +395,7 @@ namespace OrthancStone
 
     HttpCommand::SuccessMessage bis(
       dynamic_cast<const HttpCommand&>(payload.GetOriginalCommand()),
-      message.GetAnswerHeaders(), message.GetAnswer());
+      message.GetAnswerHeaders(), message.GetAnswer(), message.GetHttpStatus());
     emitter_.EmitMessage(payload.GetOriginalReceiver(), bis);
   }
 
@@ -393,7 +409,7 @@ namespace OrthancStone
 
     OrthancRestApiCommand::SuccessMessage bis(
       dynamic_cast<const OrthancRestApiCommand&>(payload.GetOriginalCommand()),
-      message.GetAnswerHeaders(), message.GetAnswer());
+      message.GetAnswerHeaders(), message.GetAnswer(), message.GetHttpStatus());
     emitter_.EmitMessage(payload.GetOriginalReceiver(), bis);
   }
 
@@ -409,6 +425,7 @@ namespace OrthancStone
     ParseDicomSuccessMessage bis(
       dynamic_cast<const OracleCommandBase&>(payload.GetOriginalCommand()),
       message.GetSource(), message.GetDicom(), message.GetFileSize(), message.HasPixelData());
+    bis.CopyDecodedFramesCache(message);
     emitter_.EmitMessage(payload.GetOriginalReceiver(), bis);
   }
 #endif
@@ -499,8 +516,32 @@ namespace OrthancStone
   }
 
 
+  uint64_t OracleScheduler::GetTotalScheduled() const
+  {
+#if ORTHANC_ENABLE_THREADS == 1
+    boost::recursive_mutex::scoped_lock lock(mutex_);
+#endif
+
+    return totalScheduled_;
+  }
+
+
+  uint64_t OracleScheduler::GetTotalProcessed() const
+  {
+#if ORTHANC_ENABLE_THREADS == 1
+    boost::recursive_mutex::scoped_lock lock(mutex_);
+#endif
+
+    return totalProcessed_;
+  }
+
+
   void OracleScheduler::CancelRequests(boost::shared_ptr<IObserver> receiver)
   {
+#if ORTHANC_ENABLE_THREADS == 1
+    boost::recursive_mutex::scoped_lock lock(mutex_);
+#endif
+
     RemoveReceiverFromQueue(standardPriorityQueue_, receiver);
     RemoveReceiverFromQueue(highPriorityQueue_, receiver);
     RemoveReceiverFromQueue(lowPriorityQueue_, receiver);
@@ -509,6 +550,10 @@ namespace OrthancStone
   
   void OracleScheduler::CancelAllRequests()
   {      
+#if ORTHANC_ENABLE_THREADS == 1
+    boost::recursive_mutex::scoped_lock lock(mutex_);
+#endif
+
     ClearQueue(standardPriorityQueue_);
     ClearQueue(highPriorityQueue_);
     ClearQueue(lowPriorityQueue_);
@@ -521,6 +566,10 @@ namespace OrthancStone
   {
     std::unique_ptr<ScheduledCommand> pending(new ScheduledCommand(receiver, dynamic_cast<IOracleCommand*>(command)));
 
+#if ORTHANC_ENABLE_THREADS == 1
+    boost::recursive_mutex::scoped_lock lock(mutex_);
+#endif
+
     /**
      * Safeguard to remember that a new "Handle()" method and a call
      * to "scheduler->Register()" must be implemented for each
@@ -29,6 +29,10 @@
 #  error The macro ORTHANC_ENABLE_DCMTK must be defined
 #endif
 
+#if !defined(ORTHANC_ENABLE_THREADS)
+#  error The macro ORTHANC_ENABLE_THREADS must be defined
+#endif
+
 #include "../Messages/IMessageEmitter.h"
 #include "../Messages/ObserverBase.h"
 #include "../Oracle/GetOrthancImageCommand.h"
@@ -43,6 +47,10 @@
 #  include "../Oracle/ParseDicomSuccessMessage.h"
 #endif
 
+#if ORTHANC_ENABLE_THREADS == 1
+#  include <boost/thread/recursive_mutex.hpp>
+#endif
+
 namespace OrthancStone
 {
   class OracleScheduler : public ObserverBase<OracleScheduler>
@@ -64,6 +72,19 @@ namespace OrthancStone
 
     typedef std::multimap<int, ScheduledCommand*>  Queue;
 
+#if ORTHANC_ENABLE_THREADS == 1
+    /**
+     * Protects the queues and the counters. The scheduler does not
+     * rely on the mutex of the loaders context, as the answers of the
+     * oracle can be handled by several threads at once (cf. the
+     * concurrent delivery of "GenericLoadersContext"). This mutex is
+     * never held while forwarding the answers to their receivers. It
+     * is recursive, as releasing the last reference to a receiver can
+     * run arbitrary code.
+     **/
+    mutable boost::recursive_mutex  mutex_;
+#endif
+
     IOracle&  oracle_;
     IMessageEmitter&  emitter_;
     Queue          standardPriorityQueue_;
@@ -149,15 +170,9 @@ namespace OrthancStone
       return maxLowPriorityCommands_;
     }
 
-    uint64_t GetTotalScheduled() const
-    {
-      return totalScheduled_;
-    }
+    uint64_t GetTotalScheduled() const;
 
-    uint64_t GetTotalProcessed() const
-    {
-      return totalProcessed_;
-    }
+    uint64_t GetTotalProcessed() const;
 
     // Cancel the HTTP requests that are still pending in the queues,
     // and that are associated with the given receiver. Note that the
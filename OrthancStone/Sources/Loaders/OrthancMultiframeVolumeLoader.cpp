@@ -23,9 +23,15 @@
 
 #include "OrthancMultiframeVolumeLoader.h"
 
+#include "BasicFetchingItemsSorter.h"
+#include "../Toolbox/PixelHistogram.h"
+
 #include <Endianness.h>
+#include <Images/ImageProcessing.h>
 #include <Toolbox.h>
 
+#include <boost/lexical_cast.hpp>
+
 #if STONE_TIME_BLOCKING_OPS
 # include <boost/date_time/posix_time/posix_time.hpp>
 #endif
@@ -147,6 +153,32 @@ namespace OrthancStone
     }
   };
 
+  class OrthancMultiframeVolumeLoader::LoadFrame : public State
+  {
+  private:
+    unsigned int  frame_;
+
+  public:
+    LoadFrame(OrthancMultiframeVolumeLoader& that,
+              unsigned int frame) :
+      State(that),
+      frame_(frame)
+    {
+    }
+
+    // Raw frame, in the case of an uncompressed transfer syntax
+    virtual void Handle(const OrthancRestApiCommand::SuccessMessage& message) ORTHANC_OVERRIDE
+    {
+      GetLoader<OrthancMultiframeVolumeLoader>().SetRawFrame(frame_, message.GetAnswer());
+    }
+
+    // Frame decoded by Orthanc, in the case of a compressed transfer syntax
+    virtual void Handle(const GetOrthancImageCommand::SuccessMessage& message) ORTHANC_OVERRIDE
+    {
+      GetLoader<OrthancMultiframeVolumeLoader>().SetDecodedFrame(frame_, message.GetImage());
+    }
+  };
+
   const std::string& OrthancMultiframeVolumeLoader::GetInstanceId() const
   {
     if (IsActive())
@@ -174,9 +206,12 @@ namespace OrthancStone
 
       See https://www.dicomlibrary.com/dicom/transfer-syntax/
     */
-    if (transferSyntaxUid_ == "1.2.840.10008.1.2" ||
-        transferSyntaxUid_ == "1.2.840.10008.1.2.1" ||
-        transferSyntaxUid_ == "1.2.840.10008.1.2.2")
+    const bool isUncompressed = (transferSyntaxUid_ == "1.2.840.10008.1.2" ||
+                                 transferSyntaxUid_ == "1.2.840.10008.1.2.1" ||
+                                 transferSyntaxUid_ == "1.2.840.10008.1.2.2");
+
+    if (isUncompressed &&
+        !perFrameLoading_)
     {
       std::unique_ptr<OrthancRestApiCommand> command(new OrthancRestApiCommand);
       command->SetCallerName("OrthancMultiframeVolumeLoader::ScheduleFrameDownloads");
@@ -188,9 +223,60 @@ namespace OrthancStone
     }
     else
     {
+      SchedulePerFrameDownloads(isUncompressed);
+    }
+  }
+
+  void OrthancMultiframeVolumeLoader::SchedulePerFrameDownloads(bool isUncompressed)
+  {
+    const Orthanc::PixelFormat format = volume_->GetPixelData().GetFormat();
+    const unsigned int depth = volume_->GetPixelData().GetDepth();
+
+    if (!isUncompressed &&
+        format != Orthanc::PixelFormat_Grayscale16 &&
+        format != Orthanc::PixelFormat_SignedGrayscale16)
+    {
+      // Orthanc can only decode frames into 16bpp images
       throw Orthanc::OrthancException(
         Orthanc::ErrorCode_NotImplemented,
-        "No support for multiframe instances with transfer syntax: " + transferSyntaxUid_);
+        "No support for multiframe instances with transfer syntax " + transferSyntaxUid_ +
+        " and pixel format " + std::string(Orthanc::EnumerationToString(format)));
+    }
+
+    if (depth == 0)
+    {
+      return;
+    }
+
+    loadedFrames_ = 0;
+
+    // The downloads are scheduled starting from the center of the
+    // volume, and "LoaderStateMachine" processes them in this order
+    std::vector<unsigned int> frames;
+    BasicFetchingItemsSorter(depth).Sort(frames, depth / 2);
+
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+      if (isUncompressed)
+      {
+        std::unique_ptr<OrthancRestApiCommand> command(new OrthancRestApiCommand);
+        command->SetCallerName("OrthancMultiframeVolumeLoader::SchedulePerFrameDownloads");
+        command->SetHttpHeader("Accept-Encoding", "gzip");
+        command->SetUri("/instances/" + instanceId_ + "/frames/" +
+                        boost::lexical_cast<std::string>(frames[i]) + "/raw");
+        command->AcquirePayload(new LoadFrame(*this, frames[i]));
+        Schedule(command.release());
+      }
+      else
+      {
+        std::unique_ptr<GetOrthancImageCommand> command(new GetOrthancImageCommand);
+        command->SetHttpHeader("Accept-Encoding", "gzip");
+        command->SetHttpHeader("Accept", std::string(Orthanc::EnumerationToString(Orthanc::MimeType_Pam)));
+        command->SetFrameUri(instanceId_, frames[i], format);
+        command->SetExpectedPixelFormat(format);
+        command->AcquirePayload(new LoadFrame(*this, frames[i]));
+        Schedule(command.release());
+      }
     }
   }
 
@@ -275,8 +361,7 @@ namespace OrthancStone
   }
 
   template <typename T>
-  void OrthancMultiframeVolumeLoader::CopyPixelDataAndComputeDistribution(
-    const std::string& pixelData, std::map<T, PixelCount>& distribution)
+  void OrthancMultiframeVolumeLoader::CopyPixelData(const std::string& pixelData)
   {
 #if STONE_TIME_BLOCKING_OPS
     boost::posix_time::ptime timerStart = boost::posix_time::microsec_clock::universal_time();
@@ -300,27 +385,6 @@ namespace OrthancStone
       return;
     }
 
-    // first pass to initialize map
-#if 0
-    {
-      const uint8_t* source = reinterpret_cast<const uint8_t*>(pixelData.c_str());
-
-      for (unsigned int z = 0; z < depth; z++)
-      {
-        for (unsigned int y = 0; y < height; y++)
-        {
-          for (unsigned int x = 0; x < width; x++)
-          {
-            T value;
-            CopyPixel(value, source);
-            distribution[value] = 0;
-            source += bpp;
-          }
-        }
-      }
-    }
-#endif
-
     {
       const uint8_t* source = reinterpret_cast<const uint8_t*>(pixelData.c_str());
 
@@ -340,24 +404,7 @@ namespace OrthancStone
 
         assert(writer.GetAccessor().GetWidth() == width &&
           writer.GetAccessor().GetHeight() == height);
-#if 0
-        for (unsigned int y = 0; y < height; y++)
-        {
-          assert(sizeof(T) == Orthanc::GetBytesPerPixel(target.GetFormat()));
-
-          T* target = reinterpret_cast<T*>(writer.GetAccessor().GetRow(y));
 
-          for (unsigned int x = 0; x < width; x++)
-          {
-            CopyPixel(*target, source);
-
-            distribution[*target] += 1;
-
-            target++;
-            source += bpp;
-          }
-        }
-#else
         // optimized version (fixed) as of 2020-04-15
         unsigned int pitch = writer.GetAccessor().GetPitch();
         T* targetAddrLine = reinterpret_cast<T*>(writer.GetAccessor().GetRow(0));
@@ -369,77 +416,56 @@ namespace OrthancStone
           for (unsigned int x = 0; x < width; x++)
           {
             CopyPixel(*targetAddrPix, source);
-
-            distribution[*targetAddrPix].count_ += 1;
-
             targetAddrPix++;
             source += bpp;
           }
           uint8_t* targetAddrLineBytes = reinterpret_cast<uint8_t*>(targetAddrLine) + pitch;
           targetAddrLine = reinterpret_cast<T*>(targetAddrLineBytes);
         }
-#endif
       }
     }
 #if STONE_TIME_BLOCKING_OPS
     boost::posix_time::ptime timerEnd = boost::posix_time::microsec_clock::universal_time();
     boost::posix_time::time_duration duration = timerEnd - timerStart;
     int64_t durationMs = duration.total_milliseconds();
-    LOG(WARNING) << "OrthancMultiframeVolumeLoader::CopyPixelDataAndComputeDistribution took " << durationMs << " ms";
+    LOG(WARNING) << "OrthancMultiframeVolumeLoader::CopyPixelData took " << durationMs << " ms";
 #endif
   }
 
-  template <typename T>
-  void OrthancMultiframeVolumeLoader::ComputeMinMaxWithOutlierRejection(
-    const std::map<T, PixelCount>& distribution)
+  void OrthancMultiframeVolumeLoader::ComputeMinMaxWithOutlierRejection()
   {
-    if (distribution.size() == 0)
+#if STONE_TIME_BLOCKING_OPS
+    boost::posix_time::ptime timerStart = boost::posix_time::microsec_clock::universal_time();
+#endif
+
+    // The volume is stored as slices, so its internal image contains all the voxels
+    PixelHistogram histogram(volume_->GetPixelData().GetInternalImage());
+    histogram.SetThreadsCount(PixelHistogram::GetHardwareConcurrency());
+
+    const uint64_t voxelCount = histogram.GetPixelsCount();
+
+    if (voxelCount == 0)
     {
       LOG(ERROR) << "ComputeMinMaxWithOutlierRejection -- Volume image empty.";
     }
     else
     {
-      const ImageBuffer3D& target = volume_->GetPixelData();
+      double rawMin, rawMax;
+      histogram.GetRange(rawMin, rawMax);
 
-      const uint64_t width = target.GetWidth();
-      const uint64_t height = target.GetHeight();
-      const uint64_t depth = target.GetDepth();
-      const uint64_t voxelCount = width * height * depth;
+      distributionRawMin_ = static_cast<float>(rawMin);
+      distributionRawMax_ = static_cast<float>(rawMax);
 
-      // now that we have distribution[pixelValue] == numberOfPixelsWithValue
-      // compute number of values and check (assertion) that it is equal to 
-      // width * height * depth 
-      {
-        typename std::map<T, PixelCount>::const_iterator it = distribution.begin();
-        uint64_t totalCount = 0;
-        distributionRawMin_ = static_cast<float>(it->first);
-
-        while (it != distribution.end())
-        {
-          T pixelValue = it->first;
-          totalCount += it->second.count_;
-          ++it;
-          if (it == distribution.end())
-            distributionRawMax_ = static_cast<float>(pixelValue);
-        }
-        LOG(INFO) << "Volume image. First distribution value = " 
-          << static_cast<float>(distributionRawMin_) 
-          << " | Last distribution value = " 
-          << static_cast<float>(distributionRawMax_);
-
-        if (totalCount != voxelCount)
-        {
-          LOG(ERROR) << "Internal error in dose distribution computation. TC (" 
-            << totalCount << ") != VoxC (" << voxelCount;
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
-        }
-      }
+      LOG(INFO) << "Volume image. First distribution value = " 
+        << static_cast<float>(distributionRawMin_) 
+        << " | Last distribution value = " 
+        << static_cast<float>(distributionRawMax_);
 
       // compute the number of voxels to reject at each end of the distribution
       uint64_t endRejectionCount = static_cast<uint64_t>(
         outliersHalfRejectionRate_ * voxelCount);
 
-      if (endRejectionCount > voxelCount)
+      if (endRejectionCount >= voxelCount)
       {
         LOG(ERROR) << "Internal error in dose distribution computation."
           << " endRejectionCount = " << endRejectionCount
@@ -447,68 +473,10 @@ namespace OrthancStone
         throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
       }
 
-      // this will contain the actual distribution minimum after outlier 
-      // rejection
-      T resultMin = 0;
-
-      // then start from start and remove pixel values up to 
-      // endRejectionCount voxels rejected
-      {
-        typename std::map<T, PixelCount>::const_iterator it = distribution.begin();
-        
-        uint64_t currentCount = 0;
+      // the actual distribution minimum and maximum after outlier rejection
+      double resultMin, resultMax;
+      histogram.ComputeQuantiles(resultMin, resultMax, endRejectionCount);
 
-        while (it != distribution.end())
-        {
-          T pixelValue = it->first;
-          uint64_t count = it->second.count_;
-
-          // if this pixelValue crosses the rejection threshold, let's set it
-          // and exit the loop
-          if ((currentCount <= endRejectionCount) &&
-              (currentCount + count > endRejectionCount))
-          {
-            resultMin = pixelValue;
-            break;
-          }
-          else
-          {
-            currentCount += count;
-          }
-          // and continue walking along the distribution
-          ++it;
-        }
-      }
-
-      // this will contain the actual distribution maximum after outlier 
-      // rejection
-      T resultMax = 0;
-      // now start from END and remove pixel values up to 
-      // endRejectionCount voxels rejected
-      {
-        typename std::map<T, PixelCount>::const_reverse_iterator it = distribution.rbegin();
-
-        uint64_t currentCount = 0;
-
-        while (it != distribution.rend())
-        {
-          T pixelValue = it->first;
-          uint64_t count = it->second.count_;
-
-          if ((currentCount <= endRejectionCount) &&
-              (currentCount + count > endRejectionCount))
-          {
-            resultMax = pixelValue;
-            break;
-          }
-          else
-          {
-            currentCount += count;
-          }
-          // and continue walking along the distribution
-          ++it;
-        }
-      }
       if (resultMin > resultMax)
       {
         LOG(ERROR) << "Internal error in dose distribution computation! " << 
@@ -518,15 +486,21 @@ namespace OrthancStone
       computedDistributionMin_ = static_cast<float>(resultMin);
       computedDistributionMax_ = static_cast<float>(resultMax);
     }
+
+#if STONE_TIME_BLOCKING_OPS
+    boost::posix_time::ptime timerEnd = boost::posix_time::microsec_clock::universal_time();
+    boost::posix_time::time_duration duration = timerEnd - timerStart;
+    int64_t durationMs = duration.total_milliseconds();
+    LOG(WARNING) << "OrthancMultiframeVolumeLoader::ComputeMinMaxWithOutlierRejection took " << durationMs << " ms";
+#endif
   }
 
   template <typename T>
   void OrthancMultiframeVolumeLoader::CopyPixelDataAndComputeMinMax(
     const std::string& pixelData)
   {
-    std::map<T, PixelCount> distribution;
-    CopyPixelDataAndComputeDistribution(pixelData, distribution);
-    ComputeMinMaxWithOutlierRejection(distribution);
+    CopyPixelData<T>(pixelData);
+    ComputeMinMaxWithOutlierRejection();
   }
 
   void OrthancMultiframeVolumeLoader::SetUncompressedPixelData(const std::string& pixelData)
@@ -552,6 +526,117 @@ namespace OrthancStone
     BroadcastMessage(DicomVolumeImage::ContentUpdatedMessage(*volume_));
   }
   
+  unsigned int OrthancMultiframeVolumeLoader::GetFrameSliceIndex(unsigned int frame) const
+  {
+    const unsigned int depth = volume_->GetPixelData().GetDepth();
+
+    if (frame >= depth)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else if (isReversedFrameOffsets_)
+    {
+      return depth - 1 - frame;
+    }
+    else
+    {
+      return frame;
+    }
+  }
+
+  template <typename T>
+  void OrthancMultiframeVolumeLoader::CopyRawFrame(Orthanc::ImageAccessor& target,
+                                                   const std::string& pixelData)
+  {
+    const unsigned int bpp = Orthanc::GetBytesPerPixel(target.GetFormat());
+    const unsigned int width = target.GetWidth();
+    const unsigned int height = target.GetHeight();
+
+    assert(sizeof(T) == bpp);
+
+    if (pixelData.size() != bpp * width * height)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "The pixel data of the frame has not the proper size");
+    }
+
+    const uint8_t* source = reinterpret_cast<const uint8_t*>(pixelData.c_str());
+
+    for (unsigned int y = 0; y < height; y++)
+    {
+      T* p = reinterpret_cast<T*>(target.GetRow(y));
+      for (unsigned int x = 0; x < width; x++, p++)
+      {
+        CopyPixel(*p, source);
+        source += bpp;
+      }
+    }
+  }
+
+  void OrthancMultiframeVolumeLoader::SetRawFrame(unsigned int frame,
+                                                  const std::string& pixelData)
+  {
+    {
+      ImageBuffer3D::SliceWriter writer(volume_->GetPixelData(), VolumeProjection_Axial,
+                                        GetFrameSliceIndex(frame));
+
+      switch (volume_->GetPixelData().GetFormat())
+      {
+        case Orthanc::PixelFormat_Grayscale32:
+          CopyRawFrame<uint32_t>(writer.GetAccessor(), pixelData);
+          break;
+        case Orthanc::PixelFormat_Grayscale16:
+          CopyRawFrame<uint16_t>(writer.GetAccessor(), pixelData);
+          break;
+        case Orthanc::PixelFormat_SignedGrayscale16:
+          CopyRawFrame<int16_t>(writer.GetAccessor(), pixelData);
+          break;
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+      }
+    }
+
+    NotifyFrameLoaded();
+  }
+
+  void OrthancMultiframeVolumeLoader::SetDecodedFrame(unsigned int frame,
+                                                      const Orthanc::ImageAccessor& image)
+  {
+    {
+      ImageBuffer3D::SliceWriter writer(volume_->GetPixelData(), VolumeProjection_Axial,
+                                        GetFrameSliceIndex(frame));
+      Orthanc::ImageProcessing::Copy(writer.GetAccessor(), image);
+    }
+
+    NotifyFrameLoaded();
+  }
+
+  void OrthancMultiframeVolumeLoader::NotifyFrameLoaded()
+  {
+    loadedFrames_++;
+
+    if (loadedFrames_ == volume_->GetPixelData().GetDepth())
+    {
+      ComputeMinMaxWithOutlierRejection();
+      pixelDataLoaded_ = true;
+    }
+
+    volume_->IncrementRevision();
+    BroadcastMessage(DicomVolumeImage::ContentUpdatedMessage(*volume_));
+  }
+
+  void OrthancMultiframeVolumeLoader::SetPerFrameLoading(bool enabled)
+  {
+    if (IsActive())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      perFrameLoading_ = enabled;
+    }
+  }
+
   bool OrthancMultiframeVolumeLoader::HasGeometry() const
   {
     return volume_->HasGeometry();
@@ -575,6 +660,8 @@ namespace OrthancStone
     , distributionRawMax_(0)
     , computedDistributionMin_(0)
     , computedDistributionMax_(0)
+    , perFrameLoading_(false)
+    , loadedFrames_(0)
   {
     if (volume.get() == NULL)
     {
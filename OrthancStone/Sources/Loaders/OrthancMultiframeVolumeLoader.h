@@ -41,12 +41,7 @@ namespace OrthancStone
     class LoadGeometry;
     class LoadTransferSyntax;    
     class LoadUncompressedPixelData;
-
-    struct PixelCount
-    {
-        uint64_t count_;
-        PixelCount() { count_ = 0; }
-    };
+    class LoadFrame;
 
     boost::shared_ptr<DicomVolumeImage>  volume_;
     bool                                 isReversedFrameOffsets_;
@@ -58,11 +53,15 @@ namespace OrthancStone
     float                                distributionRawMax_;
     float                                computedDistributionMin_;
     float                                computedDistributionMax_;
+    bool                                 perFrameLoading_;
+    unsigned int                         loadedFrames_;
 
     const std::string& GetInstanceId() const;
 
     void ScheduleFrameDownloads();
 
+    void SchedulePerFrameDownloads(bool isUncompressed);
+
     void SetTransferSyntax(const std::string& transferSyntax);
 
     void SetGeometry(const Orthanc::DicomMap& dicom);
@@ -88,15 +87,31 @@ namespace OrthancStone
       
     /** Service method for CopyPixelDataAndComputeMinMax*/
     template <typename T>
-    void CopyPixelDataAndComputeDistribution(const std::string& pixelData, 
-                                             std::map<T, PixelCount>& distribution);
+    void CopyPixelData(const std::string& pixelData);
 
-    /** Service method for CopyPixelDataAndComputeMinMax*/
-    template <typename T>
-    void ComputeMinMaxWithOutlierRejection(const std::map<T, PixelCount>& distribution);
+    /**
+    Service method for CopyPixelDataAndComputeMinMax. The distribution
+    of the voxel values is computed by "PixelHistogram" over the whole
+    volume, using multiple threads.
+    */
+    void ComputeMinMaxWithOutlierRejection();
 
     void SetUncompressedPixelData(const std::string& pixelData);
 
+    template <typename T>
+    void CopyRawFrame(Orthanc::ImageAccessor& target,
+                      const std::string& pixelData);
+
+    unsigned int GetFrameSliceIndex(unsigned int frame) const;
+
+    void SetRawFrame(unsigned int frame,
+                     const std::string& pixelData);
+
+    void SetDecodedFrame(unsigned int frame,
+                         const Orthanc::ImageAccessor& image);
+
+    void NotifyFrameLoaded();
+
   protected:
     OrthancMultiframeVolumeLoader(ILoadersContext& loadersContext,
                                   boost::shared_ptr<DicomVolumeImage> volume,
@@ -125,6 +140,24 @@ namespace OrthancStone
     void GetDistributionMinMaxWithOutliersRejection
       (float& minValue, float& maxValue) const;
 
+    /**
+    Per-frame loading: Instead of downloading the whole pixel data
+    element at once, the frames are downloaded one by one, starting
+    from the center of the volume. Each frame is written into the
+    volume as soon as it is received, and a "ContentUpdatedMessage" is
+    broadcast, which allows displaying the volume progressively. The
+    frames of uncompressed transfer syntaxes are downloaded raw, and
+    the other ones are decoded by Orthanc (then parsed by the threads
+    of the oracle). This mode is always used for compressed transfer
+    syntaxes. Must be called before "LoadInstance()".
+    */
+    void SetPerFrameLoading(bool enabled);
+
+    bool IsPerFrameLoading() const
+    {
+      return perFrameLoading_;
+    }
+
     void LoadInstance(const std::string& instanceId);
   };
 }
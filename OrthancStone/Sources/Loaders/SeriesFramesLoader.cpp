@@ -27,6 +27,7 @@
 #include "../Oracle/ParseDicomFromWadoCommand.h"
 
 #if ORTHANC_ENABLE_DCMTK == 1
+#  include "../Toolbox/ParsedDicomCache.h"
 #  include <DicomParsing/ParsedDicomFile.h>
 #endif
 
@@ -152,12 +153,24 @@ namespace OrthancStone
 
 #if ORTHANC_ENABLE_DCMTK == 1
   void SeriesFramesLoader::HandleDicom(const Payload& payload,
-                                       const Orthanc::ParsedDicomFile& dicom)
+                                       const ParseDicomSuccessMessage& message)
   {     
-    size_t frameIndex = frames_.GetFrameIndex(payload.GetSeriesIndex());
+    const unsigned int frameIndex = static_cast<unsigned int>(frames_.GetFrameIndex(payload.GetSeriesIndex()));
+
+    if (message.HasDecodedFramesCache())
+    {
+      ParsedDicomCache::FrameReader reader(message.GetDecodedFramesCache(), message.GetDecodedFramesBucket(),
+                                           message.GetDecodedFramesBucketKey(), frameIndex);
+      if (reader.IsValid())
+      {
+        // Reuse the frame that was previously decoded
+        EmitMessage(payload, reader.GetFrame());
+        return;
+      }
+    }
 
     std::unique_ptr<Orthanc::ImageAccessor> decoded;
-    decoded.reset(dicom.DecodeFrame(static_cast<unsigned int>(frameIndex)));
+    decoded.reset(message.GetDicom().DecodeFrame(frameIndex));
 
     if (decoded.get() == NULL)
     {
@@ -165,6 +178,12 @@ namespace OrthancStone
     }
 
     EmitMessage(payload, *decoded);
+
+    if (message.HasDecodedFramesCache())
+    {
+      message.GetDecodedFramesCache().AcquireDecodedFrame(
+        message.GetDecodedFramesBucket(), message.GetDecodedFramesBucketKey(), frameIndex, decoded.release());
+    }
   }
 #endif
 
@@ -241,7 +260,7 @@ namespace OrthancStone
          payload.GetSource().IsDicomWeb()) &&
         message.HasPixelData())
     {
-      HandleDicom(dynamic_cast<const Payload&>(message.GetOrigin().GetPayload()), message.GetDicom());
+      HandleDicom(dynamic_cast<const Payload&>(message.GetOrigin().GetPayload()), message);
     }
     else
     {
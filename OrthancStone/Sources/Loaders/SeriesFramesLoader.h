@@ -58,7 +58,7 @@ namespace OrthancStone
 
 #if ORTHANC_ENABLE_DCMTK == 1
     void HandleDicom(const Payload& payload,
-                     const Orthanc::ParsedDicomFile& dicom);
+                     const ParseDicomSuccessMessage& message);
 #endif
     
     void HandleDicomWebRendered(const Payload& payload,
@@ -29,7 +29,8 @@ namespace OrthancStone
 {
   SeriesMetadataLoader::SeriesMetadataLoader(boost::shared_ptr<DicomResourcesLoader>& loader) :
     loader_(loader),
-    state_(State_Setup)
+    state_(State_Setup),
+    isSourceJsonRestricted_(false)
   {
   }
 
@@ -52,6 +53,19 @@ namespace OrthancStone
   }
 
 
+  LoadedDicomResources* SeriesMetadataLoader::CreateSeriesResources() const
+  {
+    std::unique_ptr<LoadedDicomResources> target(new LoadedDicomResources(Orthanc::DICOM_TAG_SOP_INSTANCE_UID));
+
+    if (isSourceJsonRestricted_)
+    {
+      target->RestrictSourceJson(sourceJsonTags_);
+    }
+
+    return target.release();
+  }
+
+
   void SeriesMetadataLoader::Handle(const DicomResourcesLoader::SuccessMessage& message)
   {
     assert(message.GetResources());
@@ -279,8 +293,8 @@ namespace OrthancStone
     {
       if (source.IsDicomWeb())
       {
-        boost::shared_ptr<LoadedDicomResources> target
-          (new LoadedDicomResources(Orthanc::DICOM_TAG_SOP_INSTANCE_UID));
+        boost::shared_ptr<LoadedDicomResources> target(CreateSeriesResources());
+
         loader_->ScheduleGetDicomWeb(
           target, priority, source,
           "/studies/" + studyInstanceUid + "/series/" + seriesInstanceUid + "/metadata",
@@ -329,9 +343,8 @@ namespace OrthancStone
         // Dummy SOP Instance UID, as we are working at the "series" level
         Orthanc::DicomInstanceHasher hasher(patientId, studyInstanceUid, seriesInstanceUid, "dummy");
 
-        boost::shared_ptr<LoadedDicomResources> target
-          (new LoadedDicomResources(Orthanc::DICOM_TAG_SOP_INSTANCE_UID));
-        
+        boost::shared_ptr<LoadedDicomResources> target(CreateSeriesResources());
+
         loader_->ScheduleLoadOrthancResources(target, priority, source, Orthanc::ResourceType_Series,
                                               hasher.HashSeries(), Orthanc::ResourceType_Instance,
                                               NULL /* TODO PAYLOAD */);
@@ -49,12 +49,16 @@ namespace OrthancStone
     boost::shared_ptr<LoadedDicomResources>  dicomDir_;
     std::string                              dicomDirPath_;
     std::map<std::string, unsigned int>      seriesSize_;
+    bool                                     isSourceJsonRestricted_;
+    std::set<Orthanc::DicomTag>              sourceJsonTags_;
 
     explicit SeriesMetadataLoader(boost::shared_ptr<DicomResourcesLoader>& loader);
 
     bool IsScheduledWithHigherPriority(const std::string& seriesInstanceUid,
                                        int priority) const;
 
+    LoadedDicomResources* CreateSeriesResources() const;
+
     void Handle(const DicomResourcesLoader::SuccessMessage& message);
 
   public:
@@ -139,6 +143,36 @@ namespace OrthancStone
 
     static boost::shared_ptr<SeriesMetadataLoader> Create(const ILoadersContext::ILock& context);
 
+    // Cf. "DicomResourcesLoader::SetDiskCache()"
+    void SetDiskCache(boost::shared_ptr<DicomResourcesDiskCache> cache)
+    {
+      loader_->SetDiskCache(cache);
+    }
+
+    /**
+     * By default, the full source JSON of the instances is kept, and
+     * is available through "LoadedDicomResources::GetSourceJson()".
+     * This method only keeps the given tags in the source JSON of the
+     * series that are scheduled afterwards, which saves memory on
+     * series with many instances. An empty set discards the source
+     * JSON altogether. Cf. "LoadedDicomResources::RestrictSourceJson()".
+     **/
+    void RestrictSourceJson(const std::set<Orthanc::DicomTag>& tags)
+    {
+      isSourceJsonRestricted_ = true;
+      sourceJsonTags_ = tags;
+    }
+
+    bool IsSourceJsonRestricted() const
+    {
+      return isSourceJsonRestricted_;
+    }
+
+    const std::set<Orthanc::DicomTag>& GetSourceJsonTags() const
+    {
+      return sourceJsonTags_;
+    }
+
   
     class Accessor : public boost::noncopyable
     {
@@ -0,0 +1,363 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "ConcurrentMessageDelivery.h"
+
+#include "IObservable.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace OrthancStone
+{
+  class ConcurrentMessageDelivery::Strand : public boost::noncopyable
+  {
+  private:
+    // All the members are protected by "strandsMutex_"
+    uint64_t                   nextTicket_;
+    uint64_t                   serving_;
+    unsigned int               users_;
+    boost::condition_variable  turn_;
+
+  public:
+    Strand() :
+      nextTicket_(0),
+      serving_(0),
+      users_(0)
+    {
+    }
+
+    uint64_t TakeTicket()
+    {
+      users_++;
+      return nextTicket_++;
+    }
+
+    bool IsTurn(uint64_t ticket) const
+    {
+      return serving_ == ticket;
+    }
+
+    boost::condition_variable& GetTurnCondition()
+    {
+      return turn_;
+    }
+
+    // Returns "true" iff the strand is not used anymore
+    bool ReleaseTurn()
+    {
+      assert(users_ > 0);
+      serving_++;
+      users_--;
+      turn_.notify_all();
+      return (users_ == 0);
+    }
+
+    unsigned int GetUsers() const
+    {
+      return users_;
+    }
+  };
+
+
+  // Waits for the turn of the calling thread in the strand of one observer
+  class ConcurrentMessageDelivery::Turn : public boost::noncopyable
+  {
+  private:
+    ConcurrentMessageDelivery&  that_;
+    const IObserver*            observer_;
+    Strand*                     strand_;
+
+  public:
+    Turn(ConcurrentMessageDelivery& that,
+         const IObserver* observer) :
+      that_(that),
+      observer_(observer),
+      strand_(NULL)
+    {
+      boost::mutex::scoped_lock lock(that_.strandsMutex_);
+
+      Strands::iterator found = that_.strands_.find(observer);
+      if (found == that_.strands_.end())
+      {
+        strand_ = new Strand;
+        that_.strands_[observer] = strand_;
+      }
+      else
+      {
+        strand_ = found->second;
+      }
+
+      const uint64_t ticket = strand_->TakeTicket();
+
+      while (!strand_->IsTurn(ticket))
+      {
+        strand_->GetTurnCondition().wait(lock);
+      }
+    }
+
+    ~Turn()
+    {
+      boost::mutex::scoped_lock lock(that_.strandsMutex_);
+
+      if (strand_->ReleaseTurn())
+      {
+        that_.strands_.erase(observer_);
+        delete strand_;
+      }
+    }
+  };
+
+
+  ConcurrentMessageDelivery::ThreadState& ConcurrentMessageDelivery::GetThreadState()
+  {
+    ThreadState* state = threadState_.get();
+
+    if (state == NULL)
+    {
+      state = new ThreadState;
+      threadState_.reset(state);
+    }
+
+    return *state;
+  }
+
+
+  void ConcurrentMessageDelivery::EnterShared(ThreadState& state)
+  {
+    assert(!state.shared_ &&
+           state.exclusive_ == 0);
+
+    boost::mutex::scoped_lock lock(gateMutex_);
+
+    // The exclusive locks have precedence, so that they cannot starve
+    while (exclusive_ ||
+           waitingExclusive_ > 0)
+    {
+      gateCondition_.wait(lock);
+    }
+
+    sharedCount_++;
+    state.shared_ = true;
+  }
+
+
+  void ConcurrentMessageDelivery::LeaveShared(ThreadState& state)
+  {
+    assert(state.shared_);
+
+    boost::mutex::scoped_lock lock(gateMutex_);
+
+    assert(sharedCount_ > 0);
+    sharedCount_--;
+    state.shared_ = false;
+
+    if (sharedCount_ == 0)
+    {
+      gateCondition_.notify_all();
+    }
+  }
+
+
+  void ConcurrentMessageDelivery::EnterExclusive()
+  {
+    boost::mutex::scoped_lock lock(gateMutex_);
+
+    waitingExclusive_++;
+
+    while (exclusive_ ||
+           sharedCount_ > 0)
+    {
+      gateCondition_.wait(lock);
+    }
+
+    waitingExclusive_--;
+    exclusive_ = true;
+  }
+
+
+  void ConcurrentMessageDelivery::LeaveExclusive()
+  {
+    boost::mutex::scoped_lock lock(gateMutex_);
+
+    assert(exclusive_);
+    exclusive_ = false;
+    gateCondition_.notify_all();
+  }
+
+
+  void ConcurrentMessageDelivery::ApplyCallables(const std::vector<ICallable*>& callables,
+                                                 const IMessage& message)
+  {
+    // "ApplyCallable()" logs the exceptions, and never throws
+    for (size_t i = 0; i < callables.size(); i++)
+    {
+      assert(callables[i] != NULL);
+      IObservable::ApplyCallable(*callables[i], message);
+    }
+  }
+
+
+  ConcurrentMessageDelivery::ExclusiveLock::ExclusiveLock(ConcurrentMessageDelivery& that) :
+    that_(that),
+    outermost_(false),
+    resumeShared_(false)
+  {
+    ThreadState& state = that_.GetThreadState();
+
+    if (state.exclusive_ == 0)
+    {
+      if (state.shared_)
+      {
+        // Called from a message handler: Let the handlers of the
+        // other threads complete, otherwise two handlers taking an
+        // exclusive lock would wait for each other
+        that_.LeaveShared(state);
+        resumeShared_ = true;
+      }
+
+      that_.EnterExclusive();
+      outermost_ = true;
+    }
+
+    state.exclusive_++;
+  }
+
+
+  ConcurrentMessageDelivery::ExclusiveLock::~ExclusiveLock()
+  {
+    ThreadState& state = that_.GetThreadState();
+
+    assert(state.exclusive_ > 0);
+    state.exclusive_--;
+
+    if (outermost_)
+    {
+      assert(state.exclusive_ == 0);
+      that_.LeaveExclusive();
+
+      if (resumeShared_)
+      {
+        that_.EnterShared(state);
+      }
+    }
+  }
+
+
+  ConcurrentMessageDelivery::ConcurrentMessageDelivery() :
+    sharedCount_(0),
+    exclusive_(false),
+    waitingExclusive_(0)
+  {
+  }
+
+
+  ConcurrentMessageDelivery::~ConcurrentMessageDelivery()
+  {
+    for (Strands::iterator it = strands_.begin(); it != strands_.end(); ++it)
+    {
+      assert(it->second != NULL);
+      delete it->second;
+    }
+  }
+
+
+  void ConcurrentMessageDelivery::Deliver(const IObserver& observer,
+                                          const std::vector<ICallable*>& callables,
+                                          const IMessage& message)
+  {
+    ThreadState& state = GetThreadState();
+
+    if (state.exclusive_ > 0 ||
+        std::find(state.strands_.begin(), state.strands_.end(), &observer) != state.strands_.end())
+    {
+      /**
+       * Either the calling thread has an exclusive access, or it is
+       * already handling a message of this observer (nested
+       * delivery): Waiting for the turn would deadlock.
+       **/
+      ApplyCallables(callables, message);
+      return;
+    }
+
+    // Don't keep the exclusive locks from being granted while waiting for the turn
+    const bool wasShared = state.shared_;
+    if (wasShared)
+    {
+      LeaveShared(state);
+    }
+
+    {
+      Turn turn(*this, &observer);
+
+      state.strands_.push_back(&observer);
+      EnterShared(state);
+
+      ApplyCallables(callables, message);
+
+      LeaveShared(state);
+      state.strands_.pop_back();
+    }
+
+    if (wasShared)
+    {
+      EnterShared(state);
+    }
+  }
+
+
+  void ConcurrentMessageDelivery::DeliverUnordered(const std::vector<ICallable*>& callables,
+                                                   const IMessage& message)
+  {
+    ThreadState& state = GetThreadState();
+
+    if (state.exclusive_ > 0 ||
+        state.shared_)
+    {
+      ApplyCallables(callables, message);
+    }
+    else
+    {
+      EnterShared(state);
+      ApplyCallables(callables, message);
+      LeaveShared(state);
+    }
+  }
+
+
+  unsigned int ConcurrentMessageDelivery::GetPendingDeliveries(const IObserver& observer)
+  {
+    boost::mutex::scoped_lock lock(strandsMutex_);
+
+    Strands::const_iterator found = strands_.find(&observer);
+    if (found == strands_.end())
+    {
+      return 0;
+    }
+    else
+    {
+      assert(found->second != NULL);
+      return found->second->GetUsers();
+    }
+  }
+}
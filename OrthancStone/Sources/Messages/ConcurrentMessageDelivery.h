@@ -0,0 +1,137 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "ICallable.h"
+#include "IObserver.h"
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <map>
+#include <vector>
+
+namespace OrthancStone
+{
+  /**
+   * Concurrent delivery of the messages to the observers. The
+   * messages to different observers are handled concurrently, but
+   * the messages to one given observer are handled one at a time, in
+   * the order of the calls to "Deliver()": Each observer has its own
+   * FIFO queue of deliveries ("strand"), whose waiting threads are
+   * served by order of arrival.
+   *
+   * An "ExclusiveLock" waits for the handlers in progress, and keeps
+   * all the other handlers from running until it is released,
+   * including if it is taken from within a message handler. While a
+   * thread waits for its turn in a strand, or for an exclusive lock,
+   * it does not keep the exclusive locks of the other threads from
+   * being granted.
+   *
+   * The messages that are delivered by a handler to its own
+   * observer, or by a thread holding an exclusive lock, are handled
+   * immediately. The handlers must not wait for each other.
+   **/
+  class ConcurrentMessageDelivery : public boost::noncopyable
+  {
+  private:
+    class Strand;
+    class Turn;
+
+    struct ThreadState
+    {
+      bool                            shared_;     // Whether the thread is running message handlers
+      unsigned int                    exclusive_;  // Depth of the nested exclusive locks in this thread
+      std::vector<const IObserver*>   strands_;    // The strands whose turn is held by this thread
+
+      ThreadState() :
+        shared_(false),
+        exclusive_(0)
+      {
+      }
+    };
+
+    typedef std::map<const IObserver*, Strand*>  Strands;
+
+    boost::mutex                             gateMutex_;
+    boost::condition_variable                gateCondition_;
+    unsigned int                             sharedCount_;
+    bool                                     exclusive_;
+    unsigned int                             waitingExclusive_;
+
+    boost::mutex                             strandsMutex_;
+    Strands                                  strands_;
+
+    boost::thread_specific_ptr<ThreadState>  threadState_;
+
+    ThreadState& GetThreadState();
+
+    void EnterShared(ThreadState& state);
+
+    void LeaveShared(ThreadState& state);
+
+    void EnterExclusive();
+
+    void LeaveExclusive();
+
+    static void ApplyCallables(const std::vector<ICallable*>& callables,
+                               const IMessage& message);
+
+  public:
+    class ExclusiveLock : public boost::noncopyable
+    {
+    private:
+      ConcurrentMessageDelivery&  that_;
+      bool                        outermost_;
+      bool                        resumeShared_;
+
+    public:
+      explicit ExclusiveLock(ConcurrentMessageDelivery& that);
+
+      ~ExclusiveLock();
+    };
+
+    ConcurrentMessageDelivery();
+
+    ~ConcurrentMessageDelivery();
+
+    // Applies the callables in the strand of "observer"
+    void Deliver(const IObserver& observer,
+                 const std::vector<ICallable*>& callables,
+                 const IMessage& message);
+
+    /**
+     * Applies the callables outside of any strand. This is only
+     * meant for the observers that are protected by their own mutex,
+     * and that must handle their messages concurrently.
+     **/
+    void DeliverUnordered(const std::vector<ICallable*>& callables,
+                          const IMessage& message);
+
+    // Number of the deliveries to "observer" that are either in
+    // progress, or waiting for their turn
+    unsigned int GetPendingDeliveries(const IObserver& observer);
+  };
+}
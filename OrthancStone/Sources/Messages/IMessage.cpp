@@ -0,0 +1,100 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "IMessage.h"
+
+#include <OrthancException.h>
+
+#include <map>
+
+#if !defined(ORTHANC_ENABLE_THREADS)
+#  error The macro ORTHANC_ENABLE_THREADS must be defined
+#endif
+
+#if ORTHANC_ENABLE_THREADS == 1
+#  include <boost/thread/mutex.hpp>
+#endif
+
+
+namespace OrthancStone
+{
+  namespace
+  {
+    class InternedIdentifiers : public boost::noncopyable
+    {
+    private:
+      typedef std::map<std::pair<std::string, int>, uint32_t>  Content;
+
+#if ORTHANC_ENABLE_THREADS == 1
+      boost::mutex  mutex_;
+#endif
+
+      Content       content_;
+
+    public:
+      uint32_t Intern(const char* file,
+                      int line)
+      {
+        if (file == NULL)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+        }
+
+#if ORTHANC_ENABLE_THREADS == 1
+        boost::mutex::scoped_lock lock(mutex_);
+#endif
+
+        const std::pair<std::string, int> key(file, line);
+
+        Content::const_iterator found = content_.find(key);
+        if (found == content_.end())
+        {
+          // The value "0" is reserved for undefined identifiers
+          const uint32_t value = static_cast<uint32_t>(content_.size()) + 1;
+          content_[key] = value;
+          return value;
+        }
+        else
+        {
+          return found->second;
+        }
+      }
+
+      static InternedIdentifiers& GetSingleton()
+      {
+        // Constructed on first use, as identifiers can be created by
+        // the initialization of other static objects
+        static InternedIdentifiers instance;
+        return instance;
+      }
+    };
+  }
+
+
+  uint32_t MessageIdentifier::Intern(const char* file,
+                                     int line)
+  {
+    return InternedIdentifiers::GetSingleton().Intern(file, line);
+  }
+}
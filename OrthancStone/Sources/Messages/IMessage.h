@@ -26,34 +26,49 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/noncopyable.hpp>
 
+#include <stdint.h>
 #include <string.h>
 
 namespace OrthancStone 
 {
+  /**
+   * Messages are distinguished by the "__FILE__" and "__LINE__" of
+   * their declaration. These pairs are interned into integers when
+   * the identifiers are constructed, which makes the comparisons of
+   * identifiers (as done for each emitted message) as cheap as the
+   * comparison of two integers.
+   **/
   class MessageIdentifier
   {
   private:
     const char*  file_;
     int          line_;
+    uint32_t     value_;  // Interned value of ("file_", "line_"), 0 if undefined
 
-    bool IsEqual(const MessageIdentifier& other) const
-    {
-      return (line_ == other.line_ &&
-              strcmp(file_, other.file_) == 0);
-    }
+    // Returns the value that is shared by all the identifiers with
+    // the same file and line (thread-safe)
+    static uint32_t Intern(const char* file,
+                           int line);
 
   public:
     MessageIdentifier(const char* file,
                       int line) :
       file_(file),
-      line_(line)
+      line_(line),
+      value_(Intern(file, line))
     {
     }
 
     MessageIdentifier() :
       file_(NULL),
-      line_(0)
+      line_(0),
+      value_(0)
+    {
+    }
+
+    uint32_t GetInternedValue() const
     {
+      return value_;
     }
 
     std::string AsString() const
@@ -63,28 +78,17 @@ namespace OrthancStone
 
     bool operator< (const MessageIdentifier& other) const
     {
-      if (file_ == NULL)
-      {
-        return false;
-      }
-      else if (line_ != other.line_)
-      {
-        return line_ < other.line_;
-      }
-      else
-      {
-        return strcmp(file_, other.file_) < 0;
-      }
+      return value_ < other.value_;
     }
 
     bool operator== (const MessageIdentifier& other) const
     {
-      return IsEqual(other);
+      return value_ == other.value_;
     }
 
     bool operator!= (const MessageIdentifier& other) const
     {
-      return !IsEqual(other);
+      return value_ != other.value_;
     }
   };
 
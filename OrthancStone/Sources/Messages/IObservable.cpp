@@ -27,23 +27,124 @@
 
 #include <Logging.h>
 
+#include <algorithm>
 #include <cassert>
 #include <stdexcept>
 
 namespace OrthancStone 
 {
+  // Minimum number of callables before collecting the expired ones
+  static const size_t MIN_COLLECTION = 128;
+
+
+  IObservable::IObservable() :
+    countCallables_(0),
+    nextCollection_(MIN_COLLECTION),
+    emitting_(0)
+  {
+  }
+
+
   IObservable::~IObservable()
   {
     // delete all callables (this will also unregister them from the broker)
     for (Callables::const_iterator it = callables_.begin();
          it != callables_.end(); ++it)
     {
-      for (std::set<ICallable*>::const_iterator
-             it2 = it->second.begin(); it2 != it->second.end(); ++it2)
+      for (Receivers::const_iterator it2 = it->second.begin(); it2 != it->second.end(); ++it2)
+      {
+        for (CallablesSet::const_iterator it3 = it2->second.begin(); it3 != it2->second.end(); ++it3)
+        {
+          delete *it3;
+        }
+      }
+    }
+  }
+
+
+  void IObservable::RemoveExpiredCallables(CallablesSet& callables)
+  {
+    assert(emitting_ == 0);
+
+    CallablesSet::iterator it = callables.begin();
+    while (it != callables.end())
+    {
+      assert(*it != NULL);
+
+      if ((*it)->GetObserver().expired())
+      {
+        delete *it;
+        callables.erase(it++);
+
+        assert(countCallables_ > 0);
+        countCallables_--;
+      }
+      else
+      {
+        ++it;
+      }
+    }
+  }
+
+
+  void IObservable::RemoveExpiredCallables(const ExpiredBucket& bucket)
+  {
+    Callables::iterator id = callables_.find(bucket.first);
+    if (id != callables_.end())
+    {
+      Receivers::iterator receiver = id->second.find(bucket.second);
+      if (receiver != id->second.end())
+      {
+        RemoveExpiredCallables(receiver->second);
+
+        if (receiver->second.empty())
+        {
+          id->second.erase(receiver);
+
+          if (id->second.empty())
+          {
+            callables_.erase(id);
+          }
+        }
+      }
+    }
+  }
+
+
+  void IObservable::CollectExpiredCallables()
+  {
+    assert(emitting_ == 0);
+
+    Callables::iterator id = callables_.begin();
+    while (id != callables_.end())
+    {
+      Receivers::iterator receiver = id->second.begin();
+      while (receiver != id->second.end())
+      {
+        RemoveExpiredCallables(receiver->second);
+
+        if (receiver->second.empty())
+        {
+          id->second.erase(receiver++);
+        }
+        else
+        {
+          ++receiver;
+        }
+      }
+
+      if (id->second.empty())
+      {
+        callables_.erase(id++);
+      }
+      else
       {
-        delete *it2;
+        ++id;
       }
     }
+
+    // Amortize the cost of the collections over the registrations
+    nextCollection_ = std::max(MIN_COLLECTION, 2 * countCallables_);
   }
   
 
@@ -53,60 +154,170 @@ namespace OrthancStone
     {
       throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
     }
-    
+
+    boost::shared_ptr<IObserver> observer(callable->GetObserver().lock());
+    if (!observer)
+    {
+      // The observer has already been destroyed: The callable would never be invoked
+      delete callable;
+      return;
+    }
+
     const MessageIdentifier& id = callable->GetMessageIdentifier();
-    callables_[id].insert(callable);
+    if (callables_[id][observer.get()].insert(callable).second)
+    {
+      countCallables_++;
+    }
+
+    if (countCallables_ >= nextCollection_ &&
+        emitting_ == 0)
+    {
+      CollectExpiredCallables();
+    }
+  }
+
+
+  void IObservable::ApplyCallable(ICallable& callable,
+                                  const IMessage& message)
+  {
+    try
+    {
+      // LOG(INFO) << "IN Handling message : " << message.GetIdentifier().AsString();
+      callable.Apply(message);
+      // LOG(INFO) << "OUT Handling message : " << message.GetIdentifier().AsString();
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "OrthancException on callable: " << e.What() << " " << message.GetIdentifier().AsString();
+    }
+    catch (StoneException& e)
+    {
+      LOG(ERROR) << "StoneException on callable: " << e.What();
+    }
+    catch (std::exception& e)
+    {
+      LOG(ERROR) << "C++ exception on callable: " << e.what();
+    }
+    catch (...)
+    {
+      LOG(ERROR) << "Native exception on callable";
+    }
+  }
+
+
+  bool IObservable::ApplyCallables(const IObserver* receiver,
+                                   const CallablesSet& callables,
+                                   const IMessage& message)
+  {
+    bool hasExpired = false;
+
+    for (CallablesSet::const_iterator it = callables.begin(); it != callables.end(); ++it)
+    {
+      assert(*it != NULL);
+
+      boost::shared_ptr<IObserver> observer((*it)->GetObserver().lock());
+
+      if (observer)
+      {
+        if (receiver == NULL ||    // Are we broadcasting?
+            observer.get() == receiver)  // Not broadcasting, but this is the receiver
+        {
+          ApplyCallable(**it, message);
+        }
+      }
+      else
+      {
+        // The callable will be removed once the emission is over (a
+        // new observer can be allocated at the same address than an
+        // expired one, hence the check above)
+        hasExpired = true;
+      }
+    }
+
+    return hasExpired;
   }
 
+
   void IObservable::EmitMessageInternal(const IObserver* receiver,
                                         const IMessage& message)
   {
     //LOG(TRACE) << "IObservable::EmitMessageInternal receiver = " << std::hex << receiver << std::dec;
     Callables::const_iterator found = callables_.find(message.GetIdentifier());
 
-    if (found != callables_.end())
+    if (found == callables_.end())
+    {
+      return;
+    }
+
+    /**
+     * The callables can register other callables, or emit other
+     * messages. The containers are not modified by the registrations
+     * in a way that invalidates the iterators, and the expired
+     * callables are only removed once the outermost emission is over.
+     **/
+    emitting_++;
+
+    if (receiver == NULL)
+    {
+      for (Receivers::const_iterator it = found->second.begin(); it != found->second.end(); ++it)
+      {
+        if (ApplyCallables(NULL, it->second, message))
+        {
+          expired_.push_back(ExpiredBucket(found->first, it->first));
+        }
+      }
+    }
+    else
     {
-      for (std::set<ICallable*>::const_iterator
-             it = found->second.begin(); it != found->second.end(); ++it)
+      Receivers::const_iterator it = found->second.find(receiver);
+
+      if (it != found->second.end() &&
+          ApplyCallables(receiver, it->second, message))
       {
-        assert(*it != NULL);
+        expired_.push_back(ExpiredBucket(found->first, it->first));
+      }
+    }
 
-        boost::shared_ptr<IObserver> observer((*it)->GetObserver().lock());
+    assert(emitting_ > 0);
+    emitting_--;
+
+    if (emitting_ == 0 &&
+        !expired_.empty())
+    {
+      std::vector<ExpiredBucket> expired;
+      expired.swap(expired_);
 
-        if (observer)
+      for (size_t i = 0; i < expired.size(); i++)
+      {
+        RemoveExpiredCallables(expired[i]);
+      }
+    }
+  }
+
+
+  void IObservable::LookupCallables(std::vector<ICallable*>& target,
+                                    const IObserver& receiver,
+                                    const MessageIdentifier& identifier) const
+  {
+    target.clear();
+
+    Callables::const_iterator found = callables_.find(identifier);
+    if (found != callables_.end())
+    {
+      Receivers::const_iterator it = found->second.find(&receiver);
+      if (it != found->second.end())
+      {
+        for (CallablesSet::const_iterator it2 = it->second.begin(); it2 != it->second.end(); ++it2)
         {
-          if (receiver == NULL ||    // Are we broadcasting?
-              observer.get() == receiver)  // Not broadcasting, but this is the receiver
+          assert(*it2 != NULL);
+
+          // Skip the expired callables whose observer had the same address
+          boost::shared_ptr<IObserver> observer((*it2)->GetObserver().lock());
+          if (observer.get() == &receiver)
           {
-            try
-            {
-              // LOG(INFO) << "IN Handling message : " << message.GetIdentifier().AsString();
-              (*it)->Apply(message);
-              // LOG(INFO) << "OUT Handling message : " << message.GetIdentifier().AsString();
-            }
-            catch (Orthanc::OrthancException& e)
-            {
-              LOG(ERROR) << "OrthancException on callable: " << e.What() << " " << message.GetIdentifier().AsString();
-            }
-            catch (StoneException& e)
-            {
-              LOG(ERROR) << "StoneException on callable: " << e.What();
-            }
-            catch (std::exception& e)
-            {
-              LOG(ERROR) << "C++ exception on callable: " << e.what();
-            }
-            catch (...)
-            {
-              LOG(ERROR) << "Native exception on callable";
-            }
+            target.push_back(*it2);
           }
         }
-        else
-        {
-          // TODO => Remove "it" from the list of callables => This
-          // allows to suppress the need for "Unregister()"
-        }
       }
     }
   }
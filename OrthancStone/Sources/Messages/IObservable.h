@@ -29,20 +29,49 @@
 
 #include <set>
 #include <map>
+#include <vector>
 
 namespace OrthancStone 
 {
+  /**
+   * The callables are indexed by message identifier, then by the
+   * observer that receives them. This makes targeted emissions (as
+   * used for the answers of the oracle) independent of the number of
+   * other observers of the same message. The callables whose
+   * observer has expired are removed automatically, which avoids the
+   * need to unregister the observers.
+   **/
   class IObservable : public boost::noncopyable
   {
   private:
-    typedef std::map<MessageIdentifier, std::set<ICallable*> >  Callables;
+    typedef std::set<ICallable*>                         CallablesSet;
+    typedef std::map<const IObserver*, CallablesSet>     Receivers;
+    typedef std::map<MessageIdentifier, Receivers>       Callables;
+    typedef std::pair<MessageIdentifier, const IObserver*>  ExpiredBucket;
 
-    Callables       callables_;
+    Callables                   callables_;
+    size_t                      countCallables_;
+    size_t                      nextCollection_;  // Value of "countCallables_" triggering a collection
+    unsigned int                emitting_;        // Depth of the nested emissions
+    std::vector<ExpiredBucket>  expired_;         // Buckets with expired callables, seen while emitting
+
+    // Returns "true" iff some callable has an expired observer
+    bool ApplyCallables(const IObserver* receiver,
+                        const CallablesSet& callables,
+                        const IMessage& message);
 
     void EmitMessageInternal(const IObserver* receiver,
                              const IMessage& message);
 
+    void RemoveExpiredCallables(CallablesSet& callables);
+
+    void RemoveExpiredCallables(const ExpiredBucket& bucket);
+
+    void CollectExpiredCallables();
+
   public:
+    IObservable();
+
     virtual ~IObservable();
 
     // Takes ownership of the callable
@@ -52,5 +81,29 @@ namespace OrthancStone
 
     void EmitMessage(boost::weak_ptr<IObserver> observer,
                      const IMessage& message);
+
+    /**
+     * Two-phase emission, for observables whose messages are
+     * delivered by several threads at once (cf. "GenericLoadersContext").
+     * The callables of the receiver are first looked up, then applied
+     * by the caller. The caller must protect "LookupCallables()" and
+     * "RegisterCallable()" by the same mutex, and must keep the
+     * receiver alive while its callables are applied (which prevents
+     * their removal).
+     **/
+    void LookupCallables(std::vector<ICallable*>& target,
+                         const IObserver& receiver,
+                         const MessageIdentifier& identifier) const;
+
+    // Applies one callable, and logs the exceptions it raises
+    static void ApplyCallable(ICallable& callable,
+                              const IMessage& message);
+
+    // Number of registered callables, including the ones whose
+    // observer has expired, but that have not been removed yet
+    size_t GetCallablesCount() const
+    {
+      return countCallables_;
+    }
   };
 }
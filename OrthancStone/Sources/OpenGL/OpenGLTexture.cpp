@@ -100,6 +100,7 @@ namespace OrthancStone
         glBindTexture(GL_TEXTURE_2D, texture_);
 
         GLenum sourceFormat, internalFormat;
+        GLenum sourceType = GL_UNSIGNED_BYTE;
 
         switch (image.GetFormat())
         {
@@ -108,6 +109,33 @@ namespace OrthancStone
           internalFormat = GL_RED;
           break;
 
+#if defined(GL_R16) && defined(GL_R32F)
+        case Orthanc::PixelFormat_Grayscale16:
+          // Normalized texture: The shaders read "value / 65535"
+          if (!IsGrayscale16AndFloat32Supported())
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+              "This OpenGL context has no support for 16bit textures");
+          }
+
+          sourceFormat = GL_RED;
+          internalFormat = GL_R16;
+          sourceType = GL_UNSIGNED_SHORT;
+          break;
+
+        case Orthanc::PixelFormat_Float32:
+          if (!IsGrayscale16AndFloat32Supported())
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+              "This OpenGL context has no support for floating-point textures");
+          }
+
+          sourceFormat = GL_RED;
+          internalFormat = GL_R32F;
+          sourceType = GL_FLOAT;
+          break;
+#endif
+
         case Orthanc::PixelFormat_RGB24:
           sourceFormat = GL_RGB;
           internalFormat = GL_RGB;
@@ -131,7 +159,7 @@ namespace OrthancStone
 
         // Load the texture from the image buffer
         glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.GetWidth(), image.GetHeight(),
-                     0, sourceFormat, GL_UNSIGNED_BYTE, image.GetConstBuffer());
+                     0, sourceFormat, sourceType, image.GetConstBuffer());
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, interpolation);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, interpolation);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -140,6 +168,25 @@ namespace OrthancStone
     }
 
 
+    bool OpenGLTexture::IsGrayscale16AndFloat32Supported()
+    {
+#if defined(GL_R16) && defined(GL_R32F)
+      /**
+       * The "GL_R16" and "GL_R32F" internal formats are part of
+       * desktop OpenGL since version 3.0. OpenGL ES 2.0 and WebGL 1.0,
+       * whose headers do not define these formats, report versions
+       * such as "OpenGL ES 2.0 ...", and are rejected here.
+       **/
+      const char* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+      return (version != NULL &&
+              version[0] >= '3' &&
+              version[0] <= '9');
+#else
+      return false;
+#endif
+    }
+
+
     void OpenGLTexture::Bind(GLint location)
     {
       glActiveTexture(GL_TEXTURE0);
@@ -59,9 +59,19 @@ namespace OrthancStone
         return height_;
       }
 
+      /**
+       * Besides 8bpp formats, the Grayscale16 and Float32 formats are
+       * accepted if "IsGrayscale16AndFloat32Supported()" returns true.
+       * They are uploaded as single-channel textures: The shaders read
+       * Grayscale16 values as normalized values in [0, 1], and Float32
+       * values as such.
+       **/
       void Load(const Orthanc::ImageAccessor& image,
                 bool isLinearInterpolation);
 
+      // The OpenGL context must be the current one
+      static bool IsGrayscale16AndFloat32Supported();
+
       void Bind(GLint location);
     };
   }
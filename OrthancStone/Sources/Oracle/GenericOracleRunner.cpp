@@ -109,9 +109,36 @@ namespace OrthancStone
   }
 
 
-  static void RunHttpCommand(std::string& answer,
-                             Orthanc::HttpClient::HttpHeaders& answerHeaders,
-                             const HttpCommand& command)
+  static Orthanc::HttpStatus ApplyConditionalRequest(std::string& answer,
+                                                     Orthanc::HttpClient::HttpHeaders& answerHeaders,
+                                                     Orthanc::HttpClient& client)
+  {
+    if (!client.Apply(answer, answerHeaders))
+    {
+      if (client.GetLastStatus() == Orthanc::HttpStatus_304_NotModified)
+      {
+        /**
+         * Answer to a conditional request (with a "If-None-Match" or
+         * "If-Modified-Since" HTTP header), which is only issued by a
+         * caller that owns a cached copy of the resource: This is
+         * reported as a success with an empty body, whose status is
+         * available in the success message.
+         **/
+        answer.clear();
+      }
+      else
+      {
+        Orthanc::HttpClient::ThrowException(client.GetLastStatus());
+      }
+    }
+
+    return client.GetLastStatus();
+  }
+
+
+  static Orthanc::HttpStatus RunHttpCommand(std::string& answer,
+                                            Orthanc::HttpClient::HttpHeaders& answerHeaders,
+                                            const HttpCommand& command)
   {
     Orthanc::HttpClient client;
     client.SetUrl(command.GetUrl());
@@ -131,10 +158,11 @@ namespace OrthancStone
       client.SetExternalBody(command.GetBody());
     }
 
-    client.ApplyAndThrowException(answer, answerHeaders);
+    const Orthanc::HttpStatus status = ApplyConditionalRequest(answer, answerHeaders, client);
     client.ClearBody();
 
     DecodeAnswer(answer, answerHeaders);
+    return status;
   }
 
 
@@ -144,17 +172,17 @@ namespace OrthancStone
   {
     std::string answer;
     Orthanc::HttpClient::HttpHeaders answerHeaders;
-    RunHttpCommand(answer, answerHeaders, command);
+    const Orthanc::HttpStatus status = RunHttpCommand(answer, answerHeaders, command);
     
-    HttpCommand::SuccessMessage message(command, answerHeaders, answer);
+    HttpCommand::SuccessMessage message(command, answerHeaders, answer, status);
     emitter.EmitMessage(receiver, message);
   }
 
   
-  static void RunOrthancRestApiCommand(std::string& answer,
-                                       Orthanc::HttpClient::HttpHeaders& answerHeaders,
-                                       const Orthanc::WebServiceParameters& orthanc,
-                                       const OrthancRestApiCommand& command)
+  static Orthanc::HttpStatus RunOrthancRestApiCommand(std::string& answer,
+                                                      Orthanc::HttpClient::HttpHeaders& answerHeaders,
+                                                      const Orthanc::WebServiceParameters& orthanc,
+                                                      const OrthancRestApiCommand& command)
   {
     Orthanc::HttpClient client(orthanc, command.GetUri());
     client.SetRedirectionFollowed(false);
@@ -169,9 +197,10 @@ namespace OrthancStone
       client.SetExternalBody(command.GetBody());
     }
 
-    client.ApplyAndThrowException(answer, answerHeaders);
+    const Orthanc::HttpStatus status = ApplyConditionalRequest(answer, answerHeaders, client);
     client.ClearBody();
     DecodeAnswer(answer, answerHeaders);
+    return status;
   }
 
   
@@ -182,9 +211,9 @@ namespace OrthancStone
   {
     std::string answer;
     Orthanc::HttpClient::HttpHeaders answerHeaders;
-    RunOrthancRestApiCommand(answer, answerHeaders, orthanc, command);
+    const Orthanc::HttpStatus status = RunOrthancRestApiCommand(answer, answerHeaders, orthanc, command);
 
-    OrthancRestApiCommand::SuccessMessage message(command, answerHeaders, answer);
+    OrthancRestApiCommand::SuccessMessage message(command, answerHeaders, answer, status);
     emitter.EmitMessage(receiver, message);
   }
 
@@ -335,6 +364,18 @@ namespace OrthancStone
   }
 
   
+  static void SetDecodedFramesCache(ParseDicomSuccessMessage& message,
+                                    ParsedDicomCache& cache,
+                                    unsigned int bucket,
+                                    const std::string& bucketKey)
+  {
+    if (cache.IsDecodedFramesCacheEnabled())
+    {
+      message.SetDecodedFramesCache(cache, bucket, bucketKey);
+    }
+  }
+
+  
   static void RunInternal(boost::weak_ptr<IObserver> receiver,
                           IMessageEmitter& emitter,
                           boost::shared_ptr<ParsedDicomCache> cache,
@@ -353,6 +394,7 @@ namespace OrthancStone
         // Reuse the DICOM file from the cache
         ParseDicomSuccessMessage message(command, command.GetSource(), reader.GetDicom(),
                                          reader.GetFileSize(), reader.HasPixelData());
+        SetDecodedFramesCache(message, *cache, BUCKET_DICOMDIR, path);
         emitter.EmitMessage(receiver, message);
         return;
       }
@@ -367,21 +409,31 @@ namespace OrthancStone
       throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
     }
     
+    if (cache)
+    {
+      // Invalidate to overwrite DICOM instance that would already be
+      // stored without pixel data, together with its decoded frames
+      // that might be outdated. This must be done before emitting the
+      // message, as the receiver can store new decoded frames.
+      cache->Invalidate(BUCKET_DICOMDIR, path);
+    }
+    
     {
       ParseDicomSuccessMessage message
         (command, command.GetSource(), *parsed,
          static_cast<size_t>(fileSize), command.IsPixelDataIncluded());
+
+      if (cache)
+      {
+        SetDecodedFramesCache(message, *cache, BUCKET_DICOMDIR, path);
+      }
+
       emitter.EmitMessage(receiver, message);
     }
 
     if (cache)
     {
       // Store it into the cache for future use
-      
-      // Invalidate to overwrite DICOM instance that would already
-      // be stored without pixel data
-      cache->Invalidate(BUCKET_DICOMDIR, path);
-      
       cache->Acquire(BUCKET_DICOMDIR, path, parsed.release(),
                      static_cast<size_t>(fileSize), command.IsPixelDataIncluded());
     }
@@ -403,6 +455,7 @@ namespace OrthancStone
         // Reuse the DICOM file from the cache
         ParseDicomSuccessMessage message(command, command.GetSource(), reader.GetDicom(),
                                          reader.GetFileSize(), reader.HasPixelData());
+        SetDecodedFramesCache(message, *cache, BUCKET_SOP, command.GetSopInstanceUid());
         emitter.EmitMessage(receiver, message);
         return;
       }
@@ -432,6 +485,12 @@ namespace OrthancStone
     {
       ParseDicomSuccessMessage message(command, command.GetSource(), *parsed, fileSize,
                                        true /* pixel data always is included in WADO-RS */);
+
+      if (cache)
+      {
+        SetDecodedFramesCache(message, *cache, BUCKET_SOP, command.GetSopInstanceUid());
+      }
+
       emitter.EmitMessage(receiver, message);
     }
 
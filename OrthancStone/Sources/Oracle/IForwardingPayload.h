@@ -0,0 +1,48 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <IDynamicObject.h>
+
+namespace OrthancStone
+{
+  /**
+   * Payload of the commands whose receiver only forwards the answer
+   * to another observer (cf. "OracleScheduler"). This allows the
+   * oracle to drop the queued commands whose final receiver has been
+   * destroyed, even if the forwarding receiver is still alive. The
+   * forwarding receiver is then notified by an
+   * "OracleCommandExceptionMessage" with "ErrorCode_CanceledJob".
+   **/
+  class IForwardingPayload : public Orthanc::IDynamicObject
+  {
+  public:
+    virtual ~IForwardingPayload()
+    {
+    }
+
+    virtual bool IsFinalReceiverExpired() const = 0;
+  };
+}
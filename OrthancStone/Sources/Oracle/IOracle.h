@@ -44,5 +44,18 @@ namespace OrthancStone
      **/
     virtual bool Schedule(boost::shared_ptr<IObserver> receiver,
                           IOracleCommand* command) = 0;  // Takes ownership
+
+    /**
+     * Same as "Schedule()", with a hint about the priority of the
+     * command. Lower values are processed first, which is the same
+     * convention as in "OracleScheduler". Oracles that have no notion
+     * of priority simply ignore this hint.
+     **/
+    virtual bool ScheduleWithPriority(boost::shared_ptr<IObserver> receiver,
+                                      IOracleCommand* command,  // Takes ownership
+                                      int priority)
+    {
+      return Schedule(receiver, command);
+    }
   };
 }
@@ -43,16 +43,19 @@ namespace OrthancStone
       ORTHANC_STONE_MESSAGE(__FILE__, __LINE__);
       
     private:
-      const HttpHeaders&  headers_;
-      const std::string&  answer_;
+      const HttpHeaders&   headers_;
+      const std::string&   answer_;
+      Orthanc::HttpStatus  status_;
 
     public:
       SuccessMessage(const OrthancRestApiCommand& command,
                      const HttpHeaders& answerHeaders,
-                     const std::string& answer) :
+                     const std::string& answer,
+                     Orthanc::HttpStatus status) :
         OriginMessage(command),
         headers_(answerHeaders),
-        answer_(answer)
+        answer_(answer),
+        status_(status)
       {
       }
       
@@ -67,6 +70,18 @@ namespace OrthancStone
       {
         return headers_;
       }
+
+      /**
+       * A "304 Not Modified" status is reported as a success with an
+       * empty answer, which can only happen if the command contains a
+       * conditional HTTP header ("If-None-Match" or
+       * "If-Modified-Since"). This status distinguishes it from a
+       * valid empty answer (such as "204 No Content").
+       **/
+      Orthanc::HttpStatus GetHttpStatus() const
+      {
+        return status_;
+      }
     };
 
 
@@ -106,4 +106,17 @@ namespace OrthancStone
                                       "Multipart/related answer of application/dicom was expected from DICOMweb server");
     }
   }
+
+
+  ParsedDicomCache& ParseDicomSuccessMessage::GetDecodedFramesCache() const
+  {
+    if (decodedFramesCache_ == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      return *decodedFramesCache_;
+    }
+  }
 }
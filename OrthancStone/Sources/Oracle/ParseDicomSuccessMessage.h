@@ -47,6 +47,7 @@ namespace Orthanc
 namespace OrthancStone
 {
   class DicomSource;
+  class ParsedDicomCache;
   
   class ParseDicomSuccessMessage : public OriginMessage<OracleCommandBase>
   {
@@ -57,6 +58,9 @@ namespace OrthancStone
     Orthanc::ParsedDicomFile&  dicom_;
     size_t                     fileSize_;
     bool                       hasPixelData_;
+    ParsedDicomCache*          decodedFramesCache_;
+    unsigned int               decodedFramesBucket_;
+    std::string                decodedFramesBucketKey_;
     
   public:
     ParseDicomSuccessMessage(const OracleCommandBase& command,
@@ -68,7 +72,9 @@ namespace OrthancStone
       source_(source),
       dicom_(dicom),
       fileSize_(fileSize),
-      hasPixelData_(hasPixelData)
+      hasPixelData_(hasPixelData),
+      decodedFramesCache_(NULL),
+      decodedFramesBucket_(0)
     {
     }
 
@@ -91,6 +97,44 @@ namespace OrthancStone
     {
       return hasPixelData_;
     }
+
+    /**
+     * If the oracle has a cache of decoded frames, the receiver can
+     * look for the frames of this DICOM file in the cache before
+     * decoding them, and store the frames it decodes into the cache.
+     **/
+    void SetDecodedFramesCache(ParsedDicomCache& cache,
+                               unsigned int bucket,
+                               const std::string& bucketKey)
+    {
+      decodedFramesCache_ = &cache;
+      decodedFramesBucket_ = bucket;
+      decodedFramesBucketKey_ = bucketKey;
+    }
+
+    void CopyDecodedFramesCache(const ParseDicomSuccessMessage& other)
+    {
+      decodedFramesCache_ = other.decodedFramesCache_;
+      decodedFramesBucket_ = other.decodedFramesBucket_;
+      decodedFramesBucketKey_ = other.decodedFramesBucketKey_;
+    }
+
+    bool HasDecodedFramesCache() const
+    {
+      return decodedFramesCache_ != NULL;
+    }
+
+    ParsedDicomCache& GetDecodedFramesCache() const;
+
+    unsigned int GetDecodedFramesBucket() const
+    {
+      return decodedFramesBucket_;
+    }
+
+    const std::string& GetDecodedFramesBucketKey() const
+    {
+      return decodedFramesBucketKey_;
+    }
     
     static Orthanc::ParsedDicomFile* ParseWadoAnswer(size_t& fileSize /* OUT */,
                                                      const std::string& answer,
@@ -23,23 +23,30 @@
 
 #include "ThreadedOracle.h"
 
+#include "IForwardingPayload.h"
+#include "OracleCommandExceptionMessage.h"
 #include "SleepOracleCommand.h"
 
 #include <Logging.h>
 #include <OrthancException.h>
 
+#include <map>
+#include <vector>
+
 namespace OrthancStone
 {
-  class ThreadedOracle::Item : public Orthanc::IDynamicObject
+  class ThreadedOracle::Item : public boost::noncopyable
   {
   private:
     boost::weak_ptr<IObserver>      receiver_;
+    bool                            hasReceiver_;
     std::unique_ptr<IOracleCommand>   command_;
 
   public:
-    Item(boost::weak_ptr<IObserver> receiver,
+    Item(boost::shared_ptr<IObserver> receiver,
          IOracleCommand* command) :
       receiver_(receiver),
+      hasReceiver_(receiver.get() != NULL),
       command_(command)
     {
       if (command == NULL)
@@ -53,6 +60,30 @@ namespace OrthancStone
       return receiver_;
     }
 
+    // Whether nobody will ever receive the result of this command
+    bool IsReceiverExpired() const
+    {
+      if (hasReceiver_ &&
+          receiver_.expired())
+      {
+        return true;
+      }
+
+      // The receiver might only forward the answer to another observer
+      const OracleCommandBase* command = dynamic_cast<const OracleCommandBase*>(command_.get());
+      if (command != NULL &&
+          command->HasPayload())
+      {
+        const IForwardingPayload* payload = dynamic_cast<const IForwardingPayload*>(&command->GetPayload());
+        return (payload != NULL &&
+                payload->IsFinalReceiverExpired());
+      }
+      else
+      {
+        return false;
+      }
+    }
+
     IOracleCommand& GetCommand()
     {
       assert(command_.get() != NULL);
@@ -61,6 +92,222 @@ namespace OrthancStone
   };
 
 
+  /**
+   * Queue of the commands waiting for a worker, with one priority
+   * queue per lane. The commands are sorted by "priority +
+   * enqueueTime / agingPeriod": As all the queued commands age at the
+   * same speed, this key needs not to be updated over time, and is
+   * equivalent to decreasing the priority of each command by one
+   * level per aging period.
+   *
+   * The workers of one lane first serve their own lane, then steal
+   * the commands of the other lane if they are idle. The two lanes
+   * share the same mutex and condition variable, which is not a
+   * bottleneck given the duration of the oracle commands.
+   **/
+  class ThreadedOracle::PriorityQueue : public boost::noncopyable
+  {
+  private:
+    typedef std::multimap<double, Item*>  Content;
+
+    struct LaneContent
+    {
+      Content   content_;
+      uint64_t  processedCount_;
+      uint64_t  stolenCount_;
+
+      LaneContent() :
+        processedCount_(0),
+        stolenCount_(0)
+      {
+      }
+    };
+
+    boost::mutex                    mutex_;
+    boost::condition_variable       elementAvailable_;
+    LaneContent                     lanes_[2];
+    const boost::posix_time::ptime  start_;
+    unsigned int                    agingPeriod_;  // In milliseconds, 0 if no aging
+    uint64_t                        cancelledCount_;
+
+    double ComputeKey(int priority) const
+    {
+      if (agingPeriod_ == 0)
+      {
+        return static_cast<double>(priority);
+      }
+      else
+      {
+        const boost::posix_time::time_duration elapsed =
+          boost::posix_time::microsec_clock::local_time() - start_;
+        return (static_cast<double>(priority) +
+                static_cast<double>(elapsed.total_milliseconds()) / static_cast<double>(agingPeriod_));
+      }
+    }
+
+    static size_t GetLaneIndex(Lane lane)
+    {
+      switch (lane)
+      {
+        case Lane_InputOutput:
+          return 0;
+
+        case Lane_Computation:
+          return 1;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+    }
+
+    // The mutex must be locked. The cancelled commands are moved to
+    // "cancelled", as their receiver must be notified once the mutex
+    // is unlocked (the notification can schedule new commands).
+    Item* PopFirstValid(std::vector<Item*>& cancelled,
+                        Content& content)
+    {
+      while (!content.empty())
+      {
+        std::unique_ptr<Item> item(content.begin()->second);
+        content.erase(content.begin());
+
+        assert(item.get() != NULL);
+        if (item->IsReceiverExpired())
+        {
+          // Nobody is listening anymore, don't waste a worker
+          cancelledCount_++;
+          cancelled.push_back(item.release());
+        }
+        else
+        {
+          return item.release();
+        }
+      }
+
+      return NULL;
+    }
+
+  public:
+    PriorityQueue() :
+      start_(boost::posix_time::microsec_clock::local_time()),
+      agingPeriod_(1000),  // By default, gain one level of priority per second
+      cancelledCount_(0)
+    {
+    }
+
+    ~PriorityQueue()
+    {
+      for (size_t i = 0; i < 2; i++)
+      {
+        for (Content::iterator it = lanes_[i].content_.begin(); it != lanes_[i].content_.end(); ++it)
+        {
+          assert(it->second != NULL);
+          delete it->second;
+        }
+      }
+    }
+
+    void SetAgingPeriod(unsigned int milliseconds)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      agingPeriod_ = milliseconds;
+    }
+
+    void Enqueue(Item* item,   // Takes ownership
+                 Lane lane,
+                 int priority)
+    {
+      std::unique_ptr<Item> protection(item);
+
+      if (item == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+      }
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        lanes_[GetLaneIndex(lane)].content_.insert(std::make_pair(ComputeKey(priority), protection.release()));
+      }
+
+      // Any worker can process the command, possibly by stealing it
+      elementAvailable_.notify_one();
+    }
+
+    /**
+     * Returns NULL if no command is available after the timeout, or
+     * if some commands were cancelled. The caller takes ownership of
+     * the returned command, and of the cancelled commands.
+     **/
+    Item* Dequeue(std::vector<Item*>& cancelled,
+                  Lane lane,
+                  unsigned int millisecondsTimeout)
+    {
+      const size_t own = GetLaneIndex(lane);
+      const size_t other = 1 - own;
+
+      boost::mutex::scoped_lock lock(mutex_);
+
+      const boost::system_time timeout =
+        boost::get_system_time() + boost::posix_time::milliseconds(millisecondsTimeout);
+
+      for (;;)
+      {
+        Item* item = PopFirstValid(cancelled, lanes_[own].content_);
+        if (item != NULL)
+        {
+          lanes_[own].processedCount_++;
+          return item;
+        }
+
+        item = PopFirstValid(cancelled, lanes_[other].content_);
+        if (item != NULL)
+        {
+          lanes_[own].processedCount_++;
+          lanes_[own].stolenCount_++;
+          return item;
+        }
+
+        if (!cancelled.empty())
+        {
+          // Notify the receivers of the cancelled commands without delay
+          return NULL;
+        }
+
+        if (!elementAvailable_.timed_wait(lock, timeout) &&
+            lanes_[0].content_.empty() &&
+            lanes_[1].content_.empty())
+        {
+          return NULL;
+        }
+      }
+    }
+
+    uint64_t GetCancelledCount()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return cancelledCount_;
+    }
+
+    size_t GetSize(Lane lane)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return lanes_[GetLaneIndex(lane)].content_.size();
+    }
+
+    uint64_t GetProcessedCount(Lane lane)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return lanes_[GetLaneIndex(lane)].processedCount_;
+    }
+
+    uint64_t GetStolenCount(Lane lane)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return lanes_[GetLaneIndex(lane)].stolenCount_;
+    }
+  };
+
+
   class ThreadedOracle::SleepingCommands : public boost::noncopyable
   {
   private:
@@ -154,13 +401,59 @@ namespace OrthancStone
   };
 
 
-  void ThreadedOracle::Step()
+  ThreadedOracle::Lane ThreadedOracle::GetLane(IOracleCommand::Type type)
+  {
+    switch (type)
+    {
+      case IOracleCommand::Type_ParseDicomFromFile:
+        // Dominated by the parsing of the DICOM file by DCMTK
+        return Lane_Computation;
+
+      case IOracleCommand::Type_GetOrthancImage:
+      case IOracleCommand::Type_GetOrthancWebViewerJpeg:
+      case IOracleCommand::Type_Http:
+      case IOracleCommand::Type_OrthancRestApi:
+      case IOracleCommand::Type_ParseDicomFromWado:
+      case IOracleCommand::Type_ReadFile:
+      case IOracleCommand::Type_Sleep:
+        // Dominated by the network or by the filesystem
+        return Lane_InputOutput;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  void ThreadedOracle::Step(Lane lane)
   {
-    std::unique_ptr<Orthanc::IDynamicObject>  object(queue_.Dequeue(100));
+    std::vector<Item*>  cancelled;
+    std::unique_ptr<Item>  object(queue_->Dequeue(cancelled, lane, 100));
+
+    for (size_t i = 0; i < cancelled.size(); i++)
+    {
+      std::unique_ptr<Item> item(cancelled[i]);
+
+      /**
+       * Notify the receiver, which matters if it only forwards the
+       * answers to a final receiver that has been destroyed: For
+       * instance, "OracleScheduler" must release the slot of this
+       * command. This is a no-op if the receiver itself is expired.
+       **/
+      try
+      {
+        OracleCommandExceptionMessage message(item->GetCommand(), Orthanc::ErrorCode_CanceledJob);
+        emitter_.EmitMessage(item->GetReceiver(), message);
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        LOG(ERROR) << "Exception while notifying the cancellation of an oracle command: " << e.What();
+      }
+    }
 
     if (object.get() != NULL)
     {
-      Item& item = dynamic_cast<Item&>(*object);
+      Item& item = *object;
 
       if (item.GetCommand().GetType() == IOracleCommand::Type_Sleep)
       {
@@ -198,7 +491,8 @@ namespace OrthancStone
   }
 
 
-  void ThreadedOracle::Worker(ThreadedOracle* that)
+  void ThreadedOracle::Worker(ThreadedOracle* that,
+                              Lane lane)
   {
     assert(that != NULL);
       
@@ -212,7 +506,7 @@ namespace OrthancStone
         }
       }
 
-      that->Step();
+      that->Step(lane);
     }
   }
 
@@ -277,10 +571,13 @@ namespace OrthancStone
   ThreadedOracle::ThreadedOracle(IMessageEmitter& emitter) :
     emitter_(emitter),
     rootDirectory_("."),
+    queue_(new PriorityQueue),
     state_(State_Setup),
-    workers_(4),
+    inputOutputThreadsCount_(3),
+    computationThreadsCount_(1),
     sleepingCommands_(new SleepingCommands),
-    sleepingTimeResolution_(50)  // By default, time resolution of 50ms
+    sleepingTimeResolution_(50),  // By default, time resolution of 50ms
+    decodedFramesCacheSize_(0)
   {
   }
 
@@ -324,20 +621,68 @@ namespace OrthancStone
 
   void ThreadedOracle::SetThreadsCount(unsigned int count)
   {
-    boost::mutex::scoped_lock lock(mutex_);
-
     if (count == 0)
     {
       throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
-    else if (state_ != State_Setup)
+    else
+    {
+      const unsigned int computation = count / 3;
+      SetThreadsCount(Lane_InputOutput, count - computation);
+      SetThreadsCount(Lane_Computation, computation);
+    }
+  }
+
+
+  void ThreadedOracle::SetThreadsCount(Lane lane,
+                                      unsigned int count)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (state_ != State_Setup)
     {
       LOG(ERROR) << "ThreadedOracle::SetThreadsCount(): (state_ != State_Setup)";
       throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
     }
-    else
+
+    switch (lane)
     {
-      workers_.resize(count);
+      case Lane_InputOutput:
+        if (count == 0)
+        {
+          // This lane also executes the sleep commands
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+        }
+        else
+        {
+          inputOutputThreadsCount_ = count;
+        }
+        break;
+
+      case Lane_Computation:
+        computationThreadsCount_ = count;
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  unsigned int ThreadedOracle::GetThreadsCount(Lane lane) const
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    switch (lane)
+    {
+      case Lane_InputOutput:
+        return inputOutputThreadsCount_;
+
+      case Lane_Computation:
+        return computationThreadsCount_;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
   }
 
@@ -362,7 +707,8 @@ namespace OrthancStone
   }
 
 
-  void ThreadedOracle::SetDicomCacheSize(size_t size)
+  void ThreadedOracle::SetDicomCacheSize(size_t size,
+                                         unsigned int shardsCount)
   {
 #if ORTHANC_ENABLE_DCMTK == 1
     boost::mutex::scoped_lock lock(mutex_);
@@ -380,13 +726,77 @@ namespace OrthancStone
       }
       else
       {
-        dicomCache_.reset(new ParsedDicomCache(size));
+        dicomCache_.reset(new ParsedDicomCache(size, shardsCount));
+        dicomCache_->SetDecodedFramesCacheSize(decodedFramesCacheSize_);
       }
     }
 #endif
   }
 
 
+  void ThreadedOracle::SetDecodedFramesCacheSize(size_t size)
+  {
+#if ORTHANC_ENABLE_DCMTK == 1
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (state_ != State_Setup)
+    {
+      LOG(ERROR) << "ThreadedOracle::SetDecodedFramesCacheSize(): (state_ != State_Setup)";
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      decodedFramesCacheSize_ = size;
+
+      if (dicomCache_)
+      {
+        dicomCache_->SetDecodedFramesCacheSize(size);
+      }
+    }
+#endif
+  }
+
+
+  void ThreadedOracle::SetPriorityAgingPeriod(unsigned int milliseconds)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (state_ != State_Setup)
+    {
+      LOG(ERROR) << "ThreadedOracle::SetPriorityAgingPeriod(): (state_ != State_Setup)";
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      queue_->SetAgingPeriod(milliseconds);
+    }
+  }
+
+
+  uint64_t ThreadedOracle::GetCancelledCommandsCount() const
+  {
+    return queue_->GetCancelledCount();
+  }
+
+
+  size_t ThreadedOracle::GetQueueSize(Lane lane) const
+  {
+    return queue_->GetSize(lane);
+  }
+
+
+  uint64_t ThreadedOracle::GetProcessedCommandsCount(Lane lane) const
+  {
+    return queue_->GetProcessedCount(lane);
+  }
+
+
+  uint64_t ThreadedOracle::GetStolenCommandsCount(Lane lane) const
+  {
+    return queue_->GetStolenCount(lane);
+  }
+
+
   void ThreadedOracle::Start()
   {
     boost::mutex::scoped_lock lock(mutex_);
@@ -398,12 +808,21 @@ namespace OrthancStone
     }
     else
     {
-      LOG(INFO) << "Starting oracle with " << workers_.size() << " worker threads";
+      LOG(INFO) << "Starting oracle with " << inputOutputThreadsCount_ << " input/output worker threads and "
+                << computationThreadsCount_ << " computation worker threads";
       state_ = State_Running;
 
-      for (unsigned int i = 0; i < workers_.size(); i++)
+      assert(workers_.empty());
+      workers_.reserve(inputOutputThreadsCount_ + computationThreadsCount_);
+
+      for (unsigned int i = 0; i < inputOutputThreadsCount_; i++)
       {
-        workers_[i] = new boost::thread(Worker, this);
+        workers_.push_back(new boost::thread(Worker, this, Lane_InputOutput));
+      }
+
+      for (unsigned int i = 0; i < computationThreadsCount_; i++)
+      {
+        workers_.push_back(new boost::thread(Worker, this, Lane_Computation));
       }
 
       sleepingWorker_ = boost::thread(SleepingWorker, this);
@@ -413,6 +832,14 @@ namespace OrthancStone
 
   bool ThreadedOracle::Schedule(boost::shared_ptr<IObserver> receiver,
                                 IOracleCommand* command)
+  {
+    return ScheduleWithPriority(receiver, command, 0);
+  }
+
+
+  bool ThreadedOracle::ScheduleWithPriority(boost::shared_ptr<IObserver> receiver,
+                                            IOracleCommand* command,
+                                            int priority)
   {
     std::unique_ptr<Item> item(new Item(receiver, command));
 
@@ -422,7 +849,14 @@ namespace OrthancStone
       if (state_ == State_Running)
       {
         //LOG(INFO) << "New oracle command queued";
-        queue_.Enqueue(item.release());
+        Lane lane = GetLane(command->GetType());
+        if (lane == Lane_Computation &&
+            computationThreadsCount_ == 0)
+        {
+          lane = Lane_InputOutput;
+        }
+
+        queue_->Enqueue(item.release(), lane, priority);
         return true;
       }
       else
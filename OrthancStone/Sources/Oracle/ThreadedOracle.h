@@ -46,13 +46,25 @@
 #include "GenericOracleRunner.h"
 #include "../Messages/IMessageEmitter.h"
 
-#include <MultiThreading/SharedMessageQueue.h>
+#include <boost/thread.hpp>
 
 
 namespace OrthancStone
 {
   class ThreadedOracle : public IOracle
   {
+  public:
+    /**
+     * The workers are split into two lanes, that can be sized
+     * independently. Idle workers steal the commands that are
+     * queued in the other lane.
+     **/
+    enum Lane
+    {
+      Lane_InputOutput,   // Network and filesystem
+      Lane_Computation    // Parsing of DICOM files
+    };
+
   private:
     enum State
     {
@@ -62,26 +74,33 @@ namespace OrthancStone
     };
 
     class Item;
+    class PriorityQueue;
     class SleepingCommands;
 
     IMessageEmitter&                     emitter_;
     Orthanc::WebServiceParameters        orthanc_;
     std::string                          rootDirectory_;
-    Orthanc::SharedMessageQueue          queue_;
+    boost::shared_ptr<PriorityQueue>     queue_;
     State                                state_;
-    boost::mutex                         mutex_;
+    mutable boost::mutex                 mutex_;
+    unsigned int                         inputOutputThreadsCount_;
+    unsigned int                         computationThreadsCount_;
     std::vector<boost::thread*>          workers_;
     boost::shared_ptr<SleepingCommands>  sleepingCommands_;
     boost::thread                        sleepingWorker_;
     unsigned int                         sleepingTimeResolution_;
+    size_t                               decodedFramesCacheSize_;
 
 #if ORTHANC_ENABLE_DCMTK == 1
     boost::shared_ptr<ParsedDicomCache>  dicomCache_;
 #endif
     
-    void Step();
+    static Lane GetLane(IOracleCommand::Type type);
+
+    void Step(Lane lane);
 
-    static void Worker(ThreadedOracle* that);
+    static void Worker(ThreadedOracle* that,
+                       Lane lane);
 
     static void SleepingWorker(ThreadedOracle* that);
 
@@ -96,11 +115,71 @@ namespace OrthancStone
 
     void SetRootDirectory(const std::string& rootDirectory);
 
+    /**
+     * Sets the total number of workers, as before the introduction of
+     * the lanes. One worker out of three is dedicated to the
+     * computation lane, and the input/output lane has at least one
+     * worker. By default, the oracle has 4 workers (3 input/output
+     * workers and 1 computation worker).
+     **/
     void SetThreadsCount(unsigned int count);
 
+    // The computation lane can have no worker: In such a case, its
+    // commands are executed by the input/output lane
+    void SetThreadsCount(Lane lane,
+                         unsigned int count);
+
+    unsigned int GetThreadsCount(Lane lane) const;
+
     void SetSleepingTimeResolution(unsigned int milliseconds);
 
-    void SetDicomCacheSize(size_t size);
+    void SetDicomCacheSize(size_t size)
+    {
+      SetDicomCacheSize(size, 1);
+    }
+
+    /**
+     * The DICOM cache can be split into shards to reduce the
+     * contention between the workers, but each shard only gets "size
+     * / shardsCount" bytes, which must be larger than the largest
+     * DICOM instance to be cached (cf. "ParsedDicomCache").
+     **/
+    void SetDicomCacheSize(size_t size,
+                           unsigned int shardsCount);
+
+    /**
+     * Memory budget of the decoded frames that are stored next to
+     * the parsed DICOM files, so that the receivers of
+     * "ParseDicomSuccessMessage" can avoid decoding the same frame
+     * again. This has no effect if the DICOM cache is disabled.
+     **/
+    void SetDecodedFramesCacheSize(size_t size);
+
+    /**
+     * The queued commands are processed by increasing priority. To
+     * avoid starvation, a command that has been waiting in the queue
+     * for "milliseconds" gains one level of priority. A value of
+     * zero disables aging, in which case the commands with the same
+     * priority are processed in FIFO order.
+     **/
+    void SetPriorityAgingPeriod(unsigned int milliseconds);
+
+    /**
+     * Number of queued commands that were dropped because their
+     * receiver (or the final receiver of a forwarding receiver, cf.
+     * "IForwardingPayload") was destroyed before a worker picked them
+     * up. The receiver of a dropped command gets an
+     * "OracleCommandExceptionMessage" with "ErrorCode_CanceledJob".
+     **/
+    uint64_t GetCancelledCommandsCount() const;
+
+    size_t GetQueueSize(Lane lane) const;
+
+    // Number of commands executed by the workers of this lane,
+    // including the ones stolen from the other lane
+    uint64_t GetProcessedCommandsCount(Lane lane) const;
+
+    uint64_t GetStolenCommandsCount(Lane lane) const;
 
     void Start();
 
@@ -111,5 +190,9 @@ namespace OrthancStone
 
     virtual bool Schedule(boost::shared_ptr<IObserver> receiver,
                           IOracleCommand* command) ORTHANC_OVERRIDE;
+
+    virtual bool ScheduleWithPriority(boost::shared_ptr<IObserver> receiver,
+                                      IOracleCommand* command,
+                                      int priority) ORTHANC_OVERRIDE;
   };
 }
@@ -139,10 +139,11 @@ namespace OrthancStone
     }
 
     void ProcessFetchResult(const std::string& answer,
-                            const HttpHeaders& headers)
+                            const HttpHeaders& headers,
+                            Orthanc::HttpStatus status)
     {
       assert(command_.get() != NULL);
-      oracle_.ProcessFetchResult(receiver_, answer, headers, *command_);
+      oracle_.ProcessFetchResult(receiver_, answer, headers, status, *command_);
     }
 
     static void SuccessCallback(emscripten_fetch_t *fetch)
@@ -166,6 +167,8 @@ namespace OrthancStone
         answer.assign(fetch->data, fetch->numBytes);
       }
 
+      const Orthanc::HttpStatus status = static_cast<Orthanc::HttpStatus>(fetch->status);
+
 
       /**
        * Retrieving the headers of the HTTP answer.
@@ -237,7 +240,7 @@ namespace OrthancStone
         }
         else
         {
-          context->ProcessFetchResult(answer, headers);
+          context->ProcessFetchResult(answer, headers, status);
         }
       }
       catch (Orthanc::OrthancException& e)
@@ -474,13 +477,14 @@ namespace OrthancStone
   void WebAssemblyOracle::ProcessFetchResult(boost::weak_ptr<IObserver>& receiver,
                                              const std::string& answer,
                                              const HttpHeaders& headers,
+                                             Orthanc::HttpStatus status,
                                              const IOracleCommand& command)
   {
     switch (command.GetType())
     {
       case IOracleCommand::Type_Http:
       {
-        HttpCommand::SuccessMessage message(dynamic_cast<const HttpCommand&>(command), headers, answer);
+        HttpCommand::SuccessMessage message(dynamic_cast<const HttpCommand&>(command), headers, answer, status);
         EmitMessage(receiver, message);
         break;
       }
@@ -489,7 +493,7 @@ namespace OrthancStone
       {
         LOG(TRACE) << "WebAssemblyOracle::FetchContext::SuccessCallback. About to call EmitMessage(message);";
         OrthancRestApiCommand::SuccessMessage message
-          (dynamic_cast<const OrthancRestApiCommand&>(command), headers, answer);
+          (dynamic_cast<const OrthancRestApiCommand&>(command), headers, answer, status);
         EmitMessage(receiver, message);
         break;
       }
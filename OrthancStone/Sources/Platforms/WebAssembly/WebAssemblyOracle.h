@@ -95,6 +95,7 @@ namespace OrthancStone
     void ProcessFetchResult(boost::weak_ptr<IObserver>& receiver,
                             const std::string& answer,
                             const HttpHeaders& headers,
+                            Orthanc::HttpStatus status,
                             const IOracleCommand& command);
 
   public:
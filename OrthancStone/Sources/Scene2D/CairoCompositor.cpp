@@ -31,13 +31,200 @@
 #include "Internals/CairoPolylineRenderer.h"
 #include "Internals/CairoTextRenderer.h"
 #include "Internals/MacroLayerRenderer.h"
+#include "../Toolbox/UnionOfRectangles.h"
 
+#include <Logging.h>
 #include <OrthancException.h>
 
+#include <algorithm>  // For std::min()
+
+#if ORTHANC_ENABLE_THREADS == 1
+#  include "../Toolbox/Internals/WorkersPool.h"
+#endif
+
 namespace OrthancStone
 {
+#if ORTHANC_ENABLE_THREADS == 1
+  class CairoCompositor::TilesRenderer : public Internals::WorkersPool::IJob
+  {
+  private:
+    typedef std::vector<Internals::CompositorHelper::ILayerRenderer*>  Layers;
+
+    // Removes the drawing context of the tile, even if rendering fails
+    class TileContext : public boost::noncopyable
+    {
+    private:
+      boost::thread_specific_ptr<CairoContext>&  context_;
+
+    public:
+      TileContext(boost::thread_specific_ptr<CairoContext>& context,
+                  CairoSurface& surface) :
+        context_(context)
+      {
+        context_.reset(new CairoContext(surface));
+      }
+
+      ~TileContext()
+      {
+        context_.reset();
+      }
+
+      cairo_t* GetObject()
+      {
+        return context_->GetObject();
+      }
+    };
+
+    CairoCompositor&          that_;
+    const Layers&             layers_;
+    const AffineTransform2D&  transform_;
+    Orthanc::ImageAccessor    canvas_;
+    unsigned int              tileSize_;
+    unsigned int              countTilesX_;
+    unsigned int              countTiles_;
+
+    boost::mutex              mutex_;
+    unsigned int              nextTile_;
+    bool                      success_;
+    Orthanc::ErrorCode        error_;
+
+    bool GetNextTile(unsigned int& tile)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (nextTile_ < countTiles_ &&
+          success_)
+      {
+        tile = nextTile_;
+        nextTile_++;
+        return true;
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    void SetError(Orthanc::ErrorCode error)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (success_)
+      {
+        success_ = false;
+        error_ = error;
+      }
+    }
+
+    void RenderTile(unsigned int tile)
+    {
+      const unsigned int x = (tile % countTilesX_) * tileSize_;
+      const unsigned int y = (tile / countTilesX_) * tileSize_;
+      const unsigned int width = std::min(tileSize_, canvas_.GetWidth() - x);
+      const unsigned int height = std::min(tileSize_, canvas_.GetHeight() - y);
+
+      if (that_.hasClip_ &&
+          (static_cast<double>(x + width) <= that_.clipExtent_.GetX1() ||
+           static_cast<double>(y + height) <= that_.clipExtent_.GetY1() ||
+           static_cast<double>(x) >= that_.clipExtent_.GetX2() ||
+           static_cast<double>(y) >= that_.clipExtent_.GetY2()))
+      {
+        return;  // This tile is not damaged
+      }
+
+      // The tile shares the memory buffer of the canvas
+      Orthanc::ImageAccessor region;
+      canvas_.GetRegion(region, x, y, width, height);
+
+      CairoSurface surface(region, false /* no alpha */);
+
+      {
+        TileContext context(that_.tileContext_, surface);
+
+        // Bring the origin of the canvas to the top-left corner of the tile
+        cairo_translate(context.GetObject(), -static_cast<double>(x), -static_cast<double>(y));
+        that_.ApplyClip(context.GetObject());
+
+        for (size_t i = 0; i < layers_.size(); i++)
+        {
+          assert(layers_[i] != NULL);
+          layers_[i]->Render(transform_, canvas_.GetWidth(), canvas_.GetHeight());
+        }
+      }
+
+      cairo_surface_flush(surface.GetObject());
+    }
+
+  public:
+    TilesRenderer(CairoCompositor& that,
+                  const Layers& layers,
+                  const AffineTransform2D& transform) :
+      that_(that),
+      layers_(layers),
+      transform_(transform),
+      tileSize_(that.tileSize_),
+      nextTile_(0),
+      success_(true),
+      error_(Orthanc::ErrorCode_Success)
+    {
+      assert(tileSize_ > 0);
+      that.canvas_.GetWriteableAccessor(canvas_);
+
+      countTilesX_ = (canvas_.GetWidth() + tileSize_ - 1) / tileSize_;
+      countTiles_ = countTilesX_ * ((canvas_.GetHeight() + tileSize_ - 1) / tileSize_);
+    }
+
+    // Renders the tiles until none is left, never throws
+    virtual void Process() ORTHANC_OVERRIDE
+    {
+      try
+      {
+        unsigned int tile;
+        while (GetNextTile(tile))
+        {
+          RenderTile(tile);
+        }
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        SetError(e.GetErrorCode());
+      }
+      catch (...)
+      {
+        SetError(Orthanc::ErrorCode_InternalError);
+      }
+    }
+
+    void CheckSuccess()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (!success_)
+      {
+        throw Orthanc::OrthancException(error_);
+      }
+    }
+  };
+
+
+  static bool IsTextureLayer(ISceneLayer::Type type)
+  {
+    return (type == ISceneLayer::Type_ColorTexture ||
+            type == ISceneLayer::Type_FloatTexture ||
+            type == ISceneLayer::Type_LookupTableTexture);
+  }
+#endif
+
+
   cairo_t* CairoCompositor::GetCairoContext()
   {
+#if ORTHANC_ENABLE_THREADS == 1
+    if (tileContext_.get() != NULL)
+    {
+      return tileContext_->GetObject();
+    }
+#endif
+
     if (context_.get() == NULL)
     {
       throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
@@ -96,7 +283,11 @@ namespace OrthancStone
 
 
   CairoCompositor::CairoCompositor(unsigned int canvasWidth,
-                                   unsigned int canvasHeight)
+                                   unsigned int canvasHeight) :
+    threadsCount_(1),
+    tileSize_(256),
+    incrementalRefresh_(false),
+    hasClip_(false)
   {
     ResetSceneInternal();
     canvas_.SetSize(canvasWidth, canvasHeight, false);
@@ -146,6 +337,44 @@ namespace OrthancStone
   }
     
 
+  void CairoCompositor::SetThreadsCount(unsigned int threadsCount)
+  {
+    if (threadsCount == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+#if ORTHANC_ENABLE_THREADS != 1
+    if (threadsCount > 1)
+    {
+      LOG(WARNING) << "Multithreading is not available, CairoCompositor will use a single thread";
+    }
+#endif
+
+#if ORTHANC_ENABLE_THREADS == 1
+    if (threadsCount != threadsCount_)
+    {
+      pool_.reset();  // The pool is started again by the next call to "Refresh()"
+    }
+#endif
+
+    threadsCount_ = threadsCount;
+  }
+
+
+  void CairoCompositor::SetTileSize(unsigned int size)
+  {
+    if (size == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      tileSize_ = size;
+    }
+  }
+
+
 #if ORTHANC_ENABLE_LOCALE == 1
   void CairoCompositor::SetFont(size_t index,
                                 const std::string& ttf,
@@ -163,14 +392,125 @@ namespace OrthancStone
 #endif
 
 
+  void CairoCompositor::ApplyClip(cairo_t* cr) const
+  {
+    if (hasClip_)
+    {
+      cairo_new_path(cr);
+
+      for (std::list< std::vector<ScenePoint2D> >::const_iterator
+             it = clip_.begin(); it != clip_.end(); ++it)
+      {
+        for (size_t i = 0; i < it->size(); i++)
+        {
+          if (i == 0)
+          {
+            cairo_move_to(cr, (*it)[i].GetX(), (*it)[i].GetY());
+          }
+          else
+          {
+            cairo_line_to(cr, (*it)[i].GetX(), (*it)[i].GetY());
+          }
+        }
+
+        cairo_close_path(cr);
+      }
+
+      // The contours of the holes are nested inside the outer contours
+      cairo_set_fill_rule(cr, CAIRO_FILL_RULE_EVEN_ODD);
+      cairo_clip(cr);
+      cairo_set_fill_rule(cr, CAIRO_FILL_RULE_WINDING);
+    }
+  }
+
+
   void CairoCompositor::Refresh(const Scene2D& scene)
   {
     context_.reset(new CairoContext(canvas_));
 
+    hasClip_ = false;
+    clip_.clear();
+
+    if (incrementalRefresh_)
+    {
+      std::list<Extent2D> regions;
+
+      if (helper_->ComputeDamagedRegions(regions, scene, canvas_.GetWidth(), canvas_.GetHeight()))
+      {
+        if (regions.empty())
+        {
+          // The canvas is up-to-date
+          context_.reset();
+          return;
+        }
+
+        // The damaged regions are aligned on the pixels: Clipping
+        // gives the same pixels as a full redraw
+        UnionOfRectangles::Apply(clip_, regions);
+
+        clipExtent_.Clear();
+        for (std::list<Extent2D>::const_iterator it = regions.begin(); it != regions.end(); ++it)
+        {
+          clipExtent_.Union(*it);
+        }
+
+        hasClip_ = true;
+        ApplyClip(context_->GetObject());
+      }
+    }
+
     // https://www.cairographics.org/FAQ/#clear_a_surface
     cairo_set_source_rgba(context_->GetObject(), 0, 0, 0, 255);
     cairo_paint(context_->GetObject());
 
+#if ORTHANC_ENABLE_THREADS == 1
+    if (threadsCount_ > 1)
+    {
+      std::vector<Internals::CompositorHelper::PreparedLayer> layers;
+      helper_->Prepare(layers, scene, canvas_.GetWidth(), canvas_.GetHeight());
+
+      const AffineTransform2D transform = helper_->GetSceneTransform();
+
+      size_t i = 0;
+      while (i < layers.size())
+      {
+        if (IsTextureLayer(layers[i].first))
+        {
+          // Consecutive texture layers are rendered together, tile by tile
+          std::vector<Internals::CompositorHelper::ILayerRenderer*> textures;
+
+          while (i < layers.size() &&
+                 IsTextureLayer(layers[i].first))
+          {
+            textures.push_back(layers[i].second);
+            i++;
+          }
+
+          cairo_surface_flush(canvas_.GetObject());
+
+          if (pool_.get() == NULL)
+          {
+            pool_.reset(new Internals::WorkersPool(threadsCount_ - 1));
+          }
+
+          TilesRenderer renderer(*this, textures, transform);
+          pool_->Run(renderer);
+          renderer.CheckSuccess();
+
+          cairo_surface_mark_dirty(canvas_.GetObject());
+        }
+        else
+        {
+          layers[i].second->Render(transform, canvas_.GetWidth(), canvas_.GetHeight());
+          i++;
+        }
+      }
+
+      context_.reset();
+      return;
+    }
+#endif
+
     helper_->Refresh(scene, canvas_.GetWidth(), canvas_.GetHeight());
     context_.reset();
   }
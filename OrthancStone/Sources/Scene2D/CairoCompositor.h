@@ -23,33 +23,73 @@
 
 #pragma once
 
+#if !defined(ORTHANC_ENABLE_THREADS)
+#  error The macro ORTHANC_ENABLE_THREADS must be defined
+#endif
+
 #include "ICompositor.h"
 #include "../Fonts/GlyphBitmapAlphabet.h"
 #include "../Wrappers/CairoContext.h"
 #include "Internals/CompositorHelper.h"
 #include "Internals/ICairoContextProvider.h"
 
+#include <list>
+
+#if ORTHANC_ENABLE_THREADS == 1
+#  include <boost/thread/tss.hpp>
+#endif
+
 namespace OrthancStone
 {
+#if ORTHANC_ENABLE_THREADS == 1
+  namespace Internals
+  {
+    class WorkersPool;
+  }
+#endif
+
   class CairoCompositor :
       public ICompositor,
       private Internals::CompositorHelper::IRendererFactory,
       private Internals::ICairoContextProvider
   {
   private:
+    class TilesRenderer;
+
     typedef std::map<size_t, GlyphBitmapAlphabet*>   Fonts;
 
     std::unique_ptr<Internals::CompositorHelper>  helper_;
     CairoSurface                 canvas_;
     Fonts                        fonts_;
+    unsigned int                 threadsCount_;
+    unsigned int                 tileSize_;
+    bool                         incrementalRefresh_;
 
     // Only valid during a call to "Refresh()"
     std::unique_ptr<CairoContext>  context_;
 
+    // Damaged regions of the canvas, only valid during an incremental
+    // call to "Refresh()"
+    bool                                     hasClip_;
+    std::list< std::vector<ScenePoint2D> >   clip_;
+    Extent2D                                 clipExtent_;
+
+#if ORTHANC_ENABLE_THREADS == 1
+    // Drawing context of the tile being rendered by the current thread
+    boost::thread_specific_ptr<CairoContext>  tileContext_;
+
+    // Threads rendering the tiles, kept alive across the calls to
+    // "Refresh()". Declared after "tileContext_", so that the threads
+    // are joined before the thread-specific storage is destroyed.
+    std::unique_ptr<Internals::WorkersPool>  pool_;
+#endif
+
     virtual cairo_t* GetCairoContext() ORTHANC_OVERRIDE;
 
     virtual Internals::CompositorHelper::ILayerRenderer* Create(const ISceneLayer& layer) ORTHANC_OVERRIDE;
 
+    void ApplyClip(cairo_t* cr) const;
+
     void ResetSceneInternal()
     {
       helper_.reset(new Internals::CompositorHelper(*this));
@@ -82,6 +122,48 @@ namespace OrthancStone
     void SetFont(size_t index,
                  GlyphBitmapAlphabet* dict); // Takes ownership
 
+    /**
+     * Tile-parallel rendering: The canvas is split into square tiles,
+     * onto which the texture layers are rendered by a pool of
+     * "threadsCount" threads. The other layers (polylines, texts...)
+     * are drawn on the full canvas by the calling thread, which
+     * preserves the order of the layers. By default, one single
+     * thread is used, which disables the tiles. The threads are
+     * started by the first call to "Refresh()", and are kept alive
+     * until the compositor is destroyed or the count is changed.
+     **/
+    void SetThreadsCount(unsigned int threadsCount);
+
+    unsigned int GetThreadsCount() const
+    {
+      return threadsCount_;
+    }
+
+    void SetTileSize(unsigned int size);
+
+    unsigned int GetTileSize() const
+    {
+      return tileSize_;
+    }
+
+    /**
+     * Incremental refresh: If neither the scene transform nor the
+     * size of the canvas has changed since the previous call to
+     * "Refresh()", only the regions of the canvas that are covered by
+     * the added, modified or removed layers are redrawn. These
+     * regions are derived from the bounding boxes and the revisions
+     * of the layers. Disabled by default.
+     **/
+    void SetIncrementalRefresh(bool enabled)
+    {
+      incrementalRefresh_ = enabled;
+    }
+
+    bool IsIncrementalRefresh() const
+    {
+      return incrementalRefresh_;
+    }
+
 #if ORTHANC_ENABLE_LOCALE == 1
     virtual void SetFont(size_t index,
                          const std::string& ttf,
@@ -36,7 +36,8 @@ namespace OrthancStone
     applyLog_(false),
     isRangeComputed_(false),
     minValue_(0),
-    maxValue_(0)
+    maxValue_(0),
+    integerOffset_(0)
   {
     {
       std::unique_ptr<Orthanc::ImageAccessor> t(
@@ -146,6 +147,120 @@ namespace OrthancStone
   }
 
 
+  template <typename T>
+  static void MapIntegerValues(std::vector<float>& values,
+                               int32_t offset,
+                               const Orthanc::ImageAccessor& source,
+                               const Orthanc::ImageAccessor& texture)
+  {
+    const unsigned int width = source.GetWidth();
+    const unsigned int height = source.GetHeight();
+
+    for (unsigned int y = 0; y < height; y++)
+    {
+      const T* p = reinterpret_cast<const T*>(source.GetConstRow(y));
+      const float* q = reinterpret_cast<const float*>(texture.GetConstRow(y));
+
+      for (unsigned int x = 0; x < width; x++, p++, q++)
+      {
+        const int32_t index = static_cast<int32_t>(*p) - offset;
+        assert(index >= 0 && index < static_cast<int32_t>(values.size()));
+        values[index] = *q;
+      }
+    }
+  }
+  
+
+  void FloatTextureSceneLayer::SetIntegerSource(const Orthanc::ImageAccessor& source)
+  {
+    const Orthanc::ImageAccessor& texture = GetTexture();
+
+    if (source.GetWidth() != texture.GetWidth() ||
+        source.GetHeight() != texture.GetHeight())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageSize);
+    }
+
+    std::unique_ptr<Orthanc::ImageAccessor> copy(Orthanc::Image::Clone(source));
+
+    int64_t minValue = 0;
+    int64_t maxValue = 0;
+    
+    if (source.GetWidth() != 0 &&
+        source.GetHeight() != 0)
+    {
+      Orthanc::ImageProcessing::GetMinMaxIntegerValue(minValue, maxValue, source);
+    }
+
+    assert(minValue <= maxValue);
+
+    const int32_t offset = static_cast<int32_t>(minValue);
+    std::vector<float> values(static_cast<size_t>(maxValue - minValue + 1), 0.0f);
+
+    switch (source.GetFormat())
+    {
+      case Orthanc::PixelFormat_Grayscale8:
+        MapIntegerValues<uint8_t>(values, offset, source, texture);
+        break;
+        
+      case Orthanc::PixelFormat_Grayscale16:
+        MapIntegerValues<uint16_t>(values, offset, source, texture);
+        break;
+        
+      case Orthanc::PixelFormat_SignedGrayscale16:
+        MapIntegerValues<int16_t>(values, offset, source, texture);
+        break;
+        
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageFormat);
+    }
+
+    integerSource_.reset(copy.release());
+    integerOffset_ = offset;
+    integerValues_.swap(values);
+    IncrementRevision();
+  }
+
+
+  const Orthanc::ImageAccessor& FloatTextureSceneLayer::GetIntegerSource() const
+  {
+    if (integerSource_.get() == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      return *integerSource_;
+    }
+  }
+
+
+  int32_t FloatTextureSceneLayer::GetIntegerSourceOffset() const
+  {
+    if (integerSource_.get() == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      return integerOffset_;
+    }
+  }
+
+
+  const std::vector<float>& FloatTextureSceneLayer::GetIntegerSourceValues() const
+  {
+    if (integerSource_.get() == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      return integerValues_;
+    }
+  }
+
+
   ISceneLayer* FloatTextureSceneLayer::Clone() const
   {
     std::unique_ptr<FloatTextureSceneLayer> cloned
@@ -161,6 +276,13 @@ namespace OrthancStone
     cloned->minValue_ = minValue_;
     cloned->maxValue_ = maxValue_;
 
+    if (integerSource_.get() != NULL)
+    {
+      cloned->integerSource_.reset(Orthanc::Image::Clone(*integerSource_));
+      cloned->integerOffset_ = integerOffset_;
+      cloned->integerValues_ = integerValues_;
+    }
+
     return cloned.release();
   }
 }
@@ -25,6 +25,8 @@
 
 #include "TextureBaseSceneLayer.h"
 
+#include <vector>
+
 namespace OrthancStone
 {
   class FloatTextureSceneLayer : public TextureBaseSceneLayer
@@ -39,6 +41,10 @@ namespace OrthancStone
     float            minValue_;
     float            maxValue_;
 
+    std::unique_ptr<Orthanc::ImageAccessor>  integerSource_;
+    int32_t                                  integerOffset_;
+    std::vector<float>                       integerValues_;
+
   public:
     // The pixel format must be convertible to "Float32"
     explicit FloatTextureSceneLayer(const Orthanc::ImageAccessor& texture);
@@ -76,6 +82,31 @@ namespace OrthancStone
     void GetRange(float& minValue,
                   float& maxValue);
 
+    /**
+     * Keeps the integer pixel data from which the float texture was
+     * computed (e.g. before applying the rescale slope/intercept of
+     * a DICOM instance). The format must be Grayscale8, Grayscale16
+     * or SignedGrayscale16. Each integer value must always be mapped
+     * to the same float value. This allows the renderers to apply the
+     * windowing through a lookup table indexed by the integer values,
+     * instead of processing each float pixel.
+     **/
+    void SetIntegerSource(const Orthanc::ImageAccessor& source);
+
+    bool HasIntegerSource() const
+    {
+      return integerSource_.get() != NULL;
+    }
+
+    const Orthanc::ImageAccessor& GetIntegerSource() const;
+
+    // Smallest integer value in the source
+    int32_t GetIntegerSourceOffset() const;
+
+    // Float value of the texture for each integer value of the
+    // source, starting at "GetIntegerSourceOffset()"
+    const std::vector<float>& GetIntegerSourceValues() const;
+
     virtual ISceneLayer* Clone() const ORTHANC_OVERRIDE;
 
     virtual Type GetType() const ORTHANC_OVERRIDE
@@ -25,46 +25,63 @@
 
 #include "CairoColorTextureRenderer.h"
 #include "../FloatTextureSceneLayer.h"
+#include "../../Toolbox/Internals/SimdFloat4.h"
+
+#include <OrthancException.h>
+
+#include <boost/noncopyable.hpp>
 
 namespace OrthancStone
 {
   namespace Internals
   {
-    void CairoFloatTextureRenderer::UpdateInternal(const ISceneLayer& layer)
+    namespace
     {
-      const FloatTextureSceneLayer& l = dynamic_cast<const FloatTextureSceneLayer&>(layer);
-
-      textureTransform_ = l.GetTransform();
-      isLinearInterpolation_ = l.IsLinearInterpolation();
+      class WindowingFunction : public boost::noncopyable
+      {
+      private:
+        float  low_;
+        float  slope_;
+        bool   applyLog_;
+        bool   inverted_;
 
-      float windowCenter, windowWidth;
-      l.GetWindowing(windowCenter, windowWidth);
+      public:
+        explicit WindowingFunction(const FloatTextureSceneLayer& layer) :
+          applyLog_(layer.IsApplyLog()),
+          inverted_(layer.IsInverted())
+        {
+          float windowCenter, windowWidth;
+          layer.GetWindowing(windowCenter, windowWidth);
 
-      const float a = windowCenter - windowWidth / 2.0f;
-      const float slope = 256.0f / windowWidth;
+          low_ = windowCenter - windowWidth / 2.0f;
+          slope_ = 256.0f / windowWidth;
+        }
 
-      const Orthanc::ImageAccessor& source = l.GetTexture();
-      const unsigned int width = source.GetWidth();
-      const unsigned int height = source.GetHeight();
-      texture_.SetSize(width, height, false);
+        float GetLow() const
+        {
+          return low_;
+        }
 
-      Orthanc::ImageAccessor target;
-      texture_.GetWriteableAccessor(target);
+        float GetSlope() const
+        {
+          return slope_;
+        }
 
-      assert(source.GetFormat() == Orthanc::PixelFormat_Float32 &&
-             target.GetFormat() == Orthanc::PixelFormat_BGRA32 &&
-             sizeof(float) == 4);
+        bool IsApplyLog() const
+        {
+          return applyLog_;
+        }
 
-      static const float LOG_NORMALIZATION = 255.0f / log(1.0f + 255.0f);
-      
-      for (unsigned int y = 0; y < height; y++)
-      {
-        const float* p = reinterpret_cast<const float*>(source.GetConstRow(y));
-        uint8_t* q = reinterpret_cast<uint8_t*>(target.GetRow(y));
+        bool IsInverted() const
+        {
+          return inverted_;
+        }
 
-        for (unsigned int x = 0; x < width; x++)
+        uint8_t Apply(float value) const
         {
-          float v = (*p - a) * slope;
+          static const float LOG_NORMALIZATION = 255.0f / log(1.0f + 255.0f);
+
+          float v = (value - low_) * slope_;
           if (v <= 0)
           {
             v = 0;
@@ -74,7 +91,7 @@ namespace OrthancStone
             v = 255;
           }
 
-          if (l.IsApplyLog())
+          if (applyLog_)
           {
             // https://theailearner.com/2019/01/01/log-transformation/
             v = LOG_NORMALIZATION * log(1.0f + static_cast<float>(v));
@@ -84,21 +101,166 @@ namespace OrthancStone
 
           uint8_t vv = static_cast<uint8_t>(v);
 
-          if (l.IsInverted())
+          if (inverted_)
           {
             vv = 255 - vv;
           }
 
+          return vv;
+        }
+      };
+    }
+
+
+    static void ApplyFloatWindowing(Orthanc::ImageAccessor& target,
+                                    const Orthanc::ImageAccessor& source,
+                                    const WindowingFunction& windowing)
+    {
+      assert(source.GetFormat() == Orthanc::PixelFormat_Float32 &&
+             target.GetFormat() == Orthanc::PixelFormat_BGRA32 &&
+             sizeof(float) == 4);
+
+      const unsigned int width = source.GetWidth();
+      const unsigned int height = source.GetHeight();
+
+      for (unsigned int y = 0; y < height; y++)
+      {
+        const float* p = reinterpret_cast<const float*>(source.GetConstRow(y));
+        uint8_t* q = reinterpret_cast<uint8_t*>(target.GetRow(y));
+
+        unsigned int x = 0;
+
+#if ORTHANC_STONE_HAS_SIMD == 1
+        if (!windowing.IsApplyLog())
+        {
+          // Same order of operations as "WindowingFunction::Apply()", hence
+          // the same results
+          const Internals::Simd::Float4 low = Internals::Simd::Splat(windowing.GetLow());
+          const Internals::Simd::Float4 slope = Internals::Simd::Splat(windowing.GetSlope());
+          const Internals::Simd::Float4 zero = Internals::Simd::Splat(0.0f);
+          const Internals::Simd::Float4 maximum = Internals::Simd::Splat(255.0f);
+          const uint8_t mask = (windowing.IsInverted() ? 255 : 0);
+
+          for (; x + 4 <= width; x += 4, p += 4, q += 16)
+          {
+            Internals::Simd::Float4 v = Internals::Simd::Mul(Internals::Simd::Sub(Internals::Simd::Load(p), low), slope);
+            v = Internals::Simd::Min(Internals::Simd::Max(v, zero), maximum);
+
+            int32_t values[4];
+            Internals::Simd::Floor(values, v);
+
+            for (unsigned int i = 0; i < 4; i++)
+            {
+              // "255 - vv" is the same as "vv ^ 255"
+              const uint8_t vv = static_cast<uint8_t>(values[i]) ^ mask;
+              q[4 * i] = vv;
+              q[4 * i + 1] = vv;
+              q[4 * i + 2] = vv;
+            }
+          }
+        }
+#endif
+
+        for (; x < width; x++, p++, q += 4)
+        {
+          const uint8_t vv = windowing.Apply(*p);
           q[0] = vv;
           q[1] = vv;
           q[2] = vv;
+        }
+      }
+    }
+
+
+    template <typename T>
+    static void ApplyLookupTable(Orthanc::ImageAccessor& target,
+                                 const Orthanc::ImageAccessor& source,
+                                 const std::vector<uint8_t>& lookupTable,
+                                 int32_t offset)
+    {
+      assert(target.GetFormat() == Orthanc::PixelFormat_BGRA32);
+
+      const unsigned int width = source.GetWidth();
+      const unsigned int height = source.GetHeight();
 
-          p++;
-          q += 4;
+      for (unsigned int y = 0; y < height; y++)
+      {
+        const T* p = reinterpret_cast<const T*>(source.GetConstRow(y));
+        uint8_t* q = reinterpret_cast<uint8_t*>(target.GetRow(y));
+
+        for (unsigned int x = 0; x < width; x++, p++, q += 4)
+        {
+          const int32_t index = static_cast<int32_t>(*p) - offset;
+          assert(index >= 0 && index < static_cast<int32_t>(lookupTable.size()));
+
+          const uint8_t vv = lookupTable[index];
+          q[0] = vv;
+          q[1] = vv;
+          q[2] = vv;
         }
       }
     }
 
+
+    void CairoFloatTextureRenderer::UpdateInternal(const ISceneLayer& layer)
+    {
+      const FloatTextureSceneLayer& l = dynamic_cast<const FloatTextureSceneLayer&>(layer);
+
+      textureTransform_ = l.GetTransform();
+      isLinearInterpolation_ = l.IsLinearInterpolation();
+
+      const WindowingFunction windowing(l);
+
+      const Orthanc::ImageAccessor& source = l.GetTexture();
+      texture_.SetSize(source.GetWidth(), source.GetHeight(), false);
+
+      Orthanc::ImageAccessor target;
+      texture_.GetWriteableAccessor(target);
+
+      if (l.HasIntegerSource())
+      {
+        /**
+         * The texture comes from integer pixel data (typically, a
+         * DICOM instance with 8 or 16 bits per pixel): The windowing
+         * (including the log transform and the inversion) is only
+         * computed once per integer value, then applied through a
+         * lookup table.
+         **/
+        const std::vector<float>& values = l.GetIntegerSourceValues();
+        lookupTable_.resize(values.size());
+
+        for (size_t i = 0; i < values.size(); i++)
+        {
+          lookupTable_[i] = windowing.Apply(values[i]);
+        }
+
+        const Orthanc::ImageAccessor& integerSource = l.GetIntegerSource();
+        const int32_t offset = l.GetIntegerSourceOffset();
+
+        switch (integerSource.GetFormat())
+        {
+          case Orthanc::PixelFormat_Grayscale8:
+            ApplyLookupTable<uint8_t>(target, integerSource, lookupTable_, offset);
+            break;
+
+          case Orthanc::PixelFormat_Grayscale16:
+            ApplyLookupTable<uint16_t>(target, integerSource, lookupTable_, offset);
+            break;
+
+          case Orthanc::PixelFormat_SignedGrayscale16:
+            ApplyLookupTable<int16_t>(target, integerSource, lookupTable_, offset);
+            break;
+
+          default:
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        }
+      }
+      else
+      {
+        ApplyFloatWindowing(target, source, windowing);
+      }
+    }
+
       
     void CairoFloatTextureRenderer::Render(const AffineTransform2D& transform,
                                            unsigned int canvasWidth,
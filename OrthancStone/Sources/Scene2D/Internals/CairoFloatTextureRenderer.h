@@ -27,6 +27,8 @@
 #include "CompositorHelper.h"
 #include "ICairoContextProvider.h"
 
+#include <vector>
+
 namespace OrthancStone
 {
   namespace Internals
@@ -38,6 +40,7 @@ namespace OrthancStone
       CairoSurface            texture_;
       AffineTransform2D       textureTransform_;
       bool                    isLinearInterpolation_;
+      std::vector<uint8_t>    lookupTable_;  // Windowing of the integer sources
     
       void UpdateInternal(const ISceneLayer& layer);
 
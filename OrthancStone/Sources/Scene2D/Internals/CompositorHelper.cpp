@@ -23,8 +23,17 @@
 
 #include "CompositorHelper.h"
 
+#include "../ArrowSceneLayer.h"
+#include "../MacroSceneLayer.h"
+#include "../TextureBaseSceneLayer.h"
+#include "../PolylineSceneLayer.h"
+
 #include <OrthancException.h>
 
+#include <algorithm>
+#include <cmath>
+#include <set>
+
 namespace OrthancStone
 {
   namespace Internals
@@ -36,15 +45,21 @@ namespace OrthancStone
       const ISceneLayer&             layer_;
       uint64_t                       layerIdentifier_;
       uint64_t                       lastRevision_;
+      uint64_t                       generation_;
+      bool                           hasCanvasExtent_;
+      Extent2D                       canvasExtent_;   // Footprint of the last rendering
 
     public:
       Item(ILayerRenderer* renderer,     // Takes ownership
            const ISceneLayer& layer,
-           uint64_t layerIdentifier) :
+           uint64_t layerIdentifier,
+           uint64_t generation) :
         renderer_(renderer),
         layer_(layer),
         layerIdentifier_(layerIdentifier),
-        lastRevision_(layer.GetRevision())
+        lastRevision_(layer.GetRevision()),
+        generation_(generation),
+        hasCanvasExtent_(false)
       {
         if (renderer == NULL)
         {
@@ -52,6 +67,31 @@ namespace OrthancStone
         }
       }
 
+      uint64_t GetGeneration() const
+      {
+        return generation_;
+      }
+
+      void SetGeneration(uint64_t generation)
+      {
+        generation_ = generation;
+      }
+
+      void UpdateCanvasExtent(const AffineTransform2D& sceneTransform)
+      {
+        hasCanvasExtent_ = ComputeCanvasExtent(canvasExtent_, layer_, sceneTransform);
+      }
+
+      bool HasCanvasExtent() const
+      {
+        return hasCanvasExtent_;
+      }
+
+      const Extent2D& GetCanvasExtent() const
+      {
+        return canvasExtent_;
+      }
+
       ILayerRenderer& GetRenderer() const
       {
         assert(renderer_.get() != NULL);
@@ -82,6 +122,134 @@ namespace OrthancStone
     };
 
 
+    static bool IsSameTransform(const AffineTransform2D& a,
+                                const AffineTransform2D& b)
+    {
+      const Matrix& ma = a.GetHomogeneousMatrix();
+      const Matrix& mb = b.GetHomogeneousMatrix();
+
+      for (unsigned int i = 0; i < 3; i++)
+      {
+        for (unsigned int j = 0; j < 3; j++)
+        {
+          if (ma(i, j) != mb(i, j))
+          {
+            return false;
+          }
+        }
+      }
+
+      return true;
+    }
+
+
+    class CompositorHelper::DamageVisitor : public Scene2D::IVisitor
+    {
+    private:
+      const CompositorHelper&   that_;
+      const AffineTransform2D&  sceneTransform_;
+      std::list<Extent2D>&      target_;
+      std::set<int>             visitedDepths_;
+      bool                      isFullRedraw_;
+
+      void AddItem(const Item& item)
+      {
+        if (item.HasCanvasExtent())
+        {
+          target_.push_back(item.GetCanvasExtent());
+        }
+        else
+        {
+          isFullRedraw_ = true;
+        }
+      }
+
+      void AddLayer(const ISceneLayer& layer)
+      {
+        Extent2D extent;
+        if (ComputeCanvasExtent(extent, layer, sceneTransform_))
+        {
+          target_.push_back(extent);
+        }
+        else
+        {
+          isFullRedraw_ = true;
+        }
+      }
+
+    public:
+      DamageVisitor(const CompositorHelper& that,
+                    const AffineTransform2D& sceneTransform,
+                    std::list<Extent2D>& target) :
+        that_(that),
+        sceneTransform_(sceneTransform),
+        target_(target),
+        isFullRedraw_(false)
+      {
+      }
+
+      virtual void Visit(const Scene2D& scene,
+                         const ISceneLayer& layer,
+                         uint64_t layerIdentifier,
+                         int depth) ORTHANC_OVERRIDE
+      {
+        visitedDepths_.insert(depth);
+
+        Content::const_iterator found = that_.content_.find(depth);
+
+        if (found == that_.content_.end())
+        {
+          // New layer
+          AddLayer(layer);
+        }
+        else
+        {
+          assert(found->second != NULL);
+
+          if (found->second->GetLayerIdentifier() != layerIdentifier ||
+              found->second->GetLastRevision() < layer.GetRevision())
+          {
+            // Replaced or modified layer: Both its previous and its
+            // new footprints are damaged
+            AddItem(*found->second);
+            AddLayer(layer);
+          }
+        }
+      }
+
+      void AddRemovedLayers()
+      {
+        for (Content::const_iterator it = that_.content_.begin(); it != that_.content_.end(); ++it)
+        {
+          if (visitedDepths_.find(it->first) == visitedDepths_.end())
+          {
+            assert(it->second != NULL);
+            AddItem(*it->second);
+          }
+        }
+      }
+
+      bool IsFullRedraw() const
+      {
+        return isFullRedraw_;
+      }
+    };
+
+
+    void CompositorHelper::RenderLayer(ILayerRenderer& renderer,
+                                       const ISceneLayer& layer)
+    {
+      if (prepared_ == NULL)
+      {
+        renderer.Render(sceneTransform_, canvasWidth_, canvasHeight_);
+      }
+      else
+      {
+        prepared_->push_back(std::make_pair(layer.GetType(), &renderer));
+      }
+    }
+
+
     void CompositorHelper::Visit(const Scene2D& scene,
                                  const ISceneLayer& layer,
                                  uint64_t layerIdentifier,
@@ -112,8 +280,11 @@ namespace OrthancStone
 
         if (renderer.get() != NULL)
         {
-          renderer->Render(sceneTransform_, canvasWidth_, canvasHeight_);
-          content_[depth] = new Item(renderer.release(), layer, layerIdentifier);
+          ILayerRenderer& r = *renderer;
+          Item* item = new Item(renderer.release(), layer, layerIdentifier, generation_);
+          content_[depth] = item;
+          item->UpdateCanvasExtent(sceneTransform_);
+          RenderLayer(r, layer);
         }
       }
       else
@@ -124,9 +295,15 @@ namespace OrthancStone
         if (found->second->GetLastRevision() < layer.GetRevision())
         {
           found->second->UpdateRenderer();
+          found->second->UpdateCanvasExtent(sceneTransform_);
+        }
+        else if (sceneTransformChanged_)
+        {
+          found->second->UpdateCanvasExtent(sceneTransform_);
         }
 
-        found->second->GetRenderer().Render(sceneTransform_, canvasWidth_, canvasHeight_);
+        found->second->SetGeneration(generation_);
+        RenderLayer(found->second->GetRenderer(), layer);
       }
 
       // Check invariants
@@ -146,9 +323,22 @@ namespace OrthancStone
     }
 
   
-    void CompositorHelper::Refresh(const Scene2D& scene,
-                                   unsigned int canvasWidth,
-                                   unsigned int canvasHeight)
+    AffineTransform2D CompositorHelper::ComputeSceneTransform(const Scene2D& scene,
+                                                              unsigned int canvasWidth,
+                                                              unsigned int canvasHeight)
+    {
+      // Bring coordinate (0,0) to the center of the canvas
+      AffineTransform2D offset = AffineTransform2D::CreateOffset(
+        static_cast<double>(canvasWidth) / 2.0,
+        static_cast<double>(canvasHeight) / 2.0);
+
+      return AffineTransform2D::Combine(offset, scene.GetSceneToCanvasTransform());
+    }
+
+
+    void CompositorHelper::ApplyScene(const Scene2D& scene,
+                                      unsigned int canvasWidth,
+                                      unsigned int canvasHeight)
     {
       /**
        * Safeguard mechanism to enforce the fact that the same scene
@@ -163,17 +353,239 @@ namespace OrthancStone
                                         "ICompositor::ResetScene() should have been called");
       }
 
-      lastScene_ = &scene;
+      const AffineTransform2D sceneTransform = ComputeSceneTransform(scene, canvasWidth, canvasHeight);
 
-      // Bring coordinate (0,0) to the center of the canvas
-      AffineTransform2D offset = AffineTransform2D::CreateOffset(
-        static_cast<double>(canvasWidth) / 2.0,
-        static_cast<double>(canvasHeight) / 2.0);
+      sceneTransformChanged_ = (lastScene_ == NULL ||
+                                canvasWidth_ != canvasWidth ||
+                                canvasHeight_ != canvasHeight ||
+                                !IsSameTransform(sceneTransform_, sceneTransform));
 
-      sceneTransform_ = AffineTransform2D::Combine(offset, scene.GetSceneToCanvasTransform());
+      lastScene_ = &scene;
+      sceneTransform_ = sceneTransform;
       canvasWidth_ = canvasWidth;
       canvasHeight_ = canvasHeight;
+      generation_++;
+
       scene.Apply(*this);
+
+      // Forget about the layers that have been removed from the scene
+      Content::iterator it = content_.begin();
+      while (it != content_.end())
+      {
+        assert(it->second != NULL);
+
+        if (it->second->GetGeneration() == generation_)
+        {
+          ++it;
+        }
+        else
+        {
+          delete it->second;
+          content_.erase(it++);
+        }
+      }
+    }
+
+
+    void CompositorHelper::Refresh(const Scene2D& scene,
+                                   unsigned int canvasWidth,
+                                   unsigned int canvasHeight)
+    {
+      prepared_ = NULL;
+      ApplyScene(scene, canvasWidth, canvasHeight);
+    }
+
+
+    void CompositorHelper::Prepare(std::vector<PreparedLayer>& target,
+                                   const Scene2D& scene,
+                                   unsigned int canvasWidth,
+                                   unsigned int canvasHeight)
+    {
+      target.clear();
+
+      try
+      {
+        prepared_ = &target;
+        ApplyScene(scene, canvasWidth, canvasHeight);
+        prepared_ = NULL;
+      }
+      catch (...)
+      {
+        prepared_ = NULL;
+        throw;
+      }
+    }
+
+
+    bool CompositorHelper::ComputeDamagedRegions(std::list<Extent2D>& target,
+                                                 const Scene2D& scene,
+                                                 unsigned int canvasWidth,
+                                                 unsigned int canvasHeight) const
+    {
+      target.clear();
+
+      if (lastScene_ != &scene ||
+          canvasWidth_ != canvasWidth ||
+          canvasHeight_ != canvasHeight)
+      {
+        return false;
+      }
+
+      const AffineTransform2D sceneTransform = ComputeSceneTransform(scene, canvasWidth, canvasHeight);
+      if (!IsSameTransform(sceneTransform_, sceneTransform))
+      {
+        return false;
+      }
+
+      std::list<Extent2D> damaged;
+
+      DamageVisitor visitor(*this, sceneTransform, damaged);
+      scene.Apply(visitor);
+      visitor.AddRemovedLayers();
+
+      if (visitor.IsFullRedraw())
+      {
+        return false;
+      }
+
+      // Restrict the damaged regions to the canvas
+      for (std::list<Extent2D>::const_iterator it = damaged.begin(); it != damaged.end(); ++it)
+      {
+        Extent2D region(std::max(0.0, it->GetX1()),
+                        std::max(0.0, it->GetY1()),
+                        std::min(static_cast<double>(canvasWidth), it->GetX2()),
+                        std::min(static_cast<double>(canvasHeight), it->GetY2()));
+
+        if (region.GetX1() < region.GetX2() &&
+            region.GetY1() < region.GetY2())
+        {
+          target.push_back(region);
+        }
+      }
+
+      return true;
+    }
+
+
+    bool CompositorHelper::ComputeCanvasExtent(Extent2D& target,
+                                               const ISceneLayer& layer,
+                                               const AffineTransform2D& sceneTransform)
+    {
+      // Margin (in pixels) for the antialiasing
+      double margin = 2;
+
+      AffineTransform2D transform;
+      double x1, y1, x2, y2;
+
+      switch (layer.GetType())
+      {
+        case ISceneLayer::Type_NullLayer:
+          target.Clear();
+          return true;
+
+        case ISceneLayer::Type_ColorTexture:
+        case ISceneLayer::Type_FloatTexture:
+        case ISceneLayer::Type_LookupTableTexture:
+        {
+          // Add one texel around the texture, as the bilinear
+          // interpolation spreads the borders of the texture
+          const TextureBaseSceneLayer& texture = dynamic_cast<const TextureBaseSceneLayer&>(layer);
+          transform = AffineTransform2D::Combine(sceneTransform, texture.GetTransform());
+          x1 = -1;
+          y1 = -1;
+          x2 = static_cast<double>(texture.GetTexture().GetWidth()) + 1;
+          y2 = static_cast<double>(texture.GetTexture().GetHeight()) + 1;
+          break;
+        }
+
+        case ISceneLayer::Type_Polyline:
+        case ISceneLayer::Type_Arrow:
+        {
+          Extent2D box;
+          layer.GetBoundingBox(box);
+          transform = sceneTransform;
+          x1 = box.GetX1();
+          y1 = box.GetY1();
+          x2 = box.GetX2();
+          y2 = box.GetY2();
+
+          /**
+           * The thickness of the lines is expressed in pixels. The
+           * miter joins of Cairo extend up to half the miter limit
+           * (whose default value is 10) times the thickness.
+           **/
+          if (layer.GetType() == ISceneLayer::Type_Polyline)
+          {
+            margin += 5.0 * dynamic_cast<const PolylineSceneLayer&>(layer).GetThickness();
+          }
+          else
+          {
+            const ArrowSceneLayer& arrow = dynamic_cast<const ArrowSceneLayer&>(layer);
+            margin += arrow.GetArrowLength() + 5.0 * arrow.GetThickness();
+          }
+          break;
+        }
+
+        case ISceneLayer::Type_Macro:
+        {
+          const MacroSceneLayer& macro = dynamic_cast<const MacroSceneLayer&>(layer);
+
+          target.Clear();
+
+          for (size_t i = 0; i < macro.GetSize(); i++)
+          {
+            if (macro.HasLayer(i))
+            {
+              Extent2D extent;
+              if (ComputeCanvasExtent(extent, macro.GetLayer(i), sceneTransform))
+              {
+                target.Union(extent);
+              }
+              else
+              {
+                return false;
+              }
+            }
+          }
+
+          return true;
+        }
+
+        default:
+          // The footprint of texts and info panels is not known
+          return false;
+      }
+
+      Extent2D extent;
+
+      double x, y;
+
+      x = x1;
+      y = y1;
+      transform.Apply(x, y);
+      extent.AddPoint(x, y);
+
+      x = x2;
+      y = y1;
+      transform.Apply(x, y);
+      extent.AddPoint(x, y);
+
+      x = x1;
+      y = y2;
+      transform.Apply(x, y);
+      extent.AddPoint(x, y);
+
+      x = x2;
+      y = y2;
+      transform.Apply(x, y);
+      extent.AddPoint(x, y);
+
+      // Align on the pixels, as required to clip the rendering
+      target = Extent2D(floor(extent.GetX1() - margin),
+                        floor(extent.GetY1() - margin),
+                        ceil(extent.GetX2() + margin),
+                        ceil(extent.GetY2() + margin));
+      return true;
     }
   }
 }
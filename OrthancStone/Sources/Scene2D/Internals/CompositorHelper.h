@@ -29,7 +29,9 @@
 #include <Compatibility.h>  // For ORTHANC_OVERRIDE
 
 #include <boost/noncopyable.hpp>
+#include <list>
 #include <map>
+#include <vector>
 
 namespace OrthancStone
 {
@@ -63,20 +65,39 @@ namespace OrthancStone
         virtual ILayerRenderer* Create(const ISceneLayer& layer) = 0;
       };
 
+      // Renderer of a layer, together with the type of this layer
+      typedef std::pair<ISceneLayer::Type, ILayerRenderer*>  PreparedLayer;
+
     private:
       class Item;
+      class DamageVisitor;
 
       typedef std::map<int, Item*>  Content;
 
       IRendererFactory&  factory_;
       Content            content_;
       const Scene2D*     lastScene_;   // This is only a safeguard, don't use it!
+      uint64_t           generation_;  // Number of calls to "ApplyScene()"
 
       // Only valid during a call to Refresh()
       AffineTransform2D  sceneTransform_;
       unsigned int       canvasWidth_;
       unsigned int       canvasHeight_;
+      bool               sceneTransformChanged_;
+      std::vector<PreparedLayer>*  prepared_;  // If NULL, render the layers immediately
       
+      void RenderLayer(ILayerRenderer& renderer,
+                       const ISceneLayer& layer);
+
+      void ApplyScene(const Scene2D& scene,
+                      unsigned int canvasWidth,
+                      unsigned int canvasHeight);
+
+      static AffineTransform2D ComputeSceneTransform(const Scene2D& scene,
+                                                     unsigned int canvasWidth,
+                                                     unsigned int canvasHeight);
+
+
     protected:
       virtual void Visit(const Scene2D& scene,
                          const ISceneLayer& layer,
@@ -87,8 +108,11 @@ namespace OrthancStone
       explicit CompositorHelper(IRendererFactory& factory) :
         factory_(factory),
         lastScene_(NULL),
+        generation_(0),
         canvasWidth_(0),
-        canvasHeight_(0)
+        canvasHeight_(0),
+        sceneTransformChanged_(true),
+        prepared_(NULL)
       {
       }
 
@@ -97,6 +121,50 @@ namespace OrthancStone
       void Refresh(const Scene2D& scene,
                    unsigned int canvasWidth,
                    unsigned int canvasHeight);
+
+      /**
+       * Same as "Refresh()", but the layers are not rendered: Their
+       * up-to-date renderers are listed by increasing depth, and the
+       * caller is responsible for rendering them using
+       * "GetSceneTransform()". This allows a compositor to change
+       * the way (or the order) the layers are drawn onto the canvas,
+       * while keeping the renderers cached by the helper.
+       **/
+      void Prepare(std::vector<PreparedLayer>& target,
+                   const Scene2D& scene,
+                   unsigned int canvasWidth,
+                   unsigned int canvasHeight);
+
+      // Only valid after a call to "Refresh()" or "Prepare()"
+      const AffineTransform2D& GetSceneTransform() const
+      {
+        return sceneTransform_;
+      }
+
+      /**
+       * Computes the regions of the canvas that have changed since the
+       * last call to "Refresh()" or "Prepare()", according to the
+       * bounding boxes and the revisions of the layers. The regions
+       * are rectangles in canvas coordinates, aligned on the pixels.
+       * An empty list means that the canvas is up-to-date. Returns
+       * "false" if the whole canvas must be redrawn: first rendering,
+       * change in the size of the canvas or in the scene transform,
+       * or change in a layer whose footprint on the canvas is unknown
+       * (such as texts and info panels).
+       **/
+      bool ComputeDamagedRegions(std::list<Extent2D>& target,
+                                 const Scene2D& scene,
+                                 unsigned int canvasWidth,
+                                 unsigned int canvasHeight) const;
+
+      /**
+       * Computes the rectangle of the canvas that is covered by the
+       * given layer, taking into account the thickness of the lines
+       * and the antialiasing. Returns "false" if it is unknown.
+       **/
+      static bool ComputeCanvasExtent(Extent2D& target,
+                                      const ISceneLayer& layer,
+                                      const AffineTransform2D& sceneTransform);
     };
   }
 }
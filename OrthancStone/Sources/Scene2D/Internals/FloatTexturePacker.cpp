@@ -0,0 +1,299 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "FloatTexturePacker.h"
+
+#include "../../Toolbox/Internals/ParallelRows.h"
+#include "../../Toolbox/Internals/SimdFloat4.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+namespace OrthancStone
+{
+  namespace Internals
+  {
+    // Anonymous namespace to avoid clashes between compilation modules
+    namespace
+    {
+      class RangeKernel
+      {
+      private:
+        float  minValue_;
+        float  maxValue_;
+
+      public:
+        RangeKernel() :
+          minValue_(std::numeric_limits<float>::infinity()),
+          maxValue_(-std::numeric_limits<float>::infinity())
+        {
+        }
+
+        RangeKernel* CloneEmpty() const
+        {
+          return new RangeKernel;
+        }
+
+        void Process(const Orthanc::ImageAccessor& source,
+                     unsigned int firstRow,
+                     unsigned int lastRow)
+        {
+          const unsigned int width = source.GetWidth();
+
+#if ORTHANC_STONE_HAS_SIMD == 1
+          Simd::Float4 low = Simd::Splat(minValue_);
+          Simd::Float4 high = Simd::Splat(maxValue_);
+#endif
+
+          for (unsigned int y = firstRow; y < lastRow; y++)
+          {
+            const float* p = reinterpret_cast<const float*>(source.GetConstRow(y));
+            unsigned int x = 0;
+
+#if ORTHANC_STONE_HAS_SIMD == 1
+            for (; x + 4 <= width; x += 4, p += 4)
+            {
+              const Simd::Float4 v = Simd::Load(p);
+              low = Simd::Min(v, low);
+              high = Simd::Max(v, high);
+            }
+#endif
+
+            for (; x < width; x++, p++)
+            {
+              if (*p < minValue_)
+              {
+                minValue_ = *p;
+              }
+
+              if (*p > maxValue_)
+              {
+                maxValue_ = *p;
+              }
+            }
+          }
+
+#if ORTHANC_STONE_HAS_SIMD == 1
+          float lanes[4];
+
+          Simd::Store(lanes, low);
+          minValue_ = std::min(minValue_, *std::min_element(lanes, lanes + 4));
+
+          Simd::Store(lanes, high);
+          maxValue_ = std::max(maxValue_, *std::max_element(lanes, lanes + 4));
+#endif
+        }
+
+        void Merge(const RangeKernel& other)
+        {
+          minValue_ = std::min(minValue_, other.minValue_);
+          maxValue_ = std::max(maxValue_, other.maxValue_);
+        }
+
+        void GetRange(float& minValue,
+                      float& maxValue) const
+        {
+          if (minValue_ <= maxValue_)
+          {
+            minValue = minValue_;
+            maxValue = maxValue_;
+          }
+          else
+          {
+            // Empty texture
+            minValue = 0;
+            maxValue = 0;
+          }
+        }
+      };
+
+
+      class QuantizeKernel
+      {
+      private:
+        Orthanc::ImageAccessor&  target_;
+        float                    offset_;
+        float                    scale_;
+
+        template <bool IsPacked>
+        static void Store(uint8_t* q,
+                          unsigned int x,
+                          uint16_t value)
+        {
+          if (IsPacked)
+          {
+            q[3 * x] = static_cast<uint8_t>(value >> 8);   // red
+            q[3 * x + 1] = static_cast<uint8_t>(value & 0xff);  // green
+            q[3 * x + 2] = 0;  // blue is unused
+          }
+          else
+          {
+            reinterpret_cast<uint16_t*>(q)[x] = value;
+          }
+        }
+
+        template <bool IsPacked>
+        void ProcessRows(const Orthanc::ImageAccessor& source,
+                         unsigned int firstRow,
+                         unsigned int lastRow) const
+        {
+          const unsigned int width = source.GetWidth();
+
+          for (unsigned int y = firstRow; y < lastRow; y++)
+          {
+            const float* p = reinterpret_cast<const float*>(source.GetConstRow(y));
+            uint8_t* q = reinterpret_cast<uint8_t*>(target_.GetRow(y));
+            unsigned int x = 0;
+
+#if ORTHANC_STONE_HAS_SIMD == 1
+            // Same order of operations as "QuantizeValue()", hence the
+            // same results
+            const Simd::Float4 offset = Simd::Splat(offset_);
+            const Simd::Float4 scale = Simd::Splat(scale_);
+            const Simd::Float4 zero = Simd::Splat(0.0f);
+            const Simd::Float4 maximum = Simd::Splat(65535.0f);
+
+            for (; x + 4 <= width; x += 4, p += 4)
+            {
+              Simd::Float4 v = Simd::Mul(Simd::Sub(Simd::Load(p), offset), scale);
+              v = Simd::Min(Simd::Max(v, zero), maximum);
+
+              int32_t values[4];
+              Simd::Floor(values, v);
+
+              for (unsigned int i = 0; i < 4; i++)
+              {
+                Store<IsPacked>(q, x + i, static_cast<uint16_t>(values[i]));
+              }
+            }
+#endif
+
+            for (; x < width; x++, p++)
+            {
+              Store<IsPacked>(q, x, FloatTexturePacker::QuantizeValue(*p, offset_, scale_));
+            }
+          }
+        }
+
+      public:
+        QuantizeKernel(Orthanc::ImageAccessor& target,
+                       float offset,
+                       float scale) :
+          target_(target),
+          offset_(offset),
+          scale_(scale)
+        {
+        }
+
+        QuantizeKernel* CloneEmpty() const
+        {
+          // The bands write to distinct rows of the same target
+          return new QuantizeKernel(target_, offset_, scale_);
+        }
+
+        void Process(const Orthanc::ImageAccessor& source,
+                     unsigned int firstRow,
+                     unsigned int lastRow)
+        {
+          if (target_.GetFormat() == Orthanc::PixelFormat_RGB24)
+          {
+            ProcessRows<true>(source, firstRow, lastRow);
+          }
+          else
+          {
+            assert(target_.GetFormat() == Orthanc::PixelFormat_Grayscale16);
+            ProcessRows<false>(source, firstRow, lastRow);
+          }
+        }
+
+        void Merge(const QuantizeKernel& /* other */)
+        {
+          // Nothing to merge, as the bands write to distinct rows
+        }
+      };
+    }
+
+
+    FloatTexturePacker::FloatTexturePacker(const Orthanc::ImageAccessor& source) :
+      source_(source),
+      threadsCount_(1)
+    {
+      if (source.GetFormat() != Orthanc::PixelFormat_Float32)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageFormat);
+      }
+    }
+
+
+    void FloatTexturePacker::SetThreadsCount(unsigned int count)
+    {
+      if (count == 0)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+
+#if ORTHANC_ENABLE_THREADS != 1
+      if (count > 1)
+      {
+        LOG(WARNING) << "Multithreading is not available, FloatTexturePacker will use a single thread";
+      }
+#endif
+
+      threadsCount_ = count;
+    }
+
+
+    void FloatTexturePacker::GetRange(float& minValue,
+                                      float& maxValue) const
+    {
+      RangeKernel kernel;
+      ParallelRows::Apply(kernel, source_, threadsCount_);
+      kernel.GetRange(minValue, maxValue);
+    }
+
+
+    void FloatTexturePacker::Quantize(Orthanc::ImageAccessor& target,
+                                      float offset,
+                                      float scale) const
+    {
+      if (target.GetFormat() != Orthanc::PixelFormat_RGB24 &&
+          target.GetFormat() != Orthanc::PixelFormat_Grayscale16)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageFormat);
+      }
+
+      if (target.GetWidth() != source_.GetWidth() ||
+          target.GetHeight() != source_.GetHeight())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageSize);
+      }
+
+      QuantizeKernel kernel(target, offset, scale);
+      ParallelRows::Apply(kernel, source_, threadsCount_);
+    }
+  }
+}
@@ -0,0 +1,100 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <Images/ImageAccessor.h>
+
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+
+namespace OrthancStone
+{
+  namespace Internals
+  {
+    /**
+     * Converts a Float32 texture into 16bit values, in order to
+     * upload it to OpenGL contexts that have no support for floating
+     * point textures. Each value is quantized as "(value - offset) *
+     * scale", clamped to the [0, 65535] range, then rounded down. The
+     * scans use 4-wide SIMD instructions if available, and the rows
+     * of large textures can be split into bands that are processed
+     * by separate threads.
+     *
+     * The texture is not copied: It must stay alive as long as this
+     * object is used.
+     **/
+    class FloatTexturePacker : public boost::noncopyable
+    {
+    private:
+      const Orthanc::ImageAccessor&  source_;
+      unsigned int                   threadsCount_;
+
+    public:
+      explicit FloatTexturePacker(const Orthanc::ImageAccessor& source);
+
+      unsigned int GetThreadsCount() const
+      {
+        return threadsCount_;
+      }
+
+      void SetThreadsCount(unsigned int count);
+
+      // Returns (0, 0) if the texture is empty
+      void GetRange(float& minValue,
+                    float& maxValue) const;
+
+      /**
+       * The format of "target" is either RGB24 (the most significant
+       * byte is stored in the red channel, the least significant byte
+       * in the green channel, and the blue channel is set to zero), or
+       * Grayscale16. It must have the same size as the source texture.
+       **/
+      void Quantize(Orthanc::ImageAccessor& target,
+                    float offset,
+                    float scale) const;
+
+      static uint16_t QuantizeValue(float value,
+                                    float offset,
+                                    float scale)
+      {
+        float v = (value - offset) * scale;
+
+        // Also maps NaN to zero, as the "Max()" SIMD instruction
+        if (v > 0.0f)
+        {
+          if (v > 65535.0f)
+          {
+            v = 65535.0f;
+          }
+        }
+        else
+        {
+          v = 0.0f;
+        }
+
+        return static_cast<uint16_t>(v);
+      }
+    };
+  }
+}
@@ -22,8 +22,10 @@
 
 
 #include "OpenGLFloatTextureProgram.h"
+#include "FloatTexturePacker.h"
 #include "OpenGLShaderVersionDirective.h"
 
+#include <Logging.h>
 #include <OrthancException.h>
 #include <Images/Image.h>
 #include <Images/ImageProcessing.h>
@@ -36,12 +38,17 @@ static const char* FRAGMENT_SHADER =
   "uniform float u_windowCenter;                     \n"
   "uniform float u_windowWidth;                      \n"
   "uniform bool  u_invert;                           \n"
+  "uniform bool  u_isPacked;                         \n"
   "uniform sampler2D u_texture;                      \n"
   "varying vec2 v_texcoord;                          \n"
   "void main()                                       \n"
   "{                                                 \n"
   "  vec4 t = texture2D(u_texture, v_texcoord);      \n"
-  "  float v = (t.r * 256.0 + t.g) * 255.0;          \n"
+  "  float v;                                        \n"
+  "  if (u_isPacked)                                 \n"
+  "    v = (t.r * 256.0 + t.g) * 255.0;              \n"
+  "  else                                            \n"
+  "    v = t.r;                                      \n"
   "  v = v * u_slope + u_offset;                     \n"  // (*)
   "  float a = u_windowCenter - u_windowWidth / 2.0; \n"
   "  float dy = 1.0 / u_windowWidth;                 \n"
@@ -66,18 +73,45 @@ namespace OrthancStone
     OpenGLFloatTextureProgram::Data::Data(
       OpenGL::IOpenGLContext& context,
       const Orthanc::ImageAccessor& texture,
-      bool isLinearInterpolation) :
+      bool isLinearInterpolation,
+      TextureFormat format,
+      unsigned int threadsCount) :
       texture_(context),
+      isPacked_(format == TextureFormat_PackedRGB24),
       offset_(0.0f),
-      slope_(0.0f)
+      slope_(1.0f)
     {
       if (texture.GetFormat() != Orthanc::PixelFormat_Float32)
       {
         throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageFormat);
       }
 
+      const unsigned int width = texture.GetWidth();
+      const unsigned int height = texture.GetHeight();
+
+      if (format == TextureFormat_Float32)
+      {
+        // The values are read as such by the shader (offset 0, slope 1)
+        if (texture.GetPitch() == texture.GetBytesPerPixel() * width)
+        {
+          texture_.Load(texture, isLinearInterpolation);
+        }
+        else
+        {
+          // "OpenGLTexture::Load()" cannot deal with padding
+          Orthanc::Image compact(Orthanc::PixelFormat_Float32, width, height, true);
+          Orthanc::ImageProcessing::Copy(compact, texture);
+          texture_.Load(compact, isLinearInterpolation);
+        }
+
+        return;
+      }
+
+      FloatTexturePacker packer(texture);
+      packer.SetThreadsCount(threadsCount);
+
       float minValue, maxValue;
-      Orthanc::ImageProcessing::GetMinMaxFloatValue(minValue, maxValue, texture);
+      packer.GetRange(minValue, maxValue);
 
       offset_ = minValue;
 
@@ -91,53 +125,91 @@ namespace OrthancStone
         assert(!LinearAlgebra::IsCloseToZero(slope_));
       }
 
-      const unsigned int width = texture.GetWidth();
-      const unsigned int height = texture.GetHeight();
+      /**
+       * At (*), the floating-point "value" is reconstructed as
+       * "value = texture * slope + offset".
+       * <=> texture = (value - offset) / slope
+       **/
 
-      Orthanc::Image converted(Orthanc::PixelFormat_RGB24, width, height, true);
+      Orthanc::Image converted(isPacked_ ? Orthanc::PixelFormat_RGB24 : Orthanc::PixelFormat_Grayscale16,
+                               width, height, true);
+      packer.Quantize(converted, offset_, 1.0f / slope_);
+
+      texture_.Load(converted, isLinearInterpolation);
 
-      for (unsigned int y = 0; y < height; y++)
+      if (format == TextureFormat_Grayscale16)
       {
-        const float *p = reinterpret_cast<const float*>(texture.GetConstRow(y));
-        uint8_t *q = reinterpret_cast<uint8_t*>(converted.GetRow(y));
+        // The shader reads the normalized value "texture / 65535"
+        slope_ *= 65535.0f;
+      }
+    }
 
-        for (unsigned int x = 0; x < width; x++)
-        {
-          /**
-           * At (*), the floating-point "value" is reconstructed as
-           * "value = texture * slope + offset".
-           * <=> texture = (value - offset) / slope
-           **/
-
-          float value = (*p - offset_) / slope_;
-          if (value < 0)
+    
+    OpenGLFloatTextureProgram::OpenGLFloatTextureProgram(OpenGL::IOpenGLContext&  context) 
+      : program_(context, FRAGMENT_SHADER)
+      , context_(context)
+      , format_(TextureFormat_PackedRGB24)
+      , threadsCount_(1)
+    {
+    }
+
+
+    bool OpenGLFloatTextureProgram::IsTextureFormatSupported(TextureFormat format)
+    {
+      switch (format)
+      {
+        case TextureFormat_PackedRGB24:
+          return true;
+
+        case TextureFormat_Grayscale16:
+        case TextureFormat_Float32:
+          if (context_.IsContextLost())
           {
-            value = 0;
+            return false;
           }
-          else if (value >= 65535.0f)
+          else
           {
-            value = 65535.0f;
+            context_.MakeCurrent();
+            return OpenGL::OpenGLTexture::IsGrayscale16AndFloat32Supported();
           }
 
-          uint16_t t = static_cast<uint16_t>(value);
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+    }
 
-          q[0] = t / 256;  // red
-          q[1] = t % 256;  // green
-          q[2] = 0;        // blue is unused
 
-          p++;
-          q += 3;
-        }
+    void OpenGLFloatTextureProgram::SetTextureFormat(TextureFormat format)
+    {
+      if (IsTextureFormatSupported(format))
+      {
+        format_ = format;
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+                                        "This OpenGL context has no support for 16bit or floating-point textures");
       }
-
-      texture_.Load(converted, isLinearInterpolation);
     }
 
-    
-    OpenGLFloatTextureProgram::OpenGLFloatTextureProgram(OpenGL::IOpenGLContext&  context) 
-      : program_(context, FRAGMENT_SHADER)
-      , context_(context)
+
+    void OpenGLFloatTextureProgram::SetThreadsCount(unsigned int count)
     {
+      if (count == 0)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+
+#if ORTHANC_ENABLE_THREADS == 1
+      threadsCount_ = count;
+#else
+      if (count > 1)
+      {
+        LOG(WARNING) << "Multithreading is not available, the float textures will be quantized by a single thread";
+      }
+
+      threadsCount_ = 1;
+#endif
     }
 
 
@@ -159,6 +231,7 @@ namespace OrthancStone
         glUniform1f(execution.GetUniformLocation("u_windowCenter"), windowCenter);
         glUniform1f(execution.GetUniformLocation("u_windowWidth"), windowWidth);
         glUniform1f(execution.GetUniformLocation("u_invert"), invert);
+        glUniform1f(execution.GetUniformLocation("u_isPacked"), data.IsPacked());
 
         execution.DrawTriangles();
       }
@@ -32,16 +32,46 @@ namespace OrthancStone
     class OpenGLFloatTextureProgram : public boost::noncopyable
     {
     public:
+      /**
+       * Format of the textures that are uploaded to OpenGL. By
+       * default, each floating-point value is quantized on 16bits,
+       * and split across the red and green channels of a RGB24
+       * texture, which is compatible with WebGL 1.0. The two other
+       * formats are only available on contexts that support
+       * single-channel 16bit and floating-point textures (cf.
+       * "OpenGLTexture::IsGrayscale16AndFloat32Supported()").
+       * "TextureFormat_Grayscale16" halves the CPU repacking, and
+       * "TextureFormat_Float32" uploads the values as such, with no
+       * CPU conversion at all. These two formats are experimental
+       * (cf. "OpenGLCompositor::SetFloatTextureFormat()").
+       **/
+      enum TextureFormat
+      {
+        TextureFormat_PackedRGB24,
+        TextureFormat_Grayscale16,
+        TextureFormat_Float32
+      };
+
       class Data : public boost::noncopyable
       {
       private:
         OpenGL::OpenGLTexture  texture_;
+        bool                   isPacked_;
         float                  offset_;
         float                  slope_;
 
       public:
-        Data(OpenGL::IOpenGLContext& context, const Orthanc::ImageAccessor& texture,
-             bool isLinearInterpolation);
+        Data(OpenGL::IOpenGLContext& context,
+             const Orthanc::ImageAccessor& texture,
+             bool isLinearInterpolation,
+             TextureFormat format,
+             unsigned int threadsCount);
+
+        // Whether the values are split across the red and green channels
+        bool IsPacked() const
+        {
+          return isPacked_;
+        }
 
         float GetOffset() const
         {
@@ -62,10 +92,30 @@ namespace OrthancStone
     private:
       OpenGLTextureProgram     program_;
       OpenGL::IOpenGLContext&  context_;
+      TextureFormat            format_;
+      unsigned int             threadsCount_;
 
     public:
       explicit OpenGLFloatTextureProgram(OpenGL::IOpenGLContext&  context);
 
+      TextureFormat GetTextureFormat() const
+      {
+        return format_;
+      }
+
+      // Only affects the textures that are created afterwards
+      void SetTextureFormat(TextureFormat format);
+
+      bool IsTextureFormatSupported(TextureFormat format);
+
+      unsigned int GetThreadsCount() const
+      {
+        return threadsCount_;
+      }
+
+      // Number of threads to quantize the textures (1 by default)
+      void SetThreadsCount(unsigned int count);
+
       void Apply(Data& data,
                  const AffineTransform2D& transform,
                  unsigned int canvasWidth,
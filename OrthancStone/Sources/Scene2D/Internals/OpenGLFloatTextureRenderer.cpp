@@ -43,7 +43,8 @@ namespace OrthancStone
           
           context_.MakeCurrent();
           texture_.reset(new OpenGLFloatTextureProgram::Data(
-            context_, layer.GetTexture(), layer.IsLinearInterpolation()));
+            context_, layer.GetTexture(), layer.IsLinearInterpolation(),
+            program_.GetTextureFormat(), program_.GetThreadsCount()));
         }
 
         layerTransform_ = layer.GetTransform();
@@ -72,6 +72,39 @@ namespace OrthancStone
 
     void SetFont(size_t index, const GlyphBitmapAlphabet& dict);
 
+    /**
+     * Opt-in upload of the float textures as single-channel 16bit or
+     * floating-point OpenGL textures, if supported by the context
+     * (cf. "Internals::OpenGLFloatTextureProgram"). This only affects
+     * the layers that are subsequently added to the scene.
+     *
+     * WARNING: This is experimental. The GL_R16 and GL_R32F uploads
+     * and the matching branch of the shader are not covered by the
+     * unit tests, that run without an OpenGL context. Only the
+     * packing of the textures on the CPU ("FloatTexturePacker") is
+     * tested.
+     **/
+    bool IsFloatTextureFormatSupported(Internals::OpenGLFloatTextureProgram::TextureFormat format)
+    {
+      return floatTextureProgram_.IsTextureFormatSupported(format);
+    }
+
+    void SetFloatTextureFormat(Internals::OpenGLFloatTextureProgram::TextureFormat format)
+    {
+      floatTextureProgram_.SetTextureFormat(format);
+    }
+
+    // Number of threads to quantize the float textures (1 by default)
+    void SetThreadsCount(unsigned int threadsCount)
+    {
+      floatTextureProgram_.SetThreadsCount(threadsCount);
+    }
+
+    unsigned int GetThreadsCount() const
+    {
+      return floatTextureProgram_.GetThreadsCount();
+    }
+
 #if ORTHANC_ENABLE_LOCALE == 1
     void SetFont(size_t index,
                  const std::string& ttf,
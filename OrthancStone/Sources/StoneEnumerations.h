@@ -65,6 +65,12 @@ namespace OrthancStone
     VolumeProjection_Sagittal
   };
 
+  enum VolumeLayout
+  {
+    VolumeLayout_Slices,  // Stack of axial slices (the default)
+    VolumeLayout_Bricks   // Cubic bricks, with Morton order inside the bricks
+  };
+
   enum ImageInterpolation
   {
     ImageInterpolation_Nearest,
@@ -72,6 +78,13 @@ namespace OrthancStone
     ImageInterpolation_Trilinear
   };
 
+  enum IntensityProjection
+  {
+    IntensityProjection_Maximum,  // MIP
+    IntensityProjection_Minimum,  // MinIP
+    IntensityProjection_Mean      // Average intensity projection
+  };
+
   enum KeyboardModifiers
   {
     KeyboardModifiers_None = 0,
@@ -620,7 +620,8 @@ namespace OrthancStone
 
 
   TextureBaseSceneLayer* DicomInstanceParameters::CreateTexture(
-    const Orthanc::ImageAccessor& pixelData) const
+    const Orthanc::ImageAccessor& pixelData,
+    bool keepIntegerSource) const
   {
     // {
     //   const Orthanc::ImageAccessor& source = pixelData;
@@ -664,6 +665,15 @@ namespace OrthancStone
       {
         std::unique_ptr<Orthanc::ImageAccessor> converted(ConvertToFloat(pixelData));
         texture.reset(new FloatTextureSceneLayer(*converted));
+
+        if (keepIntegerSource &&
+            (sourceFormat == Orthanc::PixelFormat_Grayscale8 ||
+             sourceFormat == Orthanc::PixelFormat_Grayscale16 ||
+             sourceFormat == Orthanc::PixelFormat_SignedGrayscale16))
+        {
+          // Enables the windowing through a lookup table
+          dynamic_cast<FloatTextureSceneLayer&>(*texture).SetIntegerSource(pixelData);
+        }
       }
 
       FloatTextureSceneLayer& floatTexture = dynamic_cast<FloatTextureSceneLayer&>(*texture);
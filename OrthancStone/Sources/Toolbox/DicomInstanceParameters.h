@@ -190,7 +190,20 @@ namespace OrthancStone
 
     Orthanc::ImageAccessor* ConvertToFloat(const Orthanc::ImageAccessor& pixelData) const;
     
-    TextureBaseSceneLayer* CreateTexture(const Orthanc::ImageAccessor& pixelData) const;
+    TextureBaseSceneLayer* CreateTexture(const Orthanc::ImageAccessor& pixelData) const
+    {
+      return CreateTexture(pixelData, false);
+    }
+
+    /**
+     * If "keepIntegerSource" is "true", the grayscale textures keep a
+     * copy of the integer pixel data, which enables the windowing
+     * through a lookup table in "CairoCompositor". This is only
+     * useful for software rendering, and doubles the memory that is
+     * used by the texture.
+     **/
+    TextureBaseSceneLayer* CreateTexture(const Orthanc::ImageAccessor& pixelData,
+                                         bool keepIntegerSource) const;
 
     LookupTableTextureSceneLayer* CreateLookupTableTexture(const Orthanc::ImageAccessor& pixelData) const;
 
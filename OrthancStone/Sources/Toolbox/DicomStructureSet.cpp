@@ -1073,6 +1073,22 @@ namespace OrthancStone
   }
 
 
+  void DicomStructureSet::GetStructurePointsByInstance(PointsByInstance& target,
+                                                       size_t structureIndex) const
+  {
+    target.clear();
+
+    const Structure& structure = GetStructure(structureIndex);
+
+    for (Polygons::const_iterator polygon = structure.polygons_.begin();
+         polygon != structure.polygons_.end(); ++polygon)
+    {
+      assert(*polygon != NULL);
+      target[(*polygon)->GetSopInstanceUid()].push_back((*polygon)->GetPoints());
+    }
+  }
+
+
   void DicomStructureSet::EstimateGeometry()
   {
     static const double PI = boost::math::constants::pi<double>();
@@ -228,6 +228,13 @@ namespace OrthancStone
                             size_t structureIndex,
                             const std::string& sopInstanceUid) const;
 
+    typedef std::map<std::string, std::list< std::vector<Vector> > >  PointsByInstance;
+
+    // Same as "GetStructurePoints()", for all the referenced instances
+    // at once, with a single pass over the polygons of the structure
+    void GetStructurePointsByInstance(PointsByInstance& target,
+                                      size_t structureIndex) const;
+
     const Vector& GetEstimatedNormal() const
     {
       return estimatedNormal_;
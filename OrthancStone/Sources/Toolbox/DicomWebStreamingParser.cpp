@@ -0,0 +1,880 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "DicomWebStreamingParser.h"
+
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
+
+
+namespace OrthancStone
+{
+  // Anonymous namespace to avoid clashes between compilation modules
+  namespace
+  {
+    // Protection against stack overflows on malicious answers
+    static const unsigned int MAX_DEPTH = 256;
+
+
+    class JsonScanner : public boost::noncopyable
+    {
+    private:
+      const char*  start_;
+      const char*  current_;
+      const char*  end_;
+
+      void ThrowError() const
+      {
+        throw Orthanc::OrthancException(
+          Orthanc::ErrorCode_NetworkProtocol, "Invalid DICOMweb JSON at offset " +
+          boost::lexical_cast<std::string>(current_ - start_));
+      }
+
+      static unsigned int ParseHexDigit(char c)
+      {
+        if (c >= '0' && c <= '9')
+        {
+          return static_cast<unsigned int>(c - '0');
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+          return static_cast<unsigned int>(c - 'a' + 10);
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+          return static_cast<unsigned int>(c - 'A' + 10);
+        }
+        else
+        {
+          return 16;  // Invalid
+        }
+      }
+
+      unsigned int ReadCodeUnit()
+      {
+        if (end_ - current_ < 4)
+        {
+          ThrowError();
+        }
+
+        unsigned int value = 0;
+        for (unsigned int i = 0; i < 4; i++)
+        {
+          const unsigned int digit = ParseHexDigit(*current_++);
+          if (digit == 16)
+          {
+            ThrowError();
+          }
+
+          value = (value << 4) | digit;
+        }
+
+        return value;
+      }
+
+      static void EncodeUtf8(std::string& target,
+                             unsigned int codePoint)
+      {
+        if (codePoint < 0x80)
+        {
+          target.push_back(static_cast<char>(codePoint));
+        }
+        else if (codePoint < 0x800)
+        {
+          target.push_back(static_cast<char>(0xc0 | (codePoint >> 6)));
+          target.push_back(static_cast<char>(0x80 | (codePoint & 0x3f)));
+        }
+        else if (codePoint < 0x10000)
+        {
+          target.push_back(static_cast<char>(0xe0 | (codePoint >> 12)));
+          target.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f)));
+          target.push_back(static_cast<char>(0x80 | (codePoint & 0x3f)));
+        }
+        else
+        {
+          target.push_back(static_cast<char>(0xf0 | (codePoint >> 18)));
+          target.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3f)));
+          target.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f)));
+          target.push_back(static_cast<char>(0x80 | (codePoint & 0x3f)));
+        }
+      }
+
+      void ReadUnicodeEscape(std::string& target)
+      {
+        unsigned int codePoint = ReadCodeUnit();
+
+        if (codePoint >= 0xd800 &&
+            codePoint <= 0xdbff)
+        {
+          // High surrogate, must be followed by a low surrogate
+          if (end_ - current_ < 2 ||
+              current_[0] != '\\' ||
+              current_[1] != 'u')
+          {
+            ThrowError();
+          }
+
+          current_ += 2;
+          const unsigned int low = ReadCodeUnit();
+          if (low < 0xdc00 ||
+              low > 0xdfff)
+          {
+            ThrowError();
+          }
+
+          codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+        }
+
+        EncodeUtf8(target, codePoint);
+      }
+
+      void ReadKeyword(const char* keyword)
+      {
+        for (const char* p = keyword; *p != '\0'; p++)
+        {
+          if (current_ == end_ ||
+              *current_ != *p)
+          {
+            ThrowError();
+          }
+
+          current_++;
+        }
+      }
+
+    public:
+      JsonScanner(const void* data,
+                  size_t size) :
+        start_(reinterpret_cast<const char*>(data)),
+        current_(start_),
+        end_(start_ + size)
+      {
+      }
+
+      const char* GetPosition() const
+      {
+        return current_;
+      }
+
+      void SkipWhitespaces()
+      {
+        while (current_ != end_ &&
+               (*current_ == ' ' || *current_ == '\t' || *current_ == '\n' || *current_ == '\r'))
+        {
+          current_++;
+        }
+      }
+
+      bool IsEnd()
+      {
+        SkipWhitespaces();
+        return current_ == end_;
+      }
+
+      char Peek()
+      {
+        SkipWhitespaces();
+
+        if (current_ == end_)
+        {
+          ThrowError();
+        }
+
+        return *current_;
+      }
+
+      void Expect(char c)
+      {
+        if (Peek() == c)
+        {
+          current_++;
+        }
+        else
+        {
+          ThrowError();
+        }
+      }
+
+      bool Accept(char c)
+      {
+        if (Peek() == c)
+        {
+          current_++;
+          return true;
+        }
+        else
+        {
+          return false;
+        }
+      }
+
+      // Returns "true" if another member/element follows
+      bool ReadSeparator(char closing)
+      {
+        if (Accept(','))
+        {
+          return true;
+        }
+        else
+        {
+          Expect(closing);
+          return false;
+        }
+      }
+
+      void ReadString(std::string& target)
+      {
+        Expect('"');
+        target.clear();
+
+        for (;;)
+        {
+          // Copy the unescaped characters in one single operation
+          const char* p = current_;
+          while (p != end_ &&
+                 *p != '"' &&
+                 *p != '\\')
+          {
+            p++;
+          }
+
+          target.append(current_, p);
+          current_ = p;
+
+          if (current_ == end_)
+          {
+            ThrowError();
+          }
+          else if (*current_ == '"')
+          {
+            current_++;
+            return;
+          }
+          else
+          {
+            current_++;  // Skip the backslash
+
+            if (current_ == end_)
+            {
+              ThrowError();
+            }
+
+            const char c = *current_++;
+            switch (c)
+            {
+              case '"':
+              case '\\':
+              case '/':
+                target.push_back(c);
+                break;
+
+              case 'b':
+                target.push_back('\b');
+                break;
+
+              case 'f':
+                target.push_back('\f');
+                break;
+
+              case 'n':
+                target.push_back('\n');
+                break;
+
+              case 'r':
+                target.push_back('\r');
+                break;
+
+              case 't':
+                target.push_back('\t');
+                break;
+
+              case 'u':
+                ReadUnicodeEscape(target);
+                break;
+
+              default:
+                ThrowError();
+            }
+          }
+        }
+      }
+
+      void SkipString()
+      {
+        Expect('"');
+
+        while (current_ != end_)
+        {
+          const char c = *current_++;
+          if (c == '"')
+          {
+            return;
+          }
+          else if (c == '\\')
+          {
+            if (current_ == end_)
+            {
+              break;
+            }
+
+            current_++;  // The 4 hexadecimal digits of "\u" are skipped as regular characters
+          }
+        }
+
+        ThrowError();
+      }
+
+      void ReadNumber(std::string& target)
+      {
+        Peek();
+
+        const char* p = current_;
+        while (p != end_ &&
+               ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E'))
+        {
+          p++;
+        }
+
+        if (p == current_)
+        {
+          ThrowError();
+        }
+
+        target.assign(current_, p);
+        current_ = p;
+      }
+
+      void SkipValue(unsigned int depth)
+      {
+        if (depth > MAX_DEPTH)
+        {
+          ThrowError();
+        }
+
+        switch (Peek())
+        {
+          case '{':
+            current_++;
+            if (!Accept('}'))
+            {
+              do
+              {
+                SkipString();
+                Expect(':');
+                SkipValue(depth + 1);
+              }
+              while (ReadSeparator('}'));
+            }
+            break;
+
+          case '[':
+            current_++;
+            if (!Accept(']'))
+            {
+              do
+              {
+                SkipValue(depth + 1);
+              }
+              while (ReadSeparator(']'));
+            }
+            break;
+
+          case '"':
+            SkipString();
+            break;
+
+          case 't':
+            ReadKeyword("true");
+            break;
+
+          case 'f':
+            ReadKeyword("false");
+            break;
+
+          case 'n':
+            ReadKeyword("null");
+            break;
+
+          default:
+          {
+            std::string number;
+            ReadNumber(number);
+            break;
+          }
+        }
+      }
+    };
+
+
+    /**
+     * Reproduces the formatting of the numbers by
+     * "Orthanc::DicomMap::FromDicomWeb()", whose values go through
+     * "Json::Value::asInt()" or "Json::Value::asDouble()".
+     **/
+    static void FormatNumber(std::string& target,
+                             const std::string& number)
+    {
+      if (number.find_first_of(".eE") == std::string::npos)
+      {
+        try
+        {
+          target = boost::lexical_cast<std::string>(boost::lexical_cast<int64_t>(number));
+          return;
+        }
+        catch (boost::bad_lexical_cast&)
+        {
+          // Too large for an integer, parsed as a floating-point number by JsonCpp
+        }
+      }
+
+      try
+      {
+        target = boost::lexical_cast<std::string>(boost::lexical_cast<double>(number));
+      }
+      catch (boost::bad_lexical_cast&)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                        "Invalid number in DICOMweb JSON: " + number);
+      }
+    }
+
+
+    /**
+     * Content of one tag of a DICOMweb resource. The members of the
+     * tag can come in any order (in particular, "vr" can come after
+     * "Value"), so the conversion is done once the tag is fully read.
+     **/
+    class TagContent : public boost::noncopyable
+    {
+    private:
+      enum ItemType
+      {
+        ItemType_String,
+        ItemType_Object,
+        ItemType_Other
+      };
+
+      struct Item
+      {
+        ItemType     type_;
+        std::string  value_;          // For strings and numbers
+        bool         hasAlphabetic_;  // The 3 components of person names
+        std::string  alphabetic_;
+        bool         hasIdeographic_;
+        std::string  ideographic_;
+        bool         hasPhonetic_;
+        std::string  phonetic_;
+      };
+
+      bool               hasVr_;
+      std::string        vr_;
+      bool               hasValue_;
+      bool               isValueArray_;
+      std::vector<Item>  items_;
+      size_t             countItems_;   // "items_" is recycled between the tags
+      bool               hasInlineBinary_;
+      bool               isInlineBinaryString_;
+      std::string        inlineBinary_;
+      std::string        key_;          // Scratch buffers
+      std::string        number_;
+
+      Item& AddItem(ItemType type)
+      {
+        if (countItems_ == items_.size())
+        {
+          items_.push_back(Item());
+        }
+
+        Item& item = items_[countItems_++];
+        item.type_ = type;
+        item.hasAlphabetic_ = false;
+        item.hasIdeographic_ = false;
+        item.hasPhonetic_ = false;
+        return item;
+      }
+
+      void ReadPersonNameComponent(JsonScanner& scanner,
+                                   bool& hasComponent,
+                                   std::string& component)
+      {
+        if (scanner.Peek() == '"')
+        {
+          scanner.ReadString(component);
+          hasComponent = true;
+        }
+        else
+        {
+          scanner.SkipValue(0);
+        }
+      }
+
+      void ReadObjectItem(JsonScanner& scanner)
+      {
+        // Only the components of person names are extracted, the
+        // items of sequences are skipped
+        Item& item = AddItem(ItemType_Object);
+
+        scanner.Expect('{');
+        if (!scanner.Accept('}'))
+        {
+          do
+          {
+            scanner.ReadString(key_);
+            scanner.Expect(':');
+
+            if (key_ == "Alphabetic")
+            {
+              ReadPersonNameComponent(scanner, item.hasAlphabetic_, item.alphabetic_);
+            }
+            else if (key_ == "Ideographic")
+            {
+              ReadPersonNameComponent(scanner, item.hasIdeographic_, item.ideographic_);
+            }
+            else if (key_ == "Phonetic")
+            {
+              ReadPersonNameComponent(scanner, item.hasPhonetic_, item.phonetic_);
+            }
+            else
+            {
+              scanner.SkipValue(1);
+            }
+          }
+          while (scanner.ReadSeparator('}'));
+        }
+      }
+
+      void ReadValue(JsonScanner& scanner)
+      {
+        hasValue_ = true;
+
+        if (scanner.Peek() != '[')
+        {
+          scanner.SkipValue(0);
+          return;
+        }
+
+        isValueArray_ = true;
+        scanner.Expect('[');
+
+        if (!scanner.Accept(']'))
+        {
+          do
+          {
+            const char c = scanner.Peek();
+            if (c == '"')
+            {
+              scanner.ReadString(AddItem(ItemType_String).value_);
+            }
+            else if (c == '{')
+            {
+              ReadObjectItem(scanner);
+            }
+            else if (c == '-' ||
+                     (c >= '0' && c <= '9'))
+            {
+              scanner.ReadNumber(number_);
+              FormatNumber(AddItem(ItemType_String).value_, number_);
+            }
+            else
+            {
+              // Booleans, null values and nested arrays are ignored
+              AddItem(ItemType_Other);
+              scanner.SkipValue(0);
+            }
+          }
+          while (scanner.ReadSeparator(']'));
+        }
+      }
+
+    public:
+      TagContent() :
+        hasVr_(false),
+        hasValue_(false),
+        isValueArray_(false),
+        countItems_(0),
+        hasInlineBinary_(false),
+        isInlineBinaryString_(false)
+      {
+      }
+
+      void Read(JsonScanner& scanner)
+      {
+        hasVr_ = false;
+        hasValue_ = false;
+        isValueArray_ = false;
+        countItems_ = 0;
+        hasInlineBinary_ = false;
+        isInlineBinaryString_ = false;
+
+        if (scanner.Peek() != '{')
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+        }
+
+        scanner.Expect('{');
+        if (!scanner.Accept('}'))
+        {
+          do
+          {
+            scanner.ReadString(key_);
+            scanner.Expect(':');
+
+            if (key_ == "vr" &&
+                scanner.Peek() == '"')
+            {
+              scanner.ReadString(vr_);
+              hasVr_ = true;
+            }
+            else if (key_ == "Value")
+            {
+              ReadValue(scanner);
+            }
+            else if (key_ == "InlineBinary")
+            {
+              hasInlineBinary_ = true;
+
+              if (scanner.Peek() == '"')
+              {
+                scanner.ReadString(inlineBinary_);
+                isInlineBinaryString_ = true;
+              }
+              else
+              {
+                scanner.SkipValue(0);
+              }
+            }
+            else
+            {
+              // "BulkDataURI" or unknown member
+              scanner.SkipValue(0);
+            }
+          }
+          while (scanner.ReadSeparator('}'));
+        }
+      }
+
+      void Store(Orthanc::DicomMap& target,
+                 const Orthanc::DicomTag& tag) const
+      {
+        if (!hasVr_)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+        }
+
+        if (hasInlineBinary_)
+        {
+          if (isInlineBinaryString_)
+          {
+            std::string decoded;
+            Orthanc::Toolbox::DecodeBase64(decoded, inlineBinary_);
+            target.SetValue(tag, decoded, true /* binary data */);
+          }
+        }
+        else if (!hasValue_)
+        {
+          // Tag is present, but it has a null value
+          target.SetNullValue(tag);
+        }
+        else if (isValueArray_)
+        {
+          const bool isPersonName = (vr_ == "PN");
+
+          std::string s;
+
+          for (size_t i = 0; i < countItems_; i++)
+          {
+            const Item& item = items_[i];
+
+            if (!s.empty())
+            {
+              s += '\\';
+            }
+
+            switch (item.type_)
+            {
+              case ItemType_String:
+                s += item.value_;
+                break;
+
+              case ItemType_Object:
+                if (!isPersonName)
+                {
+                  return;  // This is the case of sequences, that are not stored
+                }
+
+                if (item.hasAlphabetic_)
+                {
+                  s += item.alphabetic_;
+                }
+
+                if (item.hasIdeographic_)
+                {
+                  s += '=' + item.ideographic_;
+                }
+
+                if (item.hasPhonetic_)
+                {
+                  if (!item.hasIdeographic_)
+                  {
+                    s += '=';
+                  }
+
+                  s += '=' + item.phonetic_;
+                }
+
+                break;
+
+              default:
+                break;
+            }
+          }
+
+          target.SetValue(tag, s, false);
+        }
+      }
+    };
+
+
+    class ResourceParser : public boost::noncopyable
+    {
+    private:
+      JsonScanner&                        scanner_;
+      bool                                keepAllSourceJson_;
+      const std::set<Orthanc::DicomTag>&  sourceJsonTags_;
+      TagContent                          content_;
+      std::string                         key_;
+
+      static void ParseSourceJson(Json::Value& target,
+                                  const char* start,
+                                  const char* end)
+      {
+        if (!Orthanc::Toolbox::ReadJson(target, start, end - start))
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+        }
+      }
+
+    public:
+      ResourceParser(JsonScanner& scanner,
+                     bool keepAllSourceJson,
+                     const std::set<Orthanc::DicomTag>& sourceJsonTags) :
+        scanner_(scanner),
+        keepAllSourceJson_(keepAllSourceJson),
+        sourceJsonTags_(sourceJsonTags)
+      {
+      }
+
+      void Parse(DicomWebStreamingParser::IVisitor& visitor)
+      {
+        scanner_.Peek();
+        const char* start = scanner_.GetPosition();
+
+        Orthanc::DicomMap dicom;
+        Json::Value sourceJson = Json::objectValue;
+
+        scanner_.Expect('{');
+        if (!scanner_.Accept('}'))
+        {
+          do
+          {
+            scanner_.ReadString(key_);
+            scanner_.Expect(':');
+
+            Orthanc::DicomTag tag(0, 0);
+            if (!Orthanc::DicomTag::ParseHexadecimal(tag, key_.c_str()))
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+            }
+
+            scanner_.Peek();
+            const char* valueStart = scanner_.GetPosition();
+
+            content_.Read(scanner_);
+            content_.Store(dicom, tag);
+
+            if (!keepAllSourceJson_ &&
+                sourceJsonTags_.find(tag) != sourceJsonTags_.end())
+            {
+              ParseSourceJson(sourceJson[key_], valueStart, scanner_.GetPosition());
+            }
+          }
+          while (scanner_.ReadSeparator('}'));
+        }
+
+        if (keepAllSourceJson_)
+        {
+          ParseSourceJson(sourceJson, start, scanner_.GetPosition());
+        }
+
+        visitor.VisitResource(dicom, sourceJson);
+      }
+    };
+  }
+
+
+  size_t DicomWebStreamingParser::Parse(IVisitor& visitor,
+                                        const void* answer,
+                                        size_t size) const
+  {
+    JsonScanner scanner(answer, size);
+    ResourceParser parser(scanner, keepAllSourceJson_, sourceJsonTags_);
+
+    size_t count = 0;
+
+    if (scanner.Peek() == '[')
+    {
+      scanner.Expect('[');
+      if (!scanner.Accept(']'))
+      {
+        do
+        {
+          parser.Parse(visitor);
+          count++;
+        }
+        while (scanner.ReadSeparator(']'));
+      }
+    }
+    else
+    {
+      parser.Parse(visitor);
+      count = 1;
+    }
+
+    if (!scanner.IsEnd())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                      "Trailing characters after the DICOMweb JSON");
+    }
+
+    return count;
+  }
+
+
+  size_t DicomWebStreamingParser::Parse(IVisitor& visitor,
+                                        const std::string& answer) const
+  {
+    return Parse(visitor, answer.c_str(), answer.size());
+  }
+}
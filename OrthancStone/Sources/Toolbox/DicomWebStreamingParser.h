@@ -0,0 +1,101 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <DicomFormat/DicomMap.h>
+
+#include <set>
+
+
+namespace OrthancStone
+{
+  /**
+   * Streaming parser for the JSON answers of DICOMweb servers (QIDO-RS
+   * and WADO-RS "/metadata"). The "DicomMap" of each resource is built
+   * while scanning the answer, without creating a "Json::Value" tree
+   * for the whole answer. The values are converted in the same way as
+   * "Orthanc::DicomMap::FromDicomWeb()".
+   *
+   * By default, no source JSON is kept. Selected tags (typically
+   * sequences, that are not stored in "DicomMap") can be kept, or the
+   * full source JSON of each resource.
+   **/
+  class DicomWebStreamingParser : public boost::noncopyable
+  {
+  public:
+    class IVisitor : public boost::noncopyable
+    {
+    public:
+      virtual ~IVisitor()
+      {
+      }
+
+      /**
+       * Called once for each resource of the answer. "sourceJson" is
+       * an object containing the selected tags. It can be swapped by
+       * the visitor in order to avoid a copy.
+       **/
+      virtual void VisitResource(const Orthanc::DicomMap& dicom,
+                                 Json::Value& sourceJson) = 0;
+    };
+
+  private:
+    bool                         keepAllSourceJson_;
+    std::set<Orthanc::DicomTag>  sourceJsonTags_;
+
+  public:
+    DicomWebStreamingParser() :
+      keepAllSourceJson_(false)
+    {
+    }
+
+    void SetKeepAllSourceJson(bool keep)
+    {
+      keepAllSourceJson_ = keep;
+    }
+
+    bool IsKeepAllSourceJson() const
+    {
+      return keepAllSourceJson_;
+    }
+
+    void AddSourceJsonTag(const Orthanc::DicomTag& tag)
+    {
+      sourceJsonTags_.insert(tag);
+    }
+
+    void AddSourceJsonTags(const std::set<Orthanc::DicomTag>& tags)
+    {
+      sourceJsonTags_.insert(tags.begin(), tags.end());
+    }
+
+    // Returns the number of resources in the answer
+    size_t Parse(IVisitor& visitor,
+                 const void* answer,
+                 size_t size) const;
+
+    size_t Parse(IVisitor& visitor,
+                 const std::string& answer) const;
+  };
+}
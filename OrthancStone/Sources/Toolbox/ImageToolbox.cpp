@@ -23,6 +23,8 @@
 #include "../OrthancStone.h"
 #include "ImageToolbox.h"
 
+#include "PixelHistogram.h"
+
 #include "../StoneException.h"
 
 #include <Images/Image.h>
@@ -32,9 +34,6 @@
 #include <Logging.h>
 #include <OrthancException.h>
 
-#include <boost/static_assert.hpp>
-#include <boost/type_traits.hpp>
-
 #include <vector>
 
 #if !defined(ORTHANC_ENABLE_DCMTK)
@@ -52,232 +51,25 @@
 
 namespace OrthancStone
 {
-  namespace
-  {
-    using Orthanc::PixelTraits;
-    using Orthanc::PixelFormat;
-    using Orthanc::ImageAccessor;
-    using Orthanc::PixelFormat;
-
-    template<typename Orthanc::PixelFormat Format>
-    class PixelBinner
-    {
-      // "PixelBinner requires an arithmetic (integer or floating-point) pixel format"
-      typedef typename Orthanc::PixelTraits<Format>::PixelType PixelType;
-      BOOST_STATIC_ASSERT(boost::is_arithmetic<PixelType>::value);
-    
-    public:
-      PixelBinner(HistogramData& hd, double minValue, double maxValue)
-        : hd_(hd)
-        , minValue_(minValue)
-        , maxValue_(maxValue)
-        , division_(1.0 / hd_.binSize)
-      {
-        ORTHANC_ASSERT(hd_.bins.size() > 0);
-        ORTHANC_ASSERT(maxValue > minValue);
-      }
-
-      ORTHANC_FORCE_INLINE void AddPixel(PixelType p)
-      {
-        if (p <= minValue_)
-        {
-          hd_.bins[0] += 1;
-        }
-        else if (p >= maxValue_)
-        {
-          hd_.bins.back() += 1;
-        }
-        else
-        {
-          double distanceFromMin = p - minValue_;
-          size_t binIndex = static_cast<size_t>(
-            std::floor(distanceFromMin * division_));
-          if (binIndex >= hd_.bins.size())
-            binIndex = hd_.bins.size() - 1;
-          hd_.bins[binIndex] += 1;
-        }
-      }
-    private:
-      HistogramData&        hd_;
-      double                minValue_;
-      double                maxValue_;
-      double                division_;
-    };
-
-    template<PixelFormat Format>
-    struct Histogram
-    {
-      typedef typename PixelTraits<Format>::PixelType PixelType;
-
-      static void Apply(const Orthanc::ImageAccessor& img, HistogramData& hd,
-                        double minValue = 0, 
-                        double maxValue = 0)
-      {
-        ORTHANC_ASSERT(Format == img.GetFormat(), 
-                       "Internal error. Wrong template histogram type");
-    
-        const size_t height = img.GetHeight();
-        const size_t width = img.GetHeight();
-
-        if ((minValue == 0) && (maxValue == 0))
-        {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
-          //ORTHANC_ASSERT(boost::is_integral<PixelType>::value, 
-          //  "Min and max values must be supplied for float-based histogram");
-          //
-          //PixelTraits<Format>::SetMinValue(minValue);
-          //PixelTraits<Format>::SetMaxValue(maxValue);
-        }
-
-        hd.minValue = minValue;
-
-        // the following code is not really pretty but ensures 
-        size_t numBins = static_cast<size_t>(
-          std::ceil((maxValue - minValue) / hd.binSize));
-
-        hd.bins.resize(numBins);
-        std::fill(hd.bins.begin(), hd.bins.end(), 0);
-
-        PixelBinner<Format> binner(hd, minValue, maxValue);
-        for (uint32_t y = 0; y < height; ++y)
-        {
-          const PixelType* curPix = reinterpret_cast<const PixelType*>(
-            img.GetConstRow(y));
-          
-          for (uint32_t x = 0; x < width; x++, curPix++)
-          {
-            binner.AddPixel(*curPix);
-          }
-        }
-      }
-    };
-
-
-    template<PixelFormat Format>
-    struct ComputeMinMax__
-    {
-      typedef typename PixelTraits<Format>::PixelType PixelType;
-
-      static void Apply(const Orthanc::ImageAccessor& img,
-                        PixelType& minValue, PixelType& maxValue)
-      {
-        ORTHANC_ASSERT(Format == img.GetFormat(), 
-                       "Internal error. Wrong template histogram type");
-
-        const size_t height = img.GetHeight();
-        const size_t width = img.GetHeight();
-
-        if (height * width == 0)
-        {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageFormat);
-        }
-
-        // min and max are crossed below. Think about it. This is OK :)
-        PixelTraits<Format>::SetMaxValue(minValue);
-        PixelTraits<Format>::SetMinValue(maxValue);
-
-        for (uint32_t y = 0; y < height; ++y)
-        {
-          const PixelType* curPix = reinterpret_cast<const PixelType*>(
-            img.GetConstRow(y));
-
-          for (uint32_t x = 0; x < width; x++, curPix++)
-          {
-            if (*curPix <= minValue)
-              minValue = *curPix;
-            if (*curPix >= maxValue)
-              maxValue = *curPix;
-          }
-        }
-      }
-    };
-
-    template<PixelFormat Format>
-    void ComputeMinMax_(const Orthanc::ImageAccessor& img, 
-                        double& minValue, double& maxValue)
-    {
-      typedef typename PixelTraits<Format>::PixelType PixelType;
-      PixelType minValuePix = PixelType();
-      PixelType maxValuePix = PixelType();
-      ComputeMinMax__<Format>::Apply(img, minValuePix, maxValuePix);
-      minValue = static_cast<double>(minValuePix);
-      maxValue = static_cast<double>(maxValuePix);
-    }
-    
-    template<PixelFormat Format>
-    void ComputeHistogram_(const Orthanc::ImageAccessor& img, HistogramData& hd)
-    {
-      typedef typename PixelTraits<Format>::PixelType PixelType;
-      PixelType minValue = PixelType();
-      PixelType maxValue = PixelType();
-      ComputeMinMax__<Format>::Apply(img, minValue, maxValue);
-      
-      // make bins a little bigger to center integer pixel values
-      Histogram<Format>::Apply(img, hd, 
-                               static_cast<double>(minValue) - 0.5, 
-                               static_cast<double>(maxValue) + 0.5);
-    }
-  }
-
   void ComputeHistogram(const Orthanc::ImageAccessor& img,
                         HistogramData& hd, double binSize)
   {
-    hd.binSize = binSize;
+    PixelHistogram histogram(img);
+    histogram.SetThreadsCount(PixelHistogram::GetHardwareConcurrency());
 
-    // dynamic/static bridge
-    switch (img.GetFormat())
-    {
-    case Orthanc::PixelFormat_Grayscale8:
-      ComputeHistogram_<Orthanc::PixelFormat_Grayscale8>       (img, hd);
-      break;
-    case Orthanc::PixelFormat_Grayscale16:
-      ComputeHistogram_<Orthanc::PixelFormat_Grayscale16>      (img, hd);
-      break;
-    case Orthanc::PixelFormat_SignedGrayscale16:
-      ComputeHistogram_<Orthanc::PixelFormat_SignedGrayscale16>(img, hd);
-      break;
-    case Orthanc::PixelFormat_Float32:
-      ComputeHistogram_<Orthanc::PixelFormat_Float32>          (img, hd);
-      break;
-    case Orthanc::PixelFormat_Grayscale32:
-      ComputeHistogram_<Orthanc::PixelFormat_Grayscale32>      (img, hd);
-      break;
-    case Orthanc::PixelFormat_Grayscale64:
-      ComputeHistogram_<Orthanc::PixelFormat_Grayscale64>      (img, hd);
-      break;
-    default:
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageFormat);
-    }
+    double minValue, maxValue;
+    histogram.GetRange(minValue, maxValue);
+
+    // make bins a little bigger to center integer pixel values
+    histogram.ComputeBins(hd, minValue - 0.5, maxValue + 0.5, binSize);
   }
 
   void ComputeMinMax(const Orthanc::ImageAccessor& img,
                      double& minValue, double& maxValue)
   {
-    // dynamic/static bridge
-    switch (img.GetFormat())
-    {
-    case Orthanc::PixelFormat_Grayscale8:
-      ComputeMinMax_<Orthanc::PixelFormat_Grayscale8>       (img, minValue, maxValue);
-      break;                                                
-    case Orthanc::PixelFormat_Grayscale16:                           
-      ComputeMinMax_<Orthanc::PixelFormat_Grayscale16>      (img, minValue, maxValue);
-      break;                                                
-    case Orthanc::PixelFormat_SignedGrayscale16:                     
-      ComputeMinMax_<Orthanc::PixelFormat_SignedGrayscale16>(img, minValue, maxValue);
-      break;                                                
-    case Orthanc::PixelFormat_Float32:                               
-      ComputeMinMax_<Orthanc::PixelFormat_Float32>          (img, minValue, maxValue);
-      break;                                                
-    case Orthanc::PixelFormat_Grayscale32:                           
-      ComputeMinMax_<Orthanc::PixelFormat_Grayscale32>      (img, minValue, maxValue);
-      break;                                                
-    case Orthanc::PixelFormat_Grayscale64:                           
-      ComputeMinMax_<Orthanc::PixelFormat_Grayscale64>      (img, minValue, maxValue);
-      break;
-    default:
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageFormat);
-    }
-
+    PixelHistogram histogram(img);
+    histogram.SetThreadsCount(PixelHistogram::GetHardwareConcurrency());
+    histogram.GetRange(minValue, maxValue);
   }
 
   void DumpHistogramResult(std::string& s, const HistogramData& hd)
@@ -0,0 +1,266 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#if !defined(ORTHANC_ENABLE_THREADS)
+#  error The macro ORTHANC_ENABLE_THREADS must be defined
+#endif
+
+#include <Compatibility.h>  // For ORTHANC_OVERRIDE
+#include <Images/ImageAccessor.h>
+#include <OrthancException.h>
+
+#include <boost/noncopyable.hpp>
+#include <algorithm>
+#include <new>
+#include <stdint.h>
+#include <vector>
+
+#if ORTHANC_ENABLE_THREADS == 1
+#  include "WorkersPool.h"
+#endif
+
+namespace OrthancStone
+{
+  namespace Internals
+  {
+    /**
+     * Processes the rows of an image by horizontal bands, that are
+     * distributed over several threads. The "Kernel" class must
+     * provide the following methods:
+     *
+     * - "void Process(const Orthanc::ImageAccessor& image, unsigned
+     *   int firstRow, unsigned int lastRow)" processes a band of rows,
+     * - "Kernel* CloneEmpty() const" creates a blank kernel with the
+     *   same parameters, to be used by another thread,
+     * - "void Merge(const Kernel& other)" adds the result of another
+     *   thread.
+     *
+     * The first band is processed using the kernel that is provided
+     * by the caller, into which the other bands are merged in order.
+     **/
+    class ParallelRows : public boost::noncopyable
+    {
+    private:
+      static unsigned int ComputeCountBands(const Orthanc::ImageAccessor& image,
+                                            unsigned int threadsCount,
+                                            uint64_t minPixelsPerBand)
+      {
+        const uint64_t countPixels = static_cast<uint64_t>(image.GetWidth()) * image.GetHeight();
+
+        unsigned int countBands = std::min(threadsCount, image.GetHeight());
+        if (minPixelsPerBand > 0 &&
+            static_cast<uint64_t>(countBands) * minPixelsPerBand > countPixels)
+        {
+          countBands = static_cast<unsigned int>(countPixels / minPixelsPerBand);
+        }
+
+        return countBands;
+      }
+
+#if ORTHANC_ENABLE_THREADS == 1
+      template <typename Kernel>
+      class Bands : public WorkersPool::IJob
+      {
+      private:
+        Kernel&                        kernel_;
+        const Orthanc::ImageAccessor&  image_;
+        unsigned int                   bandHeight_;
+        std::vector<Kernel*>           clones_;   // The first band uses "kernel_"
+        boost::mutex                   mutex_;
+        size_t                         nextBand_;
+        bool                           success_;
+        Orthanc::ErrorCode             error_;
+
+        void SetError(Orthanc::ErrorCode error)
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+
+          if (success_)
+          {
+            success_ = false;
+            error_ = error;
+          }
+        }
+
+      public:
+        Bands(Kernel& kernel,
+              const Orthanc::ImageAccessor& image,
+              unsigned int countBands) :
+          kernel_(kernel),
+          image_(image),
+          bandHeight_((image.GetHeight() + countBands - 1) / countBands),
+          nextBand_(0),
+          success_(true),
+          error_(Orthanc::ErrorCode_Success)
+        {
+          const size_t count = (image.GetHeight() + bandHeight_ - 1) / bandHeight_;
+          clones_.reserve(count);
+          clones_.push_back(NULL);
+
+          try
+          {
+            while (clones_.size() < count)
+            {
+              clones_.push_back(kernel.CloneEmpty());
+            }
+          }
+          catch (...)
+          {
+            for (size_t i = 0; i < clones_.size(); i++)
+            {
+              delete clones_[i];
+            }
+
+            throw;
+          }
+        }
+
+        virtual ~Bands()
+        {
+          for (size_t i = 0; i < clones_.size(); i++)
+          {
+            delete clones_[i];
+          }
+        }
+
+        virtual void Process() ORTHANC_OVERRIDE
+        {
+          for (;;)
+          {
+            size_t band;
+
+            {
+              boost::mutex::scoped_lock lock(mutex_);
+
+              if (!success_ ||
+                  nextBand_ == clones_.size())
+              {
+                return;
+              }
+
+              band = nextBand_++;
+            }
+
+            const unsigned int firstRow = static_cast<unsigned int>(band) * bandHeight_;
+            const unsigned int lastRow = std::min(firstRow + bandHeight_, image_.GetHeight());
+
+            try
+            {
+              if (band == 0)
+              {
+                kernel_.Process(image_, firstRow, lastRow);
+              }
+              else
+              {
+                clones_[band]->Process(image_, firstRow, lastRow);
+              }
+            }
+            catch (Orthanc::OrthancException& e)
+            {
+              SetError(e.GetErrorCode());
+            }
+            catch (std::bad_alloc&)
+            {
+              SetError(Orthanc::ErrorCode_NotEnoughMemory);
+            }
+            catch (...)
+            {
+              SetError(Orthanc::ErrorCode_InternalError);
+            }
+          }
+        }
+
+        // To be called once all the threads have processed the job
+        void Merge()
+        {
+          if (!success_)
+          {
+            throw Orthanc::OrthancException(error_);
+          }
+
+          for (size_t i = 1; i < clones_.size(); i++)
+          {
+            kernel_.Merge(*clones_[i]);
+          }
+        }
+      };
+#endif
+
+    public:
+      // Dispatching a band to a thread is not worth it for fewer pixels than this
+      static uint64_t GetMinPixelsPerBand()
+      {
+        return 256 * 1024;
+      }
+
+#if ORTHANC_ENABLE_THREADS == 1
+      /**
+       * Version that reuses the threads of a pool, for callers that
+       * process many images in a row. A band contains at least
+       * "minPixelsPerBand" pixels, unless this parameter is zero.
+       **/
+      template <typename Kernel>
+      static void Apply(Kernel& kernel,
+                        const Orthanc::ImageAccessor& image,
+                        WorkersPool& pool,
+                        uint64_t minPixelsPerBand)
+      {
+        const unsigned int countBands = ComputeCountBands(image, pool.GetThreadsCount(), minPixelsPerBand);
+
+        if (countBands > 1)
+        {
+          Bands<Kernel> bands(kernel, image, countBands);
+          pool.Run(bands);
+          bands.Merge();
+        }
+        else
+        {
+          kernel.Process(image, 0, image.GetHeight());
+        }
+      }
+#endif
+
+      // Version that starts the threads for this image only
+      template <typename Kernel>
+      static void Apply(Kernel& kernel,
+                        const Orthanc::ImageAccessor& image,
+                        unsigned int threadsCount)
+      {
+#if ORTHANC_ENABLE_THREADS == 1
+        const unsigned int countBands = ComputeCountBands(image, threadsCount, GetMinPixelsPerBand());
+
+        if (countBands > 1)
+        {
+          WorkersPool pool(countBands - 1);
+          Apply(kernel, image, pool, GetMinPixelsPerBand());
+          return;
+        }
+#endif
+
+        kernel.Process(image, 0, image.GetHeight());
+      }
+    };
+  }
+}
@@ -0,0 +1,264 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <Compatibility.h>  // For ORTHANC_FORCE_INLINE
+
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define ORTHANC_STONE_SIMD_SSE2 1
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  define ORTHANC_STONE_SIMD_NEON 1
+#  include <arm_neon.h>
+#endif
+
+#if (ORTHANC_STONE_SIMD_SSE2 == 1) || (ORTHANC_STONE_SIMD_NEON == 1)
+#  define ORTHANC_STONE_HAS_SIMD 1
+#else
+#  define ORTHANC_STONE_HAS_SIMD 0
+#endif
+
+
+namespace OrthancStone
+{
+  namespace Internals
+  {
+    /**
+     * Minimal abstraction over the 4-lanes single-precision SIMD
+     * instructions of the target CPU (SSE2 or NEON). The arithmetic
+     * operations are IEEE-compliant: A vectorized kernel that follows
+     * the order of operations of its scalar counterpart produces the
+     * same results, up to the rounding differences that appear if the
+     * compiler contracts the scalar code into fused multiply-adds
+     * (which GCC does by default on ARM64, or with "-march=native").
+     * These functions are only available if "ORTHANC_STONE_HAS_SIMD"
+     * is set to 1.
+     **/
+    namespace Simd
+    {
+#if ORTHANC_STONE_SIMD_SSE2 == 1
+      typedef __m128  Float4;
+      typedef __m128  Mask4;
+
+      ORTHANC_FORCE_INLINE Float4 Splat(float value)
+      {
+        return _mm_set1_ps(value);
+      }
+
+      ORTHANC_FORCE_INLINE Float4 Load(const float* source)
+      {
+        return _mm_loadu_ps(source);
+      }
+
+      ORTHANC_FORCE_INLINE void Store(float* target,
+                                      Float4 value)
+      {
+        _mm_storeu_ps(target, value);
+      }
+
+      ORTHANC_FORCE_INLINE Float4 Add(Float4 a,
+                                      Float4 b)
+      {
+        return _mm_add_ps(a, b);
+      }
+
+      ORTHANC_FORCE_INLINE Float4 Sub(Float4 a,
+                                      Float4 b)
+      {
+        return _mm_sub_ps(a, b);
+      }
+
+      ORTHANC_FORCE_INLINE Float4 Mul(Float4 a,
+                                      Float4 b)
+      {
+        return _mm_mul_ps(a, b);
+      }
+
+      ORTHANC_FORCE_INLINE Float4 Min(Float4 a,
+                                      Float4 b)
+      {
+        return _mm_min_ps(a, b);
+      }
+
+      ORTHANC_FORCE_INLINE Float4 Max(Float4 a,
+                                      Float4 b)
+      {
+        return _mm_max_ps(a, b);
+      }
+
+      // Lanes such that "low <= value < high"
+      ORTHANC_FORCE_INLINE Mask4 IsInRange(Float4 value,
+                                           Float4 low,
+                                           Float4 high)
+      {
+        return _mm_and_ps(_mm_cmpge_ps(value, low), _mm_cmplt_ps(value, high));
+      }
+
+      ORTHANC_FORCE_INLINE Mask4 IsLess(Float4 a,
+                                        Float4 b)
+      {
+        return _mm_cmplt_ps(a, b);
+      }
+
+      ORTHANC_FORCE_INLINE Mask4 And(Mask4 a,
+                                     Mask4 b)
+      {
+        return _mm_and_ps(a, b);
+      }
+
+      ORTHANC_FORCE_INLINE unsigned int GetBits(Mask4 mask)
+      {
+        return static_cast<unsigned int>(_mm_movemask_ps(mask));
+      }
+
+      // Set to zero the lanes that are not part of the mask
+      ORTHANC_FORCE_INLINE Float4 Keep(Float4 value,
+                                       Mask4 mask)
+      {
+        return _mm_and_ps(value, mask);
+      }
+
+      ORTHANC_FORCE_INLINE Float4 Select(Mask4 mask,
+                                         Float4 ifTrue,
+                                         Float4 ifFalse)
+      {
+        return _mm_or_ps(_mm_and_ps(mask, ifTrue), _mm_andnot_ps(mask, ifFalse));
+      }
+
+      // Rounds down non-negative values, both as integers and as floats
+      ORTHANC_FORCE_INLINE Float4 Floor(int32_t* target,
+                                        Float4 value)
+      {
+        const __m128i i = _mm_cvttps_epi32(value);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target), i);
+        return _mm_cvtepi32_ps(i);
+      }
+
+#elif ORTHANC_STONE_SIMD_NEON == 1
+      typedef float32x4_t  Float4;
+      typedef uint32x4_t   Mask4;
+
+      ORTHANC_FORCE_INLINE Float4 Splat(float value)
+      {
+        return vdupq_n_f32(value);
+      }
+
+      ORTHANC_FORCE_INLINE Float4 Load(const float* source)
+      {
+        return vld1q_f32(source);
+      }
+
+      ORTHANC_FORCE_INLINE void Store(float* target,
+                                      Float4 value)
+      {
+        vst1q_f32(target, value);
+      }
+
+      ORTHANC_FORCE_INLINE Float4 Add(Float4 a,
+                                      Float4 b)
+      {
+        return vaddq_f32(a, b);
+      }
+
+      ORTHANC_FORCE_INLINE Float4 Sub(Float4 a,
+                                      Float4 b)
+      {
+        return vsubq_f32(a, b);
+      }
+
+      ORTHANC_FORCE_INLINE Float4 Mul(Float4 a,
+                                      Float4 b)
+      {
+        return vmulq_f32(a, b);
+      }
+
+      ORTHANC_FORCE_INLINE Float4 Min(Float4 a,
+                                      Float4 b)
+      {
+        return vminq_f32(a, b);
+      }
+
+      ORTHANC_FORCE_INLINE Float4 Max(Float4 a,
+                                      Float4 b)
+      {
+        return vmaxq_f32(a, b);
+      }
+
+      // Lanes such that "low <= value < high"
+      ORTHANC_FORCE_INLINE Mask4 IsInRange(Float4 value,
+                                           Float4 low,
+                                           Float4 high)
+      {
+        return vandq_u32(vcgeq_f32(value, low), vcltq_f32(value, high));
+      }
+
+      ORTHANC_FORCE_INLINE Mask4 IsLess(Float4 a,
+                                        Float4 b)
+      {
+        return vcltq_f32(a, b);
+      }
+
+      ORTHANC_FORCE_INLINE Mask4 And(Mask4 a,
+                                     Mask4 b)
+      {
+        return vandq_u32(a, b);
+      }
+
+      ORTHANC_FORCE_INLINE unsigned int GetBits(Mask4 mask)
+      {
+        uint32_t lanes[4];
+        vst1q_u32(lanes, mask);
+        return ((lanes[0] & 1u) |
+                ((lanes[1] & 1u) << 1) |
+                ((lanes[2] & 1u) << 2) |
+                ((lanes[3] & 1u) << 3));
+      }
+
+      // Set to zero the lanes that are not part of the mask
+      ORTHANC_FORCE_INLINE Float4 Keep(Float4 value,
+                                       Mask4 mask)
+      {
+        return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(value), mask));
+      }
+
+      ORTHANC_FORCE_INLINE Float4 Select(Mask4 mask,
+                                         Float4 ifTrue,
+                                         Float4 ifFalse)
+      {
+        return vbslq_f32(mask, ifTrue, ifFalse);
+      }
+
+      // Rounds down non-negative values, both as integers and as floats
+      ORTHANC_FORCE_INLINE Float4 Floor(int32_t* target,
+                                        Float4 value)
+      {
+        const int32x4_t i = vcvtq_s32_f32(value);  // Rounds toward zero
+        vst1q_s32(target, i);
+        return vcvtq_f32_s32(i);
+      }
+#endif
+    }
+  }
+}
@@ -0,0 +1,154 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "WorkersPool.h"
+
+#include <Logging.h>
+
+#include <cassert>
+
+
+namespace OrthancStone
+{
+  namespace Internals
+  {
+    void WorkersPool::Worker(WorkersPool* that)
+    {
+      unsigned int generation = 0;
+
+      for (;;)
+      {
+        IJob* job = NULL;
+
+        {
+          boost::mutex::scoped_lock lock(that->mutex_);
+
+          while (!that->stopped_ &&
+                 that->generation_ == generation)
+          {
+            that->jobCondition_.wait(lock);
+          }
+
+          if (that->stopped_)
+          {
+            return;
+          }
+
+          generation = that->generation_;
+          job = that->job_;
+        }
+
+        assert(job != NULL);
+        job->Process();
+
+        {
+          boost::mutex::scoped_lock lock(that->mutex_);
+
+          assert(that->running_ > 0);
+          that->running_--;
+
+          if (that->running_ == 0)
+          {
+            that->doneCondition_.notify_all();
+          }
+        }
+      }
+    }
+
+
+    void WorkersPool::Stop()
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        stopped_ = true;
+        jobCondition_.notify_all();
+      }
+
+      for (size_t i = 0; i < threads_.size(); i++)
+      {
+        threads_[i]->join();
+        delete threads_[i];
+      }
+
+      threads_.clear();
+    }
+
+
+    WorkersPool::WorkersPool(unsigned int countWorkers) :
+      stopped_(false),
+      job_(NULL),
+      generation_(0),
+      running_(0)
+    {
+      threads_.reserve(countWorkers);
+
+      try
+      {
+        for (unsigned int i = 0; i < countWorkers; i++)
+        {
+          threads_.push_back(new boost::thread(Worker, this));
+        }
+      }
+      catch (...)
+      {
+        // Could not start a thread: The running threads and the
+        // calling thread will process the jobs
+        LOG(WARNING) << "Cannot start all the " << countWorkers << " worker threads, "
+                     << threads_.size() << " were started";
+      }
+    }
+
+
+    WorkersPool::~WorkersPool()
+    {
+      Stop();
+    }
+
+
+    void WorkersPool::Run(IJob& job)
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        assert(running_ == 0);
+        job_ = &job;
+        generation_++;
+        running_ = threads_.size();
+        jobCondition_.notify_all();
+      }
+
+      job.Process();
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        while (running_ > 0)
+        {
+          doneCondition_.wait(lock);
+        }
+
+        job_ = NULL;
+      }
+    }
+  }
+}
@@ -0,0 +1,97 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#if !defined(ORTHANC_ENABLE_THREADS)
+#  error The macro ORTHANC_ENABLE_THREADS must be defined
+#endif
+
+#if ORTHANC_ENABLE_THREADS != 1
+#  error This file can only be compiled if threads are enabled
+#endif
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include <vector>
+
+namespace OrthancStone
+{
+  namespace Internals
+  {
+    /**
+     * Set of threads that are started once, and that are reused by
+     * the successive parallel computations, as starting and joining
+     * threads at each computation can cost more than the computation
+     * itself. If some thread cannot be started, the computations are
+     * shared by the remaining threads.
+     **/
+    class WorkersPool : public boost::noncopyable
+    {
+    public:
+      class IJob : public boost::noncopyable
+      {
+      public:
+        virtual ~IJob()
+        {
+        }
+
+        /**
+         * Called concurrently by all the threads of the pool, and by
+         * the thread that calls "WorkersPool::Run()". This method
+         * must split the work by itself, and must not throw.
+         **/
+        virtual void Process() = 0;
+      };
+
+    private:
+      boost::mutex                 mutex_;
+      boost::condition_variable    jobCondition_;
+      boost::condition_variable    doneCondition_;
+      std::vector<boost::thread*>  threads_;
+      bool                         stopped_;
+      IJob*                        job_;
+      unsigned int                 generation_;  // Incremented at each new job
+      size_t                       running_;     // Workers still processing the job
+
+      static void Worker(WorkersPool* that);
+
+      void Stop();
+
+    public:
+      explicit WorkersPool(unsigned int countWorkers);
+
+      ~WorkersPool();
+
+      // Number of threads processing a job, including the calling thread
+      unsigned int GetThreadsCount() const
+      {
+        return static_cast<unsigned int>(threads_.size()) + 1;
+      }
+
+      // The calling thread also processes the job
+      void Run(IJob& job);
+    };
+  }
+}
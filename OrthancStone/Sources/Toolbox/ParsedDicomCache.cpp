@@ -25,30 +25,168 @@
 
 #include <Logging.h>
 
+#include <algorithm>
+#include <boost/functional/hash.hpp>
+#include <boost/lexical_cast.hpp>
 #include <cassert>
 
 
 namespace OrthancStone
 {
+  void ParsedDicomCache::Statistics::Add(const Statistics& other)
+  {
+    hits_ += other.hits_;
+    misses_ += other.misses_;
+    evictions_ += other.evictions_;
+    evictedBytes_ += other.evictedBytes_;
+    residentItems_ += other.residentItems_;
+    residentBytes_ += other.residentBytes_;
+  }
+
+
+  class ParsedDicomCache::Shard : public boost::noncopyable
+  {
+  private:
+    typedef std::map<unsigned int, Statistics>  StatisticsPerBucket;
+
+    boost::mutex                mutex_;   // Protects "statistics_" and "destroying_"
+    StatisticsPerBucket         statistics_;
+    bool                        destroying_;
+    Orthanc::MemoryObjectCache  cache_;   // Must be the last member, cf. "~Shard()"
+
+  public:
+    explicit Shard(size_t size) :
+      destroying_(false)
+    {
+      if (size != 0)
+      {
+        cache_.SetMaximumSize(size);
+      }
+    }
+
+    void SetMaximumSize(size_t size)
+    {
+      // A MemoryObjectCache cannot have a zero size
+      cache_.SetMaximumSize(std::max(static_cast<size_t>(1), size));
+    }
+
+    ~Shard()
+    {
+      // The items that are freed while destroying "cache_" are not evictions
+      boost::mutex::scoped_lock lock(mutex_);
+      destroying_ = true;
+    }
+
+    Orthanc::MemoryObjectCache& GetCache()
+    {
+      return cache_;
+    }
+
+    void RecordAccess(unsigned int bucket,
+                      bool hit)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (hit)
+      {
+        statistics_[bucket].hits_++;
+      }
+      else
+      {
+        statistics_[bucket].misses_++;
+      }
+    }
+
+    void RecordInsertion(unsigned int bucket,
+                         size_t size)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      Statistics& statistics = statistics_[bucket];
+      statistics.residentItems_++;
+      statistics.residentBytes_ += size;
+    }
+
+    void RecordRemoval(unsigned int bucket,
+                       size_t size,
+                       bool invalidated)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      Statistics& statistics = statistics_[bucket];
+      assert(statistics.residentItems_ > 0 &&
+             statistics.residentBytes_ >= size);
+      statistics.residentItems_--;
+      statistics.residentBytes_ -= size;
+
+      if (!invalidated &&
+          !destroying_)
+      {
+        statistics.evictions_++;
+        statistics.evictedBytes_ += size;
+      }
+    }
+
+    void AddStatistics(Statistics& target,
+                       unsigned int bucket)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      StatisticsPerBucket::const_iterator found = statistics_.find(bucket);
+      if (found != statistics_.end())
+      {
+        target.Add(found->second);
+      }
+    }
+
+    void AddStatistics(Statistics& target)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      for (StatisticsPerBucket::const_iterator it = statistics_.begin(); it != statistics_.end(); ++it)
+      {
+        target.Add(it->second);
+      }
+    }
+  };
+
+
   class ParsedDicomCache::Item : public Orthanc::ICacheable
   {
   private:
+    Shard&                                     shard_;
+    unsigned int                               bucket_;
     std::unique_ptr<Orthanc::ParsedDicomFile>  dicom_;
     size_t                                     fileSize_;
     bool                                       hasPixelData_;
+    bool                                       invalidated_;
     
   public:
-    Item(Orthanc::ParsedDicomFile* dicom,
+    Item(Shard& shard,
+         unsigned int bucket,
+         Orthanc::ParsedDicomFile* dicom,
          size_t fileSize,
          bool hasPixelData) :
+      shard_(shard),
+      bucket_(bucket),
       dicom_(dicom),
       fileSize_(fileSize),
-      hasPixelData_(hasPixelData)
+      hasPixelData_(hasPixelData),
+      invalidated_(false)
     {
       if (dicom == NULL)
       {
         throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
       }
+
+      shard_.RecordInsertion(bucket_, fileSize_);
+    }
+
+    virtual ~Item()
+    {
+      // This is called by "MemoryObjectCache", either because of its
+      // LRU policy, or because of an invalidation
+      shard_.RecordRemoval(bucket_, fileSize_, invalidated_);
     }
            
     virtual size_t GetMemoryUsage() const ORTHANC_OVERRIDE
@@ -66,14 +204,272 @@ namespace OrthancStone
     {
       return hasPixelData_;
     }
+
+    void MarkInvalidated()
+    {
+      invalidated_ = true;
+    }
   };
     
 
+  class ParsedDicomCache::FrameItem : public Orthanc::ICacheable
+  {
+  private:
+    ParsedDicomCache&                        cache_;
+    Shard&                                   shard_;
+    unsigned int                             bucket_;
+    std::string                              index_;
+    unsigned int                             frameNumber_;
+    uint64_t                                 generation_;
+    std::unique_ptr<Orthanc::ImageAccessor>  frame_;
+    size_t                                   size_;
+    bool                                     invalidated_;
+
+  public:
+    FrameItem(ParsedDicomCache& cache,
+              Shard& shard,
+              unsigned int bucket,
+              const std::string& index,
+              unsigned int frameNumber,
+              uint64_t generation,
+              Orthanc::ImageAccessor* frame) :
+      cache_(cache),
+      shard_(shard),
+      bucket_(bucket),
+      index_(index),
+      frameNumber_(frameNumber),
+      generation_(generation),
+      frame_(frame),
+      invalidated_(false)
+    {
+      if (frame == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+      }
+
+      size_ = static_cast<size_t>(frame->GetPitch()) * static_cast<size_t>(frame->GetHeight());
+      shard_.RecordInsertion(bucket_, size_);
+    }
+
+    virtual ~FrameItem()
+    {
+      shard_.RecordRemoval(bucket_, size_, invalidated_);
+
+      if (!invalidated_)
+      {
+        // The frame was evicted by the LRU policy, or by the
+        // destruction of the cache: Its entry in "framesIndex_" must
+        // be removed, but "framesMutex_" is possibly locked by the caller
+        cache_.RecordEvictedFrame(index_, frameNumber_, generation_);
+      }
+    }
+
+    virtual size_t GetMemoryUsage() const ORTHANC_OVERRIDE
+    {
+      return size_;
+    }
+
+    const Orthanc::ImageAccessor& GetFrame() const
+    {
+      assert(frame_.get() != NULL);
+      return *frame_;
+    }
+
+    void MarkInvalidated()
+    {
+      invalidated_ = true;
+    }
+  };
+
+
   std::string ParsedDicomCache::GetIndex(unsigned int bucket,
                                          const std::string& bucketKey)
   {
     return boost::lexical_cast<std::string>(bucket) + "|" + bucketKey;
   }
+
+
+  std::string ParsedDicomCache::GetFrameIndex(const std::string& index,
+                                              unsigned int frame)
+  {
+    return index + "|" + boost::lexical_cast<std::string>(frame);
+  }
+
+
+  void ParsedDicomCache::Setup(size_t size,
+                               unsigned int shardsCount)
+  {
+    if (shardsCount == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    maximumSize_ = size;
+    lowCacheSizeWarning_ = 0;
+
+    // The shards share the maximum size evenly
+    shards_.resize(shardsCount);
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      shards_[i] = new Shard(size / shardsCount);
+    }
+
+    // The cache of decoded frames is disabled until its size is set
+    framesMaximumSize_ = 0;
+    framesGeneration_ = 0;
+    framesShards_.resize(shardsCount);
+    for (size_t i = 0; i < framesShards_.size(); i++)
+    {
+      framesShards_[i] = new Shard(0);
+    }
+  }
+
+
+  ParsedDicomCache::Shard& ParsedDicomCache::GetShard(const std::string& index) const
+  {
+    assert(!shards_.empty());
+    const size_t hash = boost::hash<std::string>()(index);
+
+    assert(shards_[hash % shards_.size()] != NULL);
+    return *shards_[hash % shards_.size()];
+  }
+
+
+  ParsedDicomCache::Shard& ParsedDicomCache::GetFramesShard(const std::string& frameIndex) const
+  {
+    assert(!framesShards_.empty());
+    const size_t hash = boost::hash<std::string>()(frameIndex);
+
+    assert(framesShards_[hash % framesShards_.size()] != NULL);
+    return *framesShards_[hash % framesShards_.size()];
+  }
+
+
+  void ParsedDicomCache::InvalidateFrame(const std::string& frameIndex)
+  {
+    Shard& shard = GetFramesShard(frameIndex);
+
+    {
+      Orthanc::MemoryObjectCache::Accessor accessor(shard.GetCache(), frameIndex, true /* unique */);
+      if (accessor.IsValid())
+      {
+        dynamic_cast<FrameItem&>(accessor.GetValue()).MarkInvalidated();
+      }
+    }
+
+    shard.GetCache().Invalidate(frameIndex);
+  }
+
+
+  void ParsedDicomCache::InvalidateFrames(const std::string& index)
+  {
+    boost::mutex::scoped_lock lock(framesMutex_);
+
+    FramesIndex::iterator found = framesIndex_.find(index);
+    if (found != framesIndex_.end())
+    {
+      for (FramesGenerations::const_iterator it = found->second.begin(); it != found->second.end(); ++it)
+      {
+        InvalidateFrame(GetFrameIndex(index, it->first));
+      }
+
+      framesIndex_.erase(found);
+    }
+  }
+
+
+  void ParsedDicomCache::RecordEvictedFrame(const std::string& index,
+                                            unsigned int frameNumber,
+                                            uint64_t generation)
+  {
+    EvictedFrame frame;
+    frame.index_ = index;
+    frame.frameNumber_ = frameNumber;
+    frame.generation_ = generation;
+
+    boost::mutex::scoped_lock lock(evictedFramesMutex_);
+    evictedFrames_.push_back(frame);
+  }
+
+
+  void ParsedDicomCache::PruneFramesIndex()
+  {
+    std::vector<EvictedFrame> evicted;
+
+    {
+      boost::mutex::scoped_lock lock(evictedFramesMutex_);
+      evicted.swap(evictedFrames_);
+    }
+
+    for (size_t i = 0; i < evicted.size(); i++)
+    {
+      FramesIndex::iterator found = framesIndex_.find(evicted[i].index_);
+      if (found != framesIndex_.end())
+      {
+        FramesGenerations::iterator frame = found->second.find(evicted[i].frameNumber_);
+        if (frame != found->second.end() &&
+            frame->second == evicted[i].generation_)
+        {
+          found->second.erase(frame);
+
+          if (found->second.empty())
+          {
+            framesIndex_.erase(found);
+          }
+        }
+      }
+    }
+  }
+
+
+  ParsedDicomCache::ParsedDicomCache(size_t size)
+  {
+    Setup(size, 1);
+  }
+
+
+  ParsedDicomCache::ParsedDicomCache(size_t size,
+                                     unsigned int shardsCount)
+  {
+    Setup(size, shardsCount);
+  }
+
+
+  ParsedDicomCache::~ParsedDicomCache()
+  {
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      assert(shards_[i] != NULL);
+      delete shards_[i];
+    }
+
+    for (size_t i = 0; i < framesShards_.size(); i++)
+    {
+      assert(framesShards_[i] != NULL);
+      delete framesShards_[i];
+    }
+  }
+
+
+  void ParsedDicomCache::Invalidate(unsigned int bucket,
+                                    const std::string& bucketKey)
+  {
+    const std::string index = GetIndex(bucket, bucketKey);
+    Shard& shard = GetShard(index);
+
+    {
+      Orthanc::MemoryObjectCache::Accessor accessor(shard.GetCache(), index, true /* unique */);
+      if (accessor.IsValid())
+      {
+        dynamic_cast<Item&>(accessor.GetValue()).MarkInvalidated();
+      }
+    }
+
+    shard.GetCache().Invalidate(index);
+
+    // The decoded frames are obsolete as well
+    InvalidateFrames(index);
+  }
   
 
   void ParsedDicomCache::Acquire(unsigned int bucket,
@@ -84,17 +480,171 @@ namespace OrthancStone
   {
     LOG(TRACE) << "new item stored in cache: bucket " << bucket << ", key " << bucketKey;
 
+    const std::string index = GetIndex(bucket, bucketKey);
+    Shard& shard = GetShard(index);
+
+    const size_t shardSize = shard.GetCache().GetMaximumSize();
+
     if (lowCacheSizeWarning_ < fileSize &&
-        cache_.GetMaximumSize() > 0 &&
-        fileSize >= cache_.GetMaximumSize())
+        shardSize > 0 &&
+        fileSize >= shardSize)
     {
       lowCacheSizeWarning_ = fileSize;
       LOG(WARNING) << "The DICOM cache size should be larger: Storing a DICOM instance of "
                    << (fileSize / (1024 * 1024)) << "MB, whereas the cache size is only "
-                   << (cache_.GetMaximumSize() / (1024 * 1024)) << "MB wide";
+                   << (maximumSize_ / (1024 * 1024)) << "MB wide, split into "
+                   << shards_.size() << " shard(s)";
     }
     
-    cache_.Acquire(GetIndex(bucket, bucketKey), new Item(dicom, fileSize, hasPixelData));
+    shard.GetCache().Acquire(index, new Item(shard, bucket, dicom, fileSize, hasPixelData));
+  }
+
+
+  void ParsedDicomCache::GetStatistics(Statistics& target,
+                                       unsigned int bucket) const
+  {
+    target = Statistics();
+
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      shards_[i]->AddStatistics(target, bucket);
+    }
+  }
+
+
+  void ParsedDicomCache::GetStatistics(Statistics& target) const
+  {
+    target = Statistics();
+
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      shards_[i]->AddStatistics(target);
+    }
+  }
+
+
+  void ParsedDicomCache::SetDecodedFramesCacheSize(size_t size)
+  {
+    if (size == 0)
+    {
+      // Empty the cache of decoded frames
+      std::vector<std::string> indexes;
+
+      {
+        boost::mutex::scoped_lock lock(framesMutex_);
+        framesMaximumSize_ = 0;
+
+        indexes.reserve(framesIndex_.size());
+        for (FramesIndex::const_iterator it = framesIndex_.begin(); it != framesIndex_.end(); ++it)
+        {
+          indexes.push_back(it->first);
+        }
+      }
+
+      for (size_t i = 0; i < indexes.size(); i++)
+      {
+        InvalidateFrames(indexes[i]);
+      }
+    }
+    else
+    {
+      boost::mutex::scoped_lock lock(framesMutex_);
+      framesMaximumSize_ = size;
+
+      for (size_t i = 0; i < framesShards_.size(); i++)
+      {
+        framesShards_[i]->SetMaximumSize(size / framesShards_.size());
+      }
+
+      // Shrinking the cache can evict frames
+      PruneFramesIndex();
+    }
+  }
+
+
+  size_t ParsedDicomCache::GetDecodedFramesCacheSize() const
+  {
+    boost::mutex::scoped_lock lock(framesMutex_);
+    return framesMaximumSize_;
+  }
+
+
+  void ParsedDicomCache::AcquireDecodedFrame(unsigned int bucket,
+                                             const std::string& bucketKey,
+                                             unsigned int frameNumber,
+                                             Orthanc::ImageAccessor* frame)
+  {
+    std::unique_ptr<Orthanc::ImageAccessor> protection(frame);
+
+    if (frame == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+    }
+
+    /**
+     * The lock is kept while storing the frame, so that the frame
+     * cannot be missed by a concurrent call to "InvalidateFrames()".
+     * The destructor of "FrameItem" does not lock "framesMutex_".
+     **/
+    boost::mutex::scoped_lock lock(framesMutex_);
+
+    if (framesMaximumSize_ != 0)
+    {
+      LOG(TRACE) << "new decoded frame stored in cache: bucket " << bucket
+                 << ", key " << bucketKey << ", frame " << frameNumber;
+
+      const std::string index = GetIndex(bucket, bucketKey);
+      const std::string frameIndex = GetFrameIndex(index, frameNumber);
+
+      FramesIndex::iterator found = framesIndex_.find(index);
+      if (found != framesIndex_.end() &&
+          found->second.find(frameNumber) != found->second.end())
+      {
+        // "MemoryObjectCache" would keep the previous frame
+        InvalidateFrame(frameIndex);
+      }
+
+      framesGeneration_++;
+
+      Shard& shard = GetFramesShard(frameIndex);
+      shard.GetCache().Acquire(frameIndex, new FrameItem(*this, shard, bucket, index, frameNumber,
+                                                         framesGeneration_, protection.release()));
+
+      framesIndex_[index][frameNumber] = framesGeneration_;
+
+      // Forget about the frames that were evicted to make room for this frame
+      PruneFramesIndex();
+    }
+  }
+
+
+  void ParsedDicomCache::GetDecodedFramesStatistics(Statistics& target,
+                                                    unsigned int bucket) const
+  {
+    target = Statistics();
+
+    for (size_t i = 0; i < framesShards_.size(); i++)
+    {
+      framesShards_[i]->AddStatistics(target, bucket);
+    }
+  }
+
+
+  void ParsedDicomCache::GetDecodedFramesStatistics(Statistics& target) const
+  {
+    target = Statistics();
+
+    for (size_t i = 0; i < framesShards_.size(); i++)
+    {
+      framesShards_[i]->AddStatistics(target);
+    }
+  }
+
+
+  size_t ParsedDicomCache::GetDecodedFramesIndexSize() const
+  {
+    boost::mutex::scoped_lock lock(framesMutex_);
+    return framesIndex_.size();
   }
 
   
@@ -106,17 +656,22 @@ namespace OrthancStone
      * threads, even if using only getters. An unique lock (mutex) is
      * mandatory.
      **/
-    accessor_(cache.cache_, GetIndex(bucket, bucketKey), true /* unique */)
+    accessor_(cache.GetShard(GetIndex(bucket, bucketKey)).GetCache(),
+              GetIndex(bucket, bucketKey), true /* unique */)
   {
+    Shard& shard = cache.GetShard(GetIndex(bucket, bucketKey));
+
     if (accessor_.IsValid())
     {
       LOG(TRACE) << "accessing item within cache: bucket " << bucket << ", key " << bucketKey;
       item_ = &dynamic_cast<Item&>(accessor_.GetValue());
+      shard.RecordAccess(bucket, true);
     }
     else
     {
       LOG(TRACE) << "missing item within cache: bucket " << bucket << ", key " << bucketKey;
       item_ = NULL;
+      shard.RecordAccess(bucket, false);
     }
   }
 
@@ -158,4 +713,39 @@ namespace OrthancStone
       return item_->GetMemoryUsage();
     }
   }
+
+
+  ParsedDicomCache::FrameReader::FrameReader(ParsedDicomCache& cache,
+                                             unsigned int bucket,
+                                             const std::string& bucketKey,
+                                             unsigned int frameNumber) :
+    accessor_(cache.GetFramesShard(GetFrameIndex(GetIndex(bucket, bucketKey), frameNumber)).GetCache(),
+              GetFrameIndex(GetIndex(bucket, bucketKey), frameNumber), false /* shared */)
+  {
+    Shard& shard = cache.GetFramesShard(GetFrameIndex(GetIndex(bucket, bucketKey), frameNumber));
+
+    if (accessor_.IsValid())
+    {
+      item_ = &dynamic_cast<FrameItem&>(accessor_.GetValue());
+      shard.RecordAccess(bucket, true);
+    }
+    else
+    {
+      item_ = NULL;
+      shard.RecordAccess(bucket, false);
+    }
+  }
+
+
+  const Orthanc::ImageAccessor& ParsedDicomCache::FrameReader::GetFrame() const
+  {
+    if (item_ == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      return item_->GetFrame();
+    }
+  }
 }
@@ -25,32 +25,171 @@
 
 #include <Cache/MemoryObjectCache.h>
 #include <DicomParsing/ParsedDicomFile.h>
+#include <Images/ImageAccessor.h>
+
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <stdint.h>
 
 namespace OrthancStone
 {
+  /**
+   * Cache of parsed DICOM files, indexed by (bucket, bucketKey). The
+   * cache can be split into independent shards, each shard having
+   * its own LRU policy, its own mutex and its own share of the
+   * maximum size. This reduces the contention between the workers of
+   * the oracle that access different DICOM files, but a DICOM file
+   * that is larger than the size of its shard is never cached: The
+   * number of shards must be chosen according to the size of the
+   * largest expected DICOM instance.
+   *
+   * A second tier stores the decoded frames of the DICOM files,
+   * indexed by (bucket, bucketKey, frame number), so that the same
+   * frame is not decoded again each time it is displayed. This tier
+   * has its own memory budget, and is disabled by default.
+   **/
   class ParsedDicomCache : public boost::noncopyable
   {
+  public:
+    class Statistics
+    {
+      friend class ParsedDicomCache;
+
+    private:
+      uint64_t  hits_;
+      uint64_t  misses_;
+      uint64_t  evictions_;
+      uint64_t  evictedBytes_;
+      uint64_t  residentItems_;
+      uint64_t  residentBytes_;
+
+    public:
+      Statistics() :
+        hits_(0),
+        misses_(0),
+        evictions_(0),
+        evictedBytes_(0),
+        residentItems_(0),
+        residentBytes_(0)
+      {
+      }
+
+      uint64_t GetHits() const
+      {
+        return hits_;
+      }
+
+      uint64_t GetMisses() const
+      {
+        return misses_;
+      }
+
+      // Number of items that were removed by the LRU policy (this
+      // excludes the calls to "Invalidate()")
+      uint64_t GetEvictions() const
+      {
+        return evictions_;
+      }
+
+      uint64_t GetEvictedBytes() const
+      {
+        return evictedBytes_;
+      }
+
+      uint64_t GetResidentItems() const
+      {
+        return residentItems_;
+      }
+
+      uint64_t GetResidentBytes() const
+      {
+        return residentBytes_;
+      }
+
+      void Add(const Statistics& other);
+    };
+
   private:
     class Item;
+    class FrameItem;
+    class Shard;
+
+    /**
+     * Decoded frames that are stored for each DICOM file, indexed by
+     * the result of "GetIndex()", together with the generation of
+     * their "FrameItem". The frames that are evicted by the LRU
+     * policy are removed from this index by "PruneFramesIndex()", as
+     * the destructor of "FrameItem" cannot lock "framesMutex_". The
+     * generation prevents the removal of a frame that was stored
+     * again after its eviction.
+     **/
+    typedef std::map<unsigned int, uint64_t>          FramesGenerations;
+    typedef std::map<std::string, FramesGenerations>  FramesIndex;
+
+    struct EvictedFrame
+    {
+      std::string   index_;
+      unsigned int  frameNumber_;
+      uint64_t      generation_;
+    };
 
     static std::string GetIndex(unsigned int bucket,
                                 const std::string& bucketKey);
-    
-    Orthanc::MemoryObjectCache  cache_;
-    size_t                      lowCacheSizeWarning_;
+
+    static std::string GetFrameIndex(const std::string& index,
+                                     unsigned int frame);
+
+    std::vector<Shard*>  shards_;
+    size_t               maximumSize_;
+    size_t               lowCacheSizeWarning_;
+    mutable boost::mutex framesMutex_;   // Protects "framesMaximumSize_", "framesIndex_" and "framesGeneration_"
+    std::vector<Shard*>  framesShards_;
+    size_t               framesMaximumSize_;
+    FramesIndex          framesIndex_;
+    uint64_t             framesGeneration_;
+    boost::mutex         evictedFramesMutex_;   // Protects "evictedFrames_", never locked before "framesMutex_"
+    std::vector<EvictedFrame>  evictedFrames_;
+
+    void Setup(size_t size,
+               unsigned int shardsCount);
+
+    Shard& GetShard(const std::string& index) const;
+
+    Shard& GetFramesShard(const std::string& frameIndex) const;
+
+    // "framesMutex_" must be locked
+    void InvalidateFrame(const std::string& frameIndex);
+
+    void InvalidateFrames(const std::string& index);
+
+    void RecordEvictedFrame(const std::string& index,
+                            unsigned int frameNumber,
+                            uint64_t generation);
+
+    // "framesMutex_" must be locked
+    void PruneFramesIndex();
 
   public:
-    explicit ParsedDicomCache(size_t size) :
-      lowCacheSizeWarning_(0)
+    // Unsharded cache
+    explicit ParsedDicomCache(size_t size);
+
+    ParsedDicomCache(size_t size,
+                     unsigned int shardsCount);
+
+    ~ParsedDicomCache();
+
+    size_t GetMaximumSize() const
     {
-      cache_.SetMaximumSize(size);
+      return maximumSize_;
     }
 
-    void Invalidate(unsigned int bucket,
-                    const std::string& bucketKey)
+    unsigned int GetShardsCount() const
     {
-      cache_.Invalidate(GetIndex(bucket, bucketKey));
+      return static_cast<unsigned int>(shards_.size());
     }
+
+    void Invalidate(unsigned int bucket,
+                    const std::string& bucketKey);
     
     void Acquire(unsigned int bucket,
                  const std::string& bucketKey,
@@ -58,6 +197,38 @@ namespace OrthancStone
                  size_t fileSize,
                  bool hasPixelData);
 
+    // Statistics about one bucket
+    void GetStatistics(Statistics& target,
+                       unsigned int bucket) const;
+
+    // Statistics about all the buckets
+    void GetStatistics(Statistics& target) const;
+
+    // Setting the size to zero disables the cache of decoded frames
+    void SetDecodedFramesCacheSize(size_t size);
+
+    size_t GetDecodedFramesCacheSize() const;
+
+    bool IsDecodedFramesCacheEnabled() const
+    {
+      return GetDecodedFramesCacheSize() != 0;
+    }
+
+    // Takes the ownership of "frame". The frame is discarded if the
+    // cache of decoded frames is disabled.
+    void AcquireDecodedFrame(unsigned int bucket,
+                             const std::string& bucketKey,
+                             unsigned int frameNumber,
+                             Orthanc::ImageAccessor* frame);
+
+    void GetDecodedFramesStatistics(Statistics& target,
+                                    unsigned int bucket) const;
+
+    void GetDecodedFramesStatistics(Statistics& target) const;
+
+    // Number of DICOM files that have decoded frames in the cache
+    size_t GetDecodedFramesIndexSize() const;
+
     class Reader : public boost::noncopyable
     {
     private:
@@ -80,5 +251,30 @@ namespace OrthancStone
 
       size_t GetFileSize() const;
     };
+
+
+    /**
+     * Contrarily to "Reader", several "FrameReader" can access the
+     * same frame at once, as the decoded frames are read-only.
+     **/
+    class FrameReader : public boost::noncopyable
+    {
+    private:
+      Orthanc::MemoryObjectCache::Accessor accessor_;
+      FrameItem*                           item_;
+
+    public:
+      FrameReader(ParsedDicomCache& cache,
+                  unsigned int bucket,
+                  const std::string& bucketKey,
+                  unsigned int frameNumber);
+
+      bool IsValid() const
+      {
+        return item_ != NULL;
+      }
+
+      const Orthanc::ImageAccessor& GetFrame() const;
+    };
   };
 }
@@ -0,0 +1,827 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PixelHistogram.h"
+
+#include "Internals/ParallelRows.h"
+
+#include <Compatibility.h>
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <string.h>  // For memcpy()
+
+#if !defined(ORTHANC_ENABLE_THREADS)
+#  error The macro ORTHANC_ENABLE_THREADS must be defined
+#endif
+
+#if ORTHANC_ENABLE_THREADS == 1
+#  include <boost/thread.hpp>
+#endif
+
+namespace OrthancStone
+{
+  // Anonymous namespace to avoid clashes between compilation modules
+  namespace
+  {
+    // The flat arrays of counters have 65536 entries (16 bits of the keys)
+    static const unsigned int BUCKETS_BITS = 16;
+    static const uint64_t BUCKETS_COUNT = (1u << BUCKETS_BITS);
+
+
+    /**
+     * Maps the pixel values onto unsigned keys that are sorted in the
+     * same order as the values.
+     **/
+    template <typename T>
+    struct KeyTraits;
+
+    template <>
+    struct KeyTraits<uint8_t>
+    {
+      typedef uint32_t  Key;
+
+      static Key ToKey(uint8_t value)
+      {
+        return value;
+      }
+
+      static uint8_t FromKey(Key key)
+      {
+        return static_cast<uint8_t>(key);
+      }
+    };
+
+    template <>
+    struct KeyTraits<uint16_t>
+    {
+      typedef uint32_t  Key;
+
+      static Key ToKey(uint16_t value)
+      {
+        return value;
+      }
+
+      static uint16_t FromKey(Key key)
+      {
+        return static_cast<uint16_t>(key);
+      }
+    };
+
+    template <>
+    struct KeyTraits<int16_t>
+    {
+      typedef uint32_t  Key;
+
+      static Key ToKey(int16_t value)
+      {
+        return static_cast<Key>(static_cast<int32_t>(value) + 32768);
+      }
+
+      static int16_t FromKey(Key key)
+      {
+        return static_cast<int16_t>(static_cast<int32_t>(key) - 32768);
+      }
+    };
+
+    template <>
+    struct KeyTraits<uint32_t>
+    {
+      typedef uint32_t  Key;
+
+      static Key ToKey(uint32_t value)
+      {
+        return value;
+      }
+
+      static uint32_t FromKey(Key key)
+      {
+        return key;
+      }
+    };
+
+    template <>
+    struct KeyTraits<uint64_t>
+    {
+      typedef uint64_t  Key;
+
+      static Key ToKey(uint64_t value)
+      {
+        return value;
+      }
+
+      static uint64_t FromKey(Key key)
+      {
+        return key;
+      }
+    };
+
+    /**
+     * The IEEE 754 representation of positive floats is sorted as
+     * unsigned integers. Setting the sign bit of positive values and
+     * inverting all the bits of negative values sorts all the floats.
+     **/
+    template <>
+    struct KeyTraits<float>
+    {
+      typedef uint32_t  Key;
+
+      static Key ToKey(float value)
+      {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+      }
+
+      static float FromKey(Key key)
+      {
+        const uint32_t bits = (key & 0x80000000u) ? (key & 0x7fffffffu) : ~key;
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+      }
+    };
+
+
+    static size_t GetBinIndex(double value,
+                              double minValue,
+                              double maxValue,
+                              double division,
+                              size_t countBins)
+    {
+      assert(countBins > 0);
+
+      if (value <= minValue)
+      {
+        return 0;
+      }
+      else if (value >= maxValue)
+      {
+        return countBins - 1;
+      }
+      else
+      {
+        size_t index = static_cast<size_t>(std::floor((value - minValue) * division));
+        if (index >= countBins)
+        {
+          index = countBins - 1;
+        }
+
+        return index;
+      }
+    }
+
+
+    /**
+     * The counters below are kernels of "Internals::ParallelRows":
+     * "Process()" counts a band of rows of the image, "CloneEmpty()"
+     * creates a blank counter with the same parameters, to be used by
+     * another thread, and "Merge()" adds the result of another thread.
+     **/
+    template <typename T>
+    class RangeCounter : public boost::noncopyable
+    {
+    public:
+      typedef typename KeyTraits<T>::Key  Key;
+
+    private:
+      bool  hasKeys_;
+      Key   minKey_;
+      Key   maxKey_;
+
+    public:
+      RangeCounter() :
+        hasKeys_(false),
+        minKey_(0),
+        maxKey_(0)
+      {
+      }
+
+      RangeCounter* CloneEmpty() const
+      {
+        return new RangeCounter;
+      }
+
+      void Process(const Orthanc::ImageAccessor& image,
+                   unsigned int firstRow,
+                   unsigned int lastRow)
+      {
+        const unsigned int width = image.GetWidth();
+        if (width == 0)
+        {
+          return;
+        }
+
+        for (unsigned int y = firstRow; y < lastRow; y++)
+        {
+          const T* p = reinterpret_cast<const T*>(image.GetConstRow(y));
+
+          if (!hasKeys_)
+          {
+            hasKeys_ = true;
+            minKey_ = KeyTraits<T>::ToKey(*p);
+            maxKey_ = minKey_;
+          }
+
+          for (unsigned int x = 0; x < width; x++, p++)
+          {
+            const Key key = KeyTraits<T>::ToKey(*p);
+            if (key < minKey_)
+            {
+              minKey_ = key;
+            }
+            else if (key > maxKey_)
+            {
+              maxKey_ = key;
+            }
+          }
+        }
+      }
+
+      void Merge(const RangeCounter& other)
+      {
+        if (other.hasKeys_)
+        {
+          if (hasKeys_)
+          {
+            minKey_ = std::min(minKey_, other.minKey_);
+            maxKey_ = std::max(maxKey_, other.maxKey_);
+          }
+          else
+          {
+            hasKeys_ = true;
+            minKey_ = other.minKey_;
+            maxKey_ = other.maxKey_;
+          }
+        }
+      }
+
+      bool HasKeys() const
+      {
+        return hasKeys_;
+      }
+
+      Key GetMinKey() const
+      {
+        assert(hasKeys_);
+        return minKey_;
+      }
+
+      Key GetMaxKey() const
+      {
+        assert(hasKeys_);
+        return maxKey_;
+      }
+    };
+
+
+    /**
+     * Counts the keys in consecutive buckets of "2^shift" keys,
+     * starting at "firstKey". The keys outside of the buckets are
+     * ignored, which allows to count one window of the keys.
+     **/
+    template <typename T>
+    class KeysCounter : public boost::noncopyable
+    {
+    public:
+      typedef typename KeyTraits<T>::Key  Key;
+
+    private:
+      Key                    firstKey_;
+      unsigned int           shift_;
+      std::vector<uint64_t>  counts_;
+
+    public:
+      KeysCounter(Key firstKey,
+                  unsigned int shift,
+                  size_t countBuckets) :
+        firstKey_(firstKey),
+        shift_(shift),
+        counts_(countBuckets, 0)
+      {
+      }
+
+      KeysCounter* CloneEmpty() const
+      {
+        return new KeysCounter(firstKey_, shift_, counts_.size());
+      }
+
+      void Process(const Orthanc::ImageAccessor& image,
+                   unsigned int firstRow,
+                   unsigned int lastRow)
+      {
+        const unsigned int width = image.GetWidth();
+        const Key countBuckets = static_cast<Key>(counts_.size());
+        uint64_t* counts = counts_.empty() ? NULL : &counts_[0];
+
+        for (unsigned int y = firstRow; y < lastRow; y++)
+        {
+          const T* p = reinterpret_cast<const T*>(image.GetConstRow(y));
+
+          for (unsigned int x = 0; x < width; x++, p++)
+          {
+            const Key key = KeyTraits<T>::ToKey(*p);
+            if (key >= firstKey_)
+            {
+              const Key bucket = (key - firstKey_) >> shift_;
+              if (bucket < countBuckets)
+              {
+                counts[bucket]++;
+              }
+            }
+          }
+        }
+      }
+
+      void Merge(const KeysCounter& other)
+      {
+        assert(counts_.size() == other.counts_.size());
+
+        for (size_t i = 0; i < counts_.size(); i++)
+        {
+          counts_[i] += other.counts_[i];
+        }
+      }
+
+      const std::vector<uint64_t>& GetCounts() const
+      {
+        return counts_;
+      }
+
+      /**
+       * Returns the index of the bucket that contains the key of rank
+       * "rank" (0 being the smallest counted key). On exit, "rank"
+       * contains the rank of this key inside its bucket.
+       **/
+      size_t FindBucket(uint64_t& rank) const
+      {
+        for (size_t i = 0; i < counts_.size(); i++)
+        {
+          if (rank < counts_[i])
+          {
+            return i;
+          }
+          else
+          {
+            rank -= counts_[i];
+          }
+        }
+
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+    };
+
+
+    template <typename T>
+    class BinsCounter : public boost::noncopyable
+    {
+    private:
+      double                 minValue_;
+      double                 maxValue_;
+      double                 binSize_;
+      double                 division_;
+      std::vector<uint64_t>  counts_;
+
+    public:
+      BinsCounter(double minValue,
+                  double maxValue,
+                  double binSize,
+                  size_t countBins) :
+        minValue_(minValue),
+        maxValue_(maxValue),
+        binSize_(binSize),
+        division_(1.0 / binSize),
+        counts_(countBins, 0)
+      {
+      }
+
+      BinsCounter* CloneEmpty() const
+      {
+        return new BinsCounter(minValue_, maxValue_, binSize_, counts_.size());
+      }
+
+      void Process(const Orthanc::ImageAccessor& image,
+                   unsigned int firstRow,
+                   unsigned int lastRow)
+      {
+        const unsigned int width = image.GetWidth();
+
+        for (unsigned int y = firstRow; y < lastRow; y++)
+        {
+          const T* p = reinterpret_cast<const T*>(image.GetConstRow(y));
+
+          for (unsigned int x = 0; x < width; x++, p++)
+          {
+            counts_[GetBinIndex(static_cast<double>(*p), minValue_, maxValue_,
+                                division_, counts_.size())]++;
+          }
+        }
+      }
+
+      void Merge(const BinsCounter& other)
+      {
+        assert(counts_.size() == other.counts_.size());
+
+        for (size_t i = 0; i < counts_.size(); i++)
+        {
+          counts_[i] += other.counts_[i];
+        }
+      }
+
+      const std::vector<uint64_t>& GetCounts() const
+      {
+        return counts_;
+      }
+    };
+
+
+    template <typename T>
+    void ComputeRangeInternal(double& minValue,
+                              double& maxValue,
+                              const Orthanc::ImageAccessor& image,
+                              unsigned int threadsCount)
+    {
+      RangeCounter<T> counter;
+      Internals::ParallelRows::Apply(counter, image, threadsCount);
+
+      if (!counter.HasKeys())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageFormat,
+                                        "Cannot compute the range of an empty image");
+      }
+
+      minValue = static_cast<double>(KeyTraits<T>::FromKey(counter.GetMinKey()));
+      maxValue = static_cast<double>(KeyTraits<T>::FromKey(counter.GetMaxKey()));
+    }
+
+
+    static void CopyBins(HistogramData& target,
+                         const std::vector<uint64_t>& counts)
+    {
+      target.bins.resize(counts.size());
+
+      for (size_t i = 0; i < counts.size(); i++)
+      {
+        target.bins[i] = static_cast<size_t>(counts[i]);
+      }
+    }
+
+
+    template <typename T>
+    void ComputeBinsDirectly(HistogramData& target,
+                             double minValue,
+                             double maxValue,
+                             size_t countBins,
+                             const Orthanc::ImageAccessor& image,
+                             unsigned int threadsCount)
+    {
+      BinsCounter<T> counter(minValue, maxValue, target.binSize, countBins);
+      Internals::ParallelRows::Apply(counter, image, threadsCount);
+      CopyBins(target, counter.GetCounts());
+    }
+
+
+    template <typename T>
+    void ComputeBinsWithKeys(HistogramData& target,
+                             double minValue,
+                             double maxValue,
+                             size_t countBins,
+                             const Orthanc::ImageAccessor& image,
+                             unsigned int threadsCount,
+                             double imageMinValue,
+                             double imageMaxValue)
+    {
+      typedef typename KeyTraits<T>::Key  Key;
+
+      const Key minKey = KeyTraits<T>::ToKey(static_cast<T>(imageMinValue));
+      const Key maxKey = KeyTraits<T>::ToKey(static_cast<T>(imageMaxValue));
+      assert(minKey <= maxKey);
+
+      if (maxKey - minKey >= BUCKETS_COUNT)
+      {
+        ComputeBinsDirectly<T>(target, minValue, maxValue, countBins, image, threadsCount);
+      }
+      else
+      {
+        // Count each distinct value exactly, then dispatch the counters into the bins
+        KeysCounter<T> counter(minKey, 0, static_cast<size_t>(maxKey - minKey) + 1);
+        Internals::ParallelRows::Apply(counter, image, threadsCount);
+
+        std::vector<uint64_t> bins(countBins, 0);
+        const double division = 1.0 / target.binSize;
+
+        const std::vector<uint64_t>& counts = counter.GetCounts();
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+          if (counts[i] != 0)
+          {
+            const double value = static_cast<double>(KeyTraits<T>::FromKey(minKey + static_cast<Key>(i)));
+            bins[GetBinIndex(value, minValue, maxValue, division, countBins)] += counts[i];
+          }
+        }
+
+        CopyBins(target, bins);
+      }
+    }
+
+
+    template <typename T>
+    void ComputeQuantilesInternal(double& lowerValue,
+                                  double& upperValue,
+                                  const Orthanc::ImageAccessor& image,
+                                  unsigned int threadsCount,
+                                  double imageMinValue,
+                                  double imageMaxValue,
+                                  uint64_t lowerRank,
+                                  uint64_t upperRank)
+    {
+      typedef typename KeyTraits<T>::Key  Key;
+
+      const Key minKey = KeyTraits<T>::ToKey(static_cast<T>(imageMinValue));
+      const Key maxKey = KeyTraits<T>::ToKey(static_cast<T>(imageMaxValue));
+      assert(minKey <= maxKey);
+
+      unsigned int shift = 0;
+      while (((maxKey - minKey) >> shift) >= BUCKETS_COUNT)
+      {
+        shift++;
+      }
+
+      // First pass: Direct counters if the keys fit in the array, coarse buckets otherwise
+      KeysCounter<T> coarse(minKey, shift, static_cast<size_t>((maxKey - minKey) >> shift) + 1);
+      Internals::ParallelRows::Apply(coarse, image, threadsCount);
+
+      const size_t lowerBucket = coarse.FindBucket(lowerRank);
+      const size_t upperBucket = coarse.FindBucket(upperRank);
+
+      Key lowerKey, upperKey;
+
+      if (shift == 0)
+      {
+        lowerKey = minKey + static_cast<Key>(lowerBucket);
+        upperKey = minKey + static_cast<Key>(upperBucket);
+      }
+      else
+      {
+        // Second pass: Exact counters inside the buckets containing the two ranks
+        const size_t windowSize = (static_cast<size_t>(1) << shift);
+
+        const Key lowerStart = minKey + (static_cast<Key>(lowerBucket) << shift);
+        KeysCounter<T> lowerWindow(lowerStart, 0, windowSize);
+        Internals::ParallelRows::Apply(lowerWindow, image, threadsCount);
+        lowerKey = lowerStart + static_cast<Key>(lowerWindow.FindBucket(lowerRank));
+
+        if (upperBucket == lowerBucket)
+        {
+          upperKey = lowerStart + static_cast<Key>(lowerWindow.FindBucket(upperRank));
+        }
+        else
+        {
+          const Key upperStart = minKey + (static_cast<Key>(upperBucket) << shift);
+          KeysCounter<T> upperWindow(upperStart, 0, windowSize);
+          Internals::ParallelRows::Apply(upperWindow, image, threadsCount);
+          upperKey = upperStart + static_cast<Key>(upperWindow.FindBucket(upperRank));
+        }
+      }
+
+      lowerValue = static_cast<double>(KeyTraits<T>::FromKey(lowerKey));
+      upperValue = static_cast<double>(KeyTraits<T>::FromKey(upperKey));
+    }
+  }
+
+
+  PixelHistogram::PixelHistogram(const Orthanc::ImageAccessor& image) :
+    image_(image),
+    threadsCount_(1),
+    hasRange_(false),
+    minValue_(0),
+    maxValue_(0)
+  {
+    switch (image.GetFormat())
+    {
+      case Orthanc::PixelFormat_Grayscale8:
+      case Orthanc::PixelFormat_Grayscale16:
+      case Orthanc::PixelFormat_SignedGrayscale16:
+      case Orthanc::PixelFormat_Grayscale32:
+      case Orthanc::PixelFormat_Grayscale64:
+      case Orthanc::PixelFormat_Float32:
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageFormat);
+    }
+  }
+
+
+  void PixelHistogram::SetThreadsCount(unsigned int count)
+  {
+    if (count == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+#if ORTHANC_ENABLE_THREADS != 1
+    if (count > 1)
+    {
+      LOG(WARNING) << "Multithreading is not available, PixelHistogram will use a single thread";
+    }
+#endif
+
+    threadsCount_ = count;
+  }
+
+
+  uint64_t PixelHistogram::GetPixelsCount() const
+  {
+    return static_cast<uint64_t>(image_.GetWidth()) * static_cast<uint64_t>(image_.GetHeight());
+  }
+
+
+  void PixelHistogram::GetRange(double& minValue,
+                                double& maxValue)
+  {
+    if (!hasRange_)
+    {
+      switch (image_.GetFormat())
+      {
+        case Orthanc::PixelFormat_Grayscale8:
+          ComputeRangeInternal<uint8_t>(minValue_, maxValue_, image_, threadsCount_);
+          break;
+
+        case Orthanc::PixelFormat_Grayscale16:
+          ComputeRangeInternal<uint16_t>(minValue_, maxValue_, image_, threadsCount_);
+          break;
+
+        case Orthanc::PixelFormat_SignedGrayscale16:
+          ComputeRangeInternal<int16_t>(minValue_, maxValue_, image_, threadsCount_);
+          break;
+
+        case Orthanc::PixelFormat_Grayscale32:
+          ComputeRangeInternal<uint32_t>(minValue_, maxValue_, image_, threadsCount_);
+          break;
+
+        case Orthanc::PixelFormat_Grayscale64:
+          ComputeRangeInternal<uint64_t>(minValue_, maxValue_, image_, threadsCount_);
+          break;
+
+        case Orthanc::PixelFormat_Float32:
+          ComputeRangeInternal<float>(minValue_, maxValue_, image_, threadsCount_);
+          break;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+
+      hasRange_ = true;
+    }
+
+    minValue = minValue_;
+    maxValue = maxValue_;
+  }
+
+
+  void PixelHistogram::ComputeBins(HistogramData& target,
+                                   double minValue,
+                                   double maxValue,
+                                   double binSize)
+  {
+    if (binSize <= 0 ||
+        minValue >= maxValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    double imageMinValue, imageMaxValue;
+    GetRange(imageMinValue, imageMaxValue);
+
+    target.minValue = minValue;
+    target.binSize = binSize;
+
+    const size_t countBins = static_cast<size_t>(std::ceil((maxValue - minValue) / binSize));
+    if (countBins == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    switch (image_.GetFormat())
+    {
+      case Orthanc::PixelFormat_Grayscale8:
+        ComputeBinsWithKeys<uint8_t>(target, minValue, maxValue, countBins, image_,
+                                     threadsCount_, imageMinValue, imageMaxValue);
+        break;
+
+      case Orthanc::PixelFormat_Grayscale16:
+        ComputeBinsWithKeys<uint16_t>(target, minValue, maxValue, countBins, image_,
+                                      threadsCount_, imageMinValue, imageMaxValue);
+        break;
+
+      case Orthanc::PixelFormat_SignedGrayscale16:
+        ComputeBinsWithKeys<int16_t>(target, minValue, maxValue, countBins, image_,
+                                     threadsCount_, imageMinValue, imageMaxValue);
+        break;
+
+      case Orthanc::PixelFormat_Grayscale32:
+        ComputeBinsWithKeys<uint32_t>(target, minValue, maxValue, countBins, image_,
+                                      threadsCount_, imageMinValue, imageMaxValue);
+        break;
+
+      case Orthanc::PixelFormat_Float32:
+        ComputeBinsWithKeys<float>(target, minValue, maxValue, countBins, image_,
+                                   threadsCount_, imageMinValue, imageMaxValue);
+        break;
+
+      case Orthanc::PixelFormat_Grayscale64:
+        // The 64bit values cannot be recovered from the cached range (stored as "double")
+        ComputeBinsDirectly<uint64_t>(target, minValue, maxValue, countBins, image_, threadsCount_);
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+
+
+  void PixelHistogram::ComputeQuantiles(double& lowerValue,
+                                        double& upperValue,
+                                        uint64_t rejectedCount)
+  {
+    const uint64_t countPixels = GetPixelsCount();
+    if (rejectedCount >= countPixels)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    double imageMinValue, imageMaxValue;
+    GetRange(imageMinValue, imageMaxValue);
+
+    const uint64_t lowerRank = rejectedCount;
+    const uint64_t upperRank = countPixels - 1 - rejectedCount;
+
+    switch (image_.GetFormat())
+    {
+      case Orthanc::PixelFormat_Grayscale8:
+        ComputeQuantilesInternal<uint8_t>(lowerValue, upperValue, image_, threadsCount_,
+                                          imageMinValue, imageMaxValue, lowerRank, upperRank);
+        break;
+
+      case Orthanc::PixelFormat_Grayscale16:
+        ComputeQuantilesInternal<uint16_t>(lowerValue, upperValue, image_, threadsCount_,
+                                           imageMinValue, imageMaxValue, lowerRank, upperRank);
+        break;
+
+      case Orthanc::PixelFormat_SignedGrayscale16:
+        ComputeQuantilesInternal<int16_t>(lowerValue, upperValue, image_, threadsCount_,
+                                          imageMinValue, imageMaxValue, lowerRank, upperRank);
+        break;
+
+      case Orthanc::PixelFormat_Grayscale32:
+        ComputeQuantilesInternal<uint32_t>(lowerValue, upperValue, image_, threadsCount_,
+                                           imageMinValue, imageMaxValue, lowerRank, upperRank);
+        break;
+
+      case Orthanc::PixelFormat_Float32:
+        ComputeQuantilesInternal<float>(lowerValue, upperValue, image_, threadsCount_,
+                                        imageMinValue, imageMaxValue, lowerRank, upperRank);
+        break;
+
+      case Orthanc::PixelFormat_Grayscale64:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+
+
+  unsigned int PixelHistogram::GetHardwareConcurrency()
+  {
+#if ORTHANC_ENABLE_THREADS == 1
+    return std::max(1u, boost::thread::hardware_concurrency());
+#else
+    return 1;
+#endif
+  }
+}
@@ -0,0 +1,108 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "ImageToolbox.h"
+
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+
+namespace OrthancStone
+{
+  /**
+   * Computes statistics about the distribution of the values of a
+   * grayscale image (or of a whole volume, through the internal
+   * image of "ImageBuffer3D"), using flat arrays of counters instead
+   * of associative containers.
+   *
+   * Each pixel value is mapped to an ordered 32bit key. If the keys
+   * of the image span less than 65536 values (which is always the
+   * case for 8bpp and 16bpp formats), the keys are counted exactly
+   * with one counter per key. Otherwise, a first pass counts the
+   * keys in 65536 buckets, and a second pass counts exactly the keys
+   * inside the buckets of interest (two-pass radix). Floating-point
+   * values are handled through their IEEE 754 representation, which
+   * makes the quantiles exact for all the supported formats.
+   *
+   * If more than one thread is allowed, the rows of large images are
+   * split into bands that are counted by separate threads, then the
+   * counters are merged.
+   *
+   * The image is not copied: It must stay alive as long as this
+   * object is used.
+   **/
+  class PixelHistogram : public boost::noncopyable
+  {
+  private:
+    const Orthanc::ImageAccessor&  image_;
+    unsigned int                   threadsCount_;
+    bool                           hasRange_;
+    double                         minValue_;
+    double                         maxValue_;
+
+  public:
+    explicit PixelHistogram(const Orthanc::ImageAccessor& image);
+
+    unsigned int GetThreadsCount() const
+    {
+      return threadsCount_;
+    }
+
+    void SetThreadsCount(unsigned int count);
+
+    uint64_t GetPixelsCount() const;
+
+    /**
+     * Returns the smallest and the largest values of the image. This
+     * is cached, so that it is computed only once.
+     **/
+    void GetRange(double& minValue,
+                  double& maxValue);
+
+    /**
+     * Fills the bins of "target" (cf. "HistogramData"), starting at
+     * "minValue". The values below "minValue" (resp. above
+     * "maxValue") are accumulated into the first (resp. last) bin.
+     **/
+    void ComputeBins(HistogramData& target,
+                     double minValue,
+                     double maxValue,
+                     double binSize);
+
+    /**
+     * Returns the values whose rank in the sorted sequence of the
+     * pixels is "rejectedCount", starting from the smallest value
+     * (in "lowerValue") and from the largest value (in
+     * "upperValue"). In other words, this discards "rejectedCount"
+     * outliers at each end of the distribution. Not available for
+     * 64bpp images.
+     **/
+    void ComputeQuantiles(double& lowerValue,
+                          double& upperValue,
+                          uint64_t rejectedCount);
+
+    // Returns the number of threads that can run concurrently (at least 1)
+    static unsigned int GetHardwareConcurrency();
+  };
+}
@@ -27,7 +27,9 @@
 #include "Extent2D.h"
 #include "FiniteProjectiveCamera.h"
 #include "GeometryToolbox.h"
+#include "Internals/SimdFloat4.h"
 
+#include <Images/Image.h>
 #include <Images/PixelTraits.h>
 #include <Images/ImageProcessing.h>
 #include <OrthancException.h>
@@ -35,8 +37,17 @@
 
 #include <boost/numeric/ublas/matrix_proxy.hpp>
 #include <boost/math/special_functions/round.hpp>
+#include <algorithm>
 #include <cassert>
 
+#if !defined(ORTHANC_ENABLE_THREADS)
+#  error The macro ORTHANC_ENABLE_THREADS must be defined
+#endif
+
+#if ORTHANC_ENABLE_THREADS == 1
+#  include "Internals/WorkersPool.h"
+#endif
+
 
 namespace OrthancStone
 {
@@ -249,7 +260,7 @@ namespace OrthancStone
                                                          double& a22,
                                                          double& b2,
                                                          double& shearedZ,
-                                                         const double sourceZ)
+                                                         const double sourceZ) const
   {
     // Check out: ../../Resources/Computations/ComputeShearOnSlice.py
     assert(IsValidShear(M_shear));
@@ -338,9 +349,427 @@ namespace OrthancStone
   }
 
 
+  namespace
+  {
+    /**
+     * Accumulation of sheared slices into one intermediate image, for
+     * a given range of slices. When multithreading is enabled, each
+     * range of slices has its own accumulator, and the accumulators
+     * are merged once all the slices have been processed.
+     **/
+    template <Orthanc::PixelFormat SourceFormat,
+              IntensityProjection Projection>
+    class ShearAccumulator : public boost::noncopyable
+    {
+    private:
+      typedef Orthanc::PixelTraits<SourceFormat>     SourceTraits;
+      typedef typename SourceTraits::PixelType       SourcePixel;
+
+      const ShearWarpProjectiveTransform&  shearWarp_;
+      const ImageBuffer3D&                 source_;
+      unsigned int                         countSlices_;
+      ImageInterpolation                   shearInterpolation_;
+      Orthanc::Image                       accumulator_;  // Float32
+      Orthanc::Image                       counter_;      // Grayscale16
+      Orthanc::Image                       sheared_;      // Same format as the source
+      std::vector<float>                   row_;          // Scratch buffer
+
+      static float GetInitialValue()
+      {
+        if (Projection == IntensityProjection_Minimum)
+        {
+          return std::numeric_limits<float>::max();
+        }
+        else
+        {
+          // For MIP, this implies that negative values are clamped to zero
+          return 0;
+        }
+      }
+
+      ORTHANC_FORCE_INLINE
+      static float Combine(float accumulated,
+                           float value)
+      {
+        switch (Projection)
+        {
+          case IntensityProjection_Maximum:
+            return (accumulated < value ? value : accumulated);
+
+          case IntensityProjection_Minimum:
+            return (value < accumulated ? value : accumulated);
+
+          case IntensityProjection_Mean:
+            return accumulated + value;
+
+          default:
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+        }
+      }
+
+      // Combines "count" floating-point values into the accumulator
+      static void CombineRow(float* accumulator,
+                             const float* values,
+                             unsigned int count)
+      {
+        unsigned int x = 0;
+
+#if ORTHANC_STONE_HAS_SIMD == 1
+        using namespace Internals::Simd;
+
+        for (; x + 4 <= count; x += 4)
+        {
+          const Float4 a = Load(accumulator + x);
+          const Float4 v = Load(values + x);
+
+          switch (Projection)
+          {
+            case IntensityProjection_Maximum:
+              Store(accumulator + x, Max(a, v));
+              break;
+
+            case IntensityProjection_Minimum:
+              Store(accumulator + x, Min(a, v));
+              break;
+
+            case IntensityProjection_Mean:
+              Store(accumulator + x, Add(a, v));
+              break;
+
+            default:
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+          }
+        }
+#endif
+
+        for (; x < count; x++)
+        {
+          accumulator[x] = Combine(accumulator[x], values[x]);
+        }
+      }
+
+      void AccumulateSlice(unsigned int i)
+      {
+        const unsigned int intermediateWidth = accumulator_.GetWidth();
+        const unsigned int intermediateHeight = accumulator_.GetHeight();
+
+        // (3.a) Compute the shear for this specific slice
+        unsigned int z = static_cast<unsigned int>(
+          boost::math::iround(static_cast<double>(i) /
+                              static_cast<double>(countSlices_) *
+                              static_cast<double>(source_.GetDepth() - 1)));
+      
+        double a11, b1, a22, b2, vz;
+        shearWarp_.ComputeShearOnSlice(a11, b1, a22, b2, vz, static_cast<double>(z) + 0.5);
+
+        // (3.b) Detect the "useful" portion of the intermediate image
+        // for this slice (i.e. the bounding box where the source
+        // slice is mapped to by the shear), so as to update "counter"
+        Matrix a = LinearAlgebra::ZeroMatrix(3, 3);
+        a(0,0) = a11;
+        a(0,2) = b1;
+        a(1,1) = a22;
+        a(1,2) = b2;
+        a(2,2) = 1;
+
+        unsigned int x1, y1, x2, y2;
+        const bool hasExtent = GetProjectiveTransformExtent(x1, y1, x2, y2, a,
+                                                            source_.GetWidth(), source_.GetHeight(),
+                                                            intermediateWidth, intermediateHeight);
+
+        if (hasExtent)
+        {
+          for (unsigned int y = y1; y <= y2; y++)
+          {
+            uint16_t* p = reinterpret_cast<uint16_t*>(counter_.GetRow(y)) + x1;
+            for (unsigned int x = x1; x <= x2; x++, p++)
+            {
+              if (Projection == IntensityProjection_Mean)
+              {
+                *p += 1;
+              }
+              else
+              {
+                // TODO - In the case of MIP/MinIP, "counter" could be
+                // reduced to "PixelFormat_Grayscale8" to reduce
+                // memory usage
+                *p = 1;
+              }
+            }
+          }
+        }
+        else if (Projection == IntensityProjection_Minimum)
+        {
+          // The slice does not contribute to the intermediate image
+          return;
+        }
+
+        {
+          // (3.c) Shear the source slice into a temporary image
+          ImageBuffer3D::SliceReader reader(source_, VolumeProjection_Axial, z);      
+          ApplyAffineTransform(sheared_, reader.GetAccessor(),
+                               a11, 0,   b1,
+                               0,   a22, b2,
+                               shearInterpolation_, true);
+        }
+
+        // (3.d) Accumulate the pixels of the sheared image into
+        // "accumulator". For MinIP, only the bounding box is
+        // considered, as the zeros outside of the sheared slice
+        // would otherwise be the minimum.
+        unsigned int firstX = 0;
+        unsigned int lastX = intermediateWidth;   // Exclusive
+        unsigned int firstY = 0;
+        unsigned int lastY = intermediateHeight;  // Exclusive
+
+        if (Projection == IntensityProjection_Minimum)
+        {
+          firstX = x1;
+          lastX = x2 + 1;
+          firstY = y1;
+          lastY = y2 + 1;
+        }
+
+        for (unsigned int y = firstY; y < lastY; y++)
+        {
+          const SourcePixel* p = reinterpret_cast<const SourcePixel*>(sheared_.GetConstRow(y)) + firstX;
+
+          for (unsigned int x = firstX; x < lastX; x++, p++)
+          {
+            row_[x - firstX] = SourceTraits::PixelToFloat(*p);
+          }
+
+          float* q = reinterpret_cast<float*>(accumulator_.GetRow(y)) + firstX;
+          CombineRow(q, &row_[0], lastX - firstX);
+        }
+      }
+
+    public:
+      ShearAccumulator(const ShearWarpProjectiveTransform& shearWarp,
+                       const ImageBuffer3D& source,
+                       unsigned int countSlices,
+                       ImageInterpolation shearInterpolation) :
+        shearWarp_(shearWarp),
+        source_(source),
+        countSlices_(countSlices),
+        shearInterpolation_(shearInterpolation),
+        accumulator_(Orthanc::PixelFormat_Float32, shearWarp.GetIntermediateWidth(),
+                     shearWarp.GetIntermediateHeight(), false),
+        counter_(Orthanc::PixelFormat_Grayscale16, shearWarp.GetIntermediateWidth(),
+                 shearWarp.GetIntermediateHeight(), false),
+        sheared_(SourceFormat, shearWarp.GetIntermediateWidth(),
+                 shearWarp.GetIntermediateHeight(), false),
+        row_(shearWarp.GetIntermediateWidth())
+      {
+        const float initial = GetInitialValue();
+
+        for (unsigned int y = 0; y < accumulator_.GetHeight(); y++)
+        {
+          float* q = reinterpret_cast<float*>(accumulator_.GetRow(y));
+          for (unsigned int x = 0; x < accumulator_.GetWidth(); x++)
+          {
+            q[x] = initial;
+          }
+        }
+
+        Orthanc::ImageProcessing::Set(counter_, 0);
+      }
+
+      const Orthanc::ImageAccessor& GetAccumulator() const
+      {
+        return accumulator_;
+      }
+
+      const Orthanc::ImageAccessor& GetCounter() const
+      {
+        return counter_;
+      }
+
+      // Slices are indexed from "0" to "countSlices" (inclusive)
+      void AccumulateSlices(unsigned int firstSlice,
+                            unsigned int lastSlice /* exclusive */)
+      {
+        for (unsigned int i = firstSlice; i < lastSlice; i++)
+        {
+          AccumulateSlice(i);
+        }
+      }
+
+      // Merges the result of another thread into this accumulator
+      void Merge(const ShearAccumulator& other)
+      {
+        assert(accumulator_.GetWidth() == other.accumulator_.GetWidth() &&
+               accumulator_.GetHeight() == other.accumulator_.GetHeight());
+
+        const unsigned int width = accumulator_.GetWidth();
+
+        for (unsigned int y = 0; y < accumulator_.GetHeight(); y++)
+        {
+          CombineRow(reinterpret_cast<float*>(accumulator_.GetRow(y)),
+                     reinterpret_cast<const float*>(other.accumulator_.GetConstRow(y)), width);
+
+          uint16_t* p = reinterpret_cast<uint16_t*>(counter_.GetRow(y));
+          const uint16_t* q = reinterpret_cast<const uint16_t*>(other.counter_.GetConstRow(y));
+
+          for (unsigned int x = 0; x < width; x++)
+          {
+            if (Projection == IntensityProjection_Mean)
+            {
+              p[x] += q[x];
+            }
+            else if (q[x] != 0)
+            {
+              p[x] = 1;
+            }
+          }
+        }
+      }
+
+    };
+
+
+#if ORTHANC_ENABLE_THREADS == 1
+    /**
+     * Job of "Internals::WorkersPool" that accumulates consecutive
+     * ranges of slices. The first range is accumulated into the
+     * accumulator of the caller, and each other range into its own
+     * accumulator. The accumulators are merged in the order of the
+     * ranges, so that the result does not depend on the scheduling of
+     * the threads.
+     **/
+    template <typename Accumulator>
+    class SlicesRanges : public Internals::WorkersPool::IJob
+    {
+    private:
+      Accumulator&               first_;
+      std::vector<Accumulator*>  others_;
+      unsigned int               countIterations_;
+      unsigned int               rangeSize_;
+      boost::mutex               mutex_;
+      unsigned int               nextRange_;
+      bool                       success_;
+      Orthanc::ErrorCode         error_;
+
+      void SetError(Orthanc::ErrorCode error)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (success_)
+        {
+          success_ = false;
+          error_ = error;
+        }
+      }
+
+    public:
+      SlicesRanges(Accumulator& first,
+                   const ShearWarpProjectiveTransform& shearWarp,
+                   const ImageBuffer3D& source,
+                   unsigned int countSlices,
+                   ImageInterpolation shearInterpolation,
+                   unsigned int countIterations,
+                   unsigned int countRanges) :
+        first_(first),
+        countIterations_(countIterations),
+        rangeSize_((countIterations + countRanges - 1) / countRanges),
+        nextRange_(0),
+        success_(true),
+        error_(Orthanc::ErrorCode_Success)
+      {
+        try
+        {
+          for (unsigned int i = rangeSize_; i < countIterations; i += rangeSize_)
+          {
+            others_.push_back(new Accumulator(shearWarp, source, countSlices, shearInterpolation));
+          }
+        }
+        catch (...)
+        {
+          for (size_t i = 0; i < others_.size(); i++)
+          {
+            delete others_[i];
+          }
+
+          throw;
+        }
+      }
+
+      virtual ~SlicesRanges()
+      {
+        for (size_t i = 0; i < others_.size(); i++)
+        {
+          delete others_[i];
+        }
+      }
+
+      virtual void Process() ORTHANC_OVERRIDE
+      {
+        for (;;)
+        {
+          unsigned int range;
+
+          {
+            boost::mutex::scoped_lock lock(mutex_);
+
+            if (!success_ ||
+                nextRange_ > others_.size())
+            {
+              return;
+            }
+
+            range = nextRange_++;
+          }
+
+          const unsigned int firstSlice = range * rangeSize_;
+          const unsigned int lastSlice = std::min(firstSlice + rangeSize_, countIterations_);
+
+          try
+          {
+            if (range == 0)
+            {
+              first_.AccumulateSlices(firstSlice, lastSlice);
+            }
+            else
+            {
+              others_[range - 1]->AccumulateSlices(firstSlice, lastSlice);
+            }
+          }
+          catch (Orthanc::OrthancException& e)
+          {
+            SetError(e.GetErrorCode());
+          }
+          catch (std::bad_alloc&)
+          {
+            SetError(Orthanc::ErrorCode_NotEnoughMemory);
+          }
+          catch (...)
+          {
+            SetError(Orthanc::ErrorCode_InternalError);
+          }
+        }
+      }
+
+      // To be called once all the threads have processed the job
+      void Merge()
+      {
+        if (!success_)
+        {
+          throw Orthanc::OrthancException(error_);
+        }
+
+        for (size_t i = 0; i < others_.size(); i++)
+        {
+          first_.Merge(*others_[i]);
+        }
+      }
+    };
+#endif
+  }
+
+
   template <Orthanc::PixelFormat SourceFormat,
             Orthanc::PixelFormat TargetFormat,
-            bool MIP>
+            IntensityProjection Projection>
   static void ApplyAxialInternal(Orthanc::ImageAccessor& target,
                                  float& maxValue,
                                  const Matrix& M_view,
@@ -349,10 +778,11 @@ namespace OrthancStone
                                  double pixelSpacing,
                                  unsigned int countSlices,
                                  ImageInterpolation shearInterpolation,
-                                 ImageInterpolation warpInterpolation)
+                                 ImageInterpolation warpInterpolation,
+                                 unsigned int threadsCount)
   {
-    typedef Orthanc::PixelTraits<SourceFormat> SourceTraits;
     typedef Orthanc::PixelTraits<TargetFormat> TargetTraits;
+    typedef ShearAccumulator<SourceFormat, Projection> Accumulator;
 
     /**
      * Step 1: Precompute some information.
@@ -413,110 +843,33 @@ namespace OrthancStone
      * Step 3: Apply the "shear" part of the transform to form the
      * intermediate image. The sheared images are accumulated into the
      * Float32 image "accumulator". The number of samples available
-     * for each pixel is stored in the "counter" image.
+     * for each pixel is stored in the "counter" image. If multiple
+     * threads are used, each of them accumulates a range of slices
+     * into its own accumulator, then the accumulators are merged.
      **/
 
-    std::unique_ptr<Orthanc::ImageAccessor> accumulator, counter, intermediate;
-
-    accumulator.reset(new Orthanc::Image(Orthanc::PixelFormat_Float32,
-                                         intermediateWidth, intermediateHeight, false));
-    counter.reset(new Orthanc::Image(Orthanc::PixelFormat_Grayscale16,
-                                     intermediateWidth, intermediateHeight, false)); 
-    intermediate.reset(new Orthanc::Image(SourceFormat, intermediateWidth, intermediateHeight, false));
+    const unsigned int countIterations = countSlices + 1;  // Slices are indexed from 0 to countSlices
 
-    Orthanc::ImageProcessing::Set(*accumulator, 0);
-    Orthanc::ImageProcessing::Set(*counter, 0);
+    std::unique_ptr<Accumulator> accumulator
+      (new Accumulator(shearWarp, source, countSlices, shearInterpolation));
 
-    // Loop around the slices of the volume
-    for (unsigned int i = 0; i <= countSlices; i++)
+#if ORTHANC_ENABLE_THREADS == 1
+    if (threadsCount > 1 &&
+        countIterations > 1)
     {
-      // (3.a) Compute the shear for this specific slice
-      unsigned int z = static_cast<unsigned int>(
-        boost::math::iround(static_cast<double>(i) /
-                            static_cast<double>(countSlices) *
-                            static_cast<double>(source.GetDepth() - 1)));
-      
-      double a11, b1, a22, b2, vz;
-      shearWarp.ComputeShearOnSlice(a11, b1, a22, b2, vz, static_cast<double>(z) + 0.5);
-
-
-      {
-        // (3.b) Detect the "useful" portion of the intermediate image
-        // for this slice (i.e. the bounding box where the source
-        // slice is mapped to by the shear), so as to update "counter"
-        Matrix a = LinearAlgebra::ZeroMatrix(3, 3);
-        a(0,0) = a11;
-        a(0,2) = b1;
-        a(1,1) = a22;
-        a(1,2) = b2;
-        a(2,2) = 1;
-
-        unsigned int x1, y1, x2, y2;
-        if (GetProjectiveTransformExtent(x1, y1, x2, y2, a,
-                                         source.GetWidth(), source.GetHeight(),
-                                         intermediateWidth, intermediateHeight))
-        {
-          for (unsigned int y = y1; y <= y2; y++)
-          {
-            uint16_t* p = reinterpret_cast<uint16_t*>(counter->GetRow(y)) + x1;
-            for (unsigned int x = x1; x <= x2; x++, p++)
-            {
-              if (MIP)
-              {
-                // TODO - In the case of MIP, "counter" could be
-                // reduced to "PixelFormat_Grayscale8" to reduce
-                // memory usage
-                *p = 1;
-              }
-              else
-              {
-                *p += 1;
-              }
-            }
-          }
-        }
-      }
+      const unsigned int countRanges = std::min(threadsCount, countIterations);
 
+      SlicesRanges<Accumulator> ranges(*accumulator, shearWarp, source, countSlices,
+                                       shearInterpolation, countIterations, countRanges);
 
-      {
-        // (3.c) Shear the source slice into a temporary image
-        ImageBuffer3D::SliceReader reader(source, VolumeProjection_Axial, z);      
-        ApplyAffineTransform(*intermediate, reader.GetAccessor(),
-                             a11, 0,   b1,
-                             0,   a22, b2,
-                             shearInterpolation, true);
-      }
-      
-
-      for (unsigned int y = 0; y < intermediateHeight; y++)
-      {
-        // (3.d) Accumulate the pixels of the sheared image into "accumulator"
-        const typename SourceTraits::PixelType* p =
-          reinterpret_cast<const typename SourceTraits::PixelType*>(intermediate->GetConstRow(y));
-
-        float* q = reinterpret_cast<float*>(accumulator->GetRow(y));
-      
-        for (unsigned int x = 0; x < intermediateWidth; x++)
-        {
-          float pixel = SourceTraits::PixelToFloat(*p);
-          
-          if (MIP)
-          {
-            // Get maximum for MIP
-            if (*q < pixel)
-            {
-              *q = pixel;
-            }
-          }
-          else
-          {
-            *q += pixel;
-          }
-          
-          p++;
-          q++;
-        }
-      }
+      Internals::WorkersPool pool(countRanges - 1);
+      pool.Run(ranges);
+      ranges.Merge();
+    }
+    else
+#endif
+    {
+      accumulator->AccumulateSlices(0, countIterations);
     }
 
 
@@ -526,15 +879,15 @@ namespace OrthancStone
      * a counter image. "Flatten" these two images into one.
      **/
 
-    intermediate.reset(new Orthanc::Image
-                       (TargetFormat, intermediateWidth, intermediateHeight, false));
+    std::unique_ptr<Orthanc::ImageAccessor> intermediate
+      (new Orthanc::Image(TargetFormat, intermediateWidth, intermediateHeight, false));
 
     maxValue = 0;
     
     for (unsigned int y = 0; y < intermediateHeight; y++)
     {
-      const float *qacc = reinterpret_cast<const float*>(accumulator->GetConstRow(y));
-      const uint16_t *qcount = reinterpret_cast<const uint16_t*>(counter->GetConstRow(y));
+      const float *qacc = reinterpret_cast<const float*>(accumulator->GetAccumulator().GetConstRow(y));
+      const uint16_t *qcount = reinterpret_cast<const uint16_t*>(accumulator->GetCounter().GetConstRow(y));
       typename TargetTraits::PixelType *p =
         reinterpret_cast<typename TargetTraits::PixelType*>(intermediate->GetRow(y));
 
@@ -546,8 +899,15 @@ namespace OrthancStone
         }
         else
         {
-          *p = static_cast<typename TargetTraits::PixelType>
-            (*qacc / static_cast<float>(*qcount));
+          if (Projection == IntensityProjection_Mean)
+          {
+            *p = static_cast<typename TargetTraits::PixelType>
+              (*qacc / static_cast<float>(*qcount));
+          }
+          else
+          {
+            *p = static_cast<typename TargetTraits::PixelType>(*qacc);
+          }
 
           if (*p > maxValue)
           {
@@ -563,7 +923,6 @@ namespace OrthancStone
 
     // We don't need the accumulator images anymore
     accumulator.reset(NULL);
-    counter.reset(NULL);
 
     
     /**
@@ -602,24 +961,36 @@ namespace OrthancStone
                                   const Matrix& M_view,
                                   const ImageBuffer3D& source,
                                   const VolumeImageGeometry& geometry,
-                                  bool mip,
+                                  IntensityProjection projection,
                                   double pixelSpacing,
                                   unsigned int countSlices,
                                   ImageInterpolation shearInterpolation,
-                                  ImageInterpolation warpInterpolation)
+                                  ImageInterpolation warpInterpolation,
+                                  unsigned int threadsCount)
   {
-    if (mip)
+    switch (projection)
     {
-      ApplyAxialInternal<SourceFormat, TargetFormat, true>
-        (target, maxValue, M_view, source, geometry, pixelSpacing,
-         countSlices, shearInterpolation, warpInterpolation);
+      case IntensityProjection_Maximum:
+        ApplyAxialInternal<SourceFormat, TargetFormat, IntensityProjection_Maximum>
+          (target, maxValue, M_view, source, geometry, pixelSpacing,
+           countSlices, shearInterpolation, warpInterpolation, threadsCount);
+        break;
+
+      case IntensityProjection_Minimum:
+        ApplyAxialInternal<SourceFormat, TargetFormat, IntensityProjection_Minimum>
+          (target, maxValue, M_view, source, geometry, pixelSpacing,
+           countSlices, shearInterpolation, warpInterpolation, threadsCount);
+        break;
+
+      case IntensityProjection_Mean:
+        ApplyAxialInternal<SourceFormat, TargetFormat, IntensityProjection_Mean>
+          (target, maxValue, M_view, source, geometry, pixelSpacing,
+           countSlices, shearInterpolation, warpInterpolation, threadsCount);
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
-    else
-    {
-      ApplyAxialInternal<SourceFormat, TargetFormat, false>
-        (target, maxValue, M_view, source, geometry, pixelSpacing,
-         countSlices, shearInterpolation, warpInterpolation);
-    } 
   }
   
 
@@ -637,6 +1008,32 @@ namespace OrthancStone
                                            ImageInterpolation shearInterpolation,
                                            ImageInterpolation warpInterpolation)
   {
+    return ApplyAxial(maxValue, M_view, source, geometry, targetFormat, targetWidth, targetHeight,
+                      (mip ? IntensityProjection_Maximum : IntensityProjection_Mean),
+                      pixelSpacing, countSlices, shearInterpolation, warpInterpolation, 1);
+  }
+
+
+  Orthanc::ImageAccessor*
+  ShearWarpProjectiveTransform::ApplyAxial(float& maxValue,
+                                           const Matrix& M_view,
+                                           const ImageBuffer3D& source,
+                                           const VolumeImageGeometry& geometry,
+                                           Orthanc::PixelFormat targetFormat,
+                                           unsigned int targetWidth,
+                                           unsigned int targetHeight,
+                                           IntensityProjection projection,
+                                           double pixelSpacing,
+                                           unsigned int countSlices,
+                                           ImageInterpolation shearInterpolation,
+                                           ImageInterpolation warpInterpolation,
+                                           unsigned int threadsCount)
+  {
+    if (threadsCount == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
     std::unique_ptr<Orthanc::ImageAccessor> target
       (new Orthanc::Image(targetFormat, targetWidth, targetHeight, false));
     
@@ -645,16 +1042,16 @@ namespace OrthancStone
     {
       ApplyAxialInternal2<Orthanc::PixelFormat_Grayscale16,
                           Orthanc::PixelFormat_Grayscale16>
-        (*target, maxValue, M_view, source, geometry, mip, pixelSpacing,
-         countSlices, shearInterpolation, warpInterpolation);
+        (*target, maxValue, M_view, source, geometry, projection, pixelSpacing,
+         countSlices, shearInterpolation, warpInterpolation, threadsCount);
     }
     else if (source.GetFormat() == Orthanc::PixelFormat_SignedGrayscale16 &&
              targetFormat == Orthanc::PixelFormat_SignedGrayscale16)
     {
       ApplyAxialInternal2<Orthanc::PixelFormat_SignedGrayscale16,
                           Orthanc::PixelFormat_SignedGrayscale16>
-        (*target, maxValue, M_view, source, geometry, mip, pixelSpacing,
-         countSlices, shearInterpolation, warpInterpolation);
+        (*target, maxValue, M_view, source, geometry, projection, pixelSpacing,
+         countSlices, shearInterpolation, warpInterpolation, threadsCount);
     }
     else
     {
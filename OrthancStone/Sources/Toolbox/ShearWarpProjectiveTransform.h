@@ -85,7 +85,7 @@ namespace OrthancStone
                              double& a22,
                              double& b2,
                              double& shearedZ,
-                             const double sourceZ);
+                             const double sourceZ) const;
 
     static Matrix CalibrateView(const Vector& camera,
                                 const Vector& principalPoint,
@@ -103,5 +103,26 @@ namespace OrthancStone
                                               unsigned int countSlices,
                                               ImageInterpolation shearInterpolation,
                                               ImageInterpolation warpInterpolation);
+
+    /**
+     * If "threadsCount > 1", the slices are split into ranges that
+     * are sheared and accumulated in parallel (native targets
+     * only). MIP and MinIP give the same results whatever the number
+     * of threads, whereas the rounding of mean projections might
+     * slightly differ, as the summation order changes.
+     **/
+    static Orthanc::ImageAccessor* ApplyAxial(float& maxValue,
+                                              const Matrix& M_view,  // cf. "CalibrateView()"
+                                              const ImageBuffer3D& source,
+                                              const VolumeImageGeometry& geometry,
+                                              Orthanc::PixelFormat targetFormat,
+                                              unsigned int targetWidth,
+                                              unsigned int targetHeight,
+                                              IntensityProjection projection,
+                                              double pixelSpacing,
+                                              unsigned int countSlices,
+                                              ImageInterpolation shearInterpolation,
+                                              ImageInterpolation warpInterpolation,
+                                              unsigned int threadsCount);
   };
 }
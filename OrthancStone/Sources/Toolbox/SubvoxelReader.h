@@ -27,6 +27,7 @@
 #include "GeometryToolbox.h"
 
 #include <Images/ImageTraits.h>
+#include <OrthancException.h>
 
 #include <boost/noncopyable.hpp>
 #include <cmath>
@@ -44,20 +45,19 @@ namespace OrthancStone
       unsigned int         depth_;
 
     public:
-      explicit SubvoxelReaderBase(const ImageBuffer3D& source) :
+      SubvoxelReaderBase(const ImageBuffer3D& source,
+                         VolumeLayout layout) :
         source_(source),
         width_(source.GetWidth()),
         height_(source.GetHeight()),
         depth_(source.GetDepth())
       {
+        if (source.GetLayout() != layout)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadParameterType);
+        }
       }
 
-      ORTHANC_FORCE_INLINE
-      const Orthanc::ImageAccessor& GetSource() const
-      {
-        return source_.GetInternalImage();
-      }
-      
       ORTHANC_FORCE_INLINE
       unsigned int GetWidth() const
       {
@@ -76,38 +76,46 @@ namespace OrthancStone
         return depth_;
       }
       
+      /**
+       * The voxels are accessed through
+       * "ImageBuffer3D::GetVoxelPointerUnchecked<Layout>()", which
+       * takes care of the memory layout of the volume (including the
+       * DECREASING z-order of the slices in "VolumeLayout_Slices").
+       * The layout is a template parameter of the readers, so that it
+       * is not tested for each voxel. This makes
+       * the "SubvoxelReader" class use the same convention as
+       * "ImageBuffer3D::GetVoxelXXX()".
+       *
+       * WARNING: Until changeset 1782:f053c80ea411, "z" was
+       * directly used, causing this class to have a slice order
+       * that was reversed between "SubvoxelReader" and
+       * "ImageBuffer3D". This notably made
+       * "DicomVolumeImageMPRSlicer" and "DicomVolumeImageReslicer"
+       * inconsistent in sagittal and coronal views (the texture was
+       * flipped along the Y-axis in the canvas).
+       **/
+      template <VolumeLayout Layout,
+                typename PixelType>
       ORTHANC_FORCE_INLINE
-      unsigned int ComputeRow(unsigned int y,
-                              unsigned int z) const
+      const PixelType& GetVoxel(unsigned int x,
+                                unsigned int y,
+                                unsigned int z) const
       {
-        /**
-         * The "(depth_ - 1 - z)" comes from the fact that
-         * "ImageBuffer3D" class stores its slices in DECREASING
-         * z-order along the normal. This computation makes the
-         * "SubvoxelReader" class use the same convention as
-         * "ImageBuffer3D::GetVoxelXXX()".
-         *
-         * WARNING: Until changeset 1782:f053c80ea411, "z" was
-         * directly used, causing this class to have a slice order
-         * that was reversed between "SubvoxelReader" and
-         * "ImageBuffer3D". This notably made
-         * "DicomVolumeImageMPRSlicer" and "DicomVolumeImageReslicer"
-         * inconsistent in sagittal and coronal views (the texture was
-         * flipped along the Y-axis in the canvas).
-         **/
-        return (depth_ - 1 - z) * height_ + y;
+        return *reinterpret_cast<const PixelType*>(source_.GetVoxelPointerUnchecked<Layout>(x, y, z));
       }
     };
   }
 
     
   template <Orthanc::PixelFormat Format,
-            ImageInterpolation Interpolation>
+            ImageInterpolation Interpolation,
+            VolumeLayout Layout = VolumeLayout_Slices>
   class SubvoxelReader;
 
     
-  template <Orthanc::PixelFormat Format>
-  class SubvoxelReader<Format, ImageInterpolation_Nearest> : 
+  template <Orthanc::PixelFormat Format,
+            VolumeLayout Layout>
+  class SubvoxelReader<Format, ImageInterpolation_Nearest, Layout> : 
     public Internals::SubvoxelReaderBase
   {
   public:
@@ -115,7 +123,7 @@ namespace OrthancStone
     typedef typename Traits::PixelType    PixelType;
 
     explicit SubvoxelReader(const ImageBuffer3D& source) :
-      SubvoxelReaderBase(source)
+      SubvoxelReaderBase(source, Layout)
     {
     }
 
@@ -131,8 +139,9 @@ namespace OrthancStone
   };
     
     
-  template <Orthanc::PixelFormat Format>
-  class SubvoxelReader<Format, ImageInterpolation_Bilinear> : 
+  template <Orthanc::PixelFormat Format,
+            VolumeLayout Layout>
+  class SubvoxelReader<Format, ImageInterpolation_Bilinear, Layout> : 
     public Internals::SubvoxelReaderBase
   {
   public:
@@ -140,7 +149,7 @@ namespace OrthancStone
     typedef typename Traits::PixelType    PixelType;
 
     explicit SubvoxelReader(const ImageBuffer3D& source) :
-      SubvoxelReaderBase(source)
+      SubvoxelReaderBase(source, Layout)
     {
     }
 
@@ -164,19 +173,20 @@ namespace OrthancStone
   };
     
 
-  template <Orthanc::PixelFormat Format>
-  class SubvoxelReader<Format, ImageInterpolation_Trilinear> : 
+  template <Orthanc::PixelFormat Format,
+            VolumeLayout Layout>
+  class SubvoxelReader<Format, ImageInterpolation_Trilinear, Layout> : 
     public Internals::SubvoxelReaderBase
   {
   private:
-    SubvoxelReader<Format, ImageInterpolation_Bilinear>   bilinear_;
+    SubvoxelReader<Format, ImageInterpolation_Bilinear, Layout>   bilinear_;
 
   public:
     typedef Orthanc::PixelTraits<Format>  Traits;
     typedef typename Traits::PixelType    PixelType;
 
     explicit SubvoxelReader(const ImageBuffer3D& source) :
-      SubvoxelReaderBase(source),
+      SubvoxelReaderBase(source, Layout),
       bilinear_(source)
     {
     }
@@ -193,11 +203,12 @@ namespace OrthancStone
   };
 
 
-  template <Orthanc::PixelFormat Format>
-  bool SubvoxelReader<Format, ImageInterpolation_Nearest>::GetValue(PixelType& target,
-                                                                    float x,
-                                                                    float y,
-                                                                    float z) const
+  template <Orthanc::PixelFormat Format,
+            VolumeLayout Layout>
+  bool SubvoxelReader<Format, ImageInterpolation_Nearest, Layout>::GetValue(PixelType& target,
+                                                                            float x,
+                                                                            float y,
+                                                                            float z) const
   {
     if (x < 0 ||
         y < 0 ||
@@ -215,7 +226,7 @@ namespace OrthancStone
           uy < GetHeight() &&
           uz < GetDepth())
       {
-        Orthanc::ImageTraits<Format>::GetPixel(target, GetSource(), ux, ComputeRow(uy, uz));
+        target = GetVoxel<Layout, PixelType>(ux, uy, uz);
         return true;
       }
       else
@@ -226,11 +237,12 @@ namespace OrthancStone
   }
 
 
-  template <Orthanc::PixelFormat Format>
-  bool SubvoxelReader<Format, ImageInterpolation_Nearest>::GetFloatValue(float& target,
-                                                                         float x,
-                                                                         float y,
-                                                                         float z) const
+  template <Orthanc::PixelFormat Format,
+            VolumeLayout Layout>
+  bool SubvoxelReader<Format, ImageInterpolation_Nearest, Layout>::GetFloatValue(float& target,
+                                                                                 float x,
+                                                                                 float y,
+                                                                                 float z) const
   {
     PixelType value;
     
@@ -246,20 +258,21 @@ namespace OrthancStone
   }
 
 
-  template <Orthanc::PixelFormat Format>
-  bool SubvoxelReader<Format, ImageInterpolation_Bilinear>::Sample(float& f00,
-                                                                   float& f01,
-                                                                   float& f10,
-                                                                   float& f11,
-                                                                   unsigned int ux,
-                                                                   unsigned int uy,
-                                                                   unsigned int uz) const
+  template <Orthanc::PixelFormat Format,
+            VolumeLayout Layout>
+  bool SubvoxelReader<Format, ImageInterpolation_Bilinear, Layout>::Sample(float& f00,
+                                                                           float& f01,
+                                                                           float& f10,
+                                                                           float& f11,
+                                                                           unsigned int ux,
+                                                                           unsigned int uy,
+                                                                           unsigned int uz) const
   {
     if (ux < GetWidth() &&
         uy < GetHeight() &&
         uz < GetDepth())
     {
-      f00 = Orthanc::ImageTraits<Format>::GetFloatPixel(GetSource(), ux, ComputeRow(uy, uz));
+      f00 = Traits::PixelToFloat(GetVoxel<Layout, PixelType>(ux, uy, uz));
     }
     else
     {
@@ -269,7 +282,7 @@ namespace OrthancStone
 
     if (ux + 1 < GetWidth())
     {
-      f01 = Orthanc::ImageTraits<Format>::GetFloatPixel(GetSource(), ux + 1, ComputeRow(uy, uz));
+      f01 = Traits::PixelToFloat(GetVoxel<Layout, PixelType>(ux + 1, uy, uz));
     }
     else
     {
@@ -278,7 +291,7 @@ namespace OrthancStone
 
     if (uy + 1 < GetHeight())
     {
-      f10 = Orthanc::ImageTraits<Format>::GetFloatPixel(GetSource(), ux, ComputeRow(uy + 1, uz));
+      f10 = Traits::PixelToFloat(GetVoxel<Layout, PixelType>(ux, uy + 1, uz));
     }
     else
     {
@@ -288,7 +301,7 @@ namespace OrthancStone
     if (ux + 1 < GetWidth() &&
         uy + 1 < GetHeight())
     {
-      f11 = Orthanc::ImageTraits<Format>::GetFloatPixel(GetSource(), ux + 1, ComputeRow(uy + 1, uz));
+      f11 = Traits::PixelToFloat(GetVoxel<Layout, PixelType>(ux + 1, uy + 1, uz));
     }
     else
     {
@@ -299,11 +312,12 @@ namespace OrthancStone
   }
 
 
-  template <Orthanc::PixelFormat Format>
-  bool SubvoxelReader<Format, ImageInterpolation_Bilinear>::GetFloatValue(float& target,
-                                                                          float x,
-                                                                          float y,
-                                                                          float z) const
+  template <Orthanc::PixelFormat Format,
+            VolumeLayout Layout>
+  bool SubvoxelReader<Format, ImageInterpolation_Bilinear, Layout>::GetFloatValue(float& target,
+                                                                                  float x,
+                                                                                  float y,
+                                                                                  float z) const
   {
     x -= 0.5f;
     y -= 0.5f;
@@ -337,11 +351,12 @@ namespace OrthancStone
   }
 
 
-  template <Orthanc::PixelFormat Format>
-  bool SubvoxelReader<Format, ImageInterpolation_Bilinear>::GetValue(PixelType& target,
-                                                                     float x,
-                                                                     float y,
-                                                                     float z) const
+  template <Orthanc::PixelFormat Format,
+            VolumeLayout Layout>
+  bool SubvoxelReader<Format, ImageInterpolation_Bilinear, Layout>::GetValue(PixelType& target,
+                                                                             float x,
+                                                                             float y,
+                                                                             float z) const
   {
     float value;
 
@@ -357,11 +372,12 @@ namespace OrthancStone
   }
 
 
-  template <Orthanc::PixelFormat Format>
-  bool SubvoxelReader<Format, ImageInterpolation_Trilinear>::GetFloatValue(float& target,
-                                                                           float x,
-                                                                           float y,
-                                                                           float z) const
+  template <Orthanc::PixelFormat Format,
+            VolumeLayout Layout>
+  bool SubvoxelReader<Format, ImageInterpolation_Trilinear, Layout>::GetFloatValue(float& target,
+                                                                                   float x,
+                                                                                   float y,
+                                                                                   float z) const
   {
     x -= 0.5f;
     y -= 0.5f;
@@ -409,11 +425,12 @@ namespace OrthancStone
   }
 
 
-  template <Orthanc::PixelFormat Format>
-  bool SubvoxelReader<Format, ImageInterpolation_Trilinear>::GetValue(PixelType& target,
-                                                                      float x,
-                                                                      float y,
-                                                                      float z) const
+  template <Orthanc::PixelFormat Format,
+            VolumeLayout Layout>
+  bool SubvoxelReader<Format, ImageInterpolation_Trilinear, Layout>::GetValue(PixelType& target,
+                                                                              float x,
+                                                                              float y,
+                                                                              float z) const
   {
     float value;
 
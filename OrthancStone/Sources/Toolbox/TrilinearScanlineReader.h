@@ -0,0 +1,262 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "SubvoxelReader.h"
+#include "Internals/SimdFloat4.h"
+
+
+namespace OrthancStone
+{
+  /**
+   * Trilinear sampling of a volume, by blocks of "BLOCK_SIZE"
+   * voxels. This class is used to reslice volumes along scanlines:
+   * The computation of the interpolation weights and the blending
+   * of the 8 neighboring voxels are vectorized using SSE2 or NEON,
+   * whereas fetching the voxels themselves remains scalar. If no
+   * SIMD instruction set is available for the target CPU, this class
+   * falls back to "SubvoxelReader<Format, ImageInterpolation_Trilinear>",
+   * that is the reference implementation.
+   **/
+  template <Orthanc::PixelFormat Format,
+            VolumeLayout Layout = VolumeLayout_Slices>
+  class TrilinearScanlineReader : public Internals::SubvoxelReaderBase
+  {
+  public:
+    typedef Orthanc::PixelTraits<Format>  Traits;
+    typedef typename Traits::PixelType    PixelType;
+
+    enum
+    {
+      BLOCK_SIZE = 4
+    };
+
+  private:
+    SubvoxelReader<Format, ImageInterpolation_Trilinear, Layout>  reference_;
+
+    ORTHANC_FORCE_INLINE
+    float GetFloatVoxel(unsigned int x,
+                        unsigned int y,
+                        unsigned int z) const
+    {
+      return Traits::PixelToFloat(GetVoxel<Layout, PixelType>(x, y, z));
+    }
+
+    // Same as "SubvoxelReader<Format, ImageInterpolation_Bilinear>::Sample()",
+    // for a voxel that is known to be inside the volume
+    inline void SampleCorners(float& f00,
+                              float& f01,
+                              float& f10,
+                              float& f11,
+                              unsigned int ux,
+                              unsigned int uy,
+                              unsigned int uz) const;
+
+  public:
+    explicit TrilinearScanlineReader(const ImageBuffer3D& source) :
+      SubvoxelReaderBase(source, Layout),
+      reference_(source)
+    {
+    }
+
+    static bool IsSimdAvailable()
+    {
+#if ORTHANC_STONE_HAS_SIMD == 1
+      return true;
+#else
+      return false;
+#endif
+    }
+
+    /**
+     * Samples the "BLOCK_SIZE" voxels whose coordinates are given in
+     * the "x", "y" and "z" arrays. The returned value is a bitmask
+     * whose bit "i" is set iff. "target[i]" is inside the volume
+     * (the value of "target[i]" is unspecified otherwise).
+     **/
+    inline unsigned int GetFloatValues(float* target,
+                                       const float* x,
+                                       const float* y,
+                                       const float* z) const;
+
+    // Scalar reference implementation of "GetFloatValues()"
+    inline unsigned int GetFloatValuesScalar(float* target,
+                                             const float* x,
+                                             const float* y,
+                                             const float* z) const;
+  };
+
+
+  template <Orthanc::PixelFormat Format,
+            VolumeLayout Layout>
+  void TrilinearScanlineReader<Format, Layout>::SampleCorners(float& f00,
+                                                              float& f01,
+                                                              float& f10,
+                                                              float& f11,
+                                                              unsigned int ux,
+                                                              unsigned int uy,
+                                                              unsigned int uz) const
+  {
+    assert(ux < GetWidth() &&
+           uy < GetHeight() &&
+           uz < GetDepth());
+
+    f00 = GetFloatVoxel(ux, uy, uz);
+
+    const bool hasNextX = (ux + 1 < GetWidth());
+    const bool hasNextY = (uy + 1 < GetHeight());
+
+    f01 = (hasNextX ? GetFloatVoxel(ux + 1, uy, uz) : f00);
+
+    if (hasNextY)
+    {
+      f10 = GetFloatVoxel(ux, uy + 1, uz);
+      f11 = (hasNextX ? GetFloatVoxel(ux + 1, uy + 1, uz) : f00);
+    }
+    else
+    {
+      f10 = f00;
+      f11 = f00;
+    }
+  }
+
+
+  template <Orthanc::PixelFormat Format,
+            VolumeLayout Layout>
+  unsigned int TrilinearScanlineReader<Format, Layout>::GetFloatValuesScalar(float* target,
+                                                                             const float* x,
+                                                                             const float* y,
+                                                                             const float* z) const
+  {
+    unsigned int inside = 0;
+
+    for (unsigned int i = 0; i < BLOCK_SIZE; i++)
+    {
+      if (reference_.GetFloatValue(target[i], x[i], y[i], z[i]))
+      {
+        inside |= (1u << i);
+      }
+    }
+
+    return inside;
+  }
+
+
+  template <Orthanc::PixelFormat Format,
+            VolumeLayout Layout>
+  unsigned int TrilinearScanlineReader<Format, Layout>::GetFloatValues(float* target,
+                                                                       const float* x,
+                                                                       const float* y,
+                                                                       const float* z) const
+  {
+#if ORTHANC_STONE_HAS_SIMD == 1
+    using namespace Internals::Simd;
+
+    const Float4 zero = Splat(0.0f);
+    const Float4 half = Splat(0.5f);
+    const Float4 one = Splat(1.0f);
+    const Float4 depth = Splat(static_cast<float>(GetDepth()));
+
+    // Same convention as "SubvoxelReader<Format, ImageInterpolation_Trilinear>"
+    const Float4 vx = Sub(Load(x), half);
+    const Float4 vy = Sub(Load(y), half);
+    const Float4 vz = Sub(Load(z), half);
+
+    // As the coordinates are non-negative, "floor(v) < size" is equivalent to "v < size"
+    const Mask4 mask = And(And(IsInRange(vx, zero, Splat(static_cast<float>(GetWidth()))),
+                               IsInRange(vy, zero, Splat(static_cast<float>(GetHeight())))),
+                           IsInRange(vz, zero, depth));
+
+    const unsigned int inside = GetBits(mask);
+    if (inside == 0)
+    {
+      return 0;
+    }
+
+    // Clear the lanes that are outside of the volume, to prevent
+    // overflows in the conversion to integers
+    const Float4 cx = Keep(vx, mask);
+    const Float4 cy = Keep(vy, mask);
+    const Float4 cz = Keep(vz, mask);
+
+    int32_t ux[BLOCK_SIZE], uy[BLOCK_SIZE], uz[BLOCK_SIZE];
+    const Float4 fz = Floor(uz, cz);
+    const Float4 ax = Sub(cx, Floor(ux, cx));
+    const Float4 ay = Sub(cy, Floor(uy, cy));
+    const Float4 az = Sub(cz, fz);
+    const Mask4 hasUpper = IsLess(Add(fz, one), depth);
+
+    float f000[BLOCK_SIZE], f001[BLOCK_SIZE], f010[BLOCK_SIZE], f011[BLOCK_SIZE];
+    float f100[BLOCK_SIZE], f101[BLOCK_SIZE], f110[BLOCK_SIZE], f111[BLOCK_SIZE];
+
+    for (unsigned int i = 0; i < BLOCK_SIZE; i++)
+    {
+      if (inside & (1u << i))
+      {
+        const unsigned int lx = static_cast<unsigned int>(ux[i]);
+        const unsigned int ly = static_cast<unsigned int>(uy[i]);
+        const unsigned int lz = static_cast<unsigned int>(uz[i]);
+
+        SampleCorners(f000[i], f001[i], f010[i], f011[i], lx, ly, lz);
+
+        if (lz + 1 < GetDepth())
+        {
+          SampleCorners(f100[i], f101[i], f110[i], f111[i], lx, ly, lz + 1);
+        }
+        else
+        {
+          f100[i] = f101[i] = f110[i] = f111[i] = 0;
+        }
+      }
+      else
+      {
+        f000[i] = f001[i] = f010[i] = f011[i] = 0;
+        f100[i] = f101[i] = f110[i] = f111[i] = 0;
+      }
+    }
+
+    // Same operations as "GeometryToolbox::ComputeBilinearInterpolationUnitSquare()"
+    const Float4 bx = Sub(one, ax);
+    const Float4 by = Sub(one, ay);
+
+    const Float4 a = Add(Add(Add(Mul(Mul(Load(f000), bx), by),
+                                 Mul(Mul(Load(f001), ax), by)),
+                             Mul(Mul(Load(f010), bx), ay)),
+                         Mul(Mul(Load(f011), ax), ay));
+
+    const Float4 b = Add(Add(Add(Mul(Mul(Load(f100), bx), by),
+                                 Mul(Mul(Load(f101), ax), by)),
+                             Mul(Mul(Load(f110), bx), ay)),
+                         Mul(Mul(Load(f111), ax), ay));
+
+    // Same operations as "GeometryToolbox::ComputeTrilinearInterpolationUnitSquare()"
+    const Float4 trilinear = Add(Mul(Sub(one, az), a), Mul(az, b));
+
+    Store(target, Select(hasUpper, trilinear, a));
+    return inside;
+
+#else
+    return GetFloatValuesScalar(target, x, y, z);
+#endif
+  }
+}
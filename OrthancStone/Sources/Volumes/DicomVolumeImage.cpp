@@ -42,11 +42,12 @@ namespace OrthancStone
   void DicomVolumeImage::Initialize(
     const VolumeImageGeometry& geometry,
     Orthanc::PixelFormat format, 
-    bool computeRange)
+    bool computeRange,
+    VolumeLayout layout)
   {
     geometry_.reset(new VolumeImageGeometry(geometry));
     image_.reset(new ImageBuffer3D(format, geometry_->GetWidth(), geometry_->GetHeight(),
-                                   geometry_->GetDepth(), computeRange));
+                                   geometry_->GetDepth(), computeRange, layout));
 
     revision_ ++;
   }
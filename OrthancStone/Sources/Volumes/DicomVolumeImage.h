@@ -63,7 +63,8 @@ namespace OrthancStone
 
     void Initialize(const VolumeImageGeometry& geometry,
                     Orthanc::PixelFormat format, 
-                    bool computeRange = false);
+                    bool computeRange = false,
+                    VolumeLayout layout = VolumeLayout_Slices);
 
     // Used by volume slicers
     void SetDicomParameters(const DicomInstanceParameters& parameters);
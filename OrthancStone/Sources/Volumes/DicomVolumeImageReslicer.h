@@ -65,6 +65,16 @@ namespace OrthancStone
     {
       reslicer_.EnableFastMode(fast);
     }
+
+    unsigned int GetThreadsCount() const
+    {
+      return reslicer_.GetThreadsCount();
+    }
+
+    void SetThreadsCount(unsigned int count)
+    {
+      reslicer_.SetThreadsCount(count);
+    }
     
     virtual IExtractedSlice* ExtractSlice(const CoordinateSystem3D& cuttingPlane) ORTHANC_OVERRIDE;
   };
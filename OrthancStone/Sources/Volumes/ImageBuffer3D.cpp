@@ -75,31 +75,119 @@ namespace OrthancStone
   }
 
 
-  Orthanc::Image*  ImageBuffer3D::ExtractSagittalSlice(unsigned int slice) const
+  bool ImageBuffer3D::HasDirectAccess(VolumeProjection projection) const
   {
-    if (slice >= width_)
+    return (layout_ == VolumeLayout_Slices &&
+            (projection == VolumeProjection_Axial ||
+             projection == VolumeProjection_Coronal));
+  }
+
+
+  /**
+   * Maps the pixel (x,y) of a slice extracted along "projection" to
+   * the coordinates of the corresponding voxel. The Y-axis of the
+   * coronal and sagittal slices is made of decreasing "z", for
+   * consistency with "GetCoronalSliceAccessor()".
+   **/
+  static void MapSlicePixelToVoxel(unsigned int& voxelX,
+                                   unsigned int& voxelY,
+                                   unsigned int& voxelZ,
+                                   VolumeProjection projection,
+                                   unsigned int slice,
+                                   unsigned int depth,
+                                   unsigned int x,
+                                   unsigned int y)
+  {
+    switch (projection)
+    {
+      case VolumeProjection_Axial:
+        voxelX = x;
+        voxelY = y;
+        voxelZ = slice;
+        break;
+
+      case VolumeProjection_Coronal:
+        voxelX = x;
+        voxelY = slice;
+        voxelZ = depth - 1 - y;
+        break;
+
+      case VolumeProjection_Sagittal:
+        voxelX = slice;
+        voxelY = x;
+        voxelZ = depth - 1 - y;
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  static void GetSliceSize(unsigned int& sliceWidth,
+                           unsigned int& sliceHeight,
+                           unsigned int& countSlices,
+                           VolumeProjection projection,
+                           unsigned int width,
+                           unsigned int height,
+                           unsigned int depth)
+  {
+    switch (projection)
+    {
+      case VolumeProjection_Axial:
+        sliceWidth = width;
+        sliceHeight = height;
+        countSlices = depth;
+        break;
+
+      case VolumeProjection_Coronal:
+        sliceWidth = width;
+        sliceHeight = depth;
+        countSlices = height;
+        break;
+
+      case VolumeProjection_Sagittal:
+        sliceWidth = height;
+        sliceHeight = depth;
+        countSlices = width;
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  Orthanc::Image*  ImageBuffer3D::ExtractSlice(VolumeProjection projection,
+                                               unsigned int slice) const
+  {
+    unsigned int sliceWidth, sliceHeight, countSlices;
+    GetSliceSize(sliceWidth, sliceHeight, countSlices, projection, width_, height_, depth_);
+
+    if (slice >= countSlices)
     {
       throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
     
-    std::unique_ptr<Orthanc::Image> result(new Orthanc::Image(format_, height_, depth_, false));
-
-    const unsigned int bytesPerPixel = Orthanc::GetBytesPerPixel(format_);
+    std::unique_ptr<Orthanc::Image> result(new Orthanc::Image(format_, sliceWidth, sliceHeight, false));
 
-    for (unsigned int z = 0; z < depth_; z++)
+    for (unsigned int y = 0; y < sliceHeight; y++)
     {
-      uint8_t* q = reinterpret_cast<uint8_t*>(result->GetRow(z));
+      uint8_t* q = reinterpret_cast<uint8_t*>(result->GetRow(y));
 
-      for (unsigned int y = 0; y < height_; y++)
+      for (unsigned int x = 0; x < sliceWidth; x++)
       {
-        const uint8_t* p = reinterpret_cast<const uint8_t*>(image_.GetConstRow(y + z * height_)) + bytesPerPixel * slice;
+        unsigned int vx, vy, vz;
+        MapSlicePixelToVoxel(vx, vy, vz, projection, slice, depth_, x, y);
+
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(GetVoxelPointerUnchecked(vx, vy, vz));
         
-        for (size_t x = 0; x < bytesPerPixel; ++x)
+        for (size_t i = 0; i < bytesPerPixel_; ++i)
         {
-          q[x] = p[x];
+          q[i] = p[i];
         }
         
-        q += bytesPerPixel;
+        q += bytesPerPixel_;
       }
     }
 
@@ -107,54 +195,104 @@ namespace OrthancStone
   }
 
 
-  void ImageBuffer3D::CommitSagittalSlice(unsigned int slice,
-                                          const Orthanc::ImageAccessor& source)
+  void ImageBuffer3D::CommitSlice(VolumeProjection projection,
+                                  unsigned int slice,
+                                  const Orthanc::ImageAccessor& source)
   {
-    if (slice >= width_)
+    unsigned int sliceWidth, sliceHeight, countSlices;
+    GetSliceSize(sliceWidth, sliceHeight, countSlices, projection, width_, height_, depth_);
+
+    if (slice >= countSlices)
     {
       throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
-    
-    const unsigned int bytesPerPixel = Orthanc::GetBytesPerPixel(format_);
 
-    for (unsigned int z = 0; z < depth_; z++)
+    if (source.GetFormat() != format_ ||
+        source.GetWidth() != sliceWidth ||
+        source.GetHeight() != sliceHeight)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageSize);
+    }
+    
+    for (unsigned int y = 0; y < sliceHeight; y++)
     {
-      const uint8_t* p = reinterpret_cast<const uint8_t*>(source.GetConstRow(z));
+      const uint8_t* p = reinterpret_cast<const uint8_t*>(source.GetConstRow(y));
 
-      for (unsigned int y = 0; y < height_; y++)
+      for (unsigned int x = 0; x < sliceWidth; x++)
       {
-        uint8_t* q = reinterpret_cast<uint8_t*>(image_.GetRow(y + z * height_)) + bytesPerPixel * slice;
+        unsigned int vx, vy, vz;
+        MapSlicePixelToVoxel(vx, vy, vz, projection, slice, depth_, x, y);
+
+        // The "const_cast" is OK, as this method is not const
+        uint8_t* q = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(GetVoxelPointerUnchecked(vx, vy, vz)));
 
-        for (size_t x = 0; x < bytesPerPixel; ++x)
+        for (size_t i = 0; i < bytesPerPixel_; ++i)
         {
-          q[x] = p[x];
+          q[i] = p[i];
         }
         
-        p += bytesPerPixel;
+        p += bytesPerPixel_;
       }
     }
   }    
 
 
+  static unsigned int GetBricksCount(unsigned int size)
+  {
+    return (size + ImageBuffer3D::BRICK_SIZE - 1) / ImageBuffer3D::BRICK_SIZE;
+  }
+
+
   ImageBuffer3D::ImageBuffer3D(Orthanc::PixelFormat format,
                                unsigned int width,
                                unsigned int height,
                                unsigned int depth,
-                               bool computeRange) :
-    image_(format, width, height * depth, false),
+                               bool computeRange,
+                               VolumeLayout layout) :
+    layout_(layout),
     format_(format),
+    bytesPerPixel_(Orthanc::GetBytesPerPixel(format)),
     width_(width),
     height_(height),
     depth_(depth),
+    bricksX_(layout == VolumeLayout_Bricks ? GetBricksCount(width) : 0),
+    bricksY_(layout == VolumeLayout_Bricks ? GetBricksCount(height) : 0),
+    image_(format,
+           layout == VolumeLayout_Bricks ? BRICK_SIZE * BRICK_SIZE * BRICK_SIZE : width,
+           layout == VolumeLayout_Bricks ? bricksX_ * bricksY_ * GetBricksCount(depth) : height * depth,
+           false),
+    voxels_(reinterpret_cast<const uint8_t*>(image_.GetConstBuffer())),
+    pitch_(image_.GetPitch()),
     computeRange_(computeRange),
     hasRange_(false)
   {
+    if (layout != VolumeLayout_Slices &&
+        layout != VolumeLayout_Bricks)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    
     LOG(TRACE) << "Created a 3D image of size " << width << "x" << height
               << "x" << depth << " in " << Orthanc::EnumerationToString(format)
+              << (layout == VolumeLayout_Bricks ? " with bricks" : "")
               << " (" << (GetEstimatedMemorySize() / (1024ll * 1024ll)) << "MB)";
   }
 
 
+  const Orthanc::ImageAccessor& ImageBuffer3D::GetInternalImage() const
+  {
+    if (layout_ == VolumeLayout_Slices)
+    {
+      return image_;
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls,
+                                      "The internal image is only available for volumes stored as slices");
+    }
+  }
+
+
   void ImageBuffer3D::Clear()
   {
     memset(image_.GetBuffer(), 0, image_.GetHeight() * image_.GetPitch());
@@ -240,23 +378,26 @@ namespace OrthancStone
      * are set to "true", which implies read-only access.
      **/
     
-    switch (projection)
+    if (that.HasDirectAccess(projection))
     {
-      case VolumeProjection_Axial:
-        const_cast<ImageBuffer3D&>(that).GetAxialSliceAccessor(accessor_, slice, true);
-        break;
-
-      case VolumeProjection_Coronal:
-        const_cast<ImageBuffer3D&>(that).GetCoronalSliceAccessor(accessor_, slice, true);
-        break;
+      switch (projection)
+      {
+        case VolumeProjection_Axial:
+          const_cast<ImageBuffer3D&>(that).GetAxialSliceAccessor(accessor_, slice, true);
+          break;
 
-      case VolumeProjection_Sagittal:
-        sagittal_.reset(that.ExtractSagittalSlice(slice));
-        sagittal_->GetReadOnlyAccessor(accessor_);
-        break;
+        case VolumeProjection_Coronal:
+          const_cast<ImageBuffer3D&>(that).GetCoronalSliceAccessor(accessor_, slice, true);
+          break;
 
-      default:
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+    }
+    else
+    {
+      copy_.reset(that.ExtractSlice(projection, slice));
+      copy_->GetReadOnlyAccessor(accessor_);
     }
   }
 
@@ -265,13 +406,10 @@ namespace OrthancStone
   {
     if (modified_)
     {
-      if (sagittal_.get() != NULL)
+      if (copy_.get() != NULL)
       {
-        assert(sagittal_->GetWidth() == that_.height_ &&
-               sagittal_->GetHeight() == that_.depth_ &&
-               sagittal_->GetFormat() == that_.format_);
-
-        that_.CommitSagittalSlice(slice_, *sagittal_);
+        assert(copy_->GetFormat() == that_.format_);
+        that_.CommitSlice(projection_, slice_, *copy_);
       }
 
       // Update the dynamic range of the underlying image, if
@@ -286,25 +424,29 @@ namespace OrthancStone
                                           unsigned int slice) :
     that_(that),
     modified_(false),
+    projection_(projection),
     slice_(slice)
   {
-    switch (projection)
+    if (that.HasDirectAccess(projection))
     {
-      case VolumeProjection_Axial:
-        that.GetAxialSliceAccessor(accessor_, slice, false);
-        break;
-
-      case VolumeProjection_Coronal:
-        that.GetCoronalSliceAccessor(accessor_, slice, false);
-        break;
+      switch (projection)
+      {
+        case VolumeProjection_Axial:
+          that.GetAxialSliceAccessor(accessor_, slice, false);
+          break;
 
-      case VolumeProjection_Sagittal:
-        sagittal_.reset(that.ExtractSagittalSlice(slice));
-        sagittal_->GetWriteableAccessor(accessor_);
-        break;
+        case VolumeProjection_Coronal:
+          that.GetCoronalSliceAccessor(accessor_, slice, false);
+          break;
 
-      default:
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+    }
+    else
+    {
+      copy_.reset(that.ExtractSlice(projection, slice));
+      copy_->GetWriteableAccessor(accessor_);
     }
   }
 
@@ -338,8 +480,7 @@ namespace OrthancStone
       throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
 
-    const void* p = image_.GetConstRow(y + height_ * (depth_ - 1 - z));
-    return reinterpret_cast<const uint8_t*>(p) [x];
+    return GetPixelUnchecked<uint8_t>(x, y, z);
   }
 
 
@@ -359,7 +500,6 @@ namespace OrthancStone
       throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
 
-    const void* p = image_.GetConstRow(y + height_ * (depth_ - 1 - z));
-    return reinterpret_cast<const uint16_t*>(p) [x];
+    return GetPixelUnchecked<uint16_t>(x, y, z);
   }
 }
@@ -29,6 +29,8 @@
 #include <Compatibility.h>
 #include <Images/Image.h>
 
+#include <cassert>
+
 namespace OrthancStone
 {
   /*
@@ -90,16 +92,44 @@ namespace OrthancStone
   with the Z-axis in coronal projection. The sagittal projection
   nevertheless needs a memcpy.
 
+
+  ALTERNATIVE LAYOUT: If "VolumeLayout_Bricks" is provided to the
+  constructor, the volume is rather stored as a set of cubic bricks of
+  "BRICK_SIZE^3" voxels. The voxels inside one brick are stored in
+  Morton order (i.e. the bits of the x, y and z coordinates are
+  interleaved), and the bricks themselves are stored in increasing
+  x, then y, then z order. Neighboring voxels along any of the 3 axes
+  are thus close in memory, which improves the cache behavior of
+  oblique reslicing and of sagittal slices. The price to pay is that
+  "SliceReader" and "SliceWriter" always work on a copy of the slice,
+  and that "GetInternalImage()" is not available. The Z-axis is not
+  swapped in this layout, which is transparent for the users of the
+  class.
+
   */
 
   class ImageBuffer3D : public boost::noncopyable
   {
+  public:
+    enum
+    {
+      BRICK_BITS = 4,
+      BRICK_SIZE = (1 << BRICK_BITS),   // 16 voxels along each axis
+      BRICK_MASK = BRICK_SIZE - 1
+    };
+
   private:
-    Orthanc::Image         image_;
+    VolumeLayout           layout_;
     Orthanc::PixelFormat   format_;
+    unsigned int           bytesPerPixel_;
     unsigned int           width_;
     unsigned int           height_;
     unsigned int           depth_;
+    unsigned int           bricksX_;  // Only for "VolumeLayout_Bricks"
+    unsigned int           bricksY_;  // Only for "VolumeLayout_Bricks"
+    Orthanc::Image         image_;
+    const uint8_t*         voxels_;   // Buffer of "image_", cached for "GetVoxelPointerUnchecked()"
+    size_t                 pitch_;    // Pitch of "image_", cached for "GetVoxelPointerUnchecked()"
     bool                   computeRange_;
     bool                   hasRange_;
     float                  minValue_;
@@ -117,19 +147,30 @@ namespace OrthancStone
                                  unsigned int slice,
                                  bool readOnly);
 
-    Orthanc::Image*  ExtractSagittalSlice(unsigned int slice) const;
+    bool HasDirectAccess(VolumeProjection projection) const;
 
-    void CommitSagittalSlice(unsigned int slice,
-                             const Orthanc::ImageAccessor& source);
+    Orthanc::Image*  ExtractSlice(VolumeProjection projection,
+                                  unsigned int slice) const;
+
+    void CommitSlice(VolumeProjection projection,
+                     unsigned int slice,
+                     const Orthanc::ImageAccessor& source);
+
+    // Spreads the 4 lowest bits of "v" over the bits 0, 3, 6 and 9
+    static unsigned int SpreadBits(unsigned int v)
+    {
+      return ((v & 1u) |
+              ((v & 2u) << 2) |
+              ((v & 4u) << 4) |
+              ((v & 8u) << 6));
+    }
 
     template <typename T>
     T GetPixelUnchecked(unsigned int x,
                         unsigned int y,
                         unsigned int z) const
     {
-      const uint8_t* buffer = reinterpret_cast<const uint8_t*>(image_.GetConstBuffer());
-      const uint8_t* row = buffer + (y + height_ * (depth_ - 1 - z)) * image_.GetPitch();
-      return reinterpret_cast<const T*>(row) [x];
+      return *reinterpret_cast<const T*>(GetVoxelPointerUnchecked(x, y, z));
     }
 
   public:
@@ -137,15 +178,36 @@ namespace OrthancStone
                   unsigned int width,
                   unsigned int height,
                   unsigned int depth,
-                  bool computeRange);
+                  bool computeRange,
+                  VolumeLayout layout = VolumeLayout_Slices);
 
     void Clear();
 
-    const Orthanc::ImageAccessor& GetInternalImage() const
+    VolumeLayout GetLayout() const
     {
-      return image_;
+      return layout_;
     }
 
+    // Only available with "VolumeLayout_Slices"
+    const Orthanc::ImageAccessor& GetInternalImage() const;
+
+    /**
+     * Returns a pointer to the memory storing voxel (x,y,z), for a
+     * volume whose layout is known at compile time (this must match
+     * "GetLayout()"). No bound checking is done: This is the entry
+     * point used by "SubvoxelReader", which avoids testing the layout
+     * for each voxel in the reslicing loops.
+     **/
+    template <VolumeLayout Layout>
+    const void* GetVoxelPointerUnchecked(unsigned int x,
+                                         unsigned int y,
+                                         unsigned int z) const;
+
+    // Same as above, but the layout is tested at runtime
+    inline const void* GetVoxelPointerUnchecked(unsigned int x,
+                                                unsigned int y,
+                                                unsigned int z) const;
+
     unsigned int GetWidth() const
     {
       return width_;
@@ -168,7 +230,7 @@ namespace OrthancStone
 
     unsigned int GetBytesPerPixel() const
     {
-      return Orthanc::GetBytesPerPixel(format_);
+      return bytesPerPixel_;
     }
 
     uint64_t GetEstimatedMemorySize() const;
@@ -210,7 +272,7 @@ namespace OrthancStone
     {
     private:
       Orthanc::ImageAccessor         accessor_;
-      std::unique_ptr<Orthanc::Image>  sagittal_;  // Unused for axial and coronal
+      std::unique_ptr<Orthanc::Image>  copy_;  // Unused if direct access to the memory is possible
 
     public:
       SliceReader(const ImageBuffer3D& that,
@@ -230,7 +292,8 @@ namespace OrthancStone
       ImageBuffer3D&                 that_;
       bool                           modified_;
       Orthanc::ImageAccessor         accessor_;
-      std::unique_ptr<Orthanc::Image>  sagittal_;  // Unused for axial and coronal
+      std::unique_ptr<Orthanc::Image>  copy_;  // Unused if direct access to the memory is possible
+      VolumeProjection               projection_;
       unsigned int                   slice_;
 
       void Flush();
@@ -254,4 +317,47 @@ namespace OrthancStone
       }
     };
   };
+
+
+  template <>
+  inline const void* ImageBuffer3D::GetVoxelPointerUnchecked<VolumeLayout_Slices>(unsigned int x,
+                                                                                  unsigned int y,
+                                                                                  unsigned int z) const
+  {
+    assert(layout_ == VolumeLayout_Slices);
+    const uint8_t* row = voxels_ + static_cast<size_t>(y + height_ * (depth_ - 1 - z)) * pitch_;
+    return row + x * bytesPerPixel_;
+  }
+
+
+  template <>
+  inline const void* ImageBuffer3D::GetVoxelPointerUnchecked<VolumeLayout_Bricks>(unsigned int x,
+                                                                                  unsigned int y,
+                                                                                  unsigned int z) const
+  {
+    assert(layout_ == VolumeLayout_Bricks);
+
+    // Each row of "image_" corresponds to one brick
+    const unsigned int brick = (((z >> BRICK_BITS) * bricksY_ + (y >> BRICK_BITS)) * bricksX_ +
+                                (x >> BRICK_BITS));
+    const unsigned int offset = (SpreadBits(x & BRICK_MASK) |
+                                 (SpreadBits(y & BRICK_MASK) << 1) |
+                                 (SpreadBits(z & BRICK_MASK) << 2));
+    return voxels_ + static_cast<size_t>(brick) * pitch_ + offset * bytesPerPixel_;
+  }
+
+
+  const void* ImageBuffer3D::GetVoxelPointerUnchecked(unsigned int x,
+                                                      unsigned int y,
+                                                      unsigned int z) const
+  {
+    if (layout_ == VolumeLayout_Slices)
+    {
+      return GetVoxelPointerUnchecked<VolumeLayout_Slices>(x, y, z);
+    }
+    else
+    {
+      return GetVoxelPointerUnchecked<VolumeLayout_Bricks>(x, y, z);
+    }
+  }
 }
@@ -24,19 +24,33 @@
 #include "VolumeReslicer.h"
 
 #include "../Toolbox/GeometryToolbox.h"
+#include "../Toolbox/Internals/ParallelRows.h"
 #include "../Toolbox/SubvoxelReader.h"
+#include "../Toolbox/TrilinearScanlineReader.h"
 
 #include <Images/ImageTraits.h>
 #include <Logging.h>
 #include <OrthancException.h>
 
 #include <boost/math/special_functions/round.hpp>
+#include <algorithm>  // For std::min()
+
+#if !defined(ORTHANC_ENABLE_THREADS)
+#  error The macro ORTHANC_ENABLE_THREADS must be defined
+#endif
 
 namespace OrthancStone
 {
   // Anonymous namespace to avoid clashes between compilation modules
   namespace
   {
+#if ORTHANC_ENABLE_THREADS == 1
+    // Reslicing a pixel is much more expensive than the processing of
+    // "Internals::ParallelRows::GetMinPixelsPerBand()", and the
+    // threads of the pool only have to be woken up
+    static const uint64_t MIN_PIXELS_PER_BAND = 1024;
+#endif
+
     enum TransferFunction
     {
       TransferFunction_Copy,
@@ -45,30 +59,65 @@ namespace OrthancStone
     };
 
 
+    /**
+     * Value of the pixels outside of the volume, if none is provided:
+     * This is the minimum of the input format, as set by
+     * "PixelTraits::SetMinValue()" in the nearest-neighbor shaders.
+     * For floats, this is "-FLT_MAX", whereas
+     * "std::numeric_limits<float>::min()" would be "FLT_MIN".
+     **/
+    template <Orthanc::PixelFormat InputFormat>
+    static float GetOutOfVolumeValue(bool hasOutOfVolumeValue,
+                                     float outOfVolumeValue)
+    {
+      if (hasOutOfVolumeValue)
+      {
+        return outOfVolumeValue;
+      }
+      else
+      {
+        typedef Orthanc::PixelTraits<InputFormat>  Traits;
+
+        typename Traits::PixelType value;
+        Traits::SetMinValue(value);
+        return Traits::PixelToFloat(value);
+      }
+    }
+
+
     template <Orthanc::PixelFormat InputFormat,
               Orthanc::PixelFormat OutputFormat,
               ImageInterpolation Interpolation,
-              TransferFunction Function>
+              TransferFunction Function,
+              VolumeLayout Layout>
     class PixelShader;
 
     
-    template <Orthanc::PixelFormat Format>
+    template <Orthanc::PixelFormat Format,
+              VolumeLayout Layout>
     class PixelShader<Format, 
                       Format, 
                       ImageInterpolation_Nearest, 
-                      TransferFunction_Copy>
+                      TransferFunction_Copy,
+                      Layout>
     {
     private:
-      typedef SubvoxelReader<Format, ImageInterpolation_Nearest>  VoxelReader;
+      typedef SubvoxelReader<Format, ImageInterpolation_Nearest, Layout>  VoxelReader;
       typedef Orthanc::PixelTraits<Format>                        PixelWriter;
 
       VoxelReader  reader_;
+      bool         hasOutOfVolumeValue_;
+      float        outOfVolumeValue_;
       
     public:
       PixelShader(const ImageBuffer3D& image,
                   float /* scaling */,
-                  float /* offset */) :
-        reader_(image)
+                  float /* offset */,
+                  bool hasOutOfVolumeValue,
+                  float outOfVolumeValue) :
+        reader_(image),
+        hasOutOfVolumeValue_(hasOutOfVolumeValue),
+        outOfVolumeValue_(outOfVolumeValue)
       {
       }
       
@@ -82,7 +131,14 @@ namespace OrthancStone
 
         if (!reader_.GetValue(value, volumeX, volumeY, volumeZ))
         {
-          VoxelReader::Traits::SetMinValue(value);
+          if (hasOutOfVolumeValue_)
+          {
+            VoxelReader::Traits::FloatToPixel(value, outOfVolumeValue_);
+          }
+          else
+          {
+            VoxelReader::Traits::SetMinValue(value);
+          }
         }
 
         *pixel = value;
@@ -91,23 +147,31 @@ namespace OrthancStone
 
     
     template <Orthanc::PixelFormat InputFormat,
-              Orthanc::PixelFormat OutputFormat>
+              Orthanc::PixelFormat OutputFormat,
+              VolumeLayout Layout>
     class PixelShader<InputFormat, 
                       OutputFormat, 
                       ImageInterpolation_Nearest, 
-                      TransferFunction_Copy>
+                      TransferFunction_Copy,
+                      Layout>
     {
     private:
-      typedef SubvoxelReader<InputFormat, ImageInterpolation_Nearest>  VoxelReader;
-      typedef Orthanc::PixelTraits<OutputFormat>                       PixelWriter;
+      typedef SubvoxelReader<InputFormat, ImageInterpolation_Nearest, Layout>  VoxelReader;
+      typedef Orthanc::PixelTraits<OutputFormat>                               PixelWriter;
 
       VoxelReader  reader_;
+      bool         hasOutOfVolumeValue_;
+      float        outOfVolumeValue_;
       
     public:
       PixelShader(const ImageBuffer3D& image,
                   float /* scaling */,
-                  float /* offset */) :
-        reader_(image)
+                  float /* offset */,
+                  bool hasOutOfVolumeValue,
+                  float outOfVolumeValue) :
+        reader_(image),
+        hasOutOfVolumeValue_(hasOutOfVolumeValue),
+        outOfVolumeValue_(outOfVolumeValue)
       {
       }
       
@@ -119,27 +183,36 @@ namespace OrthancStone
       {
         typename VoxelReader::PixelType value;
 
-        if (!reader_.GetValue(value, volumeX, volumeY, volumeZ))
+        if (reader_.GetValue(value, volumeX, volumeY, volumeZ))
+        {
+          PixelWriter::FloatToPixel(*pixel, VoxelReader::Traits::PixelToFloat(value));
+        }
+        else if (hasOutOfVolumeValue_)
+        {
+          PixelWriter::FloatToPixel(*pixel, outOfVolumeValue_);
+        }
+        else
         {
           VoxelReader::Traits::SetMinValue(value);
+          PixelWriter::FloatToPixel(*pixel, VoxelReader::Traits::PixelToFloat(value));
         }
-
-        PixelWriter::FloatToPixel(*pixel, VoxelReader::Traits::PixelToFloat(value));
       }        
     };
 
     
     template <Orthanc::PixelFormat InputFormat,
               Orthanc::PixelFormat OutputFormat,
-              ImageInterpolation Interpolation>
+              ImageInterpolation Interpolation,
+              VolumeLayout Layout>
     class PixelShader<InputFormat,
                       OutputFormat,
                       Interpolation,
-                      TransferFunction_Float>
+                      TransferFunction_Float,
+                      Layout>
     {
     private:
-      typedef SubvoxelReader<InputFormat, Interpolation>  VoxelReader;
-      typedef Orthanc::PixelTraits<OutputFormat>          PixelWriter;
+      typedef SubvoxelReader<InputFormat, Interpolation, Layout>  VoxelReader;
+      typedef Orthanc::PixelTraits<OutputFormat>                  PixelWriter;
 
       VoxelReader  reader_;
       float        outOfVolume_;
@@ -147,9 +220,11 @@ namespace OrthancStone
     public:
       PixelShader(const ImageBuffer3D& image,
                   float /* scaling */,
-                  float /* offset */) :
+                  float /* offset */,
+                  bool hasOutOfVolumeValue,
+                  float outOfVolumeValue) :
         reader_(image),
-        outOfVolume_(static_cast<float>(std::numeric_limits<typename VoxelReader::PixelType>::min()))
+        outOfVolume_(GetOutOfVolumeValue<InputFormat>(hasOutOfVolumeValue, outOfVolumeValue))
       {
       }
       
@@ -173,15 +248,17 @@ namespace OrthancStone
     
    template <Orthanc::PixelFormat InputFormat,
              Orthanc::PixelFormat OutputFormat,
-             ImageInterpolation Interpolation>
+             ImageInterpolation Interpolation,
+             VolumeLayout Layout>
     class PixelShader<InputFormat,
                       OutputFormat,
                       Interpolation,
-                      TransferFunction_Linear>
+                      TransferFunction_Linear,
+                      Layout>
     {
     private:
-      typedef SubvoxelReader<InputFormat, Interpolation>  VoxelReader;
-      typedef Orthanc::PixelTraits<OutputFormat>          PixelWriter;
+      typedef SubvoxelReader<InputFormat, Interpolation, Layout>  VoxelReader;
+      typedef Orthanc::PixelTraits<OutputFormat>                  PixelWriter;
 
       VoxelReader  reader_;
       float        scaling_;
@@ -191,11 +268,13 @@ namespace OrthancStone
     public:
       PixelShader(const ImageBuffer3D& image,
                   float scaling,
-                  float offset) :
+                  float offset,
+                  bool hasOutOfVolumeValue,
+                  float outOfVolumeValue) :
         reader_(image),
         scaling_(scaling),
         offset_(offset),
-        outOfVolume_(static_cast<float>(std::numeric_limits<typename VoxelReader::PixelType>::min()))
+        outOfVolume_(GetOutOfVolumeValue<InputFormat>(hasOutOfVolumeValue, outOfVolumeValue))
       {
       }
       
@@ -339,27 +418,34 @@ namespace OrthancStone
               Orthanc::PixelFormat InputFormat,
               Orthanc::PixelFormat OutputFormat,
               ImageInterpolation Interpolation,
-              TransferFunction Function>
+              TransferFunction Function,
+              VolumeLayout Layout>
     static void ProcessImage(Orthanc::ImageAccessor& slice,
                              const Extent2D& extent,
                              const ImageBuffer3D& source,
                              const CoordinateSystem3D& plane,
                              const OrientedVolumeBoundingBox& box,
                              float scaling,
-                             float offset)
+                             float offset,
+                             bool hasOutOfVolumeValue,
+                             float outOfVolumeValue,
+                             unsigned int firstRow,
+                             unsigned int lastRow)
     {
-      typedef PixelShader<InputFormat, OutputFormat, Interpolation, Function>   Shader;
+      typedef PixelShader<InputFormat, OutputFormat, Interpolation, Function, Layout>   Shader;
+
+      assert(firstRow <= lastRow &&
+             lastRow <= slice.GetHeight());
 
       const unsigned int outputWidth = slice.GetWidth();
-      const unsigned int outputHeight = slice.GetHeight();
 
       const float sourceWidth = static_cast<float>(source.GetWidth());
       const float sourceHeight = static_cast<float>(source.GetHeight());
       const float sourceDepth = static_cast<float>(source.GetDepth());
 
-      Shader shader(source, scaling, offset);
+      Shader shader(source, scaling, offset, hasOutOfVolumeValue, outOfVolumeValue);
 
-      for (unsigned int y = 0; y < outputHeight; y++)
+      for (unsigned int y = firstRow; y < lastRow; y++)
       {
         typedef typename Orthanc::ImageTraits<OutputFormat>::PixelType PixelType;
         PixelType* p = reinterpret_cast<PixelType*>(slice.GetRow(y));
@@ -382,6 +468,103 @@ namespace OrthancStone
 
 
     template <typename RowIterator,
+              Orthanc::PixelFormat InputFormat,
+              Orthanc::PixelFormat OutputFormat,
+              TransferFunction Function,
+              VolumeLayout Layout>
+    static void ProcessImageTrilinearSimd(Orthanc::ImageAccessor& slice,
+                                          const Extent2D& extent,
+                                          const ImageBuffer3D& source,
+                                          const CoordinateSystem3D& plane,
+                                          const OrientedVolumeBoundingBox& box,
+                                          float scaling,
+                                          float offset,
+                                          bool hasOutOfVolumeValue,
+                                          float outOfVolumeValue,
+                                          unsigned int firstRow,
+                                          unsigned int lastRow)
+    {
+      typedef TrilinearScanlineReader<InputFormat, Layout>                                            VoxelReader;
+      typedef Orthanc::PixelTraits<OutputFormat>                                                      PixelWriter;
+      typedef PixelShader<InputFormat, OutputFormat, ImageInterpolation_Trilinear, Function, Layout>  Shader;
+
+      assert(Function == TransferFunction_Float ||
+             Function == TransferFunction_Linear);
+      assert(firstRow <= lastRow &&
+             lastRow <= slice.GetHeight());
+
+      const unsigned int blockSize = VoxelReader::BLOCK_SIZE;
+      const unsigned int outputWidth = slice.GetWidth();
+
+      const float sourceWidth = static_cast<float>(source.GetWidth());
+      const float sourceHeight = static_cast<float>(source.GetHeight());
+      const float sourceDepth = static_cast<float>(source.GetDepth());
+      const float outOfVolume = GetOutOfVolumeValue<InputFormat>(hasOutOfVolumeValue, outOfVolumeValue);
+
+      VoxelReader reader(source);
+      Shader shader(source, scaling, offset, hasOutOfVolumeValue, outOfVolumeValue);  // For the last pixels of each row
+
+      for (unsigned int y = firstRow; y < lastRow; y++)
+      {
+        typedef typename Orthanc::ImageTraits<OutputFormat>::PixelType PixelType;
+        PixelType* p = reinterpret_cast<PixelType*>(slice.GetRow(y));
+
+        RowIterator it(slice, extent, plane, box, y);
+
+        unsigned int x = 0;
+
+        while (x + blockSize <= outputWidth)
+        {
+          float volumeX[blockSize], volumeY[blockSize], volumeZ[blockSize];
+
+          for (unsigned int i = 0; i < blockSize; i++)
+          {
+            it.GetVolumeCoordinates(volumeX[i], volumeY[i], volumeZ[i]);
+            volumeX[i] *= sourceWidth;
+            volumeY[i] *= sourceHeight;
+            volumeZ[i] *= sourceDepth;
+            it.Next();
+          }
+
+          float values[blockSize];
+          const unsigned int inside = reader.GetFloatValues(values, volumeX, volumeY, volumeZ);
+
+          for (unsigned int i = 0; i < blockSize; i++, p++)
+          {
+            float value;
+
+            if (inside & (1u << i))
+            {
+              value = (Function == TransferFunction_Linear ? scaling * values[i] + offset : values[i]);
+            }
+            else
+            {
+              value = outOfVolume;
+            }
+
+            PixelWriter::FloatToPixel(*p, value);
+          }
+
+          x += blockSize;
+        }
+
+        for (; x < outputWidth; x++, p++)
+        {
+          float volumeX, volumeY, volumeZ;
+          it.GetVolumeCoordinates(volumeX, volumeY, volumeZ);
+
+          shader.Apply(p, 
+                       volumeX * sourceWidth, 
+                       volumeY * sourceHeight, 
+                       volumeZ * sourceDepth);
+          it.Next();
+        }
+      }
+    }
+
+
+    template <typename RowIterator,
+              VolumeLayout Layout,
               Orthanc::PixelFormat InputFormat,
               Orthanc::PixelFormat OutputFormat>
     static void ProcessImage(Orthanc::ImageAccessor& slice,
@@ -392,7 +575,12 @@ namespace OrthancStone
                              ImageInterpolation interpolation,
                              bool hasLinearFunction,
                              float scaling,
-                             float offset)
+                             float offset,
+                             bool hasOutOfVolumeValue,
+                             float outOfVolumeValue,
+                             bool simd,
+                             unsigned int firstRow,
+                             unsigned int lastRow)
     {
       if (hasLinearFunction)
       {
@@ -400,20 +588,28 @@ namespace OrthancStone
         {
           case ImageInterpolation_Nearest:
             ProcessImage<RowIterator, InputFormat, OutputFormat,
-                         ImageInterpolation_Nearest, TransferFunction_Linear>
-              (slice, extent, source, plane, box, scaling, offset);
+                         ImageInterpolation_Nearest, TransferFunction_Linear, Layout>
+              (slice, extent, source, plane, box, scaling, offset, hasOutOfVolumeValue, outOfVolumeValue, firstRow, lastRow);
             break;
 
           case ImageInterpolation_Bilinear:
             ProcessImage<RowIterator, InputFormat, OutputFormat,
-                         ImageInterpolation_Bilinear, TransferFunction_Linear>
-              (slice, extent, source, plane, box, scaling, offset);
+                         ImageInterpolation_Bilinear, TransferFunction_Linear, Layout>
+              (slice, extent, source, plane, box, scaling, offset, hasOutOfVolumeValue, outOfVolumeValue, firstRow, lastRow);
             break;
 
           case ImageInterpolation_Trilinear:
-            ProcessImage<RowIterator, InputFormat, OutputFormat,
-                         ImageInterpolation_Trilinear, TransferFunction_Linear>
-              (slice, extent, source, plane, box, scaling, offset);
+            if (simd)
+            {
+              ProcessImageTrilinearSimd<RowIterator, InputFormat, OutputFormat, TransferFunction_Linear, Layout>
+                (slice, extent, source, plane, box, scaling, offset, hasOutOfVolumeValue, outOfVolumeValue, firstRow, lastRow);
+            }
+            else
+            {
+              ProcessImage<RowIterator, InputFormat, OutputFormat,
+                           ImageInterpolation_Trilinear, TransferFunction_Linear, Layout>
+                (slice, extent, source, plane, box, scaling, offset, hasOutOfVolumeValue, outOfVolumeValue, firstRow, lastRow);
+            }
             break;
 
           default:
@@ -426,20 +622,28 @@ namespace OrthancStone
         {
           case ImageInterpolation_Nearest:
             ProcessImage<RowIterator, InputFormat, OutputFormat,
-                         ImageInterpolation_Nearest, TransferFunction_Copy>
-              (slice, extent, source, plane, box, 0, 0);
+                         ImageInterpolation_Nearest, TransferFunction_Copy, Layout>
+              (slice, extent, source, plane, box, 0, 0, hasOutOfVolumeValue, outOfVolumeValue, firstRow, lastRow);
             break;
 
           case ImageInterpolation_Bilinear:
             ProcessImage<RowIterator, InputFormat, OutputFormat,
-                         ImageInterpolation_Bilinear, TransferFunction_Float>
-              (slice, extent, source, plane, box, 0, 0);
+                         ImageInterpolation_Bilinear, TransferFunction_Float, Layout>
+              (slice, extent, source, plane, box, 0, 0, hasOutOfVolumeValue, outOfVolumeValue, firstRow, lastRow);
             break;
 
           case ImageInterpolation_Trilinear:
-            ProcessImage<RowIterator, InputFormat, OutputFormat,
-                         ImageInterpolation_Trilinear, TransferFunction_Float>
-              (slice, extent, source, plane, box, 0, 0);
+            if (simd)
+            {
+              ProcessImageTrilinearSimd<RowIterator, InputFormat, OutputFormat, TransferFunction_Float, Layout>
+                (slice, extent, source, plane, box, 0, 0, hasOutOfVolumeValue, outOfVolumeValue, firstRow, lastRow);
+            }
+            else
+            {
+              ProcessImage<RowIterator, InputFormat, OutputFormat,
+                           ImageInterpolation_Trilinear, TransferFunction_Float, Layout>
+                (slice, extent, source, plane, box, 0, 0, hasOutOfVolumeValue, outOfVolumeValue, firstRow, lastRow);
+            }
             break;
 
           default:
@@ -449,7 +653,8 @@ namespace OrthancStone
     }
     
     
-    template <typename RowIterator>
+    template <typename RowIterator,
+              VolumeLayout Layout>
     static void ProcessImage(Orthanc::ImageAccessor& slice,
                              const Extent2D& extent,
                              const ImageBuffer3D& source,
@@ -458,53 +663,231 @@ namespace OrthancStone
                              ImageInterpolation interpolation,
                              bool hasLinearFunction,
                              float scaling,
-                             float offset)
+                             float offset,
+                             bool hasOutOfVolumeValue,
+                             float outOfVolumeValue,
+                             bool simd,
+                             unsigned int firstRow,
+                             unsigned int lastRow)
     {
       if (source.GetFormat() == Orthanc::PixelFormat_Grayscale8 &&
           slice.GetFormat() == Orthanc::PixelFormat_Grayscale8)
       {
-        ProcessImage<RowIterator,
+        ProcessImage<RowIterator, Layout,
                      Orthanc::PixelFormat_Grayscale8,
                      Orthanc::PixelFormat_Grayscale8>
-          (slice, extent, source, plane, box, interpolation, hasLinearFunction, scaling, offset);
+          (slice, extent, source, plane, box, interpolation, hasLinearFunction, scaling, offset, hasOutOfVolumeValue, outOfVolumeValue, simd, firstRow, lastRow);
       }
       else if (source.GetFormat() == Orthanc::PixelFormat_Grayscale16 &&
                slice.GetFormat() == Orthanc::PixelFormat_Grayscale8)
       {
-        ProcessImage<RowIterator,
+        ProcessImage<RowIterator, Layout,
                      Orthanc::PixelFormat_Grayscale16,
                      Orthanc::PixelFormat_Grayscale8>
-          (slice, extent, source, plane, box, interpolation, hasLinearFunction, scaling, offset);
+          (slice, extent, source, plane, box, interpolation, hasLinearFunction, scaling, offset, hasOutOfVolumeValue, outOfVolumeValue, simd, firstRow, lastRow);
       }
       else if (source.GetFormat() == Orthanc::PixelFormat_Grayscale16 &&
                slice.GetFormat() == Orthanc::PixelFormat_Grayscale16)
       {
-        ProcessImage<RowIterator,
+        ProcessImage<RowIterator, Layout,
                      Orthanc::PixelFormat_Grayscale16,
                      Orthanc::PixelFormat_Grayscale16>
-          (slice, extent, source, plane, box, interpolation, hasLinearFunction, scaling, offset);
+          (slice, extent, source, plane, box, interpolation, hasLinearFunction, scaling, offset, hasOutOfVolumeValue, outOfVolumeValue, simd, firstRow, lastRow);
       }
       else if (source.GetFormat() == Orthanc::PixelFormat_SignedGrayscale16 &&
                slice.GetFormat() == Orthanc::PixelFormat_BGRA32)
       {
-        ProcessImage<RowIterator,
+        ProcessImage<RowIterator, Layout,
                      Orthanc::PixelFormat_SignedGrayscale16,
                      Orthanc::PixelFormat_BGRA32>
-          (slice, extent, source, plane, box, interpolation, hasLinearFunction, scaling, offset);
+          (slice, extent, source, plane, box, interpolation, hasLinearFunction, scaling, offset, hasOutOfVolumeValue, outOfVolumeValue, simd, firstRow, lastRow);
       }
       else if (source.GetFormat() == Orthanc::PixelFormat_Grayscale16 &&
                slice.GetFormat() == Orthanc::PixelFormat_BGRA32)
       {
-        ProcessImage<RowIterator,
+        ProcessImage<RowIterator, Layout,
                      Orthanc::PixelFormat_Grayscale16,
                      Orthanc::PixelFormat_BGRA32>
-          (slice, extent, source, plane, box, interpolation, hasLinearFunction, scaling, offset);
+          (slice, extent, source, plane, box, interpolation, hasLinearFunction, scaling, offset, hasOutOfVolumeValue, outOfVolumeValue, simd, firstRow, lastRow);
+      }
+      else if (source.GetFormat() == Orthanc::PixelFormat_Float32 &&
+               slice.GetFormat() == Orthanc::PixelFormat_Grayscale8)
+      {
+        ProcessImage<RowIterator, Layout,
+                     Orthanc::PixelFormat_Float32,
+                     Orthanc::PixelFormat_Grayscale8>
+          (slice, extent, source, plane, box, interpolation, hasLinearFunction, scaling, offset, hasOutOfVolumeValue, outOfVolumeValue, simd, firstRow, lastRow);
+      }
+      else if (source.GetFormat() == Orthanc::PixelFormat_Float32 &&
+               slice.GetFormat() == Orthanc::PixelFormat_Grayscale16)
+      {
+        ProcessImage<RowIterator, Layout,
+                     Orthanc::PixelFormat_Float32,
+                     Orthanc::PixelFormat_Grayscale16>
+          (slice, extent, source, plane, box, interpolation, hasLinearFunction, scaling, offset, hasOutOfVolumeValue, outOfVolumeValue, simd, firstRow, lastRow);
+      }
+      else if (source.GetFormat() == Orthanc::PixelFormat_Float32 &&
+               slice.GetFormat() == Orthanc::PixelFormat_BGRA32)
+      {
+        ProcessImage<RowIterator, Layout,
+                     Orthanc::PixelFormat_Float32,
+                     Orthanc::PixelFormat_BGRA32>
+          (slice, extent, source, plane, box, interpolation, hasLinearFunction, scaling, offset, hasOutOfVolumeValue, outOfVolumeValue, simd, firstRow, lastRow);
+      }
+      else if (source.GetFormat() == Orthanc::PixelFormat_Float32 &&
+               slice.GetFormat() == Orthanc::PixelFormat_Float32)
+      {
+        ProcessImage<RowIterator, Layout,
+                     Orthanc::PixelFormat_Float32,
+                     Orthanc::PixelFormat_Float32>
+          (slice, extent, source, plane, box, interpolation, hasLinearFunction, scaling, offset, hasOutOfVolumeValue, outOfVolumeValue, simd, firstRow, lastRow);
       }
       else
       {
         throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
       }
     }
+
+
+    template <VolumeLayout Layout>
+    static void ProcessRows(Orthanc::ImageAccessor& slice,
+                            const Extent2D& extent,
+                            const ImageBuffer3D& source,
+                            const CoordinateSystem3D& plane,
+                            const OrientedVolumeBoundingBox& box,
+                            ImageInterpolation interpolation,
+                            bool hasLinearFunction,
+                            float scaling,
+                            float offset,
+                            bool hasOutOfVolumeValue,
+                            float outOfVolumeValue,
+                            bool fastMode,
+                            bool simd,
+                            unsigned int firstRow,
+                            unsigned int lastRow)
+    {
+      if (fastMode)
+      {
+        ProcessImage<FastRowIterator, Layout>(slice, extent, source, plane, box, interpolation,
+                                              hasLinearFunction, scaling, offset, hasOutOfVolumeValue, outOfVolumeValue, simd, firstRow, lastRow);
+      }
+      else
+      {
+        ProcessImage<SlowRowIterator, Layout>(slice, extent, source, plane, box, interpolation,
+                                              hasLinearFunction, scaling, offset, hasOutOfVolumeValue, outOfVolumeValue, simd, firstRow, lastRow);
+      }
+    }
+
+
+    static void ProcessRows(Orthanc::ImageAccessor& slice,
+                            const Extent2D& extent,
+                            const ImageBuffer3D& source,
+                            const CoordinateSystem3D& plane,
+                            const OrientedVolumeBoundingBox& box,
+                            ImageInterpolation interpolation,
+                            bool hasLinearFunction,
+                            float scaling,
+                            float offset,
+                            bool hasOutOfVolumeValue,
+                            float outOfVolumeValue,
+                            bool fastMode,
+                            bool simd,
+                            unsigned int firstRow,
+                            unsigned int lastRow)
+    {
+      // The memory layout of the volume is chosen once for all here,
+      // so that the voxel readers do not have to test it for each voxel
+      switch (source.GetLayout())
+      {
+        case VolumeLayout_Slices:
+          ProcessRows<VolumeLayout_Slices>(slice, extent, source, plane, box, interpolation, hasLinearFunction,
+                                           scaling, offset, hasOutOfVolumeValue, outOfVolumeValue, fastMode, simd, firstRow, lastRow);
+          break;
+
+        case VolumeLayout_Bricks:
+          ProcessRows<VolumeLayout_Bricks>(slice, extent, source, plane, box, interpolation, hasLinearFunction,
+                                           scaling, offset, hasOutOfVolumeValue, outOfVolumeValue, fastMode, simd, firstRow, lastRow);
+          break;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+      }
+    }
+
+
+    /**
+     * Kernel of "Internals::ParallelRows" that reslices a band of rows
+     * of the output slice. As the rows are independent of each other,
+     * the output is bit-identical to that of the single-threaded path,
+     * and there is nothing to merge.
+     **/
+    class ReslicingKernel : public boost::noncopyable
+    {
+    private:
+      Orthanc::ImageAccessor&           slice_;
+      const Extent2D&                   extent_;
+      const ImageBuffer3D&              source_;
+      const CoordinateSystem3D&         plane_;
+      const OrientedVolumeBoundingBox&  box_;
+      ImageInterpolation                interpolation_;
+      bool                              hasLinearFunction_;
+      float                             scaling_;
+      float                             offset_;
+      bool                              hasOutOfVolumeValue_;
+      float                             outOfVolumeValue_;
+      bool                              fastMode_;
+      bool                              simd_;
+
+    public:
+      ReslicingKernel(Orthanc::ImageAccessor& slice,
+                      const Extent2D& extent,
+                      const ImageBuffer3D& source,
+                      const CoordinateSystem3D& plane,
+                      const OrientedVolumeBoundingBox& box,
+                      ImageInterpolation interpolation,
+                      bool hasLinearFunction,
+                      float scaling,
+                      float offset,
+                      bool hasOutOfVolumeValue,
+                      float outOfVolumeValue,
+                      bool fastMode,
+                      bool simd) :
+        slice_(slice),
+        extent_(extent),
+        source_(source),
+        plane_(plane),
+        box_(box),
+        interpolation_(interpolation),
+        hasLinearFunction_(hasLinearFunction),
+        scaling_(scaling),
+        offset_(offset),
+        hasOutOfVolumeValue_(hasOutOfVolumeValue),
+        outOfVolumeValue_(outOfVolumeValue),
+        fastMode_(fastMode),
+        simd_(simd)
+      {
+      }
+
+      // The output slice is written through "slice_"
+      void Process(const Orthanc::ImageAccessor& /* slice */,
+                   unsigned int firstRow,
+                   unsigned int lastRow)
+      {
+        ProcessRows(slice_, extent_, source_, plane_, box_, interpolation_, hasLinearFunction_, scaling_, offset_,
+                    hasOutOfVolumeValue_, outOfVolumeValue_, fastMode_, simd_, firstRow, lastRow);
+      }
+
+      ReslicingKernel* CloneEmpty() const
+      {
+        return new ReslicingKernel(slice_, extent_, source_, plane_, box_, interpolation_, hasLinearFunction_,
+                                   scaling_, offset_, hasOutOfVolumeValue_, outOfVolumeValue_, fastMode_, simd_);
+      }
+
+      void Merge(const ReslicingKernel& /* other */)
+      {
+        // Nothing to merge, as the bands write to distinct rows
+      }
+    };
   }
     
     
@@ -559,6 +942,7 @@ namespace OrthancStone
       case Orthanc::PixelFormat_Grayscale8:
       case Orthanc::PixelFormat_Grayscale16:
       case Orthanc::PixelFormat_BGRA32:
+      case Orthanc::PixelFormat_Float32:
         return 0.0f;
         break;
 
@@ -581,6 +965,15 @@ namespace OrthancStone
         return static_cast<float>(std::numeric_limits<uint16_t>::max());
         break;
 
+      case Orthanc::PixelFormat_Float32:
+        /**
+         * Floats have no natural range (the slope of "SetWindow()"
+         * would overflow with "-FLT_MAX" and "FLT_MAX"), so the
+         * windows are mapped onto the normalized range [0, 1].
+         **/
+        return 1.0f;
+        break;
+
       default:
         throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
     }
@@ -591,12 +984,22 @@ namespace OrthancStone
     outputFormat_(Orthanc::PixelFormat_Grayscale8),
     interpolation_(ImageInterpolation_Nearest),
     fastMode_(true),
+    simd_(IsSimdAvailable()),
+    threadsCount_(1),
+    hasOutOfVolumeValue_(false),
+    outOfVolumeValue_(0),
     success_(false)
   {
     ResetLinearFunction();
   }
 
 
+  VolumeReslicer::~VolumeReslicer()
+  {
+    // Out-of-line, as "Internals::WorkersPool" is incomplete in the header
+  }
+
+
   void VolumeReslicer::GetLinearFunction(float& scaling,
                                          float& offset) const
   {
@@ -686,7 +1089,8 @@ namespace OrthancStone
   {
     if (format != Orthanc::PixelFormat_Grayscale8 &&
         format != Orthanc::PixelFormat_Grayscale16 &&
-        format != Orthanc::PixelFormat_BGRA32)
+        format != Orthanc::PixelFormat_BGRA32 &&
+        format != Orthanc::PixelFormat_Float32)
     {
       throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
@@ -715,6 +1119,67 @@ namespace OrthancStone
   }
 
 
+  bool VolumeReslicer::IsSimdAvailable()
+  {
+    // The SIMD kernel does not depend on the pixel format
+    return TrilinearScanlineReader<Orthanc::PixelFormat_Grayscale16>::IsSimdAvailable();
+  }
+
+
+  void VolumeReslicer::SetThreadsCount(unsigned int count)
+  {
+    if (count == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+#if ORTHANC_ENABLE_THREADS != 1
+    if (count > 1)
+    {
+      LOG(WARNING) << "Multithreading is not available, VolumeReslicer will use a single thread";
+    }
+#endif
+
+#if ORTHANC_ENABLE_THREADS == 1
+    if (count != threadsCount_)
+    {
+      pool_.reset();  // The pool is started again by the next call to "Apply()"
+    }
+#endif
+
+    threadsCount_ = count;
+  }
+
+
+  float VolumeReslicer::GetOutOfVolumeValue() const
+  {
+    if (hasOutOfVolumeValue_)
+    {
+      return outOfVolumeValue_;
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+  }
+
+
+  void VolumeReslicer::SetOutOfVolumeValue(float value)
+  {
+    Reset();
+    hasOutOfVolumeValue_ = true;
+    outOfVolumeValue_ = value;
+  }
+
+
+  void VolumeReslicer::ResetOutOfVolumeValue()
+  {
+    Reset();
+    hasOutOfVolumeValue_ = false;
+    outOfVolumeValue_ = 0;
+  }
+
+
   const Extent2D& VolumeReslicer::GetOutputExtent() const
   {
     if (success_)
@@ -795,7 +1260,6 @@ namespace OrthancStone
                              double voxelSize)
   {
     Reset();
-    pixelSpacing_ = voxelSize;
 
     // Firstly, compute the intersection of the source volumetric
     // image with the reslicing plane. This leads to a polygon with 3
@@ -804,32 +1268,74 @@ namespace OrthancStone
     // plane.
     OrientedVolumeBoundingBox box(geometry);
 
-    if (!box.ComputeExtent(extent_, plane))
+    Extent2D extent;
+    if (box.ComputeExtent(extent, plane))
+    {
+      ApplyInternal(source, box, plane, extent, voxelSize);
+    }
+    else
     {
       // The plane does not intersect with the bounding box of the volume
+      pixelSpacing_ = voxelSize;
       slice_.reset(new Orthanc::Image(outputFormat_, 0, 0, false));
       success_ = true;
-      return;
     }
+  }
+
 
-    // Secondly, the extent together with the voxel size gives the
-    // size of the output image
+  void VolumeReslicer::Apply(const ImageBuffer3D& source,
+                             const VolumeImageGeometry& geometry,
+                             const CoordinateSystem3D& plane,
+                             const Extent2D& extent,
+                             double voxelSize)
+  {
+    Reset();
+
+    if (extent.IsEmpty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    OrientedVolumeBoundingBox box(geometry);
+    ApplyInternal(source, box, plane, extent, voxelSize);
+  }
+
+
+  void VolumeReslicer::ApplyInternal(const ImageBuffer3D& source,
+                                     const OrientedVolumeBoundingBox& box,
+                                     const CoordinateSystem3D& plane,
+                                     const Extent2D& extent,
+                                     double voxelSize)
+  {
+    pixelSpacing_ = voxelSize;
+    extent_ = extent;
+
+    // The extent together with the voxel size gives the size of the
+    // output image
     unsigned int width = boost::math::iround(extent_.GetWidth() / voxelSize);
     unsigned int height = boost::math::iround(extent_.GetHeight() / voxelSize);
 
     slice_.reset(new Orthanc::Image(outputFormat_, width, height, false));
 
     //CheckIterators(source, plane, box);
-      
-    if (fastMode_)
+
+    ReslicingKernel kernel(*slice_, extent_, source, plane, box, interpolation_, hasLinearFunction_,
+                           scaling_, offset_, hasOutOfVolumeValue_, outOfVolumeValue_, fastMode_, simd_);
+
+#if ORTHANC_ENABLE_THREADS == 1
+    if (threadsCount_ > 1)
     {
-      ProcessImage<FastRowIterator>(*slice_, extent_, source, plane, box,
-                                    interpolation_, hasLinearFunction_, scaling_, offset_);
+      if (pool_.get() == NULL)
+      {
+        pool_.reset(new Internals::WorkersPool(threadsCount_ - 1));
+      }
+
+      Internals::ParallelRows::Apply(kernel, *slice_, *pool_, MIN_PIXELS_PER_BAND);
     }
     else
+#endif
     {
-      ProcessImage<SlowRowIterator>(*slice_, extent_, source, plane, box,
-                                    interpolation_, hasLinearFunction_, scaling_, offset_);
+      kernel.Process(*slice_, 0, height);
     }
 
     success_ = true;
@@ -23,12 +23,23 @@
 
 #pragma once
 
+#if !defined(ORTHANC_ENABLE_THREADS)
+#  error The macro ORTHANC_ENABLE_THREADS must be defined
+#endif
+
 #include "../Toolbox/Extent2D.h"
 #include "OrientedVolumeBoundingBox.h"
 #include "ImageBuffer3D.h"
 
 namespace OrthancStone
 {
+#if ORTHANC_ENABLE_THREADS == 1
+  namespace Internals
+  {
+    class WorkersPool;
+  }
+#endif
+
   // Hypothesis: The output voxels always have square size
   class VolumeReslicer : public boost::noncopyable
   {
@@ -40,6 +51,10 @@ namespace OrthancStone
     float                          offset_;   // "b" in "f(x) = a * x + b"
     ImageInterpolation             interpolation_;
     bool                           fastMode_;
+    bool                           simd_;
+    unsigned int                   threadsCount_;
+    bool                           hasOutOfVolumeValue_;
+    float                          outOfVolumeValue_;
 
     // Output of reslicing
     bool                           success_;
@@ -47,12 +62,25 @@ namespace OrthancStone
     std::unique_ptr<Orthanc::Image>  slice_;
     double                         pixelSpacing_;
 
+#if ORTHANC_ENABLE_THREADS == 1
+    // Threads processing the bands of rows, kept alive across the
+    // calls to "Apply()", as a volume is typically resliced into
+    // many successive slices
+    std::unique_ptr<Internals::WorkersPool>  pool_;
+#endif
+
     void CheckIterators(const ImageBuffer3D& source,
                         const CoordinateSystem3D& plane,
                         const OrientedVolumeBoundingBox& box) const;
 
     void Reset();
 
+    void ApplyInternal(const ImageBuffer3D& source,
+                       const OrientedVolumeBoundingBox& box,
+                       const CoordinateSystem3D& plane,
+                       const Extent2D& extent,
+                       double voxelSize);
+
     float GetMinOutputValue() const;
 
     float GetMaxOutputValue() const;
@@ -63,6 +91,8 @@ namespace OrthancStone
   public:
     VolumeReslicer();
 
+    ~VolumeReslicer();
+
     void GetLinearFunction(float& scaling,
                            float& offset) const;
 
@@ -102,6 +132,52 @@ namespace OrthancStone
       fastMode_ = enabled;
     }
 
+    // Whether the SIMD kernel for trilinear interpolation is
+    // available on the target CPU (SSE2 or NEON)
+    static bool IsSimdAvailable();
+
+    // Whether the SIMD kernel is actually used
+    bool IsSimdEnabled() const
+    {
+      return simd_ && IsSimdAvailable();
+    }
+
+    // If disabled, the scalar reference implementation is used. This
+    // has no effect if "IsSimdAvailable()" is false.
+    void EnableSimd(bool enabled)
+    {
+      simd_ = enabled;
+    }
+
+    unsigned int GetThreadsCount() const
+    {
+      return threadsCount_;
+    }
+
+    // If "count > 1", the rows of the output slice are split into
+    // bands that are processed in parallel (native targets only). The
+    // threads are started by the next call to "Apply()", and are
+    // reused by the subsequent calls.
+    void SetThreadsCount(unsigned int count);
+
+    bool HasOutOfVolumeValue() const
+    {
+      return hasOutOfVolumeValue_;
+    }
+
+    float GetOutOfVolumeValue() const;
+
+    /**
+     * Value of the output pixels that fall outside of the volume,
+     * whatever the interpolation. This value is expressed in the
+     * output pixel format, and is not affected by the linear
+     * function. By default, the minimum value of the input pixel
+     * format is used.
+     **/
+    void SetOutOfVolumeValue(float value);
+
+    void ResetOutOfVolumeValue();
+
     bool IsSuccess() const
     {
       return success_;
@@ -122,6 +198,19 @@ namespace OrthancStone
                const CoordinateSystem3D& plane,
                double voxelSize);
 
+    /**
+     * Same as above, but the output slice covers the given extent of
+     * the plane, instead of its intersection with the volume. This
+     * makes it possible to stack the slices that are obtained from
+     * parallel planes into a regular volume. The voxels outside the
+     * volume are set to the out-of-volume value.
+     **/
+    void Apply(const ImageBuffer3D& source,
+               const VolumeImageGeometry& geometry,
+               const CoordinateSystem3D& plane,
+               const Extent2D& extent,
+               double voxelSize);
+
     double GetPixelSpacing() const;
   };
 }
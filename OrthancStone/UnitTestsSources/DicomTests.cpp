@@ -24,9 +24,20 @@
 #include <gtest/gtest.h>
 
 #include "../Sources/Toolbox/DicomInstanceParameters.h"
+#include "../Sources/Toolbox/DicomWebStreamingParser.h"
+#include "../Sources/Loaders/DicomResourcesDiskCache.h"
 #include "../Sources/Loaders/DicomSource.h"
+#include "../Sources/Loaders/LoadedDicomResources.h"
 
+#if ORTHANC_ENABLE_DCMTK == 1
+#  include "../Sources/Toolbox/ParsedDicomCache.h"
+#endif
+
+#include <boost/lexical_cast.hpp>
+
+#include <Images/Image.h>
 #include <OrthancException.h>
+#include <Toolbox.h>
 
 
 static void SetupUids(Orthanc::DicomMap& m)
@@ -300,3 +311,610 @@ TEST(DicomInstanceParameters, StandardFrameOffsetsGrid)
   ASSERT_DOUBLE_EQ(-388.4679, p->GetMultiFrameGeometry().GetOrigin() [1]);
   ASSERT_DOUBLE_EQ(-120.0, p->GetMultiFrameGeometry().GetOrigin() [2]);
 }
+
+
+static const char* const DICOMWEB_ANSWER =
+  "[ { \"00100010\" : { \"vr\" : \"PN\", \"Value\" : [ { \"Alphabetic\" : \"Doe^John\", \"Ideographic\" : \"I\" }, "
+  "                                                 { \"Alphabetic\" : \"X\", \"Phonetic\" : \"P\" } ] },"
+  "    \"00280010\" : { \"vr\" : \"US\", \"Value\" : [ 512 ] },"
+  "    \"00280030\" : { \"vr\" : \"DS\", \"Value\" : [ 0.5, -3 ] },"
+  "    \"00080060\" : { \"vr\" : \"CS\" },"
+  "    \"00091001\" : { \"vr\" : \"OB\", \"InlineBinary\" : \"SGVsbG8=\" },"
+  "    \"00186011\" : { \"vr\" : \"SQ\", \"Value\" : [ { \"00186012\" : { \"vr\" : \"US\", \"Value\" : [ 1 ] } } ] },"
+  "    \"00080018\" : { \"vr\" : \"UI\", \"Value\" : [ \"1.2.3\" ] } },"
+  "  { \"00080018\" : { \"vr\" : \"UI\", \"Value\" : [ \"1.2.\\u0034\" ] },"
+  "    \"00200037\" : { \"vr\" : \"DS\", \"Value\" : [ \"1\", \"0\", \"0\", \"0\", \"1\", \"0\" ] } } ]";
+
+
+namespace
+{
+  class DicomWebCollector : public OrthancStone::DicomWebStreamingParser::IVisitor
+  {
+  private:
+    std::vector<Orthanc::DicomMap*>  resources_;
+    std::vector<Json::Value>         sourceJson_;
+
+  public:
+    virtual ~DicomWebCollector()
+    {
+      for (size_t i = 0; i < resources_.size(); i++)
+      {
+        delete resources_[i];
+      }
+    }
+
+    virtual void VisitResource(const Orthanc::DicomMap& dicom,
+                               Json::Value& sourceJson) ORTHANC_OVERRIDE
+    {
+      resources_.push_back(dicom.Clone());
+      sourceJson_.push_back(sourceJson);
+    }
+
+    size_t GetSize() const
+    {
+      return resources_.size();
+    }
+
+    const Orthanc::DicomMap& GetResource(size_t i) const
+    {
+      return *resources_[i];
+    }
+
+    const Json::Value& GetSourceJson(size_t i) const
+    {
+      return sourceJson_[i];
+    }
+  };
+}
+
+
+static void CheckSameDicomMap(const Orthanc::DicomMap& expected,
+                              const Orthanc::DicomMap& actual)
+{
+  std::set<Orthanc::DicomTag> tags;
+  expected.GetTags(tags);
+
+  std::set<Orthanc::DicomTag> tags2;
+  actual.GetTags(tags2);
+  ASSERT_EQ(tags, tags2);
+
+  for (std::set<Orthanc::DicomTag>::const_iterator it = tags.begin(); it != tags.end(); ++it)
+  {
+    const Orthanc::DicomValue& a = expected.GetValue(*it);
+    const Orthanc::DicomValue& b = actual.GetValue(*it);
+    ASSERT_EQ(a.IsNull(), b.IsNull());
+    ASSERT_EQ(a.IsBinary(), b.IsBinary());
+
+    if (!a.IsNull())
+    {
+      ASSERT_EQ(a.GetContent(), b.GetContent());
+    }
+  }
+}
+
+
+TEST(DicomWebStreamingParser, FromDicomWeb)
+{
+  Json::Value reference;
+  ASSERT_TRUE(Orthanc::Toolbox::ReadJson(reference, DICOMWEB_ANSWER));
+  ASSERT_EQ(2u, reference.size());
+
+  OrthancStone::DicomWebStreamingParser parser;
+  parser.AddSourceJsonTag(Orthanc::DicomTag(0x0018, 0x6011));
+
+  DicomWebCollector collector;
+  ASSERT_EQ(2u, parser.Parse(collector, DICOMWEB_ANSWER));
+  ASSERT_EQ(2u, collector.GetSize());
+
+  for (Json::Value::ArrayIndex i = 0; i < reference.size(); i++)
+  {
+    Orthanc::DicomMap expected;
+    expected.FromDicomWeb(reference[i]);
+    CheckSameDicomMap(expected, collector.GetResource(i));
+  }
+
+  std::string s;
+  ASSERT_TRUE(collector.GetResource(0).LookupStringValue(s, Orthanc::DicomTag(0x0010, 0x0010), false));
+  ASSERT_EQ("Doe^John=I\\X==P", s);
+  ASSERT_TRUE(collector.GetResource(0).LookupStringValue(s, Orthanc::DicomTag(0x0028, 0x0030), false));
+  ASSERT_EQ("0.5\\-3", s);
+  ASSERT_TRUE(collector.GetResource(0).GetValue(Orthanc::DicomTag(0x0008, 0x0060)).IsNull());
+  ASSERT_TRUE(collector.GetResource(1).LookupStringValue(s, Orthanc::DICOM_TAG_SOP_INSTANCE_UID, false));
+  ASSERT_EQ("1.2.4", s);
+
+  // Only the selected sequence is kept in the source JSON
+  ASSERT_EQ(1u, collector.GetSourceJson(0).size());
+  ASSERT_TRUE(collector.GetSourceJson(0)["00186011"] == reference[0]["00186011"]);
+  ASSERT_EQ(0u, collector.GetSourceJson(1).size());
+
+  parser.SetKeepAllSourceJson(true);
+
+  DicomWebCollector collector2;
+  ASSERT_EQ(2u, parser.Parse(collector2, DICOMWEB_ANSWER));
+  ASSERT_TRUE(collector2.GetSourceJson(0) == reference[0]);
+  ASSERT_TRUE(collector2.GetSourceJson(1) == reference[1]);
+
+  // A single resource (not embedded in an array) is accepted
+  DicomWebCollector collector3;
+  ASSERT_EQ(1u, parser.Parse(collector3, reference[1].toStyledString()));
+  CheckSameDicomMap(collector.GetResource(1), collector3.GetResource(0));
+}
+
+
+TEST(DicomWebStreamingParser, Errors)
+{
+  OrthancStone::DicomWebStreamingParser parser;
+
+  {
+    DicomWebCollector collector;
+    ASSERT_EQ(0u, parser.Parse(collector, "[]"));
+  }
+
+  const char* const errors[] = {
+    "",
+    "[",
+    "[ {] ",
+    "[] []",
+    "[ { \"0010\" : { \"vr\" : \"LO\" } } ]",
+    "[ { \"00100020\" : { \"Value\" : [ \"a\" ] } } ]",
+    "[ { \"00100020\" : { \"vr\" : \"LO\", \"Value\" : [ \"a ] } } ]",
+    NULL
+  };
+
+  for (size_t i = 0; errors[i] != NULL; i++)
+  {
+    DicomWebCollector collector;
+    ASSERT_THROW(parser.Parse(collector, errors[i]), Orthanc::OrthancException);
+  }
+}
+
+
+TEST(LoadedDicomResources, RestrictSourceJson)
+{
+  {
+    OrthancStone::LoadedDicomResources resources(Orthanc::DICOM_TAG_SOP_INSTANCE_UID);
+    resources.AddFromDicomWebAnswer(DICOMWEB_ANSWER);
+    ASSERT_EQ(2u, resources.GetSize());
+    ASSERT_TRUE(resources.HasResource("1.2.3"));
+    ASSERT_TRUE(resources.HasResource("1.2.4"));
+    ASSERT_EQ(7u, resources.GetSourceJson(0).size());
+  }
+
+  {
+    std::set<Orthanc::DicomTag> tags;
+    tags.insert(Orthanc::DicomTag(0x0018, 0x6011));
+
+    Json::Value answer;
+    ASSERT_TRUE(Orthanc::Toolbox::ReadJson(answer, DICOMWEB_ANSWER));
+
+    OrthancStone::LoadedDicomResources resources(Orthanc::DICOM_TAG_SOP_INSTANCE_UID);
+    resources.RestrictSourceJson(tags);
+    resources.AddFromDicomWeb(answer);
+    ASSERT_EQ(2u, resources.GetSize());
+    ASSERT_EQ(1u, resources.GetSourceJson(0).size());
+    ASSERT_TRUE(resources.GetSourceJson(0).isMember("00186011"));
+    ASSERT_EQ(0u, resources.GetSourceJson(1).size());
+  }
+
+  {
+    OrthancStone::LoadedDicomResources resources(Orthanc::DICOM_TAG_SOP_INSTANCE_UID);
+    resources.RestrictSourceJson(std::set<Orthanc::DicomTag>());
+    resources.AddFromDicomWebAnswer(DICOMWEB_ANSWER);
+    ASSERT_EQ(2u, resources.GetSize());
+    ASSERT_THROW(resources.GetSourceJson(0), Orthanc::OrthancException);
+  }
+}
+
+
+TEST(DicomResourcesDiskCache, Serialization)
+{
+  std::string content;
+
+  {
+    Orthanc::DicomMap a;
+    a.SetValue(Orthanc::DICOM_TAG_SOP_INSTANCE_UID, "1.2.3", false);
+    a.SetValue(Orthanc::DICOM_TAG_PATIENT_NAME, "Doe^John", false);
+    a.SetValue(Orthanc::DicomTag(0x0009, 0x1001), std::string("\0\xff\x01", 3), true);
+    a.SetNullValue(Orthanc::DICOM_TAG_MODALITY);
+
+    Orthanc::DicomMap b;
+    b.SetValue(Orthanc::DICOM_TAG_SOP_INSTANCE_UID, "1.2.4", false);
+
+    Json::Value json = Json::objectValue;
+    json["hello"] = "world";
+
+    OrthancStone::LoadedDicomResources resources(Orthanc::DICOM_TAG_SOP_INSTANCE_UID);
+    resources.AddResource(a, json);
+    resources.AddResource(b);
+
+    OrthancStone::DicomResourcesDiskCache::Serialize(content, "etag", resources);
+  }
+
+  {
+    std::string validator;
+    OrthancStone::LoadedDicomResources resources(Orthanc::DICOM_TAG_SOP_INSTANCE_UID);
+    ASSERT_TRUE(OrthancStone::DicomResourcesDiskCache::Unserialize(validator, resources, content));
+    ASSERT_EQ("etag", validator);
+    ASSERT_EQ(2u, resources.GetSize());
+
+    std::string s;
+    ASSERT_TRUE(resources.LookupStringValue(s, "1.2.3", Orthanc::DICOM_TAG_PATIENT_NAME));
+    ASSERT_EQ("Doe^John", s);
+
+    const Orthanc::DicomMap& a = resources.GetResource(0);
+    ASSERT_EQ(4u, a.GetSize());
+    ASSERT_TRUE(a.GetValue(Orthanc::DICOM_TAG_MODALITY).IsNull());
+    ASSERT_TRUE(a.GetValue(Orthanc::DicomTag(0x0009, 0x1001)).IsBinary());
+    ASSERT_EQ(std::string("\0\xff\x01", 3), a.GetValue(Orthanc::DicomTag(0x0009, 0x1001)).GetContent());
+
+    ASSERT_TRUE(resources.HasSourceJson(0));
+    ASSERT_EQ("world", resources.GetSourceJson(0)["hello"].asString());
+    ASSERT_FALSE(resources.HasSourceJson(1));
+    ASSERT_EQ(1u, resources.GetResource(1).GetSize());
+  }
+
+  {
+    // The source JSON is dropped if the target doesn't keep it
+    std::string validator;
+    OrthancStone::LoadedDicomResources resources(Orthanc::DICOM_TAG_SOP_INSTANCE_UID);
+    resources.RestrictSourceJson(std::set<Orthanc::DicomTag>());
+    ASSERT_TRUE(OrthancStone::DicomResourcesDiskCache::Unserialize(validator, resources, content));
+    ASSERT_EQ(2u, resources.GetSize());
+    ASSERT_FALSE(resources.HasSourceJson(0));
+  }
+
+  {
+    // Truncated or corrupted entries are rejected, without modifying the target
+    std::string validator = "nope";
+    OrthancStone::LoadedDicomResources resources(Orthanc::DICOM_TAG_SOP_INSTANCE_UID);
+
+    for (size_t i = 0; i < content.size(); i++)
+    {
+      ASSERT_FALSE(OrthancStone::DicomResourcesDiskCache::Unserialize(validator, resources, content.substr(0, i)));
+    }
+
+    ASSERT_FALSE(OrthancStone::DicomResourcesDiskCache::Unserialize(validator, resources, content + "x"));
+
+    std::string s = content;
+    s[0] = 'X';
+    ASSERT_FALSE(OrthancStone::DicomResourcesDiskCache::Unserialize(validator, resources, s));
+
+    ASSERT_EQ(0u, resources.GetSize());
+    ASSERT_EQ("nope", validator);
+  }
+}
+
+
+TEST(DicomResourcesDiskCache, ConditionalAnswer)
+{
+  OrthancStone::LoadedDicomResources cached(Orthanc::DICOM_TAG_SOP_INSTANCE_UID);
+
+  {
+    Orthanc::DicomMap a;
+    a.SetValue(Orthanc::DICOM_TAG_SOP_INSTANCE_UID, "1.2.9", false);
+    cached.AddResource(a);
+  }
+
+  {
+    // "304 Not Modified": The cached content is used
+    OrthancStone::LoadedDicomResources target(Orthanc::DICOM_TAG_SOP_INSTANCE_UID);
+    ASSERT_FALSE(OrthancStone::DicomResourcesDiskCache::LoadDicomWebAnswer(
+                   target, &cached, "", Orthanc::HttpStatus_304_NotModified));
+    ASSERT_EQ(1u, target.GetSize());
+    ASSERT_TRUE(target.HasResource("1.2.9"));
+  }
+
+  {
+    // A valid empty answer must not serve the stale cached content
+    OrthancStone::LoadedDicomResources target(Orthanc::DICOM_TAG_SOP_INSTANCE_UID);
+    ASSERT_TRUE(OrthancStone::DicomResourcesDiskCache::LoadDicomWebAnswer(
+                  target, &cached, "", Orthanc::HttpStatus_204_NoContent));
+    ASSERT_EQ(0u, target.GetSize());
+
+    ASSERT_TRUE(OrthancStone::DicomResourcesDiskCache::LoadDicomWebAnswer(
+                  target, &cached, "[]", Orthanc::HttpStatus_200_Ok));
+    ASSERT_EQ(0u, target.GetSize());
+
+    ASSERT_THROW(OrthancStone::DicomResourcesDiskCache::LoadDicomWebAnswer(
+                   target, &cached, "", Orthanc::HttpStatus_200_Ok), Orthanc::OrthancException);
+  }
+
+  {
+    // Modified content
+    OrthancStone::LoadedDicomResources target(Orthanc::DICOM_TAG_SOP_INSTANCE_UID);
+    ASSERT_TRUE(OrthancStone::DicomResourcesDiskCache::LoadDicomWebAnswer(
+                  target, &cached, DICOMWEB_ANSWER, Orthanc::HttpStatus_200_Ok));
+    ASSERT_EQ(2u, target.GetSize());
+    ASSERT_TRUE(target.HasResource("1.2.3"));
+    ASSERT_FALSE(target.HasResource("1.2.9"));
+  }
+
+  {
+    // "304 Not Modified" is only valid for conditional requests
+    OrthancStone::LoadedDicomResources target(Orthanc::DICOM_TAG_SOP_INSTANCE_UID);
+    ASSERT_THROW(OrthancStone::DicomResourcesDiskCache::LoadDicomWebAnswer(
+                   target, NULL, "", Orthanc::HttpStatus_304_NotModified), Orthanc::OrthancException);
+  }
+}
+
+
+TEST(DicomResourcesDiskCache, OrthancValidator)
+{
+  Json::Value series = Json::objectValue;
+  series["IsStable"] = true;
+  series["LastUpdate"] = "20260101T120000";
+  series["Instances"] = Json::arrayValue;
+  series["Instances"].append("b");
+  series["Instances"].append("a");
+
+  std::string a, b;
+  ASSERT_TRUE(OrthancStone::DicomResourcesDiskCache::ComputeOrthancValidator(a, Orthanc::ResourceType_Series, series));
+
+  // The order of the children doesn't matter
+  Json::Value reordered = series;
+  reordered["Instances"][0] = "a";
+  reordered["Instances"][1] = "b";
+  ASSERT_TRUE(OrthancStone::DicomResourcesDiskCache::ComputeOrthancValidator(b, Orthanc::ResourceType_Series, reordered));
+  ASSERT_EQ(a, b);
+
+  // Deleting a child during the same second changes the validator
+  Json::Value deleted = series;
+  deleted["Instances"].resize(1);
+  ASSERT_TRUE(OrthancStone::DicomResourcesDiskCache::ComputeOrthancValidator(b, Orthanc::ResourceType_Series, deleted));
+  ASSERT_NE(a, b);
+
+  // Replacing a child changes the validator
+  Json::Value replaced = series;
+  replaced["Instances"][0] = "c";
+  ASSERT_TRUE(OrthancStone::DicomResourcesDiskCache::ComputeOrthancValidator(b, Orthanc::ResourceType_Series, replaced));
+  ASSERT_NE(a, b);
+
+  Json::Value updated = series;
+  updated["LastUpdate"] = "20260101T120001";
+  ASSERT_TRUE(OrthancStone::DicomResourcesDiskCache::ComputeOrthancValidator(b, Orthanc::ResourceType_Series, updated));
+  ASSERT_NE(a, b);
+
+  // Unstable resources are not cached
+  b = "nope";
+  Json::Value unstable = series;
+  unstable["IsStable"] = false;
+  ASSERT_FALSE(OrthancStone::DicomResourcesDiskCache::ComputeOrthancValidator(b, Orthanc::ResourceType_Series, unstable));
+  ASSERT_EQ("nope", b);
+
+  Json::Value missing = series;
+  missing.removeMember("IsStable");
+  ASSERT_FALSE(OrthancStone::DicomResourcesDiskCache::ComputeOrthancValidator(b, Orthanc::ResourceType_Series, missing));
+
+  // The children are looked up according to the level
+  ASSERT_FALSE(OrthancStone::DicomResourcesDiskCache::ComputeOrthancValidator(b, Orthanc::ResourceType_Study, series));
+  ASSERT_THROW(OrthancStone::DicomResourcesDiskCache::ComputeOrthancValidator(b, Orthanc::ResourceType_Instance, series),
+               Orthanc::OrthancException);
+}
+
+
+TEST(DicomSource, ServerIdentifier)
+{
+  OrthancStone::DicomSource a, b;
+  a.SetDicomWebSource("http://localhost/dicom-web/", "alice", "password1");
+  b.SetDicomWebSource("http://localhost/dicom-web/", "alice", "password2");
+  ASSERT_EQ(a.GetServerIdentifier(), b.GetServerIdentifier());
+
+  b.SetDicomWebSource("http://localhost/dicom-web/", "bob", "password1");
+  ASSERT_NE(a.GetServerIdentifier(), b.GetServerIdentifier());
+
+  b.SetDicomWebThroughOrthancSource("http://localhost/dicom-web/");
+  ASSERT_NE(a.GetServerIdentifier(), b.GetServerIdentifier());
+
+  b.SetOrthancSource();
+  ASSERT_NE(a.GetServerIdentifier(), b.GetServerIdentifier());
+}
+
+
+#if ORTHANC_ENABLE_DCMTK == 1
+TEST(ParsedDicomCache, Statistics)
+{
+  // 4 shards of 1000 bytes
+  OrthancStone::ParsedDicomCache cache(4000, 4);
+  ASSERT_EQ(4000u, cache.GetMaximumSize());
+  ASSERT_EQ(4u, cache.GetShardsCount());
+
+  {
+    OrthancStone::ParsedDicomCache::Reader reader(cache, 1, "a");
+    ASSERT_FALSE(reader.IsValid());
+  }
+
+  cache.Acquire(1, "a", new Orthanc::ParsedDicomFile(true), 100, false);
+  cache.Acquire(2, "b", new Orthanc::ParsedDicomFile(true), 200, true);
+
+  {
+    OrthancStone::ParsedDicomCache::Reader reader(cache, 1, "a");
+    ASSERT_TRUE(reader.IsValid());
+    ASSERT_FALSE(reader.HasPixelData());
+    ASSERT_EQ(100u, reader.GetFileSize());
+  }
+
+  {
+    OrthancStone::ParsedDicomCache::Reader reader(cache, 2, "b");
+    ASSERT_TRUE(reader.IsValid());
+    ASSERT_TRUE(reader.HasPixelData());
+  }
+
+  OrthancStone::ParsedDicomCache::Statistics s;
+  cache.GetStatistics(s, 1);
+  ASSERT_EQ(1u, s.GetHits());
+  ASSERT_EQ(1u, s.GetMisses());
+  ASSERT_EQ(0u, s.GetEvictions());
+  ASSERT_EQ(1u, s.GetResidentItems());
+  ASSERT_EQ(100u, s.GetResidentBytes());
+
+  cache.GetStatistics(s);
+  ASSERT_EQ(2u, s.GetHits());
+  ASSERT_EQ(1u, s.GetMisses());
+  ASSERT_EQ(2u, s.GetResidentItems());
+  ASSERT_EQ(300u, s.GetResidentBytes());
+
+  // Invalidations are not evictions
+  cache.Invalidate(1, "a");
+  cache.GetStatistics(s, 1);
+  ASSERT_EQ(0u, s.GetEvictions());
+  ASSERT_EQ(0u, s.GetResidentItems());
+  ASSERT_EQ(0u, s.GetResidentBytes());
+
+  // Overflow the shards, so that the LRU policy evicts items
+  for (unsigned int i = 0; i < 100; i++)
+  {
+    cache.Acquire(3, boost::lexical_cast<std::string>(i), new Orthanc::ParsedDicomFile(true), 300, false);
+  }
+
+  cache.GetStatistics(s, 3);
+  ASSERT_GT(s.GetEvictions(), 80u);
+  ASSERT_EQ(300u * s.GetEvictions(), s.GetEvictedBytes());
+  ASSERT_EQ(100u, s.GetEvictions() + s.GetResidentItems());
+  ASSERT_LE(s.GetResidentBytes(), 4000u);
+}
+
+
+TEST(ParsedDicomCache, Unsharded)
+{
+  OrthancStone::ParsedDicomCache cache(4000);
+  ASSERT_EQ(1u, cache.GetShardsCount());
+
+  // An instance that is larger than "size / shards", but smaller than
+  // the cache, is cached by the default (unsharded) cache
+  cache.Acquire(1, "a", new Orthanc::ParsedDicomFile(true), 3000, false);
+
+  {
+    OrthancStone::ParsedDicomCache::Reader reader(cache, 1, "a");
+    ASSERT_TRUE(reader.IsValid());
+  }
+
+  OrthancStone::ParsedDicomCache::Statistics s;
+  cache.GetStatistics(s);
+  ASSERT_EQ(0u, s.GetEvictions());
+  ASSERT_EQ(1u, s.GetResidentItems());
+}
+
+
+TEST(ParsedDicomCache, DecodedFrames)
+{
+  OrthancStone::ParsedDicomCache cache(4000, 2);
+  ASSERT_FALSE(cache.IsDecodedFramesCacheEnabled());
+
+  // The frames are discarded as long as the cache of frames is disabled
+  cache.AcquireDecodedFrame(1, "a", 0, new Orthanc::Image(Orthanc::PixelFormat_Grayscale8, 10, 10, true));
+
+  {
+    OrthancStone::ParsedDicomCache::FrameReader reader(cache, 1, "a", 0);
+    ASSERT_FALSE(reader.IsValid());
+  }
+
+  // 2 shards of 1000 bytes
+  cache.SetDecodedFramesCacheSize(2000);
+  ASSERT_TRUE(cache.IsDecodedFramesCacheEnabled());
+  ASSERT_EQ(2000u, cache.GetDecodedFramesCacheSize());
+
+  cache.Acquire(1, "a", new Orthanc::ParsedDicomFile(true), 100, true);
+  cache.AcquireDecodedFrame(1, "a", 0, new Orthanc::Image(Orthanc::PixelFormat_Grayscale8, 10, 10, true));
+  cache.AcquireDecodedFrame(1, "a", 1, new Orthanc::Image(Orthanc::PixelFormat_Grayscale16, 10, 10, true));
+  cache.AcquireDecodedFrame(1, "b", 0, new Orthanc::Image(Orthanc::PixelFormat_Grayscale8, 10, 5, true));
+
+  {
+    OrthancStone::ParsedDicomCache::FrameReader reader(cache, 1, "a", 1);
+    ASSERT_TRUE(reader.IsValid());
+    ASSERT_EQ(Orthanc::PixelFormat_Grayscale16, reader.GetFrame().GetFormat());
+    ASSERT_EQ(10u, reader.GetFrame().GetWidth());
+  }
+
+  {
+    OrthancStone::ParsedDicomCache::FrameReader reader(cache, 1, "a", 2);
+    ASSERT_FALSE(reader.IsValid());
+    ASSERT_THROW(reader.GetFrame(), Orthanc::OrthancException);
+  }
+
+  OrthancStone::ParsedDicomCache::Statistics s;
+  cache.GetDecodedFramesStatistics(s, 1);
+  ASSERT_EQ(1u, s.GetHits());
+  ASSERT_EQ(2u, s.GetMisses());
+  ASSERT_EQ(3u, s.GetResidentItems());
+  ASSERT_EQ(350u, s.GetResidentBytes());
+
+  // The parsed DICOM files and the decoded frames have separate budgets
+  cache.GetStatistics(s, 1);
+  ASSERT_EQ(1u, s.GetResidentItems());
+  ASSERT_EQ(100u, s.GetResidentBytes());
+
+  // Invalidating a DICOM file invalidates all its decoded frames
+  cache.Invalidate(1, "a");
+
+  {
+    OrthancStone::ParsedDicomCache::FrameReader reader(cache, 1, "a", 0);
+    ASSERT_FALSE(reader.IsValid());
+  }
+
+  {
+    OrthancStone::ParsedDicomCache::FrameReader reader(cache, 1, "b", 0);
+    ASSERT_TRUE(reader.IsValid());
+  }
+
+  cache.GetDecodedFramesStatistics(s, 1);
+  ASSERT_EQ(0u, s.GetEvictions());
+  ASSERT_EQ(1u, s.GetResidentItems());
+  ASSERT_EQ(50u, s.GetResidentBytes());
+
+  // Disabling the cache of frames empties it
+  cache.SetDecodedFramesCacheSize(0);
+  ASSERT_FALSE(cache.IsDecodedFramesCacheEnabled());
+
+  cache.GetDecodedFramesStatistics(s);
+  ASSERT_EQ(0u, s.GetResidentItems());
+  ASSERT_EQ(0u, s.GetResidentBytes());
+  ASSERT_EQ(0u, cache.GetDecodedFramesIndexSize());
+}
+
+
+TEST(ParsedDicomCache, DecodedFramesEvictions)
+{
+  OrthancStone::ParsedDicomCache cache(4000);
+  cache.SetDecodedFramesCacheSize(1000);  // Room for 10 frames of 100 bytes
+
+  for (unsigned int i = 0; i < 100; i++)
+  {
+    cache.AcquireDecodedFrame(1, boost::lexical_cast<std::string>(i), 0,
+                              new Orthanc::Image(Orthanc::PixelFormat_Grayscale8, 10, 10, true));
+  }
+
+  // The index of the frames forgets about the evicted frames
+  OrthancStone::ParsedDicomCache::Statistics s;
+  cache.GetDecodedFramesStatistics(s);
+  ASSERT_EQ(90u, s.GetEvictions());
+  ASSERT_EQ(10u, s.GetResidentItems());
+  ASSERT_EQ(10u, cache.GetDecodedFramesIndexSize());
+
+  // Storing the same frame again replaces it
+  cache.AcquireDecodedFrame(1, "99", 0, new Orthanc::Image(Orthanc::PixelFormat_Grayscale8, 5, 10, true));
+
+  {
+    OrthancStone::ParsedDicomCache::FrameReader reader(cache, 1, "99", 0);
+    ASSERT_TRUE(reader.IsValid());
+    ASSERT_EQ(5u, reader.GetFrame().GetWidth());
+  }
+
+  ASSERT_EQ(10u, cache.GetDecodedFramesIndexSize());
+
+  // A frame that is stored again after its eviction is still indexed,
+  // hence invalidated together with its DICOM file
+  for (unsigned int i = 0; i < 20; i++)
+  {
+    cache.AcquireDecodedFrame(2, "a", i, new Orthanc::Image(Orthanc::PixelFormat_Grayscale8, 10, 10, true));
+  }
+
+  cache.AcquireDecodedFrame(2, "a", 0, new Orthanc::Image(Orthanc::PixelFormat_Grayscale8, 10, 10, true));
+  ASSERT_EQ(1u, cache.GetDecodedFramesIndexSize());
+
+  cache.Invalidate(2, "a");
+  ASSERT_EQ(0u, cache.GetDecodedFramesIndexSize());
+
+  cache.GetDecodedFramesStatistics(s);
+  ASSERT_EQ(0u, s.GetResidentItems());
+}
+#endif
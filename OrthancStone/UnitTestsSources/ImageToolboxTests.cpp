@@ -23,6 +23,7 @@
 
 #include "../Sources/Fonts/GlyphAlphabet.h"
 #include "../Sources/Toolbox/ImageToolbox.h"
+#include "../Sources/Toolbox/PixelHistogram.h"
 
 // #include <boost/chrono.hpp>
 // #include <boost/lexical_cast.hpp>
@@ -30,6 +31,7 @@
 #include <Compatibility.h>
 #include <Images/Image.h>
 #include <Images/PixelTraits.h>
+#include <OrthancException.h>
 
 #include <cmath>
 #include <gtest/gtest.h>
@@ -261,6 +263,108 @@ TEST(ImageToolbox, SimpleHisto_Grayscale32_BinSize10_2)
 }
 
 
+TEST(PixelHistogram, Quantiles_Grayscale32)
+{
+  // Wide range of values, which requires the two passes of the radix
+  const unsigned int W = 640;
+  const unsigned int H = 480;
+
+  Orthanc::Image image(Orthanc::PixelFormat_Grayscale32, W, H, false);
+
+  for (unsigned int y = 0; y < H; ++y)
+  {
+    uint32_t* p = reinterpret_cast<uint32_t*>(image.GetRow(y));
+    for (unsigned int x = 0; x < W; ++x, ++p)
+    {
+      *p = (y * W + x) * 1000u;
+    }
+  }
+
+  // A few outliers
+  reinterpret_cast<uint32_t*>(image.GetRow(0)) [0] = 4000000000u;
+  reinterpret_cast<uint32_t*>(image.GetRow(10)) [0] = 4000000001u;
+
+  for (unsigned int threads = 1; threads <= 4; threads += 3)
+  {
+    OrthancStone::PixelHistogram histogram(image);
+    histogram.SetThreadsCount(threads);
+    ASSERT_EQ(W * H, histogram.GetPixelsCount());
+
+    double minValue, maxValue;
+    histogram.GetRange(minValue, maxValue);
+    ASSERT_DOUBLE_EQ(1000.0, minValue);  // The first pixel is an outlier
+    ASSERT_DOUBLE_EQ(4000000001.0, maxValue);
+
+    histogram.ComputeQuantiles(minValue, maxValue, 0);
+    ASSERT_DOUBLE_EQ(1000.0, minValue);
+    ASSERT_DOUBLE_EQ(4000000001.0, maxValue);
+
+    histogram.ComputeQuantiles(minValue, maxValue, 2);
+    ASSERT_DOUBLE_EQ(3000.0, minValue);
+    ASSERT_DOUBLE_EQ((W * H - 1) * 1000.0, maxValue);
+
+    histogram.ComputeQuantiles(minValue, maxValue, 1000);
+    ASSERT_DOUBLE_EQ(1001000.0, minValue);
+    ASSERT_DOUBLE_EQ((W * H - 999) * 1000.0, maxValue);
+
+    ASSERT_THROW(histogram.ComputeQuantiles(minValue, maxValue, W * H), Orthanc::OrthancException);
+  }
+}
+
+TEST(PixelHistogram, Quantiles_Float32)
+{
+  Orthanc::Image image(Orthanc::PixelFormat_Float32, 100, 1, false);
+
+  float* p = reinterpret_cast<float*>(image.GetRow(0));
+  for (unsigned int x = 0; x < 100; x++)
+  {
+    p[x] = static_cast<float>(x) - 49.5f;
+  }
+
+  p[17] = -1e30f;
+  p[42] = 1e30f;
+
+  OrthancStone::PixelHistogram histogram(image);
+
+  double minValue, maxValue;
+  histogram.GetRange(minValue, maxValue);
+  ASSERT_FLOAT_EQ(-1e30f, static_cast<float>(minValue));
+  ASSERT_FLOAT_EQ(1e30f, static_cast<float>(maxValue));
+
+  histogram.ComputeQuantiles(minValue, maxValue, 1);
+  ASSERT_DOUBLE_EQ(-49.5, minValue);
+  ASSERT_DOUBLE_EQ(49.5, maxValue);
+
+  histogram.ComputeQuantiles(minValue, maxValue, 10);
+  ASSERT_DOUBLE_EQ(-40.5, minValue);
+  ASSERT_DOUBLE_EQ(40.5, maxValue);
+}
+
+TEST(PixelHistogram, Bins_SignedGrayscale16)
+{
+  Orthanc::Image image(Orthanc::PixelFormat_SignedGrayscale16, 20, 1, false);
+
+  int16_t* p = reinterpret_cast<int16_t*>(image.GetRow(0));
+  for (unsigned int x = 0; x < 20; x++)
+  {
+    p[x] = static_cast<int16_t>(x) - 10;
+  }
+
+  OrthancStone::HistogramData hd;
+  OrthancStone::ComputeHistogram(image, hd, 5);
+  ASSERT_EQ(-10.5, hd.minValue);
+  ASSERT_EQ(4u, hd.bins.size());
+  ASSERT_EQ(5u, hd.bins[0]);
+  ASSERT_EQ(5u, hd.bins[1]);
+  ASSERT_EQ(5u, hd.bins[2]);
+  ASSERT_EQ(5u, hd.bins[3]);
+
+  double minValue, maxValue;
+  OrthancStone::ComputeMinMax(image, minValue, maxValue);
+  ASSERT_EQ(-10.0, minValue);
+  ASSERT_EQ(9.0, maxValue);
+}
+
 TEST(GlyphAlphabet, Indent)
 {
   std::string s;
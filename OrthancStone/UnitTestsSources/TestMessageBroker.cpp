@@ -23,9 +23,13 @@
 
 #include <gtest/gtest.h>
 
+#include "../Sources/Messages/ConcurrentMessageDelivery.h"
 #include "../Sources/Messages/IObservable.h"
 #include "../Sources/Messages/ObserverBase.h"
 
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
 
 int testCounter = 0;
 namespace {
@@ -104,3 +108,631 @@ TEST(MessageBroker, TestPermanentConnectionDeleteObserver)
   observable.BroadcastMessage(MyObservable::MyCustomMessage(20));
   ASSERT_EQ(0, testCounter);
 }
+
+
+namespace
+{
+  class CountingObserver : public ObserverBase<CountingObserver>
+  {
+  private:
+    int  count_;
+
+  public:
+    CountingObserver() :
+      count_(0)
+    {
+    }
+
+    void Handle(const MyObservable::MyCustomMessage& message)
+    {
+      count_ += message.payload_;
+    }
+
+    int GetCount() const
+    {
+      return count_;
+    }
+  };
+}
+
+
+TEST(MessageBroker, TargetedEmission)
+{
+  MyObservable  observable;
+
+  std::vector< boost::shared_ptr<CountingObserver> > observers;
+  for (size_t i = 0; i < 3; i++)
+  {
+    observers.push_back(boost::shared_ptr<CountingObserver>(new CountingObserver));
+    observers[i]->Register<MyObservable::MyCustomMessage>(observable, &CountingObserver::Handle);
+  }
+
+  ASSERT_EQ(3u, observable.GetCallablesCount());
+
+  observable.EmitMessage(observers[1], MyObservable::MyCustomMessage(5));
+  ASSERT_EQ(0, observers[0]->GetCount());
+  ASSERT_EQ(5, observers[1]->GetCount());
+  ASSERT_EQ(0, observers[2]->GetCount());
+
+  observable.BroadcastMessage(MyObservable::MyCustomMessage(2));
+  ASSERT_EQ(2, observers[0]->GetCount());
+  ASSERT_EQ(7, observers[1]->GetCount());
+  ASSERT_EQ(2, observers[2]->GetCount());
+
+  // Emitting to an expired observer is a no-op
+  boost::weak_ptr<IObserver> expired(observers[2]);
+  observers[2].reset();
+  observable.EmitMessage(expired, MyObservable::MyCustomMessage(1));
+  ASSERT_EQ(2, observers[0]->GetCount());
+  ASSERT_EQ(7, observers[1]->GetCount());
+}
+
+
+TEST(MessageBroker, RemoveExpiredCallables)
+{
+  MyObservable  observable;
+
+  std::vector< boost::shared_ptr<CountingObserver> > observers;
+  for (size_t i = 0; i < 10; i++)
+  {
+    observers.push_back(boost::shared_ptr<CountingObserver>(new CountingObserver));
+    observers[i]->Register<MyObservable::MyCustomMessage>(observable, &CountingObserver::Handle);
+  }
+
+  for (size_t i = 0; i < 10; i += 2)
+  {
+    observers[i].reset();
+  }
+
+  ASSERT_EQ(10u, observable.GetCallablesCount());
+
+  // Broadcasting removes the callables of the expired observers
+  observable.BroadcastMessage(MyObservable::MyCustomMessage(1));
+  ASSERT_EQ(5u, observable.GetCallablesCount());
+
+  for (size_t i = 1; i < 10; i += 2)
+  {
+    ASSERT_EQ(1, observers[i]->GetCount());
+  }
+
+  // Registering an expired observer is a no-op
+  {
+    boost::shared_ptr<CountingObserver> observer(new CountingObserver);
+    std::unique_ptr<ICallable> callable(observer->CreateCallable(&CountingObserver::Handle));
+    observer.reset();
+    observable.RegisterCallable(callable.release());
+    ASSERT_EQ(5u, observable.GetCallablesCount());
+  }
+
+  // Registrations collect the expired callables, even without any emission
+  observers.clear();
+
+  for (size_t i = 0; i < 1000; i++)
+  {
+    boost::shared_ptr<CountingObserver> observer(new CountingObserver);
+    observer->Register<MyObservable::MyCustomMessage>(observable, &CountingObserver::Handle);
+  }
+
+  ASSERT_LT(observable.GetCallablesCount(), 1000u);
+}
+
+
+TEST(MessageBroker, TargetedEmissionBenchmark)
+{
+  static const size_t COUNT_OBSERVERS = 10000;
+
+  MyObservable  observable;
+
+  std::vector< boost::shared_ptr<CountingObserver> > observers;
+  observers.reserve(COUNT_OBSERVERS);
+
+  for (size_t i = 0; i < COUNT_OBSERVERS; i++)
+  {
+    observers.push_back(boost::shared_ptr<CountingObserver>(new CountingObserver));
+    observers[i]->Register<MyObservable::MyCustomMessage>(observable, &CountingObserver::Handle);
+  }
+
+  // One targeted message per observer, as for the answers of the oracle
+  boost::posix_time::ptime start = boost::posix_time::microsec_clock::local_time();
+
+  for (size_t i = 0; i < COUNT_OBSERVERS; i++)
+  {
+    observable.EmitMessage(observers[i], MyObservable::MyCustomMessage(1));
+  }
+
+  boost::posix_time::ptime end = boost::posix_time::microsec_clock::local_time();
+
+  for (size_t i = 0; i < COUNT_OBSERVERS; i++)
+  {
+    ASSERT_EQ(1, observers[i]->GetCount());
+  }
+
+  std::cout << COUNT_OBSERVERS << " targeted messages to " << COUNT_OBSERVERS
+            << " observers in " << (end - start).total_microseconds() << "us" << std::endl;
+}
+
+
+TEST(MessageBroker, InternedIdentifiers)
+{
+  const MessageIdentifier a("file.cpp", 10);
+  const MessageIdentifier b("file.cpp", 10);
+  const MessageIdentifier c("file.cpp", 11);
+  const MessageIdentifier d("other.cpp", 10);
+
+  ASSERT_EQ(a.GetInternedValue(), b.GetInternedValue());
+  ASSERT_TRUE(a == b);
+  ASSERT_FALSE(a != b);
+  ASSERT_TRUE(a != c);
+  ASSERT_TRUE(a != d);
+  ASSERT_TRUE(c != d);
+  ASSERT_TRUE((a < c) != (c < a));
+  ASSERT_FALSE(a < b);
+
+  // Identifiers built from distinct copies of the same file name
+  const std::string copy("file.cpp");
+  ASSERT_TRUE(MessageIdentifier(copy.c_str(), 11) == c);
+
+  ASSERT_EQ(0u, MessageIdentifier().GetInternedValue());
+  ASSERT_TRUE(MessageIdentifier() != a);
+  ASSERT_TRUE(MyObservable::MyCustomMessage::GetStaticIdentifier() == MyObservable::MyCustomMessage(0).GetIdentifier());
+}
+
+
+namespace
+{
+  // Family of distinct messages, to fill the table of callables
+  template <int Index>
+  class IndexedMessage : public IMessage
+  {
+    ORTHANC_STONE_MESSAGE(__FILE__, __LINE__ * 100 + Index);
+  };
+
+  class BenchmarkObserver : public ObserverBase<BenchmarkObserver>
+  {
+  private:
+    unsigned int  count_;
+
+  public:
+    BenchmarkObserver() :
+      count_(0)
+    {
+    }
+
+    template <int Index>
+    void Handle(const IndexedMessage<Index>& /* message */)
+    {
+      count_++;
+    }
+
+    template <int Index>
+    void RegisterIndexed(IObservable& observable)
+    {
+      Register< IndexedMessage<Index> >(observable, &BenchmarkObserver::Handle<Index>);
+    }
+
+    unsigned int GetCount() const
+    {
+      return count_;
+    }
+  };
+}
+
+
+TEST(MessageBroker, EmissionBenchmark)
+{
+  static const unsigned int COUNT_MESSAGES = 1000000;
+
+  IObservable  observable;
+
+  boost::shared_ptr<BenchmarkObserver> observer(new BenchmarkObserver);
+  observer->RegisterIndexed<0>(observable);
+  observer->RegisterIndexed<1>(observable);
+  observer->RegisterIndexed<2>(observable);
+  observer->RegisterIndexed<3>(observable);
+  observer->RegisterIndexed<4>(observable);
+  observer->RegisterIndexed<5>(observable);
+  observer->RegisterIndexed<6>(observable);
+  observer->RegisterIndexed<7>(observable);
+
+  const IndexedMessage<5> message;
+
+  boost::posix_time::ptime start = boost::posix_time::microsec_clock::local_time();
+
+  for (unsigned int i = 0; i < COUNT_MESSAGES; i++)
+  {
+    observable.EmitMessage(observer, message);
+  }
+
+  boost::posix_time::ptime end = boost::posix_time::microsec_clock::local_time();
+
+  ASSERT_EQ(COUNT_MESSAGES, observer->GetCount());
+
+  const int64_t elapsed = std::max<int64_t>(1, (end - start).total_microseconds());
+  std::cout << "Emission of " << COUNT_MESSAGES << " messages in " << elapsed << "us ("
+            << static_cast<double>(COUNT_MESSAGES) / (static_cast<double>(elapsed) / 1000000.0)
+            << " messages/s)" << std::endl;
+}
+
+
+namespace
+{
+  class LockingObserver : public ObserverBase<LockingObserver>
+  {
+  private:
+    ConcurrentMessageDelivery&  delivery_;
+    boost::mutex                mutex_;
+    boost::condition_variable   condition_;
+    bool                        insideLock_;
+    unsigned int                countLocks_;
+
+    void SetInsideLock(bool inside)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      insideLock_ = inside;
+
+      if (inside)
+      {
+        countLocks_++;
+      }
+
+      condition_.notify_all();
+    }
+
+  public:
+    explicit LockingObserver(ConcurrentMessageDelivery& delivery) :
+      delivery_(delivery),
+      insideLock_(false),
+      countLocks_(0)
+    {
+    }
+
+    void Handle(const MyObservable::MyCustomMessage& message)
+    {
+      ConcurrentMessageDelivery::ExclusiveLock lock(delivery_);
+      SetInsideLock(true);
+      boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+      SetInsideLock(false);
+    }
+
+    bool IsInsideLock()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return insideLock_;
+    }
+
+    unsigned int GetCountLocks()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return countLocks_;
+    }
+
+    bool WaitInsideLock()
+    {
+      const boost::system_time timeout = boost::get_system_time() + boost::posix_time::seconds(5);
+
+      boost::mutex::scoped_lock lock(mutex_);
+      while (!insideLock_)
+      {
+        if (!condition_.timed_wait(lock, timeout))
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+  };
+
+
+  class DeliveryObserver : public ObserverBase<DeliveryObserver>
+  {
+  private:
+    boost::mutex               mutex_;
+    boost::condition_variable  condition_;
+    std::vector<int>           handled_;
+    bool                       blocked_;
+    LockingObserver*           watched_;  // Can be NULL
+    bool                       sawLock_;
+
+  public:
+    DeliveryObserver() :
+      blocked_(false),
+      watched_(NULL),
+      sawLock_(false)
+    {
+    }
+
+    void Block()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      blocked_ = true;
+    }
+
+    void Unblock()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      blocked_ = false;
+      condition_.notify_all();
+    }
+
+    // Records whether the handler runs while "watched" holds the exclusive lock
+    void Watch(LockingObserver& watched)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      watched_ = &watched;
+    }
+
+    void Handle(const MyObservable::MyCustomMessage& message)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (watched_ != NULL &&
+          watched_->IsInsideLock())
+      {
+        sawLock_ = true;
+      }
+
+      handled_.push_back(message.payload_);
+      condition_.notify_all();
+
+      while (blocked_)
+      {
+        condition_.wait(lock);
+      }
+    }
+
+    bool WaitHandled(size_t count)
+    {
+      const boost::system_time timeout = boost::get_system_time() + boost::posix_time::seconds(5);
+
+      boost::mutex::scoped_lock lock(mutex_);
+      while (handled_.size() < count)
+      {
+        if (!condition_.timed_wait(lock, timeout))
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    std::vector<int> GetHandled()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return handled_;
+    }
+
+    bool HasSeenLock()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return sawLock_;
+    }
+  };
+
+
+  class NestedObserver : public ObserverBase<NestedObserver>
+  {
+  private:
+    ConcurrentMessageDelivery&  delivery_;
+    IObservable&                observable_;
+    std::vector<int>            handled_;
+
+  public:
+    NestedObserver(ConcurrentMessageDelivery& delivery,
+                   IObservable& observable) :
+      delivery_(delivery),
+      observable_(observable)
+    {
+    }
+
+    void Handle(const MyObservable::MyCustomMessage& message)
+    {
+      handled_.push_back(message.payload_);
+
+      if (message.payload_ > 0)
+      {
+        // Delivery to the observer whose message is being handled
+        std::vector<ICallable*> callables;
+        observable_.LookupCallables(callables, *this, MyObservable::MyCustomMessage::GetStaticIdentifier());
+        delivery_.Deliver(*this, callables, MyObservable::MyCustomMessage(message.payload_ - 1));
+      }
+    }
+
+    const std::vector<int>& GetHandled() const
+    {
+      return handled_;
+    }
+  };
+
+
+  template <typename TObserver>
+  void DeliverMessage(ConcurrentMessageDelivery* delivery,
+                      IObservable* observable,
+                      boost::shared_ptr<TObserver> observer,
+                      int payload)
+  {
+    std::vector<ICallable*> callables;
+    observable->LookupCallables(callables, *observer, MyObservable::MyCustomMessage::GetStaticIdentifier());
+    delivery->Deliver(*observer, callables, MyObservable::MyCustomMessage(payload));
+  }
+
+
+  bool WaitPendingDeliveries(ConcurrentMessageDelivery& delivery,
+                             const IObserver& observer,
+                             unsigned int count)
+  {
+    for (unsigned int i = 0; i < 5000; i++)
+    {
+      if (delivery.GetPendingDeliveries(observer) == count)
+      {
+        return true;
+      }
+
+      boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+
+    return false;
+  }
+}
+
+
+TEST(ConcurrentMessageDelivery, OrderOfObserver)
+{
+  static const int COUNT = 20;
+
+  MyObservable observable;
+  boost::shared_ptr<DeliveryObserver> observer(new DeliveryObserver);
+  observer->Register<MyObservable::MyCustomMessage>(observable, &DeliveryObserver::Handle);
+
+  ConcurrentMessageDelivery delivery;
+
+  // The handling of the first message blocks the strand of the
+  // observer, and each thread is queued before starting the next one
+  observer->Block();
+
+  std::vector<boost::thread*> threads;
+  bool queued = true;
+
+  for (int i = 0; i < COUNT && queued; i++)
+  {
+    threads.push_back(new boost::thread(DeliverMessage<DeliveryObserver>, &delivery, &observable, observer, i));
+    queued = WaitPendingDeliveries(delivery, *observer, i + 1);
+  }
+
+  const bool blocked = observer->WaitHandled(1);
+  const size_t countBlocked = observer->GetHandled().size();
+  observer->Unblock();
+
+  for (size_t i = 0; i < threads.size(); i++)
+  {
+    threads[i]->join();
+    delete threads[i];
+  }
+
+  ASSERT_TRUE(queued);
+  ASSERT_TRUE(blocked);
+  ASSERT_EQ(1u, countBlocked);
+  ASSERT_EQ(0u, delivery.GetPendingDeliveries(*observer));
+
+  // The messages are handled in the order of their delivery
+  const std::vector<int> handled = observer->GetHandled();
+  ASSERT_EQ(static_cast<size_t>(COUNT), handled.size());
+
+  for (int i = 0; i < COUNT; i++)
+  {
+    ASSERT_EQ(i, handled[i]);
+  }
+}
+
+
+TEST(ConcurrentMessageDelivery, NestedDelivery)
+{
+  MyObservable observable;
+  ConcurrentMessageDelivery delivery;
+
+  boost::shared_ptr<NestedObserver> observer(new NestedObserver(delivery, observable));
+  observer->Register<MyObservable::MyCustomMessage>(observable, &NestedObserver::Handle);
+
+  DeliverMessage(&delivery, &observable, observer, 3);
+
+  ASSERT_EQ(4u, observer->GetHandled().size());
+  ASSERT_EQ(3, observer->GetHandled() [0]);
+  ASSERT_EQ(0, observer->GetHandled() [3]);
+  ASSERT_EQ(0u, delivery.GetPendingDeliveries(*observer));
+}
+
+
+TEST(ConcurrentMessageDelivery, DistinctObservers)
+{
+  MyObservable observable;
+  boost::shared_ptr<DeliveryObserver> observer1(new DeliveryObserver);
+  boost::shared_ptr<DeliveryObserver> observer2(new DeliveryObserver);
+  observer1->Register<MyObservable::MyCustomMessage>(observable, &DeliveryObserver::Handle);
+  observer2->Register<MyObservable::MyCustomMessage>(observable, &DeliveryObserver::Handle);
+
+  ConcurrentMessageDelivery delivery;
+
+  observer1->Block();
+  boost::thread thread1(DeliverMessage<DeliveryObserver>, &delivery, &observable, observer1, 1);
+  const bool blocked = observer1->WaitHandled(1);
+
+  // The second observer is served while the handler of the first one is running
+  boost::thread thread2(DeliverMessage<DeliveryObserver>, &delivery, &observable, observer2, 2);
+  const bool concurrent = observer2->WaitHandled(1);
+
+  observer1->Unblock();
+  thread1.join();
+  thread2.join();
+
+  ASSERT_TRUE(blocked);
+  ASSERT_TRUE(concurrent);
+  ASSERT_EQ(1u, observer1->GetHandled().size());
+  ASSERT_EQ(1u, observer2->GetHandled().size());
+}
+
+
+TEST(ConcurrentMessageDelivery, ExclusiveLock)
+{
+  MyObservable observable;
+  boost::shared_ptr<DeliveryObserver> observer(new DeliveryObserver);
+  observer->Register<MyObservable::MyCustomMessage>(observable, &DeliveryObserver::Handle);
+
+  ConcurrentMessageDelivery delivery;
+
+  // A lock that is taken outside of any handler blocks the deliveries
+  std::unique_ptr<ConcurrentMessageDelivery::ExclusiveLock> lock(new ConcurrentMessageDelivery::ExclusiveLock(delivery));
+  boost::thread thread(DeliverMessage<DeliveryObserver>, &delivery, &observable, observer, 42);
+  boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+  const size_t countLocked = observer->GetHandled().size();
+
+  {
+    // The lock is recursive
+    ConcurrentMessageDelivery::ExclusiveLock nested(delivery);
+  }
+
+  lock.reset();
+  thread.join();
+
+  ASSERT_EQ(0u, countLocked);
+  ASSERT_EQ(1u, observer->GetHandled().size());
+  ASSERT_EQ(42, observer->GetHandled() [0]);
+}
+
+
+TEST(ConcurrentMessageDelivery, ExclusiveLockFromHandler)
+{
+  MyObservable observable;
+  ConcurrentMessageDelivery delivery;
+
+  boost::shared_ptr<LockingObserver> locking(new LockingObserver(delivery));
+  boost::shared_ptr<DeliveryObserver> observer(new DeliveryObserver);
+  locking->Register<MyObservable::MyCustomMessage>(observable, &LockingObserver::Handle);
+  observer->Register<MyObservable::MyCustomMessage>(observable, &DeliveryObserver::Handle);
+  observer->Watch(*locking);
+
+  // The lock taken by a handler waits for the handlers of the other observers
+  observer->Block();
+  boost::thread thread1(DeliverMessage<DeliveryObserver>, &delivery, &observable, observer, 1);
+  const bool blocked = observer->WaitHandled(1);
+
+  boost::thread thread2(DeliverMessage<LockingObserver>, &delivery, &observable, locking, 2);
+  boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+  const unsigned int countLocksBlocked = locking->GetCountLocks();
+
+  observer->Unblock();
+  thread1.join();
+
+  // The handlers of the other observers wait for the lock taken by a handler
+  const bool locked = locking->WaitInsideLock();
+  boost::thread thread3(DeliverMessage<DeliveryObserver>, &delivery, &observable, observer, 3);
+  thread2.join();
+  thread3.join();
+
+  ASSERT_TRUE(blocked);
+  ASSERT_TRUE(locked);
+  ASSERT_EQ(0u, countLocksBlocked);
+  ASSERT_EQ(1u, locking->GetCountLocks());
+  ASSERT_EQ(2u, observer->GetHandled().size());
+  ASSERT_FALSE(observer->HasSeenLock());
+}
@@ -0,0 +1,564 @@
+/**
+ * Stone of Orthanc
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include <gtest/gtest.h>
+
+#include "../Sources/Loaders/OracleScheduler.h"
+#include "../Sources/Messages/IObservable.h"
+#include "../Sources/Oracle/IForwardingPayload.h"
+#include "../Sources/Oracle/OracleCommandExceptionMessage.h"
+#include "../Sources/Oracle/ParseDicomFromFileCommand.h"
+#include "../Sources/Oracle/ReadFileCommand.h"
+#include "../Sources/Oracle/ThreadedOracle.h"
+
+#include <TemporaryFile.h>
+
+#include <boost/thread.hpp>
+
+#include <algorithm>
+
+
+namespace
+{
+  using namespace OrthancStone;
+
+
+  class TestPayload : public IForwardingPayload
+  {
+  private:
+    int                         identifier_;
+    bool                        hasFinalReceiver_;
+    boost::weak_ptr<IObserver>  finalReceiver_;
+
+  public:
+    explicit TestPayload(int identifier) :
+      identifier_(identifier),
+      hasFinalReceiver_(false)
+    {
+    }
+
+    TestPayload(int identifier,
+                boost::weak_ptr<IObserver> finalReceiver) :
+      identifier_(identifier),
+      hasFinalReceiver_(true),
+      finalReceiver_(finalReceiver)
+    {
+    }
+
+    int GetIdentifier() const
+    {
+      return identifier_;
+    }
+
+    virtual bool IsFinalReceiverExpired() const ORTHANC_OVERRIDE
+    {
+      return (hasFinalReceiver_ &&
+              finalReceiver_.expired());
+    }
+  };
+
+
+  /**
+   * Emitter that records the answers of the oracle, and that can
+   * block the workers of the oracle while they emit an answer, which
+   * makes it possible to fill the queue of the oracle in a
+   * deterministic way.
+   **/
+  class TestEmitter : public IMessageEmitter
+  {
+  private:
+    boost::mutex               mutex_;
+    boost::condition_variable  changed_;
+    bool                       blocked_;
+    unsigned int               emitting_;
+    std::vector<int>           answered_;
+    std::vector<int>           cancelled_;
+    IObservable*               observable_;
+
+    static const IOracleCommand* GetOrigin(bool& isCancelled,
+                                           const IMessage& message)
+    {
+      const ReadFileCommand::SuccessMessage* success =
+        dynamic_cast<const ReadFileCommand::SuccessMessage*>(&message);
+      if (success != NULL)
+      {
+        isCancelled = false;
+        return &success->GetOrigin();
+      }
+
+      const OracleCommandExceptionMessage* failure =
+        dynamic_cast<const OracleCommandExceptionMessage*>(&message);
+      if (failure != NULL)
+      {
+        isCancelled = (failure->GetException().GetErrorCode() == Orthanc::ErrorCode_CanceledJob);
+        return &failure->GetOrigin();
+      }
+
+      return NULL;
+    }
+
+    static bool GetIdentifier(int& identifier,
+                              const IOracleCommand& command)
+    {
+      const OracleCommandBase& base = dynamic_cast<const OracleCommandBase&>(command);
+      if (base.HasPayload())
+      {
+        const TestPayload* payload = dynamic_cast<const TestPayload*>(&base.GetPayload());
+        if (payload != NULL)
+        {
+          identifier = payload->GetIdentifier();
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    bool WaitSize(const std::vector<int>& values,
+                  size_t expected,
+                  boost::mutex::scoped_lock& lock)
+    {
+      const boost::system_time timeout = boost::get_system_time() + boost::posix_time::seconds(10);
+
+      while (values.size() < expected)
+      {
+        if (!changed_.timed_wait(lock, timeout))
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+  public:
+    TestEmitter() :
+      blocked_(false),
+      emitting_(0),
+      observable_(NULL)
+    {
+    }
+
+    // Forwards the messages to an observable, as "GenericLoadersContext" does
+    void SetObservable(IObservable& observable)
+    {
+      observable_ = &observable;
+    }
+
+    virtual void EmitMessage(boost::weak_ptr<IObserver> observer,
+                             const IMessage& message) ORTHANC_OVERRIDE
+    {
+      bool isCancelled = false;
+      const IOracleCommand* origin = GetOrigin(isCancelled, message);
+
+      int identifier;
+      if (origin != NULL &&
+          GetIdentifier(identifier, *origin))
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (isCancelled)
+        {
+          // This is also invoked if the receiver itself is expired,
+          // which is a no-op in the actual emitters
+          cancelled_.push_back(identifier);
+        }
+        else
+        {
+          emitting_++;
+          changed_.notify_all();
+
+          while (blocked_)
+          {
+            changed_.wait(lock);
+          }
+
+          emitting_--;
+          answered_.push_back(identifier);
+        }
+
+        changed_.notify_all();
+      }
+      else if (!isCancelled)
+      {
+        // Answers of the commands wrapped by "OracleScheduler"
+        boost::mutex::scoped_lock lock(mutex_);
+
+        while (blocked_)
+        {
+          changed_.wait(lock);
+        }
+      }
+
+      if (observable_ != NULL)
+      {
+        observable_->EmitMessage(observer, message);
+      }
+    }
+
+    void Block()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      blocked_ = true;
+    }
+
+    void Unblock()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      blocked_ = false;
+      changed_.notify_all();
+    }
+
+    // Waits until "count" workers are blocked while emitting an answer
+    bool WaitEmitting(unsigned int count)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      const boost::system_time timeout = boost::get_system_time() + boost::posix_time::seconds(10);
+
+      while (emitting_ < count)
+      {
+        if (!changed_.timed_wait(lock, timeout))
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    bool WaitAnswered(size_t count)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return WaitSize(answered_, count, lock);
+    }
+
+    bool WaitCancelled(size_t count)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return WaitSize(cancelled_, count, lock);
+    }
+
+    std::vector<int> GetAnswered()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return answered_;
+    }
+
+    std::vector<int> GetCancelled()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return cancelled_;
+    }
+  };
+
+
+  class TestOracle : public boost::noncopyable
+  {
+  private:
+    Orthanc::TemporaryFile  file_;
+    TestEmitter             emitter_;
+    ThreadedOracle          oracle_;
+
+  public:
+    TestOracle() :
+      oracle_(emitter_)
+    {
+      file_.Write("Hello");
+
+      // A single worker processes the commands in the order of the queue
+      oracle_.SetThreadsCount(ThreadedOracle::Lane_InputOutput, 1);
+      oracle_.SetThreadsCount(ThreadedOracle::Lane_Computation, 0);
+    }
+
+    ~TestOracle()
+    {
+      emitter_.Unblock();
+      oracle_.Stop();
+    }
+
+    TestEmitter& GetEmitter()
+    {
+      return emitter_;
+    }
+
+    ThreadedOracle& GetOracle()
+    {
+      return oracle_;
+    }
+
+    IOracleCommand* CreateCommand(TestPayload* payload)
+    {
+      std::unique_ptr<ReadFileCommand> command(new ReadFileCommand(file_.GetPath()));
+      command->AcquirePayload(payload);
+      return command.release();
+    }
+
+    IOracleCommand* CreateCommand(int identifier)
+    {
+      return CreateCommand(new TestPayload(identifier));
+    }
+
+    void Schedule(boost::shared_ptr<IObserver> receiver,
+                  int identifier,
+                  int priority)
+    {
+      ASSERT_TRUE(oracle_.ScheduleWithPriority(receiver, CreateCommand(identifier), priority));
+    }
+
+    // Blocks the worker on the answer to the command "-1", so that
+    // the next commands stay in the queue until "Unblock()"
+    void StartBlocked(boost::shared_ptr<IObserver> receiver)
+    {
+      emitter_.Block();
+      oracle_.Start();
+      Schedule(receiver, -1, 0);
+      ASSERT_TRUE(emitter_.WaitEmitting(1));
+    }
+  };
+}
+
+
+TEST(ThreadedOracle, PriorityOrder)
+{
+  boost::shared_ptr<IObserver> receiver(new IObserver);
+
+  TestOracle test;
+  test.GetOracle().SetPriorityAgingPeriod(0);
+  test.StartBlocked(receiver);
+
+  test.Schedule(receiver, 0, 5);
+  test.Schedule(receiver, 1, -3);
+  test.Schedule(receiver, 2, 5);
+  test.Schedule(receiver, 3, 0);
+  test.Schedule(receiver, 4, -3);
+  ASSERT_EQ(5u, test.GetOracle().GetQueueSize(ThreadedOracle::Lane_InputOutput));
+
+  test.GetEmitter().Unblock();
+  ASSERT_TRUE(test.GetEmitter().WaitAnswered(6));
+
+  // Increasing priority, then FIFO order
+  const std::vector<int> answered = test.GetEmitter().GetAnswered();
+  ASSERT_EQ(6u, answered.size());
+  ASSERT_EQ(-1, answered[0]);
+  ASSERT_EQ(1, answered[1]);
+  ASSERT_EQ(4, answered[2]);
+  ASSERT_EQ(3, answered[3]);
+  ASSERT_EQ(0, answered[4]);
+  ASSERT_EQ(2, answered[5]);
+  ASSERT_EQ(0u, test.GetOracle().GetCancelledCommandsCount());
+}
+
+
+TEST(ThreadedOracle, PriorityAging)
+{
+  boost::shared_ptr<IObserver> receiver(new IObserver);
+
+  TestOracle test;
+  test.GetOracle().SetPriorityAgingPeriod(50);
+  test.StartBlocked(receiver);
+
+  test.Schedule(receiver, 0, 10);
+
+  // After 20 aging periods, the command "0" has gained more than the
+  // 10 levels of priority that separate it from the command "1"
+  boost::this_thread::sleep(boost::posix_time::milliseconds(1000));
+  test.Schedule(receiver, 1, 0);
+
+  test.GetEmitter().Unblock();
+  ASSERT_TRUE(test.GetEmitter().WaitAnswered(3));
+
+  const std::vector<int> answered = test.GetEmitter().GetAnswered();
+  ASSERT_EQ(3u, answered.size());
+  ASSERT_EQ(-1, answered[0]);
+  ASSERT_EQ(0, answered[1]);
+  ASSERT_EQ(1, answered[2]);
+}
+
+
+TEST(ThreadedOracle, CancelledCommands)
+{
+  boost::shared_ptr<IObserver> receiver(new IObserver);
+
+  TestOracle test;
+  test.StartBlocked(receiver);
+
+  {
+    // The receiver of the command "0" is destroyed while it is queued
+    boost::shared_ptr<IObserver> transient(new IObserver);
+    test.Schedule(transient, 0, 0);
+  }
+
+  {
+    // The final receiver of the command "1" is destroyed while it is
+    // queued, but its forwarding receiver is still alive
+    boost::shared_ptr<IObserver> finalReceiver(new IObserver);
+    ASSERT_TRUE(test.GetOracle().ScheduleWithPriority(
+                  receiver, test.CreateCommand(new TestPayload(1, finalReceiver)), 0));
+  }
+
+  test.Schedule(receiver, 2, 0);
+
+  test.GetEmitter().Unblock();
+  ASSERT_TRUE(test.GetEmitter().WaitAnswered(2));
+  ASSERT_TRUE(test.GetEmitter().WaitCancelled(2));
+
+  const std::vector<int> answered = test.GetEmitter().GetAnswered();
+  ASSERT_EQ(2u, answered.size());
+  ASSERT_EQ(-1, answered[0]);
+  ASSERT_EQ(2, answered[1]);
+
+  std::vector<int> cancelled = test.GetEmitter().GetCancelled();
+  std::sort(cancelled.begin(), cancelled.end());
+  ASSERT_EQ(2u, cancelled.size());
+  ASSERT_EQ(0, cancelled[0]);
+  ASSERT_EQ(1, cancelled[1]);
+
+  ASSERT_EQ(2u, test.GetOracle().GetCancelledCommandsCount());
+}
+
+
+TEST(ThreadedOracle, SchedulerCancelledCommands)
+{
+  IObservable observable;
+  boost::shared_ptr<IObserver> receiver(new IObserver);
+
+  TestOracle test;
+  test.GetEmitter().SetObservable(observable);
+
+  boost::shared_ptr<OracleScheduler> scheduler(
+    OracleScheduler::Create(test.GetOracle(), observable, test.GetEmitter()));
+
+  test.StartBlocked(receiver);
+
+  {
+    // The receiver of these commands is the scheduler, that only
+    // forwards the answers to the destroyed final receiver
+    boost::shared_ptr<IObserver> transient(new IObserver);
+    scheduler->Schedule(transient, 0, test.CreateCommand(0));
+    scheduler->Schedule(transient, 0, test.CreateCommand(1));
+  }
+
+  ASSERT_EQ(2u, scheduler->GetTotalScheduled());
+  ASSERT_EQ(0u, scheduler->GetTotalProcessed());
+
+  test.GetEmitter().Unblock();
+
+  // The scheduler must release the slots of the cancelled commands
+  for (unsigned int i = 0; i < 1000 && scheduler->GetTotalProcessed() < 2u; i++)
+  {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+
+  ASSERT_EQ(2u, scheduler->GetTotalProcessed());
+  ASSERT_EQ(2u, test.GetOracle().GetCancelledCommandsCount());
+
+  test.GetOracle().Stop();
+}
+
+
+TEST(ThreadedOracle, ThreadsCount)
+{
+  TestEmitter emitter;
+  ThreadedOracle oracle(emitter);
+
+  // By default, 4 workers in total, as before the introduction of the lanes
+  ASSERT_EQ(3u, oracle.GetThreadsCount(ThreadedOracle::Lane_InputOutput));
+  ASSERT_EQ(1u, oracle.GetThreadsCount(ThreadedOracle::Lane_Computation));
+
+  ASSERT_THROW(oracle.SetThreadsCount(0), Orthanc::OrthancException);
+
+  oracle.SetThreadsCount(1);
+  ASSERT_EQ(1u, oracle.GetThreadsCount(ThreadedOracle::Lane_InputOutput));
+  ASSERT_EQ(0u, oracle.GetThreadsCount(ThreadedOracle::Lane_Computation));
+
+  oracle.SetThreadsCount(8);
+  ASSERT_EQ(6u, oracle.GetThreadsCount(ThreadedOracle::Lane_InputOutput));
+  ASSERT_EQ(2u, oracle.GetThreadsCount(ThreadedOracle::Lane_Computation));
+
+  ASSERT_THROW(oracle.SetThreadsCount(ThreadedOracle::Lane_InputOutput, 0), Orthanc::OrthancException);
+  oracle.SetThreadsCount(ThreadedOracle::Lane_Computation, 0);
+  ASSERT_EQ(0u, oracle.GetThreadsCount(ThreadedOracle::Lane_Computation));
+}
+
+
+TEST(ThreadedOracle, LanesAndStealing)
+{
+  boost::shared_ptr<IObserver> receiver(new IObserver);
+
+  TestOracle test;
+  test.GetOracle().SetThreadsCount(ThreadedOracle::Lane_InputOutput, 1);
+  test.GetOracle().SetThreadsCount(ThreadedOracle::Lane_Computation, 1);
+  test.StartBlocked(receiver);
+
+  // The input/output worker is busy or blocked, so the idle
+  // computation worker must steal one of these two input/output commands
+  test.Schedule(receiver, 0, 0);
+  ASSERT_TRUE(test.GetEmitter().WaitEmitting(2));
+
+  ASSERT_EQ(1u, test.GetOracle().GetProcessedCommandsCount(ThreadedOracle::Lane_InputOutput));
+  ASSERT_EQ(1u, test.GetOracle().GetProcessedCommandsCount(ThreadedOracle::Lane_Computation));
+  ASSERT_EQ(0u, test.GetOracle().GetStolenCommandsCount(ThreadedOracle::Lane_InputOutput));
+  ASSERT_EQ(1u, test.GetOracle().GetStolenCommandsCount(ThreadedOracle::Lane_Computation));
+
+  // Both workers are blocked: Check the routing of the commands to the lanes
+  test.Schedule(receiver, 1, 0);
+
+  {
+    std::unique_ptr<ParseDicomFromFileCommand> command(
+      new ParseDicomFromFileCommand(DicomSource(), "nope.dcm"));
+    command->AcquirePayload(new TestPayload(2));
+    ASSERT_TRUE(test.GetOracle().Schedule(receiver, command.release()));
+  }
+
+  ASSERT_EQ(1u, test.GetOracle().GetQueueSize(ThreadedOracle::Lane_InputOutput));
+  ASSERT_EQ(1u, test.GetOracle().GetQueueSize(ThreadedOracle::Lane_Computation));
+
+  test.GetEmitter().Unblock();
+  ASSERT_TRUE(test.GetEmitter().WaitAnswered(4));
+
+  ASSERT_EQ(4u, test.GetOracle().GetProcessedCommandsCount(ThreadedOracle::Lane_InputOutput) +
+            test.GetOracle().GetProcessedCommandsCount(ThreadedOracle::Lane_Computation));
+}
+
+
+TEST(ThreadedOracle, ComputationLaneWithoutWorker)
+{
+  boost::shared_ptr<IObserver> receiver(new IObserver);
+
+  // The commands of the computation lane go to the input/output lane
+  TestOracle test;
+  test.StartBlocked(receiver);
+
+  std::unique_ptr<ParseDicomFromFileCommand> command(
+    new ParseDicomFromFileCommand(DicomSource(), "nope.dcm"));
+  command->AcquirePayload(new TestPayload(0));
+  ASSERT_TRUE(test.GetOracle().Schedule(receiver, command.release()));
+
+  ASSERT_EQ(1u, test.GetOracle().GetQueueSize(ThreadedOracle::Lane_InputOutput));
+  ASSERT_EQ(0u, test.GetOracle().GetQueueSize(ThreadedOracle::Lane_Computation));
+
+  test.GetEmitter().Unblock();
+  ASSERT_TRUE(test.GetEmitter().WaitAnswered(2));
+  ASSERT_EQ(0u, test.GetOracle().GetStolenCommandsCount(ThreadedOracle::Lane_InputOutput));
+}
@@ -91,3 +91,59 @@ TEST(StructureSet, ReadFromJson)
   ASSERT_EQ(0, rtstruct.GetStructureColor(6).GetGreen());
   ASSERT_EQ(255, rtstruct.GetStructureColor(6).GetBlue());
 }
+
+
+TEST(StructureSet, PointsByInstance)
+{
+  OrthancStone::FullOrthancDataset dicom(
+    Orthanc::EmbeddedResources::GetFileResourceBuffer(Orthanc::EmbeddedResources::RT_STRUCT_00),
+    Orthanc::EmbeddedResources::GetFileResourceSize(Orthanc::EmbeddedResources::RT_STRUCT_00));
+
+  OrthancStone::DicomStructureSet rtstruct(dicom);
+
+  std::set<std::string> instances;
+  rtstruct.GetReferencedInstances(instances);
+  ASSERT_FALSE(instances.empty());
+
+  for (size_t i = 0; i < rtstruct.GetStructuresCount(); i++)
+  {
+    OrthancStone::DicomStructureSet::PointsByInstance binned;
+    rtstruct.GetStructurePointsByInstance(binned, i);
+
+    for (OrthancStone::DicomStructureSet::PointsByInstance::const_iterator
+           it = binned.begin(); it != binned.end(); ++it)
+    {
+      ASSERT_TRUE(instances.find(it->first) != instances.end());
+    }
+
+    for (std::set<std::string>::const_iterator it = instances.begin(); it != instances.end(); ++it)
+    {
+      std::list< std::vector<OrthancStone::Vector> > expected;
+      rtstruct.GetStructurePoints(expected, i, *it);
+
+      OrthancStone::DicomStructureSet::PointsByInstance::const_iterator found = binned.find(*it);
+      if (expected.empty())
+      {
+        ASSERT_TRUE(found == binned.end());
+      }
+      else
+      {
+        ASSERT_TRUE(found != binned.end());
+        ASSERT_EQ(expected.size(), found->second.size());
+
+        std::list< std::vector<OrthancStone::Vector> >::const_iterator a = expected.begin();
+        std::list< std::vector<OrthancStone::Vector> >::const_iterator b = found->second.begin();
+        for (; a != expected.end(); ++a, ++b)
+        {
+          ASSERT_EQ(a->size(), b->size());
+          for (size_t j = 0; j < a->size(); j++)
+          {
+            ASSERT_DOUBLE_EQ((*a) [j][0], (*b) [j][0]);
+            ASSERT_DOUBLE_EQ((*a) [j][1], (*b) [j][1]);
+            ASSERT_DOUBLE_EQ((*a) [j][2], (*b) [j][2]);
+          }
+        }
+      }
+    }
+  }
+}
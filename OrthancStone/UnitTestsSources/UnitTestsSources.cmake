@@ -28,6 +28,7 @@ set(UNIT_TESTS_SOURCES
   ${CMAKE_CURRENT_LIST_DIR}/PixelTestPatternsTests.cpp
   ${CMAKE_CURRENT_LIST_DIR}/SortedFramesTests.cpp
   ${CMAKE_CURRENT_LIST_DIR}/TestMessageBroker.cpp
+  ${CMAKE_CURRENT_LIST_DIR}/TestOracle.cpp
   ${CMAKE_CURRENT_LIST_DIR}/TestStrategy.cpp
   ${CMAKE_CURRENT_LIST_DIR}/TestStructureSet.cpp
   ${CMAKE_CURRENT_LIST_DIR}/UnitTestsMain.cpp
@@ -24,17 +24,28 @@
 #include "../Sources/Scene2D/CairoCompositor.h"
 #include "../Sources/Scene2D/ColorTextureSceneLayer.h"
 #include "../Sources/Scene2D/CopyStyleConfigurator.h"
+#include "../Sources/Scene2D/FloatTextureSceneLayer.h"
+#include "../Sources/Scene2D/Internals/FloatTexturePacker.h"
 #include "../Sources/Scene2D/MacroSceneLayer.h"
 #include "../Sources/Scene2D/PolylineSceneLayer.h"
+#include "../Sources/Scene2D/TextSceneLayer.h"
+#include "../Sources/Toolbox/GeometryToolbox.h"
+#include "../Sources/Toolbox/ImageGeometry.h"
+#include "../Sources/Toolbox/ShearWarpProjectiveTransform.h"
 #include "../Sources/Toolbox/SubvoxelReader.h"
+#include "../Sources/Toolbox/TrilinearScanlineReader.h"
 #include "../Sources/Volumes/DicomVolumeImageMPRSlicer.h"
 #include "../Sources/Volumes/DicomVolumeImageReslicer.h"
 
+#include <Images/Image.h>
 #include <Images/ImageProcessing.h>
 #include <Images/ImageTraits.h>
 #include <OrthancException.h>
 
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/math/special_functions/round.hpp>
 #include <gtest/gtest.h>
+#include <limits>
 
 
 
@@ -47,6 +58,9 @@ static float GetPixelValue(const Orthanc::ImageAccessor& image,
     case Orthanc::PixelFormat_Grayscale8:
       return Orthanc::ImageTraits<Orthanc::PixelFormat_Grayscale8>::GetFloatPixel(image, x, y);
     
+    case Orthanc::PixelFormat_Grayscale16:
+      return Orthanc::ImageTraits<Orthanc::PixelFormat_Grayscale16>::GetFloatPixel(image, x, y);
+    
     case Orthanc::PixelFormat_Float32:
       return Orthanc::ImageTraits<Orthanc::PixelFormat_Float32>::GetFloatPixel(image, x, y);
     
@@ -1067,3 +1081,1271 @@ TEST(VolumeRendering, MacroLayer)
   ASSERT_TRUE(clone->HasLayer(3));
   ASSERT_THROW(clone->HasLayer(4), Orthanc::OrthancException);
 }
+
+
+static void FillVolumePattern(OrthancStone::ImageBuffer3D& volume)
+{
+  if (volume.GetFormat() != Orthanc::PixelFormat_Grayscale16)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+  }
+
+  for (unsigned int z = 0; z < volume.GetDepth(); z++)
+  {
+    OrthancStone::ImageBuffer3D::SliceWriter writer(volume, OrthancStone::VolumeProjection_Axial, z);
+
+    for (unsigned int y = 0; y < volume.GetHeight(); y++)
+    {
+      uint16_t* p = reinterpret_cast<uint16_t*>(writer.GetAccessor().GetRow(y));
+      for (unsigned int x = 0; x < volume.GetWidth(); x++, p++)
+      {
+        *p = static_cast<uint16_t>((x * 97 + y * 57 + z * 1013) % 4096);
+      }
+    }
+  }
+}
+
+
+// Oblique cutting plane through the center of a 37x29x23 volume
+static OrthancStone::CoordinateSystem3D CreateObliquePlane()
+{
+  OrthancStone::Vector axisX = OrthancStone::LinearAlgebra::CreateVector(1, 0.3, 0.2);
+  OrthancStone::Vector axisY = OrthancStone::LinearAlgebra::CreateVector(-0.3, 1, 0);
+  OrthancStone::LinearAlgebra::NormalizeVector(axisX);
+  OrthancStone::LinearAlgebra::NormalizeVector(axisY);
+
+  return OrthancStone::CoordinateSystem3D(OrthancStone::LinearAlgebra::CreateVector(18, 14, 11), axisX, axisY);
+}
+
+
+static bool AreIdenticalImages(const Orthanc::ImageAccessor& image1,
+                               const Orthanc::ImageAccessor& image2)
+{
+  if (image1.GetFormat() != image2.GetFormat() ||
+      image1.GetWidth() != image2.GetWidth() ||
+      image1.GetHeight() != image2.GetHeight())
+  {
+    return false;
+  }
+
+  const size_t rowSize = image1.GetBytesPerPixel() * image1.GetWidth();
+
+  for (unsigned int y = 0; y < image1.GetHeight(); y++)
+  {
+    if (memcmp(image1.GetConstRow(y), image2.GetConstRow(y), rowSize) != 0)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+TEST(VolumeRendering, ReslicerThreads)
+{
+  OrthancStone::VolumeImageGeometry geometry;
+  geometry.SetSizeInVoxels(37, 29, 23);
+
+  OrthancStone::ImageBuffer3D volume(Orthanc::PixelFormat_Grayscale16, 37, 29, 23, false);
+  FillVolumePattern(volume);
+
+  OrthancStone::VolumeReslicer reslicer;
+  reslicer.SetOutputFormat(Orthanc::PixelFormat_Grayscale16);
+  ASSERT_EQ(1u, reslicer.GetThreadsCount());
+  ASSERT_THROW(reslicer.SetThreadsCount(0), Orthanc::OrthancException);
+
+  const OrthancStone::CoordinateSystem3D plane = CreateObliquePlane();
+
+  for (unsigned int interpolation = 0; interpolation < 3; interpolation++)
+  {
+    for (unsigned int linear = 0; linear < 2; linear++)
+    {
+      switch (interpolation)
+      {
+        case 0:
+          reslicer.SetInterpolation(OrthancStone::ImageInterpolation_Nearest);
+          break;
+
+        case 1:
+          reslicer.SetInterpolation(OrthancStone::ImageInterpolation_Bilinear);
+          break;
+
+        default:
+          reslicer.SetInterpolation(OrthancStone::ImageInterpolation_Trilinear);
+          break;
+      }
+
+      if (linear)
+      {
+        reslicer.SetLinearFunction(3.0f, -100.0f);
+      }
+      else
+      {
+        reslicer.ResetLinearFunction();
+      }
+
+      reslicer.SetThreadsCount(1);
+      reslicer.Apply(volume, geometry, plane, 0.7);
+      std::unique_ptr<Orthanc::ImageAccessor> serial(reslicer.ReleaseOutputSlice());
+      ASSERT_GT(serial->GetHeight(), 4u);
+
+      for (unsigned int threads = 2; threads <= 7; threads++)
+      {
+        reslicer.SetThreadsCount(threads);
+
+        // The second call reuses the threads started by the first one
+        for (unsigned int i = 0; i < 2; i++)
+        {
+          reslicer.Apply(volume, geometry, plane, 0.7);
+          ASSERT_TRUE(AreIdenticalImages(*serial, reslicer.GetOutputSlice()));
+        }
+      }
+    }
+  }
+}
+
+
+template <Orthanc::PixelFormat Format>
+static void FillVolumeRamp(OrthancStone::ImageBuffer3D& volume)
+{
+  typedef typename Orthanc::PixelTraits<Format>::PixelType  PixelType;
+
+  for (unsigned int z = 0; z < volume.GetDepth(); z++)
+  {
+    OrthancStone::ImageBuffer3D::SliceWriter writer(volume, OrthancStone::VolumeProjection_Axial, z);
+
+    for (unsigned int y = 0; y < volume.GetHeight(); y++)
+    {
+      PixelType* p = reinterpret_cast<PixelType*>(writer.GetAccessor().GetRow(y));
+      for (unsigned int x = 0; x < volume.GetWidth(); x++, p++)
+      {
+        Orthanc::PixelTraits<Format>::FloatToPixel(
+          *p, static_cast<float>(static_cast<int>((x * 97 + y * 57 + z * 1013) % 2000) - 500));
+      }
+    }
+  }
+}
+
+
+template <Orthanc::PixelFormat Format>
+static void CheckTrilinearScanlineReader()
+{
+  OrthancStone::ImageBuffer3D volume(Format, 13, 11, 7, false);
+  FillVolumeRamp<Format>(volume);
+
+  OrthancStone::TrilinearScanlineReader<Format> reader(volume);
+
+  // Sample points inside and around the volume, including its borders
+  for (unsigned int k = 0; k < 2000; k++)
+  {
+    float x[OrthancStone::TrilinearScanlineReader<Format>::BLOCK_SIZE];
+    float y[OrthancStone::TrilinearScanlineReader<Format>::BLOCK_SIZE];
+    float z[OrthancStone::TrilinearScanlineReader<Format>::BLOCK_SIZE];
+
+    for (unsigned int i = 0; i < OrthancStone::TrilinearScanlineReader<Format>::BLOCK_SIZE; i++)
+    {
+      const unsigned int j = k * OrthancStone::TrilinearScanlineReader<Format>::BLOCK_SIZE + i;
+      x[i] = -1.0f + static_cast<float>((j * 37) % 160) / 10.0f;
+      y[i] = -1.0f + static_cast<float>((j * 53) % 140) / 10.0f;
+      z[i] = -1.0f + static_cast<float>((j * 71) % 100) / 10.0f;
+    }
+
+    float simd[OrthancStone::TrilinearScanlineReader<Format>::BLOCK_SIZE];
+    float scalar[OrthancStone::TrilinearScanlineReader<Format>::BLOCK_SIZE];
+
+    const unsigned int a = reader.GetFloatValues(simd, x, y, z);
+    const unsigned int b = reader.GetFloatValuesScalar(scalar, x, y, z);
+    ASSERT_EQ(a, b);
+
+    for (unsigned int i = 0; i < OrthancStone::TrilinearScanlineReader<Format>::BLOCK_SIZE; i++)
+    {
+      if (a & (1u << i))
+      {
+        // The compiler might contract the scalar code into FMA
+        ASSERT_NEAR(scalar[i], simd[i], 0.01f);
+      }
+    }
+  }
+}
+
+
+template <Orthanc::PixelFormat InputFormat>
+static void CheckReslicerSimd(Orthanc::PixelFormat outputFormat)
+{
+  OrthancStone::VolumeImageGeometry geometry;
+  geometry.SetSizeInVoxels(37, 29, 23);
+
+  OrthancStone::ImageBuffer3D volume(InputFormat, 37, 29, 23, false);
+  FillVolumeRamp<InputFormat>(volume);
+
+  const OrthancStone::CoordinateSystem3D plane = CreateObliquePlane();
+
+  OrthancStone::VolumeReslicer reslicer;
+  reslicer.SetOutputFormat(outputFormat);
+  reslicer.SetInterpolation(OrthancStone::ImageInterpolation_Trilinear);
+  reslicer.SetLinearFunction(0.1f, 60.0f);
+
+  reslicer.EnableSimd(false);
+  reslicer.Apply(volume, geometry, plane, 0.7);
+  std::unique_ptr<Orthanc::ImageAccessor> scalar(reslicer.ReleaseOutputSlice());
+
+  reslicer.EnableSimd(true);
+  reslicer.Apply(volume, geometry, plane, 0.7);
+  const Orthanc::ImageAccessor& simd = reslicer.GetOutputSlice();
+
+  ASSERT_EQ(scalar->GetWidth(), simd.GetWidth());
+  ASSERT_EQ(scalar->GetHeight(), simd.GetHeight());
+  ASSERT_GT(simd.GetWidth(), 4u);
+
+  for (unsigned int y = 0; y < simd.GetHeight(); y++)
+  {
+    for (unsigned int x = 0; x < simd.GetWidth(); x++)
+    {
+      // Tolerate a difference of 1 in the rounding to integers, if
+      // the compiler contracts the scalar code into FMA
+      ASSERT_NEAR(GetPixelValue(*scalar, x, y), GetPixelValue(simd, x, y), 1.0f);
+    }
+  }
+}
+
+
+TEST(VolumeRendering, TrilinearSimd)
+{
+  CheckTrilinearScanlineReader<Orthanc::PixelFormat_Grayscale16>();
+  CheckTrilinearScanlineReader<Orthanc::PixelFormat_SignedGrayscale16>();
+  CheckTrilinearScanlineReader<Orthanc::PixelFormat_Float32>();
+
+  ASSERT_EQ(OrthancStone::VolumeReslicer::IsSimdAvailable(),
+            OrthancStone::VolumeReslicer().IsSimdEnabled());
+
+  CheckReslicerSimd<Orthanc::PixelFormat_Grayscale16>(Orthanc::PixelFormat_Grayscale8);
+  CheckReslicerSimd<Orthanc::PixelFormat_SignedGrayscale16>(Orthanc::PixelFormat_BGRA32);
+  CheckReslicerSimd<Orthanc::PixelFormat_Float32>(Orthanc::PixelFormat_Grayscale8);
+}
+
+
+/**
+ * Reference implementation of the MIP and mean projections, copied
+ * from the original (single-threaded, scalar) implementation of
+ * "ShearWarpProjectiveTransform::ApplyAxial()". Restricted to
+ * Grayscale16 volumes and targets.
+ **/
+static Orthanc::ImageAccessor* ApplyReferenceShearWarp(float& maxValue,
+                                                       const OrthancStone::Matrix& view,
+                                                       const OrthancStone::ImageBuffer3D& source,
+                                                       const OrthancStone::VolumeImageGeometry& geometry,
+                                                       unsigned int targetWidth,
+                                                       unsigned int targetHeight,
+                                                       bool mip,
+                                                       double pixelSpacing,
+                                                       unsigned int countSlices)
+{
+  using namespace OrthancStone;
+
+  std::unique_ptr<Orthanc::ImageAccessor> target(
+    new Orthanc::Image(Orthanc::PixelFormat_Grayscale16, targetWidth, targetHeight, false));
+
+  Vector origin = geometry.GetCoordinates(0, 0, 0);
+  Vector ps = geometry.GetVoxelDimensions(VolumeProjection_Axial);
+  Matrix world = LinearAlgebra::Product(
+    GeometryToolbox::CreateScalingMatrix(1.0 / ps[0], 1.0 / ps[1], 1.0 / ps[2]),
+    GeometryToolbox::CreateTranslationMatrix(-origin[0], -origin[1], -origin[2]));
+
+  Matrix worldInv;
+  LinearAlgebra::InvertMatrix(worldInv, world);
+
+  ShearWarpProjectiveTransform shearWarp(LinearAlgebra::Product(view, worldInv),
+                                         source.GetWidth(), source.GetHeight(), source.GetDepth(),
+                                         pixelSpacing, pixelSpacing, targetWidth, targetHeight);
+
+  const unsigned int intermediateWidth = shearWarp.GetIntermediateWidth();
+  const unsigned int intermediateHeight = shearWarp.GetIntermediateHeight();
+
+  Orthanc::Image accumulator(Orthanc::PixelFormat_Float32, intermediateWidth, intermediateHeight, false);
+  Orthanc::Image counter(Orthanc::PixelFormat_Grayscale16, intermediateWidth, intermediateHeight, false);
+  std::unique_ptr<Orthanc::ImageAccessor> intermediate(
+    new Orthanc::Image(Orthanc::PixelFormat_Grayscale16, intermediateWidth, intermediateHeight, false));
+
+  Orthanc::ImageProcessing::Set(accumulator, 0);
+  Orthanc::ImageProcessing::Set(counter, 0);
+
+  for (unsigned int i = 0; i <= countSlices; i++)
+  {
+    unsigned int z = static_cast<unsigned int>(
+      boost::math::iround(static_cast<double>(i) /
+                          static_cast<double>(countSlices) *
+                          static_cast<double>(source.GetDepth() - 1)));
+
+    double a11, b1, a22, b2, vz;
+    shearWarp.ComputeShearOnSlice(a11, b1, a22, b2, vz, static_cast<double>(z) + 0.5);
+
+    {
+      Matrix a = LinearAlgebra::ZeroMatrix(3, 3);
+      a(0, 0) = a11;
+      a(0, 2) = b1;
+      a(1, 1) = a22;
+      a(1, 2) = b2;
+      a(2, 2) = 1;
+
+      unsigned int x1, y1, x2, y2;
+      if (GetProjectiveTransformExtent(x1, y1, x2, y2, a, source.GetWidth(), source.GetHeight(),
+                                       intermediateWidth, intermediateHeight))
+      {
+        for (unsigned int y = y1; y <= y2; y++)
+        {
+          uint16_t* p = reinterpret_cast<uint16_t*>(counter.GetRow(y)) + x1;
+          for (unsigned int x = x1; x <= x2; x++, p++)
+          {
+            *p = (mip ? 1 : *p + 1);
+          }
+        }
+      }
+    }
+
+    {
+      ImageBuffer3D::SliceReader reader(source, VolumeProjection_Axial, z);
+      ApplyAffineTransform(*intermediate, reader.GetAccessor(), a11, 0, b1, 0, a22, b2,
+                           ImageInterpolation_Bilinear, true);
+    }
+
+    for (unsigned int y = 0; y < intermediateHeight; y++)
+    {
+      const uint16_t* p = reinterpret_cast<const uint16_t*>(intermediate->GetConstRow(y));
+      float* q = reinterpret_cast<float*>(accumulator.GetRow(y));
+
+      for (unsigned int x = 0; x < intermediateWidth; x++, p++, q++)
+      {
+        const float pixel = static_cast<float>(*p);
+
+        if (mip)
+        {
+          if (*q < pixel)
+          {
+            *q = pixel;
+          }
+        }
+        else
+        {
+          *q += pixel;
+        }
+      }
+    }
+  }
+
+  intermediate.reset(new Orthanc::Image(Orthanc::PixelFormat_Grayscale16, intermediateWidth, intermediateHeight, false));
+
+  maxValue = 0;
+
+  for (unsigned int y = 0; y < intermediateHeight; y++)
+  {
+    const float* qacc = reinterpret_cast<const float*>(accumulator.GetConstRow(y));
+    const uint16_t* qcount = reinterpret_cast<const uint16_t*>(counter.GetConstRow(y));
+    uint16_t* p = reinterpret_cast<uint16_t*>(intermediate->GetRow(y));
+
+    for (unsigned int x = 0; x < intermediateWidth; x++, p++, qacc++, qcount++)
+    {
+      if (*qcount == 0)
+      {
+        *p = 0;
+      }
+      else
+      {
+        *p = static_cast<uint16_t>(*qacc / static_cast<float>(*qcount));
+
+        if (*p > maxValue)
+        {
+          maxValue = *p;
+        }
+      }
+    }
+  }
+
+  Matrix warp;
+
+  {
+    Matrix fullWarp = LinearAlgebra::Product(shearWarp.GetIntrinsicParameters(), shearWarp.GetWarp());
+
+    const double v[] = {
+      fullWarp(0, 0), fullWarp(0, 1), fullWarp(0, 3),
+      fullWarp(1, 0), fullWarp(1, 1), fullWarp(1, 3),
+      fullWarp(2, 0), fullWarp(2, 1), fullWarp(2, 3)
+    };
+
+    LinearAlgebra::FillMatrix(warp, 3, 3, v);
+  }
+
+  ApplyProjectiveTransform(*target, *intermediate, warp, ImageInterpolation_Bilinear, true);
+
+  return target.release();
+}
+
+
+TEST(VolumeRendering, ShearWarpThreads)
+{
+  OrthancStone::VolumeImageGeometry geometry;
+  geometry.SetSizeInVoxels(37, 29, 23);
+
+  OrthancStone::ImageBuffer3D volume(Orthanc::PixelFormat_Grayscale16, 37, 29, 23, false);
+  FillVolumePattern(volume);
+
+  const OrthancStone::Matrix view = OrthancStone::ShearWarpProjectiveTransform::CalibrateView(
+    OrthancStone::LinearAlgebra::CreateVector(-50, -30, -200),
+    OrthancStone::LinearAlgebra::CreateVector(18, 14, 11), 0.3);
+
+  const OrthancStone::IntensityProjection projections[] = {
+    OrthancStone::IntensityProjection_Maximum,
+    OrthancStone::IntensityProjection_Minimum,
+    OrthancStone::IntensityProjection_Mean
+  };
+
+  for (size_t i = 0; i < sizeof(projections) / sizeof(projections[0]); i++)
+  {
+    float serialMax;
+    std::unique_ptr<Orthanc::ImageAccessor> serial(
+      OrthancStone::ShearWarpProjectiveTransform::ApplyAxial(
+        serialMax, view, volume, geometry, Orthanc::PixelFormat_Grayscale16, 64, 64, projections[i], 1, 23,
+        OrthancStone::ImageInterpolation_Bilinear, OrthancStone::ImageInterpolation_Bilinear, 1));
+
+    ASSERT_GT(serialMax, 0.0f);
+
+    for (unsigned int threads = 2; threads <= 30; threads += 7)
+    {
+      float threadedMax;
+      std::unique_ptr<Orthanc::ImageAccessor> threaded(
+        OrthancStone::ShearWarpProjectiveTransform::ApplyAxial(
+          threadedMax, view, volume, geometry, Orthanc::PixelFormat_Grayscale16, 64, 64, projections[i], 1, 23,
+          OrthancStone::ImageInterpolation_Bilinear, OrthancStone::ImageInterpolation_Bilinear, threads));
+
+      if (projections[i] == OrthancStone::IntensityProjection_Mean)
+      {
+        // The summation order depends on the number of threads
+        ASSERT_NEAR(serialMax, threadedMax, 1.0f);
+        for (unsigned int y = 0; y < 64; y++)
+        {
+          for (unsigned int x = 0; x < 64; x++)
+          {
+            ASSERT_NEAR(GetPixelValue(*serial, x, y), GetPixelValue(*threaded, x, y), 1.0f);
+          }
+        }
+      }
+      else
+      {
+        ASSERT_FLOAT_EQ(serialMax, threadedMax);
+        ASSERT_TRUE(AreIdenticalImages(*serial, *threaded));
+      }
+    }
+  }
+
+  for (unsigned int mip = 0; mip < 2; mip++)
+  {
+    // Compare with the original implementation, through the legacy
+    // "mip" flag (maximum or mean projections) and through the
+    // threaded code path
+    float expectedMax;
+    std::unique_ptr<Orthanc::ImageAccessor> expected(
+      ApplyReferenceShearWarp(expectedMax, view, volume, geometry, 64, 64, (mip == 1), 1, 23));
+
+    float a;
+    std::unique_ptr<Orthanc::ImageAccessor> legacy(
+      OrthancStone::ShearWarpProjectiveTransform::ApplyAxial(
+        a, view, volume, geometry, Orthanc::PixelFormat_Grayscale16, 64, 64, (mip == 1), 1, 23,
+        OrthancStone::ImageInterpolation_Bilinear, OrthancStone::ImageInterpolation_Bilinear));
+    ASSERT_FLOAT_EQ(expectedMax, a);
+    ASSERT_TRUE(AreIdenticalImages(*expected, *legacy));
+
+    if (mip == 1)
+    {
+      float b;
+      std::unique_ptr<Orthanc::ImageAccessor> threaded(
+        OrthancStone::ShearWarpProjectiveTransform::ApplyAxial(
+          b, view, volume, geometry, Orthanc::PixelFormat_Grayscale16, 64, 64,
+          OrthancStone::IntensityProjection_Maximum, 1, 23,
+          OrthancStone::ImageInterpolation_Bilinear, OrthancStone::ImageInterpolation_Bilinear, 9));
+      ASSERT_FLOAT_EQ(expectedMax, b);
+      ASSERT_TRUE(AreIdenticalImages(*expected, *threaded));
+    }
+  }
+}
+
+
+static void CheckSameSlices(const OrthancStone::ImageBuffer3D& volume1,
+                            const OrthancStone::ImageBuffer3D& volume2)
+{
+  const OrthancStone::VolumeProjection projections[] = {
+    OrthancStone::VolumeProjection_Axial,
+    OrthancStone::VolumeProjection_Coronal,
+    OrthancStone::VolumeProjection_Sagittal
+  };
+
+  const unsigned int counts[] = {
+    volume1.GetDepth(),
+    volume1.GetHeight(),
+    volume1.GetWidth()
+  };
+
+  for (size_t i = 0; i < 3; i++)
+  {
+    for (unsigned int slice = 0; slice < counts[i]; slice++)
+    {
+      OrthancStone::ImageBuffer3D::SliceReader reader1(volume1, projections[i], slice);
+      OrthancStone::ImageBuffer3D::SliceReader reader2(volume2, projections[i], slice);
+      ASSERT_TRUE(AreIdenticalImages(reader1.GetAccessor(), reader2.GetAccessor()));
+    }
+  }
+}
+
+
+TEST(VolumeRendering, BrickedLayout)
+{
+  // Sizes that are not multiples of "BRICK_SIZE"
+  OrthancStone::ImageBuffer3D slices(Orthanc::PixelFormat_Grayscale16, 37, 29, 23, false);
+  OrthancStone::ImageBuffer3D bricks(Orthanc::PixelFormat_Grayscale16, 37, 29, 23, false,
+                                     OrthancStone::VolumeLayout_Bricks);
+
+  ASSERT_EQ(OrthancStone::VolumeLayout_Slices, slices.GetLayout());
+  ASSERT_EQ(OrthancStone::VolumeLayout_Bricks, bricks.GetLayout());
+  ASSERT_NO_THROW(slices.GetInternalImage());
+  ASSERT_THROW(bricks.GetInternalImage(), Orthanc::OrthancException);
+
+  FillVolumePattern(slices);
+  FillVolumePattern(bricks);
+
+  for (unsigned int z = 0; z < 23; z++)
+  {
+    for (unsigned int y = 0; y < 29; y++)
+    {
+      for (unsigned int x = 0; x < 37; x++)
+      {
+        ASSERT_EQ(slices.GetVoxelGrayscale16(x, y, z), bricks.GetVoxelGrayscale16(x, y, z));
+      }
+    }
+  }
+
+  CheckSameSlices(slices, bricks);
+
+  {
+    // The layout of the voxel readers must match that of the volume
+    typedef OrthancStone::SubvoxelReader<Orthanc::PixelFormat_Grayscale16,
+                                         OrthancStone::ImageInterpolation_Nearest>  SlicesReader;
+    typedef OrthancStone::SubvoxelReader<Orthanc::PixelFormat_Grayscale16,
+                                         OrthancStone::ImageInterpolation_Nearest,
+                                         OrthancStone::VolumeLayout_Bricks>  BricksReader;
+
+    ASSERT_THROW(SlicesReader reader(bricks), Orthanc::OrthancException);
+    ASSERT_THROW(BricksReader reader(slices), Orthanc::OrthancException);
+
+    BricksReader reader(bricks);
+    uint16_t value;
+    ASSERT_TRUE(reader.GetValue(value, 5.5f, 6.5f, 7.5f));
+    ASSERT_EQ(slices.GetVoxelGrayscale16(5, 6, 7), value);
+    ASSERT_FALSE(reader.GetValue(value, 37.5f, 6.5f, 7.5f));
+  }
+
+  {
+    // Modify one sagittal and one coronal slice
+    OrthancStone::ImageBuffer3D* volumes[] = { &slices, &bricks };
+    
+    for (size_t i = 0; i < 2; i++)
+    {
+      {
+        OrthancStone::ImageBuffer3D::SliceWriter writer(*volumes[i], OrthancStone::VolumeProjection_Sagittal, 17);
+        Orthanc::ImageProcessing::Set(writer.GetAccessor(), 42);
+      }
+
+      {
+        OrthancStone::ImageBuffer3D::SliceWriter writer(*volumes[i], OrthancStone::VolumeProjection_Coronal, 28);
+        Orthanc::ImageProcessing::Set(writer.GetAccessor(), 43);
+      }
+    }
+
+    ASSERT_EQ(42u, bricks.GetVoxelGrayscale16(17, 3, 22));
+    ASSERT_EQ(43u, bricks.GetVoxelGrayscale16(36, 28, 0));
+    CheckSameSlices(slices, bricks);
+  }
+
+  {
+    // Reslicing must not depend on the layout
+    OrthancStone::VolumeImageGeometry geometry;
+    geometry.SetSizeInVoxels(37, 29, 23);
+
+    OrthancStone::VolumeReslicer reslicer;
+    reslicer.SetOutputFormat(Orthanc::PixelFormat_Grayscale16);
+    reslicer.SetInterpolation(OrthancStone::ImageInterpolation_Trilinear);
+
+    reslicer.Apply(slices, geometry, CreateObliquePlane(), 0.7);
+    std::unique_ptr<Orthanc::ImageAccessor> a(reslicer.ReleaseOutputSlice());
+
+    reslicer.Apply(bricks, geometry, CreateObliquePlane(), 0.7);
+    ASSERT_TRUE(AreIdenticalImages(*a, reslicer.GetOutputSlice()));
+  }
+}
+
+
+static int64_t BenchmarkSlices(const OrthancStone::ImageBuffer3D& volume,
+                               OrthancStone::VolumeProjection projection,
+                               unsigned int countSlices)
+{
+  boost::posix_time::ptime start = boost::posix_time::microsec_clock::local_time();
+
+  for (unsigned int slice = 0; slice < countSlices; slice++)
+  {
+    OrthancStone::ImageBuffer3D::SliceReader reader(volume, projection, slice);
+
+    // Read one pixel so that the extraction cannot be optimized away
+    EXPECT_TRUE(reader.GetAccessor().GetConstRow(0) != NULL);
+  }
+
+  boost::posix_time::ptime end = boost::posix_time::microsec_clock::local_time();
+  return (end - start).total_microseconds();
+}
+
+
+static int64_t BenchmarkOblique(const OrthancStone::ImageBuffer3D& volume,
+                                const OrthancStone::VolumeImageGeometry& geometry,
+                                unsigned int countPlanes)
+{
+  OrthancStone::VolumeReslicer reslicer;
+  reslicer.SetOutputFormat(Orthanc::PixelFormat_Grayscale16);
+  reslicer.SetInterpolation(OrthancStone::ImageInterpolation_Trilinear);
+
+  const OrthancStone::Vector center = OrthancStone::LinearAlgebra::CreateVector(
+    volume.GetWidth() / 2, volume.GetHeight() / 2, volume.GetDepth() / 2);
+
+  boost::posix_time::ptime start = boost::posix_time::microsec_clock::local_time();
+
+  for (unsigned int i = 0; i < countPlanes; i++)
+  {
+    // Rotate the cutting plane around the Z axis
+    const double angle = static_cast<double>(i) / static_cast<double>(countPlanes) * 3.14159265358979;
+    OrthancStone::Vector axisX = OrthancStone::LinearAlgebra::CreateVector(cos(angle), 0, sin(angle));
+    OrthancStone::Vector axisY = OrthancStone::LinearAlgebra::CreateVector(0.2, 1, 0);
+    OrthancStone::LinearAlgebra::NormalizeVector(axisY);
+
+    reslicer.Apply(volume, geometry, OrthancStone::CoordinateSystem3D(center, axisX, axisY), 1.0);
+    EXPECT_TRUE(reslicer.IsSuccess());
+  }
+
+  boost::posix_time::ptime end = boost::posix_time::microsec_clock::local_time();
+  return (end - start).total_microseconds();
+}
+
+
+TEST(VolumeRendering, DISABLED_BrickedLayoutBenchmark)
+{
+  static const unsigned int WIDTH = 256;
+  static const unsigned int HEIGHT = 256;
+  static const unsigned int DEPTH = 128;
+  static const unsigned int OBLIQUE_PLANES = 16;
+
+  OrthancStone::VolumeImageGeometry geometry;
+  geometry.SetSizeInVoxels(WIDTH, HEIGHT, DEPTH);
+
+  const OrthancStone::VolumeLayout layouts[] = {
+    OrthancStone::VolumeLayout_Slices,
+    OrthancStone::VolumeLayout_Bricks
+  };
+
+  for (size_t i = 0; i < 2; i++)
+  {
+    OrthancStone::ImageBuffer3D volume(Orthanc::PixelFormat_Grayscale16, WIDTH, HEIGHT, DEPTH, false, layouts[i]);
+    FillVolumePattern(volume);
+
+    const int64_t axial = BenchmarkSlices(volume, OrthancStone::VolumeProjection_Axial, DEPTH);
+    const int64_t coronal = BenchmarkSlices(volume, OrthancStone::VolumeProjection_Coronal, HEIGHT);
+    const int64_t sagittal = BenchmarkSlices(volume, OrthancStone::VolumeProjection_Sagittal, WIDTH);
+    const int64_t oblique = BenchmarkOblique(volume, geometry, OBLIQUE_PLANES);
+
+    const double mvoxels = static_cast<double>(WIDTH * HEIGHT * DEPTH) / 1000000.0;
+
+    std::cout << (layouts[i] == OrthancStone::VolumeLayout_Slices ? "Slices" : "Bricks")
+              << " layout of " << WIDTH << "x" << HEIGHT << "x" << DEPTH << " voxels (Mvoxels/s):"
+              << " axial = " << mvoxels / (static_cast<double>(std::max<int64_t>(1, axial)) / 1000000.0)
+              << ", coronal = " << mvoxels / (static_cast<double>(std::max<int64_t>(1, coronal)) / 1000000.0)
+              << ", sagittal = " << mvoxels / (static_cast<double>(std::max<int64_t>(1, sagittal)) / 1000000.0)
+              << " - " << OBLIQUE_PLANES << " oblique planes in " << oblique << "us" << std::endl;
+  }
+}
+
+
+TEST(VolumeRendering, ReslicerFixedExtent)
+{
+  OrthancStone::VolumeImageGeometry geometry;
+  geometry.SetSizeInVoxels(37, 29, 23);
+
+  OrthancStone::ImageBuffer3D volume(Orthanc::PixelFormat_Float32, 37, 29, 23, false);
+  FillVolumeRamp<Orthanc::PixelFormat_Float32>(volume);
+
+  OrthancStone::VolumeReslicer reslicer;
+  reslicer.SetOutputFormat(Orthanc::PixelFormat_Float32);
+  reslicer.SetInterpolation(OrthancStone::ImageInterpolation_Trilinear);
+  reslicer.EnableFastMode(false);
+
+  const OrthancStone::CoordinateSystem3D plane = CreateObliquePlane();
+  const double voxelSize = 0.5;
+
+  reslicer.Apply(volume, geometry, plane, voxelSize);
+  const OrthancStone::Extent2D extent = reslicer.GetOutputExtent();
+  std::unique_ptr<Orthanc::ImageAccessor> reference(reslicer.ReleaseOutputSlice());
+  ASSERT_EQ(Orthanc::PixelFormat_Float32, reference->GetFormat());
+
+  // Providing the extent of the intersection gives back the same slice
+  reslicer.Apply(volume, geometry, plane, extent, voxelSize);
+  ASSERT_TRUE(AreIdenticalImages(*reference, reslicer.GetOutputSlice()));
+
+  // Snap the extent to the voxel size, then add a margin of (2, 3) voxels
+  const unsigned int width = reference->GetWidth();
+  const unsigned int height = reference->GetHeight();
+
+  reslicer.Apply(volume, geometry, plane, OrthancStone::Extent2D(
+                   extent.GetX1(), extent.GetY1(),
+                   extent.GetX1() + static_cast<double>(width) * voxelSize,
+                   extent.GetY1() + static_cast<double>(height) * voxelSize), voxelSize);
+  std::unique_ptr<Orthanc::ImageAccessor> snapped(reslicer.ReleaseOutputSlice());
+  ASSERT_EQ(width, snapped->GetWidth());
+  ASSERT_EQ(height, snapped->GetHeight());
+
+  reslicer.Apply(volume, geometry, plane, OrthancStone::Extent2D(
+                   extent.GetX1() - 2.0 * voxelSize, extent.GetY1() - 3.0 * voxelSize,
+                   extent.GetX1() + static_cast<double>(width + 1) * voxelSize,
+                   extent.GetY1() + static_cast<double>(height + 2) * voxelSize), voxelSize);
+  ASSERT_EQ(width + 3, reslicer.GetOutputSlice().GetWidth());
+  ASSERT_EQ(height + 5, reslicer.GetOutputSlice().GetHeight());
+
+  for (unsigned int y = 0; y < height; y++)
+  {
+    const float* a = reinterpret_cast<const float*>(snapped->GetConstRow(y));
+    const float* b = reinterpret_cast<const float*>(reslicer.GetOutputSlice().GetConstRow(y + 3)) + 2;
+
+    for (unsigned int x = 0; x < width; x++)
+    {
+      ASSERT_NEAR(a[x], b[x], 0.01f);
+    }
+  }
+}
+
+
+TEST(VolumeRendering, ReslicerOutOfVolumeValue)
+{
+  OrthancStone::VolumeImageGeometry geometry;
+  geometry.SetSizeInVoxels(37, 29, 23);
+
+  OrthancStone::ImageBuffer3D volume(Orthanc::PixelFormat_Float32, 37, 29, 23, false);
+  FillVolumeRamp<Orthanc::PixelFormat_Float32>(volume);
+
+  const OrthancStone::CoordinateSystem3D plane = CreateObliquePlane();
+  const double voxelSize = 0.5;
+
+  OrthancStone::VolumeReslicer reslicer;
+  reslicer.SetOutputFormat(Orthanc::PixelFormat_Float32);
+  ASSERT_FALSE(reslicer.HasOutOfVolumeValue());
+  ASSERT_THROW(reslicer.GetOutOfVolumeValue(), Orthanc::OrthancException);
+
+  reslicer.SetOutOfVolumeValue(-1234.5f);
+  ASSERT_TRUE(reslicer.HasOutOfVolumeValue());
+  ASSERT_FLOAT_EQ(-1234.5f, reslicer.GetOutOfVolumeValue());
+
+  reslicer.Apply(volume, geometry, plane, voxelSize);
+  const OrthancStone::Extent2D extent = reslicer.GetOutputExtent();
+
+  /**
+   * Margin of 8 pixels around the intersection of the plane with the
+   * volume. Only the 2 outermost pixels are checked, as the linear
+   * interpolations still sample the volume up to half a voxel beyond
+   * its border.
+   **/
+  const OrthancStone::Extent2D margin(extent.GetX1() - 8.0 * voxelSize, extent.GetY1() - 8.0 * voxelSize,
+                                      extent.GetX2() + 8.0 * voxelSize, extent.GetY2() + 8.0 * voxelSize);
+
+  // The second pass checks that, by default, all the interpolations
+  // pad the slice with the minimum of the input format (which is
+  // "-FLT_MAX", and not "FLT_MIN", for floats)
+  for (unsigned int i = 0; i < 6; i++)
+  {
+    if (i == 3)
+    {
+      reslicer.ResetOutOfVolumeValue();
+      ASSERT_FALSE(reslicer.HasOutOfVolumeValue());
+    }
+
+    const float expected = (i < 3 ? -1234.5f : -std::numeric_limits<float>::max());
+
+    switch (i % 3)
+    {
+      case 0:
+        reslicer.SetInterpolation(OrthancStone::ImageInterpolation_Nearest);
+        break;
+
+      case 1:
+        reslicer.SetInterpolation(OrthancStone::ImageInterpolation_Trilinear);
+        reslicer.EnableSimd(false);
+        break;
+
+      case 2:
+        reslicer.SetInterpolation(OrthancStone::ImageInterpolation_Trilinear);
+        reslicer.EnableSimd(true);
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+
+    reslicer.Apply(volume, geometry, plane, margin, voxelSize);
+
+    const Orthanc::ImageAccessor& slice = reslicer.GetOutputSlice();
+    ASSERT_LT(16u, slice.GetWidth());
+    ASSERT_LT(16u, slice.GetHeight());
+
+    for (unsigned int y = 0; y < slice.GetHeight(); y++)
+    {
+      const float* p = reinterpret_cast<const float*>(slice.GetConstRow(y));
+
+      for (unsigned int x = 0; x < slice.GetWidth(); x++)
+      {
+        if (x < 2 || x + 2 >= slice.GetWidth() ||
+            y < 2 || y + 2 >= slice.GetHeight())
+        {
+          ASSERT_FLOAT_EQ(expected, p[x]);
+        }
+      }
+    }
+  }
+
+}
+
+
+TEST(VolumeRendering, ReslicerFloatWindowing)
+{
+  OrthancStone::ImageBuffer3D volume(Orthanc::PixelFormat_Float32, 5, 5, 5, false);
+
+  OrthancStone::VolumeReslicer reslicer;
+  reslicer.SetOutputFormat(Orthanc::PixelFormat_Float32);
+
+  // The windows are mapped onto [0, 1] for floats
+  reslicer.SetWindowing(OrthancStone::ImageWindowing_Bone, volume, 2.0f, -1024.0f);
+
+  float center, width;
+  OrthancStone::ComputeWindowing(center, width, OrthancStone::ImageWindowing_Bone, 0, 0);
+
+  float scaling, offset;
+  reslicer.GetLinearFunction(scaling, offset);
+  ASSERT_NEAR(0.0f, scaling * (center - width / 2.0f + 1024.0f) / 2.0f + offset, 0.0001f);
+  ASSERT_NEAR(1.0f, scaling * (center + width / 2.0f + 1024.0f) / 2.0f + offset, 0.0001f);
+}
+
+
+TEST(VolumeRendering, FloatTextureLookupTable)
+{
+  // Emulates a CT slice with rescale slope/intercept
+  Orthanc::Image source(Orthanc::PixelFormat_SignedGrayscale16, 67, 31, false);
+  Orthanc::Image texture(Orthanc::PixelFormat_Float32, 67, 31, false);
+
+  for (unsigned int y = 0; y < source.GetHeight(); y++)
+  {
+    int16_t* p = reinterpret_cast<int16_t*>(source.GetRow(y));
+    float* q = reinterpret_cast<float*>(texture.GetRow(y));
+
+    for (unsigned int x = 0; x < source.GetWidth(); x++)
+    {
+      p[x] = static_cast<int16_t>(static_cast<int>(x * 97 + y * 13) - 1024);
+      q[x] = static_cast<float>(p[x]) * 0.5f - 100.0f;
+    }
+  }
+
+  OrthancStone::FloatTextureSceneLayer reference(texture);
+  ASSERT_FALSE(reference.HasIntegerSource());
+  ASSERT_THROW(reference.GetIntegerSource(), Orthanc::OrthancException);
+
+  OrthancStone::FloatTextureSceneLayer layer(texture);
+  layer.SetIntegerSource(source);
+  ASSERT_TRUE(layer.HasIntegerSource());
+  ASSERT_EQ(-1024, layer.GetIntegerSourceOffset());
+
+  Orthanc::Image tooSmall(Orthanc::PixelFormat_SignedGrayscale16, 66, 31, false);
+  ASSERT_THROW(layer.SetIntegerSource(tooSmall), Orthanc::OrthancException);
+  ASSERT_THROW(layer.SetIntegerSource(texture), Orthanc::OrthancException);
+
+  for (unsigned int i = 0; i < 8; i++)
+  {
+    const bool inverted = (i & 1);
+    const bool applyLog = (i & 2);
+    const float width = ((i & 4) ? 400.0f : 1500.0f);
+
+    reference.SetCustomWindowing(40.0f, width);
+    reference.SetInverted(inverted);
+    reference.SetApplyLog(applyLog);
+
+    layer.SetCustomWindowing(40.0f, width);
+    layer.SetInverted(inverted);
+    layer.SetApplyLog(applyLog);
+
+    // The lookup table must give the same rendering as the float texture
+    std::unique_ptr<Orthanc::ImageAccessor> a(Render(reference.Clone(), 67, 31, true));
+    std::unique_ptr<Orthanc::ImageAccessor> b(Render(layer.Clone(), 67, 31, true));
+    ASSERT_TRUE(AreIdenticalImages(*a, *b));
+  }
+}
+
+
+TEST(VolumeRendering, FloatTexturePacker)
+{
+  // Odd width to exercise the scalar tail of the SIMD loops, and
+  // enough pixels to split the rows between several threads
+  Orthanc::Image texture(Orthanc::PixelFormat_Float32, 1027, 601, false);
+
+  for (unsigned int y = 0; y < texture.GetHeight(); y++)
+  {
+    float* p = reinterpret_cast<float*>(texture.GetRow(y));
+    for (unsigned int x = 0; x < texture.GetWidth(); x++)
+    {
+      p[x] = static_cast<float>((x * 7919 + y * 104729) % 10007) * 0.37f - 1000.0f;
+    }
+  }
+
+  reinterpret_cast<float*>(texture.GetRow(599))[1026] = 3000.5f;
+  reinterpret_cast<float*>(texture.GetRow(0))[1025] = -1200.25f;
+
+  float minValue, maxValue;
+  Orthanc::ImageProcessing::GetMinMaxFloatValue(minValue, maxValue, texture);
+  ASSERT_FLOAT_EQ(-1200.25f, minValue);
+  ASSERT_FLOAT_EQ(3000.5f, maxValue);
+
+  const float offset = minValue;
+  const float scale = 65536.0f / (maxValue - minValue);
+
+  for (unsigned int threads = 1; threads <= 4; threads += 3)
+  {
+    OrthancStone::Internals::FloatTexturePacker packer(texture);
+    packer.SetThreadsCount(threads);
+
+    float a, b;
+    packer.GetRange(a, b);
+    ASSERT_EQ(minValue, a);
+    ASSERT_EQ(maxValue, b);
+
+    Orthanc::Image packed(Orthanc::PixelFormat_RGB24, texture.GetWidth(), texture.GetHeight(), false);
+    Orthanc::Image grayscale(Orthanc::PixelFormat_Grayscale16, texture.GetWidth(), texture.GetHeight(), false);
+    packer.Quantize(packed, offset, scale);
+    packer.Quantize(grayscale, offset, scale);
+
+    for (unsigned int y = 0; y < texture.GetHeight(); y++)
+    {
+      const float* p = reinterpret_cast<const float*>(texture.GetConstRow(y));
+      const uint8_t* q = reinterpret_cast<const uint8_t*>(packed.GetConstRow(y));
+      const uint16_t* r = reinterpret_cast<const uint16_t*>(grayscale.GetConstRow(y));
+
+      for (unsigned int x = 0; x < texture.GetWidth(); x++)
+      {
+        const uint16_t expected = OrthancStone::Internals::FloatTexturePacker::QuantizeValue(p[x], offset, scale);
+        ASSERT_EQ(expected, r[x]);
+        ASSERT_EQ(expected / 256, q[3 * x]);
+        ASSERT_EQ(expected % 256, q[3 * x + 1]);
+        ASSERT_EQ(0, q[3 * x + 2]);
+      }
+    }
+
+    ASSERT_EQ(0, reinterpret_cast<const uint16_t*>(grayscale.GetConstRow(0))[1025]);
+    ASSERT_EQ(65535, reinterpret_cast<const uint16_t*>(grayscale.GetConstRow(599))[1026]);
+  }
+
+  ASSERT_EQ(0, OrthancStone::Internals::FloatTexturePacker::QuantizeValue(-5.0f, 0.0f, 1.0f));
+  ASSERT_EQ(12, OrthancStone::Internals::FloatTexturePacker::QuantizeValue(12.9f, 0.0f, 1.0f));
+  ASSERT_EQ(65535, OrthancStone::Internals::FloatTexturePacker::QuantizeValue(1.0e10f, 0.0f, 1.0f));
+
+  {
+    Orthanc::Image empty(Orthanc::PixelFormat_Float32, 0, 0, false);
+    OrthancStone::Internals::FloatTexturePacker packer(empty);
+    float a, b;
+    packer.GetRange(a, b);
+    ASSERT_EQ(0.0f, a);
+    ASSERT_EQ(0.0f, b);
+  }
+
+  {
+    OrthancStone::Internals::FloatTexturePacker packer(texture);
+    ASSERT_THROW(packer.SetThreadsCount(0), Orthanc::OrthancException);
+
+    Orthanc::Image tooSmall(Orthanc::PixelFormat_Grayscale16, 1026, 601, false);
+    Orthanc::Image badFormat(Orthanc::PixelFormat_Grayscale8, 1027, 601, false);
+    ASSERT_THROW(packer.Quantize(tooSmall, 0, 1), Orthanc::OrthancException);
+    ASSERT_THROW(packer.Quantize(badFormat, 0, 1), Orthanc::OrthancException);
+  }
+
+  Orthanc::Image notFloat(Orthanc::PixelFormat_Grayscale16, 10, 10, false);
+  ASSERT_THROW(OrthancStone::Internals::FloatTexturePacker packer(notFloat), Orthanc::OrthancException);
+}
+
+static void CreateTilesScene(OrthancStone::Scene2D& scene,
+                             unsigned int width,
+                             unsigned int height)
+{
+  Orthanc::Image texture(Orthanc::PixelFormat_Float32, width, height, false);
+
+  for (unsigned int y = 0; y < height; y++)
+  {
+    float* p = reinterpret_cast<float*>(texture.GetRow(y));
+    for (unsigned int x = 0; x < width; x++)
+    {
+      p[x] = static_cast<float>((x * 7 + y * 3) % 256);
+    }
+  }
+
+  scene.SetLayer(0, new OrthancStone::FloatTextureSceneLayer(texture));
+
+  std::unique_ptr<OrthancStone::PolylineSceneLayer> polyline(new OrthancStone::PolylineSceneLayer);
+  OrthancStone::PolylineSceneLayer::Chain chain;
+  chain.push_back(OrthancStone::ScenePoint2D(-static_cast<double>(width) / 2.0, -static_cast<double>(height) / 2.0));
+  chain.push_back(OrthancStone::ScenePoint2D(static_cast<double>(width) / 2.0, static_cast<double>(height) / 2.0));
+  polyline->AddChain(chain, false, 255, 0, 0);
+  scene.SetLayer(1, polyline.release());
+
+  // This texture partially hides the polyline
+  Orthanc::Image color(Orthanc::PixelFormat_RGB24, 61, 43, false);
+  Orthanc::ImageProcessing::Set(color, 0, 128, 255, 255);
+
+  std::unique_ptr<OrthancStone::ColorTextureSceneLayer> layer(new OrthancStone::ColorTextureSceneLayer(color));
+  layer->SetOrigin(-20, -10);
+  scene.SetLayer(2, layer.release());
+}
+
+
+TEST(VolumeRendering, CairoCompositorTiles)
+{
+  OrthancStone::Scene2D scene;
+  CreateTilesScene(scene, 300, 200);
+
+  std::unique_ptr<Orthanc::ImageAccessor> reference(Render(scene, 300, 200));
+
+  OrthancStone::CairoCompositor compositor(300, 200);
+  ASSERT_THROW(compositor.SetThreadsCount(0), Orthanc::OrthancException);
+  ASSERT_THROW(compositor.SetTileSize(0), Orthanc::OrthancException);
+
+  const unsigned int threads[] = { 4, 2, 1, 3 };
+  const unsigned int tileSizes[] = { 7, 37, 64, 256, 1000 };
+
+  for (size_t i = 0; i < sizeof(threads) / sizeof(unsigned int); i++)
+  {
+    // The pool of threads is reused across the refreshes
+    compositor.SetThreadsCount(threads[i]);
+
+    for (size_t j = 0; j < sizeof(tileSizes) / sizeof(unsigned int); j++)
+    {
+      compositor.SetTileSize(tileSizes[j]);
+      compositor.Refresh(scene);
+
+      Orthanc::ImageAccessor rendered;
+      compositor.GetCanvas().GetReadOnlyAccessor(rendered);
+      ASSERT_TRUE(AreIdenticalImages(*reference, rendered));
+    }
+  }
+}
+
+
+TEST(VolumeRendering, DISABLED_CairoCompositorTilesBenchmark)
+{
+  static const unsigned int REPETITIONS = 10;
+
+  const unsigned int sizes[][2] = {
+    { 512, 512 },
+    { 1920, 1080 },
+    { 3840, 2160 }
+  };
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    const unsigned int width = sizes[i][0];
+    const unsigned int height = sizes[i][1];
+
+    OrthancStone::Scene2D scene;
+    CreateTilesScene(scene, width / 2, height / 2);
+    scene.FitContent(width, height);  // Bilinear magnification of the textures
+
+    std::cout << "Cairo compositor of " << width << "x" << height << " pixels (frames/s):";
+
+    const unsigned int threads[] = { 1, 2, 4, 8 };
+
+    for (size_t j = 0; j < sizeof(threads) / sizeof(unsigned int); j++)
+    {
+      OrthancStone::CairoCompositor compositor(width, height);
+      compositor.SetThreadsCount(threads[j]);
+      compositor.Refresh(scene);  // Warm up the renderers
+
+      const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+      for (unsigned int k = 0; k < REPETITIONS; k++)
+      {
+        compositor.Refresh(scene);
+      }
+
+      const int64_t elapsed = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+
+      std::cout << (j == 0 ? " " : ", ") << threads[j] << " thread(s) = "
+                << static_cast<double>(REPETITIONS) / (static_cast<double>(std::max<int64_t>(1, elapsed)) / 1000000.0);
+    }
+
+    std::cout << std::endl;
+  }
+}
+
+
+namespace
+{
+  class NullRendererFactory : public OrthancStone::Internals::CompositorHelper::IRendererFactory
+  {
+  private:
+    class Renderer : public OrthancStone::Internals::CompositorHelper::ILayerRenderer
+    {
+    public:
+      virtual void Render(const OrthancStone::AffineTransform2D& transform,
+                          unsigned int canvasWidth,
+                          unsigned int canvasHeight) ORTHANC_OVERRIDE
+      {
+      }
+
+      virtual void Update(const OrthancStone::ISceneLayer& layer) ORTHANC_OVERRIDE
+      {
+      }
+    };
+
+  public:
+    virtual OrthancStone::Internals::CompositorHelper::ILayerRenderer* Create(const OrthancStone::ISceneLayer& layer) ORTHANC_OVERRIDE
+    {
+      return new Renderer;
+    }
+  };
+}
+
+
+static OrthancStone::PolylineSceneLayer* CreateSegment(double x1,
+                                                       double y1,
+                                                       double x2,
+                                                       double y2)
+{
+  std::unique_ptr<OrthancStone::PolylineSceneLayer> layer(new OrthancStone::PolylineSceneLayer);
+
+  OrthancStone::PolylineSceneLayer::Chain chain;
+  chain.push_back(OrthancStone::ScenePoint2D(x1, y1));
+  chain.push_back(OrthancStone::ScenePoint2D(x2, y2));
+  layer->AddChain(chain, false, 255, 0, 0);
+
+  return layer.release();
+}
+
+
+TEST(VolumeRendering, CompositorHelperDamage)
+{
+  Orthanc::Image texture(Orthanc::PixelFormat_RGB24, 100, 80, false);
+  Orthanc::ImageProcessing::Set(texture, 10, 20, 30, 255);
+
+  OrthancStone::Scene2D scene;
+  scene.SetLayer(0, new OrthancStone::ColorTextureSceneLayer(texture));
+  scene.SetLayer(1, CreateSegment(10, 10, 20, 10));
+
+  NullRendererFactory factory;
+  OrthancStone::Internals::CompositorHelper helper(factory);
+
+  // First rendering
+  std::list<OrthancStone::Extent2D> regions;
+  ASSERT_FALSE(helper.ComputeDamagedRegions(regions, scene, 200, 100));
+  helper.Refresh(scene, 200, 100);
+
+  ASSERT_TRUE(helper.ComputeDamagedRegions(regions, scene, 200, 100));
+  ASSERT_TRUE(regions.empty());
+
+  // Change in the size of the canvas
+  ASSERT_FALSE(helper.ComputeDamagedRegions(regions, scene, 201, 100));
+
+  // Replacing the segment damages both its old and its new footprints
+  // (the origin of the scene is at the center of the canvas, and the
+  // margin is 5 times the thickness plus 2 pixels for antialiasing)
+  scene.SetLayer(1, CreateSegment(-30, -20, -30, -10));
+  ASSERT_TRUE(helper.ComputeDamagedRegions(regions, scene, 200, 100));
+  ASSERT_EQ(2u, regions.size());
+  ASSERT_DOUBLE_EQ(103.0, regions.front().GetX1());
+  ASSERT_DOUBLE_EQ(53.0, regions.front().GetY1());
+  ASSERT_DOUBLE_EQ(127.0, regions.front().GetX2());
+  ASSERT_DOUBLE_EQ(67.0, regions.front().GetY2());
+  ASSERT_DOUBLE_EQ(63.0, regions.back().GetX1());
+  ASSERT_DOUBLE_EQ(23.0, regions.back().GetY1());
+  ASSERT_DOUBLE_EQ(77.0, regions.back().GetX2());
+  ASSERT_DOUBLE_EQ(47.0, regions.back().GetY2());
+
+  helper.Refresh(scene, 200, 100);
+  ASSERT_TRUE(helper.ComputeDamagedRegions(regions, scene, 200, 100));
+  ASSERT_TRUE(regions.empty());
+
+  // Removing the segment only damages its old footprint
+  scene.DeleteLayer(1);
+  ASSERT_TRUE(helper.ComputeDamagedRegions(regions, scene, 200, 100));
+  ASSERT_EQ(1u, regions.size());
+  ASSERT_DOUBLE_EQ(63.0, regions.front().GetX1());
+
+  helper.Refresh(scene, 200, 100);
+  ASSERT_TRUE(helper.ComputeDamagedRegions(regions, scene, 200, 100));
+  ASSERT_TRUE(regions.empty());
+
+  // The damaged regions are restricted to the canvas (the texture
+  // starts at the center of the canvas, with one texel of margin)
+  dynamic_cast<OrthancStone::TextureBaseSceneLayer&>(scene.GetLayer(0)).SetOrigin(10, 0);
+  ASSERT_TRUE(helper.ComputeDamagedRegions(regions, scene, 200, 100));
+  ASSERT_EQ(2u, regions.size());
+  ASSERT_DOUBLE_EQ(96.0, regions.front().GetX1());
+  ASSERT_DOUBLE_EQ(46.0, regions.front().GetY1());
+  ASSERT_DOUBLE_EQ(200.0, regions.front().GetX2());
+  ASSERT_DOUBLE_EQ(100.0, regions.front().GetY2());
+  ASSERT_DOUBLE_EQ(106.0, regions.back().GetX1());
+
+  helper.Refresh(scene, 200, 100);
+
+  // Texts have no known footprint
+  scene.SetLayer(2, new OrthancStone::TextSceneLayer);
+  ASSERT_FALSE(helper.ComputeDamagedRegions(regions, scene, 200, 100));
+  ASSERT_TRUE(regions.empty());
+
+  helper.Refresh(scene, 200, 100);
+  ASSERT_TRUE(helper.ComputeDamagedRegions(regions, scene, 200, 100));
+  ASSERT_TRUE(regions.empty());
+
+  // Change in the scene transform
+  scene.SetSceneToCanvasTransform(OrthancStone::AffineTransform2D::CreateScaling(2, 2));
+  ASSERT_FALSE(helper.ComputeDamagedRegions(regions, scene, 200, 100));
+}
+
+
+TEST(VolumeRendering, CairoCompositorIncremental)
+{
+  OrthancStone::Scene2D scene;
+  CreateTilesScene(scene, 300, 200);
+
+  OrthancStone::CairoCompositor compositor(300, 200);
+  compositor.SetIncrementalRefresh(true);
+  compositor.Refresh(scene);
+
+  for (unsigned int threads = 1; threads <= 4; threads += 3)
+  {
+    compositor.SetThreadsCount(threads);
+    compositor.SetTileSize(64);
+
+    for (unsigned int i = 0; i < 5; i++)
+    {
+      // Move a handle over the image, then compare with a full redraw
+      const double x = static_cast<double>(i) * 17.0 - 40.0;
+      scene.SetLayer(3, CreateSegment(x, -30, x + 25, 12));
+
+      if (i == 3)
+      {
+        scene.DeleteLayer(1);
+      }
+
+      compositor.Refresh(scene);
+
+      std::unique_ptr<Orthanc::ImageAccessor> reference(Render(scene, 300, 200));
+
+      Orthanc::ImageAccessor rendered;
+      compositor.GetCanvas().GetReadOnlyAccessor(rendered);
+      ASSERT_TRUE(AreIdenticalImages(*reference, rendered));
+    }
+
+    CreateTilesScene(scene, 300, 200);
+  }
+}
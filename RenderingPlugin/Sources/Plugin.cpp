@@ -23,19 +23,41 @@
 #include "OrthancPluginConnection.h"
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 
+#include "../../OrthancStone/Sources/Scene2D/CairoCompositor.h"
+#include "../../OrthancStone/Sources/Scene2D/FloatTextureSceneLayer.h"
+#include "../../OrthancStone/Sources/Scene2D/PolylineSceneLayer.h"
 #include "../../OrthancStone/Sources/Toolbox/AffineTransform2D.h"
 #include "../../OrthancStone/Sources/Toolbox/DicomInstanceParameters.h"
 #include "../../OrthancStone/Sources/Toolbox/DicomStructureSet.h"
+#include "../../OrthancStone/Sources/Toolbox/SlicesSorter.h"
+#include "../../OrthancStone/Sources/Volumes/ImageBuffer3D.h"
+#include "../../OrthancStone/Sources/Volumes/OrientedVolumeBoundingBox.h"
+#include "../../OrthancStone/Sources/Volumes/VolumeImageGeometry.h"
+#include "../../OrthancStone/Sources/Volumes/VolumeReslicer.h"
 
 #include <Cache/MemoryObjectCache.h>
+#include <ChunkedBuffer.h>
+#include <Compression/ZipWriter.h>
 #include <Images/Image.h>
 #include <Images/ImageProcessing.h>
 #include <Images/NumpyWriter.h>
 #include <Logging.h>
 #include <SerializationToolbox.h>
+#include <SingleValueObject.h>
 #include <Toolbox.h>
 
 #include <boost/math/constants/constants.hpp>
+#include <boost/math/special_functions/round.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <limits>
+
+#if ORTHANC_ENABLE_THREADS == 1
+#  include "../../OrthancStone/Sources/Toolbox/Internals/WorkersPool.h"
+#  include <boost/thread.hpp>
+#endif
 
 
 static const char* const INSTANCES = "Instances";  
@@ -231,6 +253,34 @@ static unsigned int ParseUnsignedInteger(const std::string& key,
 
 
 
+// Parses a 3D direction of the form "x,y,z", and normalizes it
+static OrthancStone::Vector ParseDirection(const std::string& key,
+                                           const std::string& value)
+{
+  std::vector<std::string> tokens;
+  Orthanc::Toolbox::TokenizeString(tokens, value, ',');
+
+  if (tokens.size() != 3)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "Bad value for " + key + " (must be a 3D vector \"x,y,z\"): " + value);
+  }
+
+  OrthancStone::Vector direction;
+  OrthancStone::LinearAlgebra::AssignVector(direction, ParseDouble(key, tokens[0]),
+                                            ParseDouble(key, tokens[1]), ParseDouble(key, tokens[2]));
+
+  if (OrthancStone::LinearAlgebra::IsCloseToZero(boost::numeric::ublas::norm_2(direction)))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "Null vector for " + key);
+  }
+
+  OrthancStone::LinearAlgebra::NormalizeVector(direction);
+  return direction;
+}
+
+
 class DataAugmentationParameters : public boost::noncopyable
 {
 private:
@@ -247,7 +297,7 @@ private:
   OrthancStone::ImageInterpolation  interpolation_;
 
   void ApplyInternal(Orthanc::ImageAccessor& target,
-                     const Orthanc::ImageAccessor& source)
+                     const Orthanc::ImageAccessor& source) const
   {
     if (source.GetWidth() == 0 ||
         source.GetHeight() == 0)
@@ -284,7 +334,7 @@ private:
   }    
 
 
-  Orthanc::ImageAccessor* ApplyUnchecked(const Orthanc::ImageAccessor& source)
+  Orthanc::ImageAccessor* ApplyUnchecked(const Orthanc::ImageAccessor& source) const
   {
     std::unique_ptr<Orthanc::ImageAccessor> target;
     
@@ -325,11 +375,21 @@ public:
   }
 
   
+  unsigned int GetTargetWidth(unsigned int sourceWidth) const
+  {
+    return (hasResize_ ? targetWidth_ : sourceWidth);
+  }
+
+  unsigned int GetTargetHeight(unsigned int sourceHeight) const
+  {
+    return (hasResize_ ? targetHeight_ : sourceHeight);
+  }
+
   OrthancStone::AffineTransform2D ComputeTransform(unsigned int sourceWidth,
                                                    unsigned int sourceHeight) const
   {
-    unsigned int w = (hasResize_ ? targetWidth_ : sourceWidth);
-    unsigned int h = (hasResize_ ? targetHeight_ : sourceHeight);
+    unsigned int w = GetTargetWidth(sourceWidth);
+    unsigned int h = GetTargetHeight(sourceHeight);
 
     if (w == 0 ||
         h == 0 ||
@@ -437,7 +497,7 @@ public:
   }
 
   
-  Orthanc::ImageAccessor* Apply(const Orthanc::ImageAccessor& source)
+  Orthanc::ImageAccessor* Apply(const Orthanc::ImageAccessor& source) const
   {
     if (source.GetFormat() != Orthanc::PixelFormat_RGB24 &&
         source.GetFormat() != Orthanc::PixelFormat_Float32)
@@ -451,7 +511,7 @@ public:
   }
 
   
-  Orthanc::ImageAccessor* ApplyBinaryMask(const Orthanc::ImageAccessor& source)
+  Orthanc::ImageAccessor* ApplyBinaryMask(const Orthanc::ImageAccessor& source) const
   {
     if (source.GetFormat() != Orthanc::PixelFormat_Grayscale8)
     {
@@ -488,35 +548,369 @@ public:
 };
 
 
-static OrthancStone::DicomInstanceParameters* GetInstanceParameters(const std::string& orthancId)
+/**
+ * LRU cache of the parameters of the instances, which avoids
+ * retrieving and parsing the tags of the same instance on each call
+ * to the rendering routes (e.g. during the epochs of a training). The
+ * entries are invalidated by "OnChangeCallback()".
+ **/
+class InstanceParametersCache : public boost::noncopyable
 {
-  OrthancPlugins::MemoryBuffer tags;
-  if (!tags.RestApiGet("/instances/" + orthancId + "/tags", false))
+private:
+  class Item : public Orthanc::ICacheable
   {
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem);
+  private:
+    std::unique_ptr<OrthancStone::DicomInstanceParameters>  parameters_;
+    size_t                                                   memoryUsage_;
+
+  public:
+    Item(OrthancStone::DicomInstanceParameters* parameters,
+         size_t memoryUsage) :
+      parameters_(parameters),
+      memoryUsage_(memoryUsage)
+    {
+      if (parameters == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+      }
+    }
+
+    virtual size_t GetMemoryUsage() const ORTHANC_OVERRIDE
+    {
+      return memoryUsage_;
+    }
+
+    const OrthancStone::DicomInstanceParameters& GetParameters() const
+    {
+      return *parameters_;
+    }
+  };
+
+  Orthanc::MemoryObjectCache   cache_;
+  boost::mutex                 countersMutex_;
+  uint64_t                     hits_;
+  uint64_t                     misses_;
+
+  InstanceParametersCache() :  // Singleton design pattern
+    hits_(0),
+    misses_(0)
+  {
+  }
+
+public:
+  void Invalidate(const std::string& instanceId)
+  {
+    cache_.Invalidate(instanceId);
+  }
+
+  void SetMaximumMemory(size_t bytes)
+  {
+    cache_.SetMaximumSize(bytes);
+  }
+
+  size_t GetMaximumMemory()
+  {
+    return cache_.GetMaximumSize();
+  }
+
+  void GetCounters(uint64_t& hits,
+                   uint64_t& misses)
+  {
+    boost::mutex::scoped_lock lock(countersMutex_);
+    hits = hits_;
+    misses = misses_;
   }
 
-  Json::Value json;
-  tags.ToJson(json);
+  static InstanceParametersCache& GetSingleton()
+  {
+    static InstanceParametersCache instance;
+    return instance;
+  }
+
+  // Returns a copy of the parameters, as "DicomInstanceParameters"
+  // evaluates some of its fields lazily, which is not thread-safe
+  OrthancStone::DicomInstanceParameters* GetParameters(const std::string& instanceId)
+  {
+    {
+      Orthanc::MemoryObjectCache::Accessor accessor(cache_, instanceId, false /* shared */);
+
+      if (accessor.IsValid())
+      {
+        {
+          boost::mutex::scoped_lock lock(countersMutex_);
+          hits_++;
+        }
+
+        return dynamic_cast<const Item&>(accessor.GetValue()).GetParameters().Clone();
+      }
+    }
+
+    {
+      boost::mutex::scoped_lock lock(countersMutex_);
+      misses_++;
+    }
+
+    OrthancPlugins::MemoryBuffer tags;
+    if (!tags.RestApiGet("/instances/" + instanceId + "/tags", false))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem);
+    }
+
+    Json::Value json;
+    tags.ToJson(json);
+
+    Orthanc::DicomMap m;
+    m.FromDicomAsJson(json);
+
+    std::unique_ptr<OrthancStone::DicomInstanceParameters> parameters(new OrthancStone::DicomInstanceParameters(m));
+
+    try
+    {
+      // The size of the JSON tags is a reasonable estimate of the
+      // memory that is used by the "DicomMap" of the parameters
+      cache_.Acquire(instanceId, new Item(parameters->Clone(), tags.GetSize()));
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Cannot insert instance parameters into cache: " << e.What();
+    }
+
+    return parameters.release();
+  }
+};
+
+
+static OrthancStone::DicomInstanceParameters* GetInstanceParameters(const std::string& orthancId)
+{
+  return InstanceParametersCache::GetSingleton().GetParameters(orthancId);
+}
 
-  Orthanc::DicomMap m;
-  m.FromDicomAsJson(json);
 
-  return new OrthancStone::DicomInstanceParameters(m);
+static void GetInstanceParametersCacheStatistics(OrthancPluginRestOutput* output,
+                                                 const char* url,
+                                                 const OrthancPluginHttpRequest* request)
+{
+  uint64_t hits, misses;
+  InstanceParametersCache::GetSingleton().GetCounters(hits, misses);
+
+  Json::Value answer = Json::objectValue;
+  answer["Hits"] = static_cast<Json::UInt64>(hits);
+  answer["Misses"] = static_cast<Json::UInt64>(misses);
+  answer["MaximumMemory"] = static_cast<Json::UInt64>(InstanceParametersCache::GetSingleton().GetMaximumMemory());
+
+  std::string s = answer.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(), s.size(), "application/json");
 }
 
 
+/**
+ * Writer of the NumPy arrays that are answered by the plugin. As
+ * the shape of the array is known once its header is written, the
+ * ".npy" content is written into one single buffer of the final
+ * size, instead of being accumulated into a "ChunkedBuffer" that is
+ * flattened afterward, which doubles the peak memory. In the
+ * compressed variant, the rows are streamed through the deflate
+ * encoder of "ZipWriter", which avoids the uncompressed copy.
+ **/
+class NumpyAnswerWriter : public boost::noncopyable
+{
+private:
+  bool                                  compress_;
+  std::string                           answer_;
+  std::unique_ptr<Orthanc::ZipWriter>   zip_;
+  bool                                  hasHeader_;
+  Orthanc::PixelFormat                  format_;
+  unsigned int                          width_;
+  unsigned int                          height_;
+  size_t                                remainingSlices_;
+  size_t                                position_;  // Only used if not compressed
+
+  void Append(const void* data,
+              size_t size)
+  {
+    if (compress_)
+    {
+      zip_->Write(data, size);
+    }
+    else
+    {
+      assert(position_ + size <= answer_.size());
+
+      if (size > 0)
+      {
+        memcpy(&answer_[position_], data, size);
+        position_ += size;
+      }
+    }
+  }
+
+public:
+  explicit NumpyAnswerWriter(bool compress) :
+    compress_(compress),
+    hasHeader_(false),
+    format_(Orthanc::PixelFormat_Grayscale8),
+    width_(0),
+    height_(0),
+    remainingSlices_(0),
+    position_(0)
+  {
+  }
+
+  // Use "depth == 0" for a 2D array
+  void WriteHeader(unsigned int depth,
+                   unsigned int width,
+                   unsigned int height,
+                   Orthanc::PixelFormat format)
+  {
+    if (hasHeader_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    std::string header;
+
+    {
+      Orthanc::ChunkedBuffer buffer;
+      Orthanc::NumpyWriter::WriteHeader(buffer, depth, width, height, format);
+      buffer.Flatten(header);
+    }
+
+    const size_t sliceSize = (static_cast<size_t>(width) * static_cast<size_t>(height) *
+                              static_cast<size_t>(Orthanc::GetBytesPerPixel(format)));
+    const size_t slicesCount = (depth == 0 ? 1 : depth);
+    const size_t uncompressedSize = header.size() + slicesCount * sliceSize;
+
+    if (compress_)
+    {
+      // This is the default name of the first array in "numpy.savez()"
+      zip_.reset(new Orthanc::ZipWriter);
+      zip_->SetMemoryOutput(answer_, uncompressedSize >= static_cast<size_t>(1024) * 1024 * 1024 /* ZIP64 */);
+      zip_->Open();
+      zip_->OpenFile("arr_0.npy");
+    }
+    else
+    {
+      answer_.resize(uncompressedSize);
+      position_ = 0;
+    }
+
+    hasHeader_ = true;
+    format_ = format;
+    width_ = width;
+    height_ = height;
+    remainingSlices_ = slicesCount;
+
+    Append(header.c_str(), header.size());
+  }
+
+  void WritePixels(const Orthanc::ImageAccessor& slice)
+  {
+    if (!hasHeader_ ||
+        remainingSlices_ == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (slice.GetFormat() != format_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageFormat);
+    }
+
+    if (slice.GetWidth() != width_ ||
+        slice.GetHeight() != height_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageSize);
+    }
+
+    const size_t rowSize = static_cast<size_t>(width_) * static_cast<size_t>(Orthanc::GetBytesPerPixel(format_));
+
+    for (unsigned int y = 0; y < height_; y++)
+    {
+      Append(slice.GetConstRow(y), rowSize);
+    }
+
+    remainingSlices_--;
+  }
+
+  void Answer(OrthancPluginRestOutput* output)
+  {
+    if (!hasHeader_ ||
+        remainingSlices_ != 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (compress_)
+    {
+      zip_->Close();  // Flushes the ZIP archive into "answer_"
+      zip_.reset();
+    }
+    else
+    {
+      assert(position_ == answer_.size());
+    }
+
+    OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output,
+                              answer_.empty() ? NULL : answer_.c_str(), answer_.size(), "application/octet-stream");
+  }
+};
+
+
 static void AnswerNumpyImage(OrthancPluginRestOutput* output,
                              const Orthanc::ImageAccessor& image,
                              bool compress)
 {
-  std::string answer;
-  Orthanc::NumpyWriter writer;
-  writer.SetCompressed(compress);
-  Orthanc::IImageWriter::WriteToMemory(writer, answer, image);
-  
-  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output,
-                            answer.c_str(), answer.size(), "application/octet-stream");
+  NumpyAnswerWriter writer(compress);
+  writer.WriteHeader(0 /* no depth */, image.GetWidth(), image.GetHeight(), image.GetFormat());
+  writer.WritePixels(image);
+  writer.Answer(output);
+}
+
+
+static Orthanc::ImageAccessor* RenderFrame(const OrthancStone::DicomInstanceParameters& parameters,
+                                           const DataAugmentationParameters& dataAugmentation,
+                                           OrthancPlugins::OrthancImage& image)
+{
+  Orthanc::ImageAccessor source;
+  source.AssignReadOnly(Convert(image.GetPixelFormat()), image.GetWidth(), image.GetHeight(),
+                        image.GetPitch(), image.GetBuffer());
+
+  if (parameters.GetSopClassUid() == OrthancStone::SopClassUid_DicomSeg)
+  {
+    return dataAugmentation.ApplyBinaryMask(source);
+  }
+  else if (source.GetFormat() == Orthanc::PixelFormat_RGB24)
+  {
+    return dataAugmentation.Apply(source);
+  }
+  else
+  {
+    std::unique_ptr<Orthanc::ImageAccessor> converted(parameters.ConvertToFloat(source));
+    assert(converted.get() != NULL);
+    
+    return dataAugmentation.Apply(*converted);
+  }
+}
+
+
+// Conversion of a grayscale frame to floating-point values, with the
+// rescale slope/intercept applied, but without data augmentation
+static Orthanc::ImageAccessor* ConvertFrameToFloat(const OrthancStone::DicomInstanceParameters& parameters,
+                                                   OrthancPlugins::OrthancImage& image)
+{
+  Orthanc::ImageAccessor source;
+  source.AssignReadOnly(Convert(image.GetPixelFormat()), image.GetWidth(), image.GetHeight(),
+                        image.GetPitch(), image.GetBuffer());
+
+  if (source.GetFormat() == Orthanc::PixelFormat_RGB24)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageFormat,
+                                    "Cannot assemble a volume from color images");
+  }
+  else
+  {
+    return parameters.ConvertToFloat(source);
+  }
 }
 
 
@@ -554,371 +948,2903 @@ static void RenderNumpyFrame(OrthancPluginRestOutput* output,
   
   OrthancPlugins::OrthancImage image;
   image.DecodeDicomImage(dicom.GetData(), dicom.GetSize(), frame);
-  
-  Orthanc::ImageAccessor source;
-  source.AssignReadOnly(Convert(image.GetPixelFormat()), image.GetWidth(), image.GetHeight(),
-                        image.GetPitch(), image.GetBuffer());
-
-  std::unique_ptr<Orthanc::ImageAccessor> modified;
 
-  if (parameters->GetSopClassUid() == OrthancStone::SopClassUid_DicomSeg)
-  {
-    modified.reset(dataAugmentation.ApplyBinaryMask(source));
-  }
-  else if (source.GetFormat() == Orthanc::PixelFormat_RGB24)
-  {
-    modified.reset(dataAugmentation.Apply(source));
-  }
-  else
-  {
-    std::unique_ptr<Orthanc::ImageAccessor> converted(parameters->ConvertToFloat(source));
-    assert(converted.get() != NULL);
-    
-    modified.reset(dataAugmentation.Apply(*converted));
-  }
+  std::unique_ptr<Orthanc::ImageAccessor> modified(RenderFrame(*parameters, dataAugmentation, image));
 
   assert(modified.get() != NULL);
   AnswerNumpyImage(output, *modified, compress);
 }
 
 
-static bool IsRtStruct(const std::string& instanceId)
+static unsigned int GetBatchThreadsCount()
 {
-  std::string s;
-  if (OrthancPlugins::RestApiGetString(s, "/instances/" + instanceId + "/content/" + SOP_CLASS_UID, false) &&
-      !s.empty())
-  {
-    if (s[s.size() - 1] == '\0')  // Deal with DICOM padding
-    {
-      s.resize(s.size() - 1);
-    }
-    
-    return s == RT_STRUCT_IOD;
-  }
-  else
-  {
-    return false;
-  }
+#if ORTHANC_ENABLE_THREADS == 1
+  return std::max(1u, boost::thread::hardware_concurrency());
+#else
+  return 1;
+#endif
 }
 
 
-static void ListRtStruct(OrthancPluginRestOutput* output,
-                         const char* url,
-                         const OrthancPluginHttpRequest* request)
+/**
+ * Budget of worker threads that is shared by all the REST requests
+ * of the plugin, so that concurrent batch requests cannot start more
+ * than one worker thread per core altogether. The thread that serves
+ * a REST request always takes part in its own computation, which
+ * guarantees progress even if the budget is exhausted.
+ **/
+class WorkersBudget : public boost::noncopyable
 {
-  // This is a quick version of "/tools/find" on "SOPClassUID" (the
-  // latter would load all the DICOM files from disk)
-
-  Json::Value series;
-  OrthancPlugins::RestApiGet(series, "/series?expand", false);
+private:
+  boost::mutex  mutex_;
+  unsigned int  available_;
 
-  if (series.type() != Json::arrayValue)
+  WorkersBudget() :  // Singleton design pattern
+    available_(GetBatchThreadsCount())
   {
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
   }
 
-  Json::Value answer = Json::arrayValue;
+  static WorkersBudget& GetSingleton()
+  {
+    static WorkersBudget instance;
+    return instance;
+  }
 
-  for (Json::Value::ArrayIndex i = 0; i < series.size(); i++)
+  unsigned int Acquire(unsigned int wanted)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    const unsigned int granted = std::min(wanted, available_);
+    available_ -= granted;
+    return granted;
+  }
+
+  void Release(unsigned int count)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    available_ += count;
+  }
+
+public:
+  /**
+   * Reserves at most "threadsCount - 1" worker threads from the
+   * budget, in addition to the calling thread. The reservation never
+   * blocks: It is reduced if other requests are running.
+   **/
+  class Reservation : public boost::noncopyable
+  {
+  private:
+    unsigned int  workers_;
+
+  public:
+    explicit Reservation(unsigned int threadsCount) :
+      workers_(GetSingleton().Acquire(threadsCount > 1 ? threadsCount - 1 : 0))
+    {
+    }
+
+    ~Reservation()
+    {
+      GetSingleton().Release(workers_);
+    }
+
+    // Number of worker threads, including the calling thread
+    unsigned int GetThreadsCount() const
+    {
+      return workers_ + 1;
+    }
+  };
+};
+
+
+/**
+ * Runs "Process()" on the items [0, count) using at most
+ * "threadsCount" threads, taken from the budget of the plugin. The
+ * first error that is encountered stops the other threads, and
+ * is rethrown by "Run()". The threads are kept alive across the
+ * successive calls to "Run()". If some thread cannot be started, the
+ * items are processed by the remaining threads.
+ **/
+class ParallelLoop : public boost::noncopyable
+{
+private:
+  boost::mutex        mutex_;
+  size_t              next_;
+  size_t              count_;
+  bool                success_;
+  Orthanc::ErrorCode  error_;
+  std::string         details_;
+
+#if ORTHANC_ENABLE_THREADS == 1
+  class Job : public OrthancStone::Internals::WorkersPool::IJob
+  {
+  private:
+    ParallelLoop&  that_;
+
+  public:
+    explicit Job(ParallelLoop& that) :
+      that_(that)
+    {
+    }
+
+    virtual void Process() ORTHANC_OVERRIDE
+    {
+      Worker(&that_);
+    }
+  };
+
+  unsigned int                                           threadsCount_;
+  std::unique_ptr<WorkersBudget::Reservation>            reservation_;
+
+  // Declared after the reservation, so that the threads are stopped
+  // before they are given back to the budget
+  std::unique_ptr<OrthancStone::Internals::WorkersPool>  pool_;
+#endif
+
+  bool GetNextItem(size_t& item)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (next_ < count_)
+    {
+      item = next_;
+      next_++;
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  void SetError(Orthanc::ErrorCode error,
+                const std::string& details)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (success_)
+    {
+      success_ = false;
+      error_ = error;
+      details_ = details;
+    }
+
+    next_ = count_;  // Stop the other threads
+  }
+
+  static void Worker(ParallelLoop* that)
+  {
+    size_t item;
+
+    while (that->GetNextItem(item))
+    {
+      try
+      {
+        that->Process(item);
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        that->SetError(e.GetErrorCode(), e.HasDetails() ? e.GetDetails() : "");
+      }
+      catch (std::bad_alloc&)
+      {
+        that->SetError(Orthanc::ErrorCode_NotEnoughMemory, "");
+      }
+      catch (...)
+      {
+        that->SetError(Orthanc::ErrorCode_InternalError, "");
+      }
+    }
+  }
+
+protected:
+  virtual void Process(size_t item) = 0;
+
+public:
+  ParallelLoop() :
+    next_(0),
+    count_(0),
+    success_(true),
+    error_(Orthanc::ErrorCode_Success)
+#if ORTHANC_ENABLE_THREADS == 1
+    , threadsCount_(0)
+#endif
+  {
+  }
+
+  virtual ~ParallelLoop()
+  {
+  }
+
+  void Run(size_t count,
+           unsigned int threadsCount)
+  {
+    next_ = 0;
+    count_ = count;
+    success_ = true;
+    details_.clear();
+
+#if ORTHANC_ENABLE_THREADS == 1
+    if (threadsCount > 1 &&
+        count > 1)
+    {
+      if (pool_.get() == NULL ||
+          threadsCount_ != threadsCount)
+      {
+        pool_.reset();
+        reservation_.reset();
+
+        reservation_.reset(new WorkersBudget::Reservation(threadsCount));
+        pool_.reset(new OrthancStone::Internals::WorkersPool(reservation_->GetThreadsCount() - 1));
+        threadsCount_ = threadsCount;
+      }
+
+      // The calling thread is one of the workers
+      Job job(*this);
+      pool_->Run(job);
+    }
+    else
+#endif
+    {
+      Worker(this);
+    }
+
+    if (!success_)
+    {
+      if (details_.empty())
+      {
+        throw Orthanc::OrthancException(error_);
+      }
+      else
+      {
+        throw Orthanc::OrthancException(error_, details_);
+      }
+    }
+  }
+};
+
+
+/**
+ * One instance whose frames are requested by the batch routes. The
+ * tags and the DICOM file are only retrieved once, whatever the
+ * number of frames of interest, and the DICOM file is only parsed
+ * once if the plugin SDK is recent enough. The DICOM file is kept
+ * in memory until the last frame of interest is rendered.
+ **/
+class BatchInstance : public boost::noncopyable
+{
+private:
+  std::string                                             instanceId_;
+  std::vector<unsigned int>                               frames_;
+  std::unique_ptr<OrthancStone::DicomInstanceParameters>  parameters_;
+  std::vector<OrthancPlugins::OrthancImage*>              decoded_;
+  std::vector<Orthanc::ImageAccessor*>                    rendered_;
+  size_t                                                  decodedCount_;
+  size_t                                                  renderTarget_;
+  std::unique_ptr<OrthancPlugins::MemoryBuffer>           dicom_;
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 7, 0)
+  std::unique_ptr<OrthancPlugins::DicomInstance>          instance_;
+#endif
+
+public:
+  explicit BatchInstance(const std::string& instanceId) :
+    instanceId_(instanceId),
+    decodedCount_(0),
+    renderTarget_(0)
+  {
+  }
+
+  ~BatchInstance()
+  {
+    for (size_t i = 0; i < frames_.size(); i++)
+    {
+      delete decoded_[i];   // Can be NULL
+      delete rendered_[i];  // Can be NULL
+    }
+  }
+
+  void LoadParameters()
+  {
+    parameters_.reset(GetInstanceParameters(instanceId_));
+  }
+
+  const OrthancStone::DicomInstanceParameters& GetParameters() const
+  {
+    if (parameters_.get() == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      return *parameters_;
+    }
+  }
+
+  // Returns the index of the frame in the rendered frames
+  size_t AddFrame(unsigned int frame)
+  {
+    if (frame >= GetParameters().GetNumberOfFrames())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "Instance " + instanceId_ + " has no frame number " +
+                                      boost::lexical_cast<std::string>(frame));
+    }
+    else
+    {
+      frames_.push_back(frame);
+      decoded_.push_back(NULL);
+      rendered_.push_back(NULL);
+      return frames_.size() - 1;
+    }
+  }
+
+  // The frames up to "index" will be decoded by the next call to "DecodeScheduledFrames()"
+  void ScheduleFrame(size_t index)
+  {
+    assert(index < frames_.size());
+    renderTarget_ = std::max(renderTarget_, index + 1);
+  }
+
+  bool HasScheduledFrames() const
+  {
+    return decodedCount_ < renderTarget_;
+  }
+
+  // Decodes the frames that were scheduled since the previous call.
+  // This is done by one single thread, as the frames share the
+  // parsed DICOM file.
+  void DecodeScheduledFrames()
+  {
+    if (!HasScheduledFrames())
+    {
+      return;
+    }
+
+    if (dicom_.get() == NULL)
+    {
+      dicom_.reset(new OrthancPlugins::MemoryBuffer);
+      dicom_->GetDicomInstance(instanceId_);
+
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 7, 0)
+      // Parse the DICOM file only once for all its frames
+      instance_.reset(new OrthancPlugins::DicomInstance(dicom_->GetData(), dicom_->GetSize()));
+#endif
+    }
+
+    for (; decodedCount_ < renderTarget_; decodedCount_++)
+    {
+      const unsigned int frame = frames_[decodedCount_];
+
+      assert(decoded_[decodedCount_] == NULL);
+
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 7, 0)
+      decoded_[decodedCount_] = instance_->GetDecodedFrame(frame);
+#else
+      std::unique_ptr<OrthancPlugins::OrthancImage> image(new OrthancPlugins::OrthancImage);
+      image->DecodeDicomImage(dicom_->GetData(), dicom_->GetSize(), frame);
+      decoded_[decodedCount_] = image.release();
+#endif
+    }
+
+    if (decodedCount_ == frames_.size())
+    {
+      // All the frames of interest are decoded, the DICOM file is not needed anymore
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 7, 0)
+      instance_.reset(NULL);
+#endif
+      dicom_.reset(NULL);
+    }
+  }
+
+  // Renders one decoded frame, then releases its decoded version. The
+  // distinct frames of the instance can be rendered concurrently. If
+  // "dataAugmentation" is NULL, the frame is only converted to
+  // floating-point values.
+  void RenderDecodedFrame(size_t index,
+                          const DataAugmentationParameters* dataAugmentation)
+  {
+    if (index >= decoded_.size() ||
+        decoded_[index] == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    std::unique_ptr<OrthancPlugins::OrthancImage> image(decoded_[index]);
+    decoded_[index] = NULL;
+
+    assert(rendered_[index] == NULL);
+
+    if (dataAugmentation == NULL)
+    {
+      rendered_[index] = ConvertFrameToFloat(GetParameters(), *image);
+    }
+    else
+    {
+      rendered_[index] = RenderFrame(GetParameters(), *dataAugmentation, *image);
+    }
+  }
+
+  const Orthanc::ImageAccessor& GetRenderedFrame(size_t index) const
+  {
+    if (index >= rendered_.size() ||
+        rendered_[index] == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      return *rendered_[index];
+    }
+  }
+
+  void ReleaseRenderedFrame(size_t index)
+  {
+    if (index >= rendered_.size() ||
+        rendered_[index] == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      delete rendered_[index];
+      rendered_[index] = NULL;
+    }
+  }
+};
+
+
+/**
+ * Batch of frames that are rendered in parallel, then stacked into a
+ * single 3D array. The tags of the instances are first retrieved in
+ * parallel (they are needed to know their number of frames and to
+ * sort them). The frames are then rendered by successive windows
+ * whose size is proportional to the number of threads, and each
+ * window is handed to a visitor in the order of the frames before
+ * being released, so that the whole batch never lives in memory.
+ *
+ * Within a window, the frames are decoded in parallel across the
+ * instances, each instance being decoded by one single thread as
+ * its frames share the parsed DICOM file. The decoded frames are
+ * then rendered in parallel, frame by frame, so that a batch made of
+ * one single multiframe instance also benefits from the threads.
+ **/
+class FramesBatch : public ParallelLoop
+{
+public:
+  class IFrameVisitor : public boost::noncopyable
+  {
+  public:
+    virtual ~IFrameVisitor()
+    {
+    }
+
+    // The frames are visited in the order of their addition
+    virtual void Visit(size_t index,
+                       const Orthanc::ImageAccessor& frame) = 0;
+  };
+
+private:
+  static const size_t FRAMES_PER_THREAD = 4;  // Size of the rendering windows
+
+  struct Slot
+  {
+    size_t  instance_;
+    size_t  frame_;   // Index in the rendered frames of the instance
+
+    Slot(size_t instance,
+         size_t frame) :
+      instance_(instance),
+      frame_(frame)
+    {
+    }
+  };
+
+  enum Pass
+  {
+    Pass_LoadParameters,
+    Pass_Decode,   // The items are the scheduled instances of the window
+    Pass_Render    // The items are the frames of the window
+  };
+
+  typedef std::map<std::string, size_t>  InstancesIndex;
+
+  const DataAugmentationParameters*  dataAugmentation_;  // Can be NULL
+  std::vector<BatchInstance*>        instances_;
+  InstancesIndex                     instancesIndex_;
+  std::vector<Slot>                  slots_;
+  Pass                               pass_;
+  std::vector<size_t>                scheduled_;  // Instances to be decoded in the current window
+  size_t                             windowStart_;
+
+protected:
+  virtual void Process(size_t item) ORTHANC_OVERRIDE
+  {
+    switch (pass_)
+    {
+      case Pass_LoadParameters:
+        assert(item < instances_.size());
+        instances_[item]->LoadParameters();
+        break;
+
+      case Pass_Decode:
+        assert(item < scheduled_.size() &&
+               scheduled_[item] < instances_.size());
+        instances_[scheduled_[item]]->DecodeScheduledFrames();
+        break;
+
+      case Pass_Render:
+      {
+        assert(windowStart_ + item < slots_.size());
+        const Slot& slot = slots_[windowStart_ + item];
+        instances_[slot.instance_]->RenderDecodedFrame(slot.frame_, dataAugmentation_);
+        break;
+      }
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+
+public:
+  explicit FramesBatch(const DataAugmentationParameters& dataAugmentation) :
+    dataAugmentation_(&dataAugmentation),
+    pass_(Pass_LoadParameters),
+    windowStart_(0)
+  {
+  }
+
+  // Constructor for batches whose frames are not augmented, but
+  // only converted to floating-point values
+  FramesBatch() :
+    dataAugmentation_(NULL),
+    pass_(Pass_LoadParameters),
+    windowStart_(0)
+  {
+  }
+
+  virtual ~FramesBatch()
+  {
+    for (size_t i = 0; i < instances_.size(); i++)
+    {
+      assert(instances_[i] != NULL);
+      delete instances_[i];
+    }
+  }
+
+  size_t AddInstance(const std::string& instanceId)
+  {
+    InstancesIndex::const_iterator found = instancesIndex_.find(instanceId);
+    if (found == instancesIndex_.end())
+    {
+      instances_.push_back(new BatchInstance(instanceId));
+      instancesIndex_[instanceId] = instances_.size() - 1;
+      return instances_.size() - 1;
+    }
+    else
+    {
+      return found->second;
+    }
+  }
+
+  size_t GetInstancesCount() const
+  {
+    return instances_.size();
+  }
+
+  void LoadParameters(unsigned int threadsCount)
+  {
+    pass_ = Pass_LoadParameters;
+    Run(instances_.size(), threadsCount);
+  }
+
+  const OrthancStone::DicomInstanceParameters& GetParameters(size_t instance) const
+  {
+    assert(instance < instances_.size());
+    return instances_[instance]->GetParameters();
+  }
+
+  void AddFrame(size_t instance,
+                unsigned int frame)
+  {
+    assert(instance < instances_.size());
+    slots_.push_back(Slot(instance, instances_[instance]->AddFrame(frame)));
+  }
+
+  void AddAllFrames(size_t instance)
+  {
+    for (unsigned int i = 0; i < GetParameters(instance).GetNumberOfFrames(); i++)
+    {
+      AddFrame(instance, i);
+    }
+  }
+
+  size_t GetFramesCount() const
+  {
+    return slots_.size();
+  }
+
+  // Can only be invoked once
+  void Render(IFrameVisitor& visitor,
+              unsigned int threadsCount)
+  {
+    const size_t windowSize = FRAMES_PER_THREAD * static_cast<size_t>(std::max(1u, threadsCount));
+
+    for (size_t start = 0; start < slots_.size(); start += windowSize)
+    {
+      const size_t end = std::min(start + windowSize, slots_.size());
+
+      // The frames of one instance are decoded in the order of their addition
+      scheduled_.clear();
+      for (size_t i = start; i < end; i++)
+      {
+        BatchInstance& instance = *instances_[slots_[i].instance_];
+        if (!instance.HasScheduledFrames())
+        {
+          scheduled_.push_back(slots_[i].instance_);
+        }
+
+        instance.ScheduleFrame(slots_[i].frame_);
+      }
+
+      pass_ = Pass_Decode;
+      Run(scheduled_.size(), threadsCount);
+
+      pass_ = Pass_Render;
+      windowStart_ = start;
+      Run(end - start, threadsCount);
+
+      for (size_t i = start; i < end; i++)
+      {
+        BatchInstance& instance = *instances_[slots_[i].instance_];
+        visitor.Visit(i, instance.GetRenderedFrame(slots_[i].frame_));
+        instance.ReleaseRenderedFrame(slots_[i].frame_);
+      }
+    }
+  }
+
+  void Answer(OrthancPluginRestOutput* output,
+              bool compress,
+              unsigned int threadsCount)
+  {
+    if (slots_.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "No frame to be rendered");
+    }
+
+    class Visitor : public IFrameVisitor
+    {
+    private:
+      NumpyAnswerWriter     writer_;
+      size_t                count_;
+      Orthanc::PixelFormat  format_;
+      unsigned int          width_;
+      unsigned int          height_;
+
+    public:
+      Visitor(bool compress,
+              size_t count) :
+        writer_(compress),
+        count_(count),
+        format_(Orthanc::PixelFormat_Grayscale8),
+        width_(0),
+        height_(0)
+      {
+      }
+
+      virtual void Visit(size_t index,
+                         const Orthanc::ImageAccessor& frame) ORTHANC_OVERRIDE
+      {
+        if (index == 0)
+        {
+          format_ = frame.GetFormat();
+          width_ = frame.GetWidth();
+          height_ = frame.GetHeight();
+          writer_.WriteHeader(static_cast<unsigned int>(count_), width_, height_, format_);
+        }
+
+        if (frame.GetFormat() != format_)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageFormat,
+                                          "All the frames of a batch must have the same pixel format");
+        }
+
+        if (frame.GetWidth() != width_ ||
+            frame.GetHeight() != height_)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageSize,
+                                          "All the frames of a batch must have the same size, use the \"resize\" option");
+        }
+
+        writer_.WritePixels(frame);
+      }
+
+      void Answer(OrthancPluginRestOutput* output)
+      {
+        writer_.Answer(output);
+      }
+    };
+
+    Visitor visitor(compress, slots_.size());
+    Render(visitor, threadsCount);
+    visitor.Answer(output);
+  }
+};
+
+
+static void ParseBatchParameters(DataAugmentationParameters& dataAugmentation,
+                                 bool& compress,
+                                 std::string* frames,  // Can be NULL if the "frames" option is not allowed
+                                 const OrthancPluginHttpRequest* request)
+{
+  compress = false;
+
+  for (uint32_t i = 0; i < request->getCount; i++)
+  {
+    std::string key(request->getKeys[i]);
+    std::string value(request->getValues[i]);
+
+    if (!dataAugmentation.ParseParameter(key, value))
+    {
+      if (key == "compress")
+      {
+        compress = ParseBoolean(key, value);
+      }
+      else if (key == "frames" &&
+               frames != NULL)
+      {
+        *frames = value;
+      }
+      else
+      {
+        LOG(WARNING) << "Unsupported option for data augmentation: " << key;
+      }
+    }
+  }
+}
+
+
+static void GetSeriesInstances(std::vector<std::string>& instances,
+                               const std::string& seriesId)
+{
+  Json::Value series;
+  if (!OrthancPlugins::RestApiGet(series, "/series/" + seriesId, false))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem);
+  }
+
+  if (series.type() != Json::objectValue ||
+      !series.isMember(INSTANCES) ||
+      series[INSTANCES].type() != Json::arrayValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+
+  instances.clear();
+  instances.reserve(series[INSTANCES].size());
+
+  for (Json::Value::ArrayIndex i = 0; i < series[INSTANCES].size(); i++)
+  {
+    if (series[INSTANCES][i].type() != Json::stringValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+
+    instances.push_back(series[INSTANCES][i].asString());
+  }
+}
+
+
+// Payload of the slices sorter: Index of the instance in the batch, and frame number
+typedef Orthanc::SingleValueObject< std::pair<size_t, unsigned int> >  FramePayload;
+
+
+/**
+ * Sorts all the frames of the instances of the batch along the
+ * normal of the series. Returns "false" if some frame could not be
+ * sorted (e.g. if the frames are not parallel).
+ **/
+template <typename Instances>
+static bool SortFramesAlongNormal(OrthancStone::SlicesSorter& sorter,
+                                  const Instances& instances)
+{
+  size_t countFrames = 0;
+
+  for (size_t i = 0; i < instances.GetInstancesCount(); i++)
+  {
+    const OrthancStone::DicomInstanceParameters& parameters = instances.GetParameters(i);
+
+    for (unsigned int j = 0; j < parameters.GetNumberOfFrames(); j++)
+    {
+      sorter.AddSlice(parameters.GetFrameGeometry(j), new FramePayload(std::make_pair(i, j)));
+      countFrames++;
+    }
+  }
+
+  return (sorter.Sort() &&
+          sorter.GetSlicesCount() == countFrames);
+}
+
+
+/**
+ * Lists all the frames of the instances, as (instance, frame) pairs,
+ * sorted along the normal of the series. If this is not possible
+ * (e.g. if the frames are not parallel), the frames are sorted by
+ * instance number, then by frame number.
+ **/
+template <typename Instances>
+static void SortSeriesFrames(std::vector< std::pair<size_t, unsigned int> >& frames,
+                             const Instances& instances)
+{
+  frames.clear();
+
+  OrthancStone::SlicesSorter sorter;
+
+  if (SortFramesAlongNormal(sorter, instances))
+  {
+    frames.reserve(sorter.GetSlicesCount());
+    
+    for (size_t i = 0; i < sorter.GetSlicesCount(); i++)
+    {
+      const FramePayload& payload = dynamic_cast<const FramePayload&>(sorter.GetSlicePayload(i));
+      frames.push_back(payload.GetValue());
+    }
+  }
+  else
+  {
+    std::vector< std::pair<int32_t, size_t> > ordered;
+    ordered.reserve(instances.GetInstancesCount());
+
+    for (size_t i = 0; i < instances.GetInstancesCount(); i++)
+    {
+      ordered.push_back(std::make_pair(instances.GetParameters(i).GetInstanceNumber(), i));
+    }
+
+    std::sort(ordered.begin(), ordered.end());
+
+    for (size_t i = 0; i < ordered.size(); i++)
+    {
+      const size_t instance = ordered[i].second;
+      
+      for (unsigned int j = 0; j < instances.GetParameters(instance).GetNumberOfFrames(); j++)
+      {
+        frames.push_back(std::make_pair(instance, j));
+      }
+    }
+  }
+}
+
+
+static void RenderNumpySeries(OrthancPluginRestOutput* output,
+                              const char* url,
+                              const OrthancPluginHttpRequest* request)
+{
+  DataAugmentationParameters dataAugmentation;
+  bool compress;
+  ParseBatchParameters(dataAugmentation, compress, NULL, request);
+
+  std::vector<std::string> instances;
+  GetSeriesInstances(instances, request->groups[0]);
+
+  FramesBatch batch(dataAugmentation);
+
+  for (size_t i = 0; i < instances.size(); i++)
+  {
+    batch.AddInstance(instances[i]);
+  }
+
+  const unsigned int threadsCount = GetBatchThreadsCount();
+  batch.LoadParameters(threadsCount);
+
+  std::vector< std::pair<size_t, unsigned int> > frames;
+  SortSeriesFrames(frames, batch);
+
+  for (size_t i = 0; i < frames.size(); i++)
+  {
+    batch.AddFrame(frames[i].first, frames[i].second);
+  }
+
+  batch.Answer(output, compress, threadsCount);
+}
+
+
+static void RenderNumpyFrames(OrthancPluginRestOutput* output,
+                              const char* url,
+                              const OrthancPluginHttpRequest* request)
+{
+  DataAugmentationParameters dataAugmentation;
+  bool compress;
+  std::string frames;
+  ParseBatchParameters(dataAugmentation, compress, &frames, request);
+
+  /**
+   * The "frames" option is a comma-separated list of items of the
+   * form "instance:frame", where "instance" is an Orthanc identifier.
+   * If ":frame" is omitted, all the frames of the instance are taken.
+   **/
+  std::vector<std::string> items;
+  Orthanc::Toolbox::TokenizeString(items, frames, ',');
+
+  FramesBatch batch(dataAugmentation);
+  std::vector<size_t> instances;
+  instances.reserve(items.size());
+
+  for (size_t i = 0; i < items.size(); i++)
+  {
+    std::vector<std::string> tokens;
+    Orthanc::Toolbox::TokenizeString(tokens, items[i], ':');
+
+    if (tokens.empty() ||
+        tokens.size() > 2 ||
+        tokens[0].empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "Bad item in option \"frames\": " + items[i]);
+    }
+
+    instances.push_back(batch.AddInstance(tokens[0]));
+  }
+
+  if (instances.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                    "Missing option \"frames\" to provide the frames of interest");
+  }
+
+  const unsigned int threadsCount = GetBatchThreadsCount();
+  batch.LoadParameters(threadsCount);
+
+  for (size_t i = 0; i < items.size(); i++)
+  {
+    std::vector<std::string> tokens;
+    Orthanc::Toolbox::TokenizeString(tokens, items[i], ':');
+
+    if (tokens.size() == 1)
+    {
+      batch.AddAllFrames(instances[i]);
+    }
+    else
+    {
+      batch.AddFrame(instances[i], ParseUnsignedInteger("frames", tokens[1]));
+    }
+  }
+
+  batch.Answer(output, compress, threadsCount);
+}
+
+
+/**
+ * 3D volume assembled from all the frames of a series, sorted along
+ * the normal of the series. The voxels contain the floating-point
+ * values of the pixels, with the rescale slope/intercept applied.
+ * The fingerprint identifies the instances from which the volume was
+ * assembled, which detects the series that have been modified since
+ * their volume was put in the cache.
+ **/
+class SeriesVolume : public boost::noncopyable
+{
+private:
+  std::string                                   fingerprint_;
+  OrthancStone::VolumeImageGeometry             geometry_;
+  std::unique_ptr<OrthancStone::ImageBuffer3D>  image_;
+
+  explicit SeriesVolume(const std::string& fingerprint) :
+    fingerprint_(fingerprint)
+  {
+  }
+
+public:
+  static std::string ComputeFingerprint(const std::vector<std::string>& instances)
+  {
+    std::vector<std::string> sorted(instances);
+    std::sort(sorted.begin(), sorted.end());
+
+    std::string fingerprint;
+    for (size_t i = 0; i < sorted.size(); i++)
+    {
+      fingerprint += sorted[i] + "|";
+    }
+
+    return fingerprint;
+  }
+
+  static SeriesVolume* Assemble(const std::vector<std::string>& instances)
+  {
+    if (instances.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "Cannot assemble a volume from an empty series");
+    }
+
+    FramesBatch batch;
+
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+      batch.AddInstance(instances[i]);
+    }
+
+    const unsigned int threadsCount = GetBatchThreadsCount();
+    batch.LoadParameters(threadsCount);
+
+    OrthancStone::SlicesSorter sorter;
+    double spacingZ;
+
+    if (!SortFramesAlongNormal(sorter, batch) ||
+        !sorter.AreAllSlicesDistinct() ||
+        !sorter.ComputeSpacingBetweenSlices(spacingZ))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadGeometry,
+                                      "The frames of the series are not parallel and regularly spaced");
+    }
+
+    for (size_t i = 0; i < sorter.GetSlicesCount(); i++)
+    {
+      const FramePayload& payload = dynamic_cast<const FramePayload&>(sorter.GetSlicePayload(i));
+      batch.AddFrame(payload.GetValue().first, payload.GetValue().second);
+    }
+
+    const FramePayload& first = dynamic_cast<const FramePayload&>(sorter.GetSlicePayload(0));
+    const OrthancStone::DicomInstanceParameters& parameters = batch.GetParameters(first.GetValue().first);
+
+    const unsigned int width = parameters.GetWidth();
+    const unsigned int height = parameters.GetHeight();
+    const unsigned int depth = static_cast<unsigned int>(batch.GetFramesCount());
+
+    std::unique_ptr<SeriesVolume> volume(new SeriesVolume(ComputeFingerprint(instances)));
+    volume->geometry_.SetSizeInVoxels(width, height, depth);
+    volume->geometry_.SetAxialGeometry(sorter.GetSliceGeometry(0));
+    volume->geometry_.SetVoxelDimensions(parameters.GetPixelSpacingX(), parameters.GetPixelSpacingY(), spacingZ);
+
+    // The range of the volume is computed, as its minimum is the default padding value
+    volume->image_.reset(new OrthancStone::ImageBuffer3D(Orthanc::PixelFormat_Float32, width, height, depth,
+                                                         true /* compute range */));
+
+    // The frames are copied into the volume as soon as they are rendered
+    class Visitor : public FramesBatch::IFrameVisitor
+    {
+    private:
+      OrthancStone::ImageBuffer3D&  image_;
+
+    public:
+      explicit Visitor(OrthancStone::ImageBuffer3D& image) :
+        image_(image)
+      {
+      }
+
+      virtual void Visit(size_t index,
+                         const Orthanc::ImageAccessor& frame) ORTHANC_OVERRIDE
+      {
+        if (frame.GetWidth() != image_.GetWidth() ||
+            frame.GetHeight() != image_.GetHeight())
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageSize,
+                                          "All the frames of a volume must have the same size");
+        }
+
+        OrthancStone::ImageBuffer3D::SliceWriter writer(image_, OrthancStone::VolumeProjection_Axial,
+                                                        static_cast<unsigned int>(index));
+        Orthanc::ImageProcessing::Copy(writer.GetAccessor(), frame);
+      }
+    };
+
+    Visitor visitor(*volume->image_);
+    batch.Render(visitor, threadsCount);
+
+    return volume.release();
+  }
+
+  const std::string& GetFingerprint() const
+  {
+    return fingerprint_;
+  }
+
+  const OrthancStone::VolumeImageGeometry& GetGeometry() const
+  {
+    return geometry_;
+  }
+
+  const OrthancStone::ImageBuffer3D& GetImage() const
+  {
+    assert(image_.get() != NULL);
+    return *image_;
+  }
+
+  size_t GetMemoryUsage() const
+  {
+    return static_cast<size_t>(GetImage().GetEstimatedMemorySize());
+  }
+};
+
+
+class SeriesVolumeCache : public boost::noncopyable
+{
+private:
+  /**
+   * The volumes are shared with the requests that are using them, so
+   * that the cache is only locked while looking for a volume, and not
+   * during its reslicing. A volume that is evicted from the cache is
+   * released once the last request that uses it completes.
+   **/
+  class Item : public Orthanc::ICacheable
+  {
+  private:
+    boost::shared_ptr<const SeriesVolume>  volume_;
+
+  public:
+    explicit Item(const boost::shared_ptr<const SeriesVolume>& volume) :
+      volume_(volume)
+    {
+      if (volume.get() == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+      }
+    }
+
+    virtual size_t GetMemoryUsage() const ORTHANC_OVERRIDE
+    {
+      return volume_->GetMemoryUsage();
+    }
+
+    const boost::shared_ptr<const SeriesVolume>& GetVolume() const
+    {
+      return volume_;
+    }
+  };
+
+  Orthanc::MemoryObjectCache   cache_;
+
+  SeriesVolumeCache()  // Singleton design pattern
+  {
+  }
+
+public:
+  void Invalidate(const std::string& seriesId)
+  {
+    cache_.Invalidate(seriesId);
+  }
+
+  void SetMaximumMemory(size_t bytes)
+  {
+    cache_.SetMaximumSize(bytes);
+  }
+
+  // The volume is not cached if it is too large
+  void Store(const std::string& seriesId,
+             const boost::shared_ptr<const SeriesVolume>& volume)
+  {
+    std::unique_ptr<Item> item(new Item(volume));
+
+    try
+    {
+      cache_.Invalidate(seriesId);  // Remove the outdated volume, if any
+      cache_.Acquire(seriesId, item.release());
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Cannot insert volume into cache: " << e.What();
+    }
+  }
+
+  static SeriesVolumeCache& GetSingleton()
+  {
+    static SeriesVolumeCache instance;
+    return instance;
+  }
+
+  // Returns NULL if the series is not cached
+  boost::shared_ptr<const SeriesVolume> Find(const std::string& seriesId)
+  {
+    Orthanc::MemoryObjectCache::Accessor accessor(cache_, seriesId, false /* shared, as the volumes are read-only */);
+
+    if (accessor.IsValid())
+    {
+      return dynamic_cast<const Item&>(accessor.GetValue()).GetVolume();
+    }
+    else
+    {
+      return boost::shared_ptr<const SeriesVolume>();
+    }
+  }
+};
+
+
+/**
+ * Resamples the volume onto a stack of parallel planes whose axes
+ * are "axisX" and "axisY" (which must be orthonormal), using
+ * isotropic voxels of size "spacing". The planes cover the bounding
+ * box of the volume along their normal, and all the slices share
+ * the same extent, which is the union of the intersections of the
+ * planes with the volume, rounded to a whole number of voxels.
+ **/
+static void WriteResampledVolume(NumpyAnswerWriter& writer,
+                                 const SeriesVolume& volume,
+                                 const OrthancStone::Vector& axisX,
+                                 const OrthancStone::Vector& axisY,
+                                 double spacing,
+                                 OrthancStone::ImageInterpolation interpolation,
+                                 float padding)
+{
+  assert(spacing > 0);
+
+  const OrthancStone::OrientedVolumeBoundingBox box(volume.GetGeometry());
+
+  OrthancStone::Vector normal;
+  OrthancStone::LinearAlgebra::CrossProduct(normal, axisX, axisY);
+
+  // Range of the volume along the normal of the planes
+  double minDepth = 0;
+  double maxDepth = 0;
+
+  for (unsigned int i = 0; i < 8; i++)
+  {
+    OrthancStone::Vector corner;
+    box.FromInternalCoordinates(corner, (i & 1) ? 1 : 0, (i & 2) ? 1 : 0, (i & 4) ? 1 : 0);
+
+    const double d = OrthancStone::LinearAlgebra::DotProduct(corner, normal);
+    if (i == 0)
+    {
+      minDepth = d;
+      maxDepth = d;
+    }
+    else
+    {
+      minDepth = std::min(minDepth, d);
+      maxDepth = std::max(maxDepth, d);
+    }
+  }
+
+  const unsigned int depth = std::max(1, boost::math::iround((maxDepth - minDepth) / spacing));
+
+  // The planes are centered on the volume
+  const double firstDepth = (minDepth + maxDepth - spacing * static_cast<double>(depth - 1)) / 2.0;
+
+  std::vector<OrthancStone::CoordinateSystem3D> planes;
+  planes.reserve(depth);
+
+  OrthancStone::Extent2D extent;
+
+  for (unsigned int z = 0; z < depth; z++)
+  {
+    const OrthancStone::Vector origin = normal * (firstDepth + spacing * static_cast<double>(z));
+    planes.push_back(OrthancStone::CoordinateSystem3D(origin, axisX, axisY));
+
+    // As the origins of the planes only differ along their normal,
+    // the 2D extents are expressed in the same coordinate system
+    OrthancStone::Extent2D intersection;
+    if (box.ComputeExtent(intersection, planes.back()))
+    {
+      extent.Union(intersection);
+    }
+  }
+
+  if (extent.IsEmpty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+
+  // The tolerance avoids adding one voxel because of rounding errors
+  const unsigned int width = std::max(1, static_cast<int>(std::ceil(extent.GetWidth() / spacing - 0.001)));
+  const unsigned int height = std::max(1, static_cast<int>(std::ceil(extent.GetHeight() / spacing - 0.001)));
+
+  const double centerX = (extent.GetX1() + extent.GetX2()) / 2.0;
+  const double centerY = (extent.GetY1() + extent.GetY2()) / 2.0;
+  const double halfWidth = spacing * static_cast<double>(width) / 2.0;
+  const double halfHeight = spacing * static_cast<double>(height) / 2.0;
+
+  const OrthancStone::Extent2D snapped(centerX - halfWidth, centerY - halfHeight,
+                                       centerX + halfWidth, centerY + halfHeight);
+
+  writer.WriteHeader(depth, width, height, Orthanc::PixelFormat_Float32);
+
+  OrthancStone::VolumeReslicer reslicer;
+  reslicer.SetOutputFormat(Orthanc::PixelFormat_Float32);
+  reslicer.SetInterpolation(interpolation);
+  reslicer.SetOutOfVolumeValue(padding);
+
+  WorkersBudget::Reservation reservation(GetBatchThreadsCount());
+  reslicer.SetThreadsCount(reservation.GetThreadsCount());
+
+  for (unsigned int z = 0; z < depth; z++)
+  {
+    reslicer.Apply(volume.GetImage(), volume.GetGeometry(), planes[z], snapped, spacing);
+
+    std::unique_ptr<Orthanc::ImageAccessor> slice(reslicer.ReleaseOutputSlice());
+
+    if (slice->GetWidth() != width ||
+        slice->GetHeight() != height)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+
+    writer.WritePixels(*slice);
+  }
+}
+
+
+static void WriteVolume(NumpyAnswerWriter& writer,
+                        const SeriesVolume& volume)
+{
+  const OrthancStone::ImageBuffer3D& image = volume.GetImage();
+
+  writer.WriteHeader(image.GetDepth(), image.GetWidth(), image.GetHeight(),
+                     Orthanc::PixelFormat_Float32);
+
+  for (unsigned int z = 0; z < image.GetDepth(); z++)
+  {
+    OrthancStone::ImageBuffer3D::SliceReader reader(image, OrthancStone::VolumeProjection_Axial, z);
+    writer.WritePixels(reader.GetAccessor());
+  }
+}
+
+
+/**
+ * Answers the 3D volume of a series as an array of shape (depth,
+ * height, width). Without option, the volume is answered in its
+ * acquisition geometry. Option "spacing" resamples the volume to
+ * isotropic voxels of the given size (in mm), and options "axis-x"
+ * and "axis-y" reslice it along oblique planes (the voxel size
+ * defaults to the finest dimension of the source voxels).
+ **/
+static void RenderNumpyVolume(OrthancPluginRestOutput* output,
+                              const char* url,
+                              const OrthancPluginHttpRequest* request)
+{
+  bool compress = false;
+  double spacing = 0;
+  bool hasPadding = false;
+  float padding = 0;
+  bool hasAxisX = false;
+  bool hasAxisY = false;
+  OrthancStone::Vector axisX, axisY;
+  OrthancStone::ImageInterpolation interpolation = OrthancStone::ImageInterpolation_Trilinear;
+
+  for (uint32_t i = 0; i < request->getCount; i++)
+  {
+    std::string key(request->getKeys[i]);
+    std::string value(request->getValues[i]);
+
+    if (key == "compress")
+    {
+      compress = ParseBoolean(key, value);
+    }
+    else if (key == "spacing")
+    {
+      spacing = ParseDouble(key, value);
+      if (spacing <= 0)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "The spacing must be positive");
+      }
+    }
+    else if (key == "padding")
+    {
+      hasPadding = true;
+      padding = static_cast<float>(ParseDouble(key, value));
+    }
+    else if (key == "axis-x")
+    {
+      hasAxisX = true;
+      axisX = ParseDirection(key, value);
+    }
+    else if (key == "axis-y")
+    {
+      hasAxisY = true;
+      axisY = ParseDirection(key, value);
+    }
+    else if (key == "interpolation")
+    {
+      if (value == "nearest")
+      {
+        interpolation = OrthancStone::ImageInterpolation_Nearest;
+      }
+      else if (value == "trilinear")
+      {
+        interpolation = OrthancStone::ImageInterpolation_Trilinear;
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "Bad value for " + key + " (must be \"nearest\" or \"trilinear\"): " + value);
+      }
+    }
+    else
+    {
+      LOG(WARNING) << "Unsupported option for volume rendering: " << key;
+    }
+  }
+
+  if (hasAxisX != hasAxisY)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "Options \"axis-x\" and \"axis-y\" must be provided together");
+  }
+
+  const std::string seriesId(request->groups[0]);
+
+  std::vector<std::string> instances;
+  GetSeriesInstances(instances, seriesId);
+
+  const std::string fingerprint = SeriesVolume::ComputeFingerprint(instances);
+
+  // The cache is not locked while the volume is used
+  boost::shared_ptr<const SeriesVolume> volume = SeriesVolumeCache::GetSingleton().Find(seriesId);
+
+  if (volume.get() == NULL ||
+      volume->GetFingerprint() != fingerprint)
+  {
+    // Cache miss, or the series has been modified since its volume was cached
+    volume.reset(SeriesVolume::Assemble(instances));
+    SeriesVolumeCache::GetSingleton().Store(seriesId, volume);
+  }
+
+  NumpyAnswerWriter writer(compress);
+
+  if (hasAxisX ||
+      spacing > 0)
+  {
+    const OrthancStone::VolumeImageGeometry& geometry = volume->GetGeometry();
+
+    if (hasAxisX)
+    {
+      // Gram-Schmidt, as the two axes must be orthonormal
+      axisY -= OrthancStone::LinearAlgebra::DotProduct(axisX, axisY) * axisX;
+
+      if (OrthancStone::LinearAlgebra::IsCloseToZero(boost::numeric::ublas::norm_2(axisY)))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "Options \"axis-x\" and \"axis-y\" must not be parallel");
+      }
+
+      OrthancStone::LinearAlgebra::NormalizeVector(axisY);
+    }
+    else
+    {
+      // Isotropic resampling, keeping the orientation of the series
+      axisX = geometry.GetAxialGeometry().GetAxisX();
+      axisY = geometry.GetAxialGeometry().GetAxisY();
+    }
+
+    if (spacing <= 0)
+    {
+      const OrthancStone::Vector dimensions = geometry.GetVoxelDimensions(OrthancStone::VolumeProjection_Axial);
+      spacing = std::min(dimensions[0], std::min(dimensions[1], dimensions[2]));
+    }
+
+    if (!hasPadding)
+    {
+      float maxValue;
+      if (!volume->GetImage().GetRange(padding, maxValue))
+      {
+        padding = 0;
+      }
+    }
+
+    WriteResampledVolume(writer, *volume, axisX, axisY, spacing, interpolation, padding);
+  }
+  else
+  {
+    WriteVolume(writer, *volume);
+  }
+
+  writer.Answer(output);
+}
+
+
+static bool IsRtStruct(const std::string& instanceId)
+{
+  std::string s;
+  if (OrthancPlugins::RestApiGetString(s, "/instances/" + instanceId + "/content/" + SOP_CLASS_UID, false) &&
+      !s.empty())
+  {
+    if (s[s.size() - 1] == '\0')  // Deal with DICOM padding
+    {
+      s.resize(s.size() - 1);
+    }
+    
+    return s == RT_STRUCT_IOD;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+
+static void ListRtStruct(OrthancPluginRestOutput* output,
+                         const char* url,
+                         const OrthancPluginHttpRequest* request)
+{
+  // This is a quick version of "/tools/find" on "SOPClassUID" (the
+  // latter would load all the DICOM files from disk)
+
+  Json::Value series;
+  OrthancPlugins::RestApiGet(series, "/series?expand", false);
+
+  if (series.type() != Json::arrayValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+
+  Json::Value answer = Json::arrayValue;
+
+  for (Json::Value::ArrayIndex i = 0; i < series.size(); i++)
   {
     if (series[i].type() != Json::objectValue ||
         !series[i].isMember(INSTANCES) ||
         series[i][INSTANCES].type() != Json::arrayValue)
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+    
+    const Json::Value& instances = series[i][INSTANCES];
+
+    for (Json::Value::ArrayIndex j = 0; j < instances.size(); j++)
+    {
+      if (instances[j].type() != Json::stringValue)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+    }
+    
+    if (instances.size() > 0 &&
+        IsRtStruct(instances[0].asString()))
+    {
+      for (Json::Value::ArrayIndex j = 0; j < instances.size(); j++)
+      {
+        answer.append(instances[j].asString());
+      }
+    }
+  }
+
+  std::string s = answer.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(), s.size(), "application/json");
+}
+
+
+static void GetRtStruct(OrthancPluginRestOutput* output,
+                        const char* url,
+                        const OrthancPluginHttpRequest* request)
+{
+  DicomStructureCache::Accessor accessor(DicomStructureCache::GetSingleton(), request->groups[0]);
+
+  Json::Value answer;
+  answer[STRUCTURES] = Json::arrayValue;
+
+  for (size_t i = 0; i < accessor.GetRtStruct().GetStructuresCount(); i++)
+  {
+    Json::Value color = Json::arrayValue;
+    color.append(accessor.GetRtStruct().GetStructureColor(i).GetRed());
+    color.append(accessor.GetRtStruct().GetStructureColor(i).GetGreen());
+    color.append(accessor.GetRtStruct().GetStructureColor(i).GetBlue());
+    
+    Json::Value structure;
+    structure["Name"] = accessor.GetRtStruct().GetStructureName(i);
+    structure["Interpretation"] = accessor.GetRtStruct().GetStructureInterpretation(i);
+    structure["Color"] = color;
+    
+    answer[STRUCTURES].append(structure);
+  }
+
+  std::set<std::string> sopInstanceUids;
+  accessor.GetRtStruct().GetReferencedInstances(sopInstanceUids);
+
+  answer[INSTANCES] = Json::arrayValue;
+  for (std::set<std::string>::const_iterator it = sopInstanceUids.begin(); it != sopInstanceUids.end(); ++it)
+  {
+    OrthancPlugins::OrthancString s;
+    s.Assign(OrthancPluginLookupInstance(OrthancPlugins::GetGlobalContext(), it->c_str()));
+
+    std::string t;
+    s.ToString(t);
+
+    answer[INSTANCES].append(t);
+  }
+
+  std::string s = answer.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(), s.size(), "application/json");
+}
+
+
+
+typedef std::list< std::vector<OrthancStone::Vector> >  RtStructPolygons;
+
+
+/**
+ * Rasterizes polygons of a RT-STRUCT onto a binary mask, whose
+ * pixels are set to 255 inside the polygons, and to 0 outside. A
+ * "XOR" filler is used in order to deal with the holes in the
+ * RT-STRUCT. The polygons are projected onto "geometry", then
+ * converted to pixels and mapped through "transform".
+ **/
+class RtStructRasterizer : public boost::noncopyable
+{
+private:
+  class XorFiller : public Orthanc::ImageProcessing::IPolygonFiller
+  {
+  private:
+    Orthanc::ImageAccessor&  image_;
+
+  public:
+    explicit XorFiller(Orthanc::ImageAccessor& image) :
+      image_(image)
+    {
+    }
+
+    virtual void Fill(int y,
+                      int x1,
+                      int x2) ORTHANC_OVERRIDE
+    {
+      assert(x1 <= x2);
+
+      if (y >= 0 &&
+          y < static_cast<int>(image_.GetHeight()))
+      {
+        x1 = std::max(x1, 0);
+        x2 = std::min(x2, static_cast<int>(image_.GetWidth()) - 1);
+
+        uint8_t* p = reinterpret_cast<uint8_t*>(image_.GetRow(y)) + x1;
+
+        for (int i = x1; i <= x2; i++, p++)
+        {
+          *p = (*p ^ 0xff);
+        }
+      }
+    }
+  };
+
+  
+  class HorizontalSegment
+  {
+  private:
+    int  y_;
+    int  x1_;
+    int  x2_;
+    
+  public:
+    HorizontalSegment(int y,
+                      int x1,
+                      int x2) :
+      y_(y),
+      x1_(std::min(x1, x2)),
+      x2_(std::max(x1, x2))
+    {
+    }
+    
+    void Fill(Orthanc::ImageAccessor& image) const
+    {
+      assert(x1_ <= x2_);
+
+      if (y_ >= 0 &&
+          y_ < static_cast<int>(image.GetHeight()))
+      {
+        int a = std::max(x1_, 0);
+        int b = std::min(x2_, static_cast<int>(image.GetWidth()) - 1);
+
+        uint8_t* p = reinterpret_cast<uint8_t*>(image.GetRow(y_)) + a;
+
+        for (int i = a; i <= b; i++, p++)
+        {
+          *p = 0xff;
+        }
+      }
+    }
+  };
+
+  // Scratch buffers, that are reused across the calls to "Apply()"
+  std::vector<Orthanc::ImageProcessing::ImagePoint>  points_;
+  std::vector<HorizontalSegment>                     horizontalSegments_;
+
+public:
+  void Apply(Orthanc::ImageAccessor& mask,
+             const RtStructPolygons& polygons,
+             const OrthancStone::CoordinateSystem3D& geometry,
+             double pixelSpacingX,
+             double pixelSpacingY,
+             const OrthancStone::AffineTransform2D& transform)
+  {
+    if (mask.GetFormat() != Orthanc::PixelFormat_Grayscale8)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageFormat);
+    }
+
+    Orthanc::ImageProcessing::Set(mask, 0);
+
+    XorFiller filler(mask);
+    horizontalSegments_.clear();
+  
+    for (RtStructPolygons::const_iterator it = polygons.begin(); it != polygons.end(); ++it)
+    {
+      points_.clear();
+      points_.reserve(it->size());
+
+      for (size_t i = 0; i < it->size(); i++)
+      {
+        // The (0.5, 0.5) offset is due to the fact that DICOM
+        // coordinates are expressed wrt. the CENTER of the voxels
+      
+        double x, y;
+        geometry.ProjectPoint(x, y, (*it) [i]);
+        x = x / pixelSpacingX + 0.5;
+        y = y / pixelSpacingY + 0.5;
+      
+        transform.Apply(x, y);
+
+        points_.push_back(Orthanc::ImageProcessing::ImagePoint(std::floor(x), std::floor(y)));
+      }
+    
+      Orthanc::ImageProcessing::FillPolygon(filler, points_);
+
+      for (size_t i = 0; i < points_.size(); i++)
+      {
+        size_t next = (i + 1) % points_.size();
+        if (points_[i].GetY() == points_[next].GetY())
+        {
+          horizontalSegments_.push_back(HorizontalSegment(points_[i].GetY(), points_[i].GetX(), points_[next].GetX()));
+        }
+      }
+    }
+
+    /**
+     * We repeat the filling of the horizontal segments. This is
+     * important to deal with horizontal edges that are seen in one
+     * direction, then in the reverse direction within the same
+     * polygon, which can typically be seen in RT-STRUCT with
+     * holes. If this step is not done, only the starting point and
+     * the ending point of the segments are drawn.
+     **/
+    for (size_t i = 0; i < horizontalSegments_.size(); i++)
+    {
+      horizontalSegments_[i].Fill(mask);
+    }
+  }
+};
+
+
+static void RenderRtStruct(OrthancPluginRestOutput* output,
+                           const char* url,
+                           const OrthancPluginHttpRequest* request)
+{
+  DataAugmentationParameters dataAugmentation;
+  std::vector<std::string> structureNames;
+  std::string instanceId;
+  bool compress = false;
+
+  for (uint32_t i = 0; i < request->getCount; i++)
+  {
+    std::string key(request->getKeys[i]);
+    std::string value(request->getValues[i]);
+
+    if (!dataAugmentation.ParseParameter(key, value))
+    {
+      if (key == "structure")
+      {
+        Orthanc::Toolbox::TokenizeString(structureNames, value, ',');
+      }
+      else if (key == "instance")
+      {
+        instanceId = value;
+      }
+      else if (key == "compress")
+      {
+        compress = ParseBoolean(key, value);
+      }
+      else
+      {
+        LOG(WARNING) << "Unsupported option: " << key;
+      }
+    }
+  }
+
+  if (structureNames.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                    "Missing option \"structure\" to provide the names of the structures of interest");
+  }
+
+  if (instanceId.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                    "Missing option \"instance\" to provide the Orthanc identifier of the instance of interest");
+  }
+  
+  std::unique_ptr<OrthancStone::DicomInstanceParameters> parameters(GetInstanceParameters(instanceId));
+
+  RtStructPolygons polygons;
+
+  {
+    DicomStructureCache::Accessor accessor(DicomStructureCache::GetSingleton(), request->groups[0]);
+
+    for (size_t i = 0; i < structureNames.size(); i++)
+    {
+      size_t structureIndex;
+      if (accessor.GetRtStruct().LookupStructureName(structureIndex, structureNames[i]))
+      {
+        RtStructPolygons p;
+        accessor.GetRtStruct().GetStructurePoints(p, structureIndex, parameters->GetSopInstanceUid());
+        polygons.splice(polygons.begin(), p);
+      }
+      else
+      {
+        LOG(WARNING) << "Missing structure name \"" << structureNames[i]
+                     << "\" in RT-STRUCT: " << parameters->GetSopInstanceUid();
+      }
+    }
+  }
+
+  Orthanc::Image mask(Orthanc::PixelFormat_Grayscale8,
+                      dataAugmentation.GetTargetWidth(parameters->GetWidth()),
+                      dataAugmentation.GetTargetHeight(parameters->GetHeight()), false);
+
+  RtStructRasterizer rasterizer;
+  rasterizer.Apply(mask, polygons, parameters->GetGeometry(),
+                   parameters->GetPixelSpacingX(), parameters->GetPixelSpacingY(),
+                   dataAugmentation.ComputeTransform(parameters->GetWidth(), parameters->GetHeight()));
+  
+  AnswerNumpyImage(output, mask, compress);
+}
+
+
+/**
+ * The parameters of all the instances of one series, that are
+ * retrieved by one single call to the REST API of Orthanc (instead
+ * of one call per instance).
+ **/
+class SeriesInstancesParameters : public boost::noncopyable
+{
+private:
+  std::vector<std::string>                               instances_;
+  std::vector<OrthancStone::DicomInstanceParameters*>    parameters_;
+
+public:
+  ~SeriesInstancesParameters()
+  {
+    for (size_t i = 0; i < parameters_.size(); i++)
+    {
+      assert(parameters_[i] != NULL);
+      delete parameters_[i];
+    }
+  }
+
+  void Load(const std::string& seriesId)
+  {
+    if (!parameters_.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    Json::Value tags;
+    if (!OrthancPlugins::RestApiGet(tags, "/series/" + seriesId + "/instances-tags", false))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem);
+    }
+
+    if (tags.type() != Json::objectValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+
+    const std::vector<std::string> instances = tags.getMemberNames();
+    
+    instances_.reserve(instances.size());
+    parameters_.reserve(instances.size());
+
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+      Orthanc::DicomMap m;
+      m.FromDicomAsJson(tags[instances[i]]);
+
+      std::unique_ptr<OrthancStone::DicomInstanceParameters> parameters(new OrthancStone::DicomInstanceParameters(m));
+      parameters_.push_back(parameters.release());
+      instances_.push_back(instances[i]);
+    }
+  }
+
+  size_t GetInstancesCount() const
+  {
+    return parameters_.size();
+  }
+
+  const std::string& GetInstanceId(size_t instance) const
+  {
+    assert(instance < instances_.size());
+    return instances_[instance];
+  }
+
+  const OrthancStone::DicomInstanceParameters& GetParameters(size_t instance) const
+  {
+    assert(instance < parameters_.size());
+    return *parameters_[instance];
+  }
+};
+
+
+/**
+ * Rasterization of several structures of a RT-STRUCT onto all the
+ * frames of one series, which results in a multi-label volume. The
+ * polygons are binned by frame beforehand, then the frames are
+ * rasterized in parallel.
+ *
+ * In the "labels" encoding, each voxel contains the index (plus one)
+ * of one structure. As the structures are rasterized in the order of
+ * the request, a voxel that belongs to several overlapping structures
+ * gets the label of the LAST of them. In the "bitmask" encoding, the
+ * bit "i" of each voxel is set iff the voxel belongs to the structure
+ * "i", which preserves the overlaps.
+ **/
+class RtStructLabels : public ParallelLoop
+{
+private:
+  struct Slice
+  {
+    size_t        instance_;
+    unsigned int  frame_;
+
+    // The polygons of each structure that lie on this slice
+    std::vector<RtStructPolygons>  structures_;
+  };
+
+  const SeriesInstancesParameters&    series_;
+  const DataAugmentationParameters&   dataAugmentation_;
+  size_t                              structuresCount_;
+  bool                                bitmask_;
+  Orthanc::PixelFormat                format_;
+  unsigned int                        width_;
+  unsigned int                        height_;
+  std::vector<Slice>                  slices_;
+  std::vector<Orthanc::ImageAccessor*>  labels_;
+
+  // Index of the frames of each instance in "slices_"
+  typedef std::map<std::string, std::vector<size_t> >  SopInstanceIndex;
+  SopInstanceIndex  sopInstanceIndex_;
+
+  template <typename PixelType>
+  static void MergeMask(Orthanc::ImageAccessor& target,
+                        const Orthanc::ImageAccessor& mask,
+                        PixelType value,
+                        bool bitmask)
+  {
+    const unsigned int width = target.GetWidth();
+    const unsigned int height = target.GetHeight();
+
+    for (unsigned int y = 0; y < height; y++)
+    {
+      const uint8_t* p = reinterpret_cast<const uint8_t*>(mask.GetConstRow(y));
+      PixelType* q = reinterpret_cast<PixelType*>(target.GetRow(y));
+
+      for (unsigned int x = 0; x < width; x++, p++, q++)
+      {
+        if (*p != 0)
+        {
+          if (bitmask)
+          {
+            *q |= value;
+          }
+          else
+          {
+            *q = value;
+          }
+        }
+      }
+    }
+  }
+
+protected:
+  virtual void Process(size_t item) ORTHANC_OVERRIDE
+  {
+    assert(item < slices_.size() &&
+           labels_[item] == NULL);
+
+    const Slice& slice = slices_[item];
+    const OrthancStone::DicomInstanceParameters& parameters = series_.GetParameters(slice.instance_);
+
+    const OrthancStone::AffineTransform2D transform =
+      dataAugmentation_.ComputeTransform(parameters.GetWidth(), parameters.GetHeight());
+
+    std::unique_ptr<Orthanc::ImageAccessor> labels(new Orthanc::Image(format_, width_, height_, false));
+    Orthanc::ImageProcessing::Set(*labels, 0);
+
+    Orthanc::Image mask(Orthanc::PixelFormat_Grayscale8, width_, height_, false);
+    RtStructRasterizer rasterizer;
+
+    for (size_t i = 0; i < structuresCount_; i++)
+    {
+      if (!slice.structures_[i].empty())
+      {
+        rasterizer.Apply(mask, slice.structures_[i], parameters.GetFrameGeometry(slice.frame_),
+                         parameters.GetPixelSpacingX(), parameters.GetPixelSpacingY(), transform);
+
+        // The label of a structure is its index in the request, plus
+        // one, and its bit is its index in the request
+        switch (format_)
+        {
+          case Orthanc::PixelFormat_Grayscale8:
+            MergeMask<uint8_t>(*labels, mask, bitmask_ ? static_cast<uint8_t>(1u << i) :
+                               static_cast<uint8_t>(i + 1), bitmask_);
+            break;
+
+          case Orthanc::PixelFormat_Grayscale16:
+            assert(bitmask_);
+            MergeMask<uint16_t>(*labels, mask, static_cast<uint16_t>(1u << i), true);
+            break;
+
+          case Orthanc::PixelFormat_Grayscale32:
+            assert(bitmask_);
+            MergeMask<uint32_t>(*labels, mask, static_cast<uint32_t>(1u) << i, true);
+            break;
+
+          default:
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        }
+      }
+    }
+
+    labels_[item] = labels.release();
+  }
+
+public:
+  RtStructLabels(const SeriesInstancesParameters& series,
+                 const DataAugmentationParameters& dataAugmentation,
+                 size_t structuresCount,
+                 bool bitmask) :
+    series_(series),
+    dataAugmentation_(dataAugmentation),
+    structuresCount_(structuresCount),
+    bitmask_(bitmask),
+    format_(Orthanc::PixelFormat_Grayscale8),
+    width_(0),
+    height_(0)
+  {
+    if (bitmask)
+    {
+      // The smallest unsigned integer type with one bit per structure
+      if (structuresCount <= 8)
+      {
+        format_ = Orthanc::PixelFormat_Grayscale8;
+      }
+      else if (structuresCount <= 16)
+      {
+        format_ = Orthanc::PixelFormat_Grayscale16;
+      }
+      else if (structuresCount <= 32)
+      {
+        format_ = Orthanc::PixelFormat_Grayscale32;
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "At most 32 structures can be rasterized as a bitmask");
+      }
+    }
+    else if (structuresCount > 255)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "At most 255 structures can be rasterized as labels");
+    }
+  }
+
+  virtual ~RtStructLabels()
+  {
+    for (size_t i = 0; i < labels_.size(); i++)
+    {
+      if (labels_[i] != NULL)
+      {
+        delete labels_[i];
+      }
+    }
+  }
+
+  void AddFrame(size_t instance,
+                unsigned int frame)
+  {
+    const OrthancStone::DicomInstanceParameters& parameters = series_.GetParameters(instance);
+
+    const unsigned int width = dataAugmentation_.GetTargetWidth(parameters.GetWidth());
+    const unsigned int height = dataAugmentation_.GetTargetHeight(parameters.GetHeight());
+
+    if (slices_.empty())
+    {
+      width_ = width;
+      height_ = height;
+    }
+    else if (width_ != width ||
+             height_ != height)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageSize,
+                                      "All the frames of a batch must have the same size, use the \"resize\" option");
+    }
+
+    Slice slice;
+    slice.instance_ = instance;
+    slice.frame_ = frame;
+    slice.structures_.resize(structuresCount_);
+
+    sopInstanceIndex_[parameters.GetSopInstanceUid()].push_back(slices_.size());
+    slices_.push_back(slice);
+    labels_.push_back(NULL);
+  }
+
+  // Bins the polygons of one structure onto the frames, in one pass
+  void AddStructure(size_t structure,
+                    const OrthancStone::DicomStructureSet::PointsByInstance& points)
+  {
+    if (structure >= structuresCount_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    for (OrthancStone::DicomStructureSet::PointsByInstance::const_iterator
+           it = points.begin(); it != points.end(); ++it)
+    {
+      SopInstanceIndex::const_iterator frames = sopInstanceIndex_.find(it->first);
+      if (frames == sopInstanceIndex_.end())
+      {
+        continue;  // This instance does not belong to the series
+      }
+
+      assert(!frames->second.empty());
+
+      for (RtStructPolygons::const_iterator polygon = it->second.begin();
+           polygon != it->second.end(); ++polygon)
+      {
+        if (polygon->empty())
+        {
+          continue;
+        }
+        
+        // In the case of a multiframe instance, the polygon is
+        // associated with the frame whose plane is the closest
+        size_t best = frames->second[0];
+
+        if (frames->second.size() > 1)
+        {
+          double bestDistance = std::numeric_limits<double>::infinity();
+          
+          for (size_t i = 0; i < frames->second.size(); i++)
+          {
+            const Slice& slice = slices_[frames->second[i]];
+            double distance = series_.GetParameters(slice.instance_).GetFrameGeometry(slice.frame_).ComputeDistance((*polygon) [0]);
+            if (distance < bestDistance)
+            {
+              best = frames->second[i];
+              bestDistance = distance;
+            }
+          }
+        }
+
+        slices_[best].structures_[structure].push_back(*polygon);
+      }
+    }
+  }
+
+  void Render(unsigned int threadsCount)
+  {
+    Run(slices_.size(), threadsCount);
+  }
+
+  void Answer(OrthancPluginRestOutput* output,
+              bool compress) const
+  {
+    if (slices_.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "No frame to be rendered");
+    }
+
+    NumpyAnswerWriter writer(compress);
+    writer.WriteHeader(static_cast<unsigned int>(slices_.size()),
+                       width_, height_, format_);
+
+    for (size_t i = 0; i < labels_.size(); i++)
+    {
+      assert(labels_[i] != NULL);
+      writer.WritePixels(*labels_[i]);
+    }
+
+    writer.Answer(output);
+  }
+};
+
+
+/**
+ * Rasterizes the structures of a RT-STRUCT onto all the frames of a
+ * series, in one single call. By default ("encoding=labels"), the
+ * answer is a multi-label NumPy array, in which the value of each
+ * voxel is the index (plus one) of the structure in the "structure"
+ * option, or zero for the background. If structures overlap, the
+ * voxel gets the label of the structure that comes last. With
+ * "encoding=bitmask", the bit "i" of each voxel is set iff the voxel
+ * belongs to the structure "i", which supports overlaps for up to 32
+ * structures. By default, all the structures are rasterized, in the
+ * order of the "/info" route. The frames are sorted as in the
+ * "/stone/series/.../numpy" route.
+ **/
+static void RenderRtStructSeries(OrthancPluginRestOutput* output,
+                                 const char* url,
+                                 const OrthancPluginHttpRequest* request)
+{
+  DataAugmentationParameters dataAugmentation;
+  std::vector<std::string> structureNames;
+  bool compress = false;
+  bool bitmask = false;
+
+  for (uint32_t i = 0; i < request->getCount; i++)
+  {
+    std::string key(request->getKeys[i]);
+    std::string value(request->getValues[i]);
+
+    if (!dataAugmentation.ParseParameter(key, value))
+    {
+      if (key == "structure")
+      {
+        Orthanc::Toolbox::TokenizeString(structureNames, value, ',');
+      }
+      else if (key == "compress")
+      {
+        compress = ParseBoolean(key, value);
+      }
+      else if (key == "encoding")
+      {
+        if (value == "labels")
+        {
+          bitmask = false;
+        }
+        else if (value == "bitmask")
+        {
+          bitmask = true;
+        }
+        else
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                          "Unknown encoding (must be \"labels\" or \"bitmask\"): " + value);
+        }
+      }
+      else
+      {
+        LOG(WARNING) << "Unsupported option: " << key;
+      }
+    }
+  }
+
+  SeriesInstancesParameters series;
+  series.Load(request->groups[1]);
+
+  std::vector< std::pair<size_t, unsigned int> > frames;
+  SortSeriesFrames(frames, series);
+
+  std::unique_ptr<RtStructLabels> labels;
+
+  {
+    // The polygons are copied into "labels", so that the RT-STRUCT is
+    // not locked during the rasterization
+    DicomStructureCache::Accessor accessor(DicomStructureCache::GetSingleton(), request->groups[0]);
+
+    std::vector<size_t> structures;
+
+    if (structureNames.empty())
+    {
+      for (size_t i = 0; i < accessor.GetRtStruct().GetStructuresCount(); i++)
+      {
+        structures.push_back(i);
+      }
+    }
+    else
+    {
+      for (size_t i = 0; i < structureNames.size(); i++)
+      {
+        size_t structureIndex;
+        if (accessor.GetRtStruct().LookupStructureName(structureIndex, structureNames[i]))
+        {
+          structures.push_back(structureIndex);
+        }
+        else
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem,
+                                          "Missing structure name \"" + structureNames[i] + "\" in RT-STRUCT");
+        }
+      }
+    }
+
+    labels.reset(new RtStructLabels(series, dataAugmentation, structures.size(), bitmask));
+
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+      labels->AddFrame(frames[i].first, frames[i].second);
+    }
+
+    for (size_t i = 0; i < structures.size(); i++)
+    {
+      OrthancStone::DicomStructureSet::PointsByInstance points;
+      accessor.GetRtStruct().GetStructurePointsByInstance(points, structures[i]);
+      labels->AddStructure(i, points);
+    }
+  }
+
+  labels->Render(GetBatchThreadsCount());
+  labels->Answer(output, compress);
+}
+
+
+
+/**
+ * Pool of the Cairo compositors that are used by the concurrent calls
+ * to the "/rendered" route. A compositor is reserved for the whole
+ * duration of one rendering, and the number of compositors is
+ * bounded, which bounds the memory that is used by the canvases.
+ **/
+class CompositorPool : public boost::noncopyable
+{
+private:
+  typedef std::vector<OrthancStone::CairoCompositor*>  Compositors;
+
+  boost::mutex               mutex_;
+  boost::condition_variable  available_;
+  Compositors                all_;
+  Compositors                free_;
+  size_t                     maximumSize_;
+
+  CompositorPool() :  // Singleton design pattern
+    maximumSize_(1)
+  {
+  }
+
+public:
+  ~CompositorPool()
+  {
+    for (size_t i = 0; i < all_.size(); i++)
+    {
+      assert(all_[i] != NULL);
+      delete all_[i];
+    }
+  }
+
+  // The compositors are created lazily, on the first concurrent requests
+  void SetMaximumSize(size_t size)
+  {
+    if (size == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    maximumSize_ = size;
+  }
+
+  static CompositorPool& GetSingleton()
+  {
+    static CompositorPool instance;
+    return instance;
+  }
+
+  class Accessor : public boost::noncopyable
+  {
+  private:
+    CompositorPool&                  that_;
+    OrthancStone::CairoCompositor*   compositor_;
+
+  public:
+    explicit Accessor(CompositorPool& that) :
+      that_(that),
+      compositor_(NULL)
+    {
+      boost::mutex::scoped_lock lock(that.mutex_);
+
+      while (that.free_.empty() &&
+             that.all_.size() >= that.maximumSize_)
+      {
+        that.available_.wait(lock);
+      }
+
+      if (that.free_.empty())
+      {
+        std::unique_ptr<OrthancStone::CairoCompositor> compositor(new OrthancStone::CairoCompositor(1, 1));
+        that.all_.push_back(compositor.get());
+        compositor_ = compositor.release();
+      }
+      else
+      {
+        compositor_ = that.free_.back();
+        that.free_.pop_back();
+      }
+    }
+
+    ~Accessor()
+    {
+      {
+        boost::mutex::scoped_lock lock(that_.mutex_);
+        that_.free_.push_back(compositor_);
+      }
+
+      that_.available_.notify_one();
+    }
+
+    OrthancStone::CairoCompositor& GetCompositor() const
+    {
+      return *compositor_;
+    }
+  };
+};
+
+
+// Parses the "Annotations" of the body of a call to the "/rendered"
+// route. The points are expressed in pixels wrt. the top-left corner
+// of the frame, as in the other routes of this plugin.
+static void ParseAnnotations(OrthancStone::PolylineSceneLayer& target,
+                             const Json::Value& body,
+                             const OrthancStone::DicomInstanceParameters& parameters)
+{
+  static const char* const ANNOTATIONS = "Annotations";
+  static const char* const POINTS = "Points";
+  static const char* const CLOSED = "Closed";
+  static const char* const COLOR = "Color";
+  
+  if (body.type() != Json::objectValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "The body must be a JSON object");
+  }
+
+  if (!body.isMember(ANNOTATIONS))
+  {
+    return;
+  }
+
+  const Json::Value& annotations = body[ANNOTATIONS];
+  if (annotations.type() != Json::arrayValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "The \"" + std::string(ANNOTATIONS) + "\" field must be an array");
+  }
+
+  for (Json::Value::ArrayIndex i = 0; i < annotations.size(); i++)
+  {
+    const Json::Value& annotation = annotations[i];
+
+    if (annotation.type() != Json::objectValue ||
+        !annotation.isMember(POINTS) ||
+        annotation[POINTS].type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "Each annotation must provide an array of \"" + std::string(POINTS) + "\"");
+    }
+
+    const Json::Value& points = annotation[POINTS];
+
+    OrthancStone::PolylineSceneLayer::Chain chain;
+    chain.reserve(points.size());
+
+    for (Json::Value::ArrayIndex j = 0; j < points.size(); j++)
+    {
+      if (points[j].type() != Json::arrayValue ||
+          points[j].size() != 2 ||
+          !points[j][0].isNumeric() ||
+          !points[j][1].isNumeric())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                        "Each point of an annotation must be an array \"[x, y]\"");
+      }
+
+      // The (-0.5, -0.5) offset is due to the fact that the center of
+      // the top-left pixel of the texture is the origin of the scene
+      const double x = (points[j][0].asDouble() - 0.5) * parameters.GetPixelSpacingX();
+      const double y = (points[j][1].asDouble() - 0.5) * parameters.GetPixelSpacingY();
+      chain.push_back(OrthancStone::ScenePoint2D(x, y));
+    }
+
+    bool closed = false;
+    if (annotation.isMember(CLOSED))
+    {
+      if (annotation[CLOSED].type() != Json::booleanValue)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                        "The \"" + std::string(CLOSED) + "\" field must be a Boolean");
+      }
+
+      closed = annotation[CLOSED].asBool();
+    }
+
+    uint8_t red = 0;
+    uint8_t green = 255;
+    uint8_t blue = 0;
+
+    if (annotation.isMember(COLOR))
+    {
+      const Json::Value& color = annotation[COLOR];
+      if (color.type() != Json::arrayValue ||
+          color.size() != 3 ||
+          !color[0].isUInt() || color[0].asUInt() > 255 ||
+          !color[1].isUInt() || color[1].asUInt() > 255 ||
+          !color[2].isUInt() || color[2].asUInt() > 255)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                        "The \"" + std::string(COLOR) + "\" field must be an array \"[red, green, blue]\"");
+      }
+
+      red = static_cast<uint8_t>(color[0].asUInt());
+      green = static_cast<uint8_t>(color[1].asUInt());
+      blue = static_cast<uint8_t>(color[2].asUInt());
+    }
+
+    target.AddChain(chain, closed, red, green, blue);
+  }
+}
+
+
+// Maximum width and height of the images that are rendered by the
+// server, as the canvas is allocated for each request. Can be changed
+// through the "RenderedMaximumSize" configuration option.
+static unsigned int maximumRenderedSize_ = 8192;
+
+
+static unsigned int ParseRenderedSize(const std::string& key,
+                                      const std::string& value)
+{
+  const unsigned int size = ParseUnsignedInteger(key, value);
+
+  if (size > maximumRenderedSize_)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "The " + key + " cannot be above " +
+                                    boost::lexical_cast<std::string>(maximumRenderedSize_) + ": " + value);
+  }
+  else
+  {
+    return size;
+  }
+}
+
+
+/**
+ * Server-side rendering of one frame, without any GPU. The scene is
+ * made of the texture of the frame, of the optional contours of a
+ * RT-STRUCT, and of the optional annotations that are provided in
+ * the JSON body of a POST request. The scene is drawn by a Cairo
+ * compositor taken from "CompositorPool", and the result is answered
+ * as a PNG or JPEG image.
+ **/
+static void RenderImage(OrthancPluginRestOutput* output,
+                        const char* url,
+                        const OrthancPluginHttpRequest* request)
+{
+  static const int LAYER_TEXTURE = 0;
+  static const int LAYER_RT_STRUCT = 1;
+  static const int LAYER_ANNOTATIONS = 2;
+  
+  unsigned int width = 0;
+  unsigned int height = 0;
+  bool jpeg = false;
+  unsigned int quality = 90;
+  bool hasWindowCenter = false;
+  bool hasWindowWidth = false;
+  double windowCenter = 0;
+  double windowWidth = 0;
+  bool inverted = false;
+  bool linearInterpolation = true;
+  double zoom = 1;
+  double panX = 0;
+  double panY = 0;
+  double angleRadians = 0;
+  std::string rtStructId;
+  std::vector<std::string> structureNames;
+  double thickness = 1;
+
+  for (uint32_t i = 0; i < request->getCount; i++)
+  {
+    std::string key(request->getKeys[i]);
+    std::string value(request->getValues[i]);
+
+    if (key == "width")
+    {
+      width = ParseRenderedSize(key, value);
+    }
+    else if (key == "height")
+    {
+      height = ParseRenderedSize(key, value);
+    }
+    else if (key == "format")
+    {
+      if (value == "png")
+      {
+        jpeg = false;
+      }
+      else if (value == "jpeg")
+      {
+        jpeg = true;
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "Unknown format (must be \"png\" or \"jpeg\"): " + value);
+      }
+    }
+    else if (key == "quality")
+    {
+      quality = ParseUnsignedInteger(key, value);
+      if (quality < 1 ||
+          quality > 100)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "The quality of JPEG must be between 1 and 100: " + value);
+      }
     }
-    
-    const Json::Value& instances = series[i][INSTANCES];
-
-    for (Json::Value::ArrayIndex j = 0; j < instances.size(); j++)
+    else if (key == "window-center")
     {
-      if (instances[j].type() != Json::stringValue)
+      windowCenter = ParseDouble(key, value);
+      hasWindowCenter = true;
+    }
+    else if (key == "window-width")
+    {
+      windowWidth = ParseDouble(key, value);
+      hasWindowWidth = true;
+    }
+    else if (key == "invert")
+    {
+      inverted = ParseBoolean(key, value);
+    }
+    else if (key == "interpolation")
+    {
+      if (value == "nearest")
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        linearInterpolation = false;
+      }
+      else if (value == "bilinear")
+      {
+        linearInterpolation = true;
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "Unknown interpolation (must be \"nearest\" or \"bilinear\"): " + value);
       }
     }
-    
-    if (instances.size() > 0 &&
-        IsRtStruct(instances[0].asString()))
+    else if (key == "zoom")
     {
-      for (Json::Value::ArrayIndex j = 0; j < instances.size(); j++)
+      zoom = ParseDouble(key, value);
+      if (zoom <= 0)
       {
-        answer.append(instances[j].asString());
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "The zoom must be positive: " + value);
       }
     }
+    else if (key == "pan-x")
+    {
+      panX = ParseDouble(key, value);
+    }
+    else if (key == "pan-y")
+    {
+      panY = ParseDouble(key, value);
+    }
+    else if (key == "angle")
+    {
+      double angle = ParseDouble(key, value);
+      angleRadians = angle / 180.0 * boost::math::constants::pi<double>();
+    }
+    else if (key == "rt-struct")
+    {
+      rtStructId = value;
+    }
+    else if (key == "structure")
+    {
+      Orthanc::Toolbox::TokenizeString(structureNames, value, ',');
+    }
+    else if (key == "thickness")
+    {
+      thickness = ParseDouble(key, value);
+    }
+    else
+    {
+      LOG(WARNING) << "Unsupported option for rendering: " << key;
+    }
   }
 
-  std::string s = answer.toStyledString();
-  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(), s.size(), "application/json");
-}
-
-
-static void GetRtStruct(OrthancPluginRestOutput* output,
-                        const char* url,
-                        const OrthancPluginHttpRequest* request)
-{
-  DicomStructureCache::Accessor accessor(DicomStructureCache::GetSingleton(), request->groups[0]);
-
-  Json::Value answer;
-  answer[STRUCTURES] = Json::arrayValue;
-
-  for (size_t i = 0; i < accessor.GetRtStruct().GetStructuresCount(); i++)
+  if (hasWindowCenter != hasWindowWidth)
   {
-    Json::Value color = Json::arrayValue;
-    color.append(accessor.GetRtStruct().GetStructureColor(i).GetRed());
-    color.append(accessor.GetRtStruct().GetStructureColor(i).GetGreen());
-    color.append(accessor.GetRtStruct().GetStructureColor(i).GetBlue());
-    
-    Json::Value structure;
-    structure["Name"] = accessor.GetRtStruct().GetStructureName(i);
-    structure["Interpretation"] = accessor.GetRtStruct().GetStructureInterpretation(i);
-    structure["Color"] = color;
-    
-    answer[STRUCTURES].append(structure);
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "Options \"window-center\" and \"window-width\" must be provided together");
   }
 
-  std::set<std::string> sopInstanceUids;
-  accessor.GetRtStruct().GetReferencedInstances(sopInstanceUids);
-
-  answer[INSTANCES] = Json::arrayValue;
-  for (std::set<std::string>::const_iterator it = sopInstanceUids.begin(); it != sopInstanceUids.end(); ++it)
-  {
-    OrthancPlugins::OrthancString s;
-    s.Assign(OrthancPluginLookupInstance(OrthancPlugins::GetGlobalContext(), it->c_str()));
-
-    std::string t;
-    s.ToString(t);
+  const std::string instanceId(request->groups[0]);
+  const unsigned int frame = boost::lexical_cast<unsigned int>(request->groups[1]);
 
-    answer[INSTANCES].append(t);
-  }
+  std::unique_ptr<OrthancStone::DicomInstanceParameters> parameters(GetInstanceParameters(instanceId));
 
-  std::string s = answer.toStyledString();
-  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(), s.size(), "application/json");
-}
+  OrthancStone::Scene2D scene;
 
+  {
+    OrthancPlugins::MemoryBuffer dicom;
+    dicom.GetDicomInstance(instanceId);
 
+    OrthancPlugins::OrthancImage image;
+    image.DecodeDicomImage(dicom.GetData(), dicom.GetSize(), frame);
 
-static void RenderRtStruct(OrthancPluginRestOutput* output,
-                           const char* url,
-                           const OrthancPluginHttpRequest* request)
-{
-  class XorFiller : public Orthanc::ImageProcessing::IPolygonFiller
-  {
-  private:
-    Orthanc::Image  image_;
+    Orthanc::ImageAccessor source;
+    source.AssignReadOnly(Convert(image.GetPixelFormat()), image.GetWidth(), image.GetHeight(),
+                          image.GetPitch(), image.GetBuffer());
 
-  public:
-    XorFiller(unsigned int width,
-              unsigned int height) :
-      image_(Orthanc::PixelFormat_Grayscale8, width, height, false)
-    {
-      Orthanc::ImageProcessing::Set(image_, 0);
-    }
+    // The texture makes a copy of the pixel data. The integer pixel
+    // data is kept, as "CairoCompositor" can window it through a
+    // lookup table.
+    std::unique_ptr<OrthancStone::TextureBaseSceneLayer> texture(parameters->CreateTexture(source, true));
+    texture->SetLinearInterpolation(linearInterpolation);
 
-    Orthanc::ImageAccessor& GetImage()
-    {
-      return image_;
-    }
+    OrthancStone::FloatTextureSceneLayer* floatTexture =
+      dynamic_cast<OrthancStone::FloatTextureSceneLayer*>(texture.get());
 
-    virtual void Fill(int y,
-                      int x1,
-                      int x2) ORTHANC_OVERRIDE
+    if (floatTexture != NULL)
     {
-      assert(x1 <= x2);
-
-      if (y >= 0 &&
-          y < static_cast<int>(image_.GetHeight()))
+      OrthancStone::Windowing windowing;
+      
+      if (hasWindowCenter)
       {
-        x1 = std::max(x1, 0);
-        x2 = std::min(x2, static_cast<int>(image_.GetWidth()) - 1);
-
-        uint8_t* p = reinterpret_cast<uint8_t*>(image_.GetRow(y)) + x1;
+        floatTexture->SetCustomWindowing(windowCenter, windowWidth);
+      }
+      else if (parameters->LookupPerFrameWindowing(windowing, frame))
+      {
+        floatTexture->SetCustomWindowing(windowing.GetCenter(), windowing.GetWidth());
+      }
+      else if (parameters->GetWindowingPresetsCount() == 0)
+      {
+        windowing = parameters->GetFallbackWindowing();
+        floatTexture->SetCustomWindowing(windowing.GetCenter(), windowing.GetWidth());
+      }
 
-        for (int i = x1; i <= x2; i++, p++)
-        {
-          *p = (*p ^ 0xff);
-        }
+      if (inverted)
+      {
+        // Inversion wrt. the photometric interpretation of the frame
+        floatTexture->SetInverted(!floatTexture->IsInverted());
       }
     }
-  };
 
-  
-  class HorizontalSegment
-  {
-  private:
-    int  y_;
-    int  x1_;
-    int  x2_;
-    
-  public:
-    HorizontalSegment(int y,
-                      int x1,
-                      int x2) :
-      y_(y),
-      x1_(std::min(x1, x2)),
-      x2_(std::max(x1, x2))
+    if (width == 0)
     {
+      width = texture->GetTexture().GetWidth();
     }
-    
-    int GetY() const
+
+    if (height == 0)
     {
-      return y_;
+      height = texture->GetTexture().GetHeight();
     }
+
+    scene.SetLayer(LAYER_TEXTURE, texture.release());
+  }
+
+  if (!rtStructId.empty())
+  {
+    std::unique_ptr<OrthancStone::PolylineSceneLayer> layer(new OrthancStone::PolylineSceneLayer);
+    layer->SetThickness(thickness);
     
-    int GetX1() const
+    DicomStructureCache::Accessor accessor(DicomStructureCache::GetSingleton(), rtStructId);
+
+    std::vector<size_t> structures;
+
+    if (structureNames.empty())
     {
-      return x1_;
+      for (size_t i = 0; i < accessor.GetRtStruct().GetStructuresCount(); i++)
+      {
+        structures.push_back(i);
+      }
     }
-    
-    int GetX2() const
+    else
     {
-      return x2_;
+      for (size_t i = 0; i < structureNames.size(); i++)
+      {
+        size_t structureIndex;
+        if (accessor.GetRtStruct().LookupStructureName(structureIndex, structureNames[i]))
+        {
+          structures.push_back(structureIndex);
+        }
+        else
+        {
+          LOG(WARNING) << "Missing structure name \"" << structureNames[i]
+                       << "\" in RT-STRUCT: " << rtStructId;
+        }
+      }
     }
 
-    void Fill(Orthanc::ImageAccessor& image) const
+    for (size_t i = 0; i < structures.size(); i++)
     {
-      assert(x1_ <= x2_);
+      std::list< std::vector<OrthancStone::Vector> > polygons;
+      accessor.GetRtStruct().GetStructurePoints(polygons, structures[i], parameters->GetSopInstanceUid());
 
-      if (y_ >= 0 &&
-          y_ < static_cast<int>(image.GetHeight()))
-      {
-        int a = std::max(x1_, 0);
-        int b = std::min(x2_, static_cast<int>(image.GetWidth()) - 1);
+      const OrthancStone::Color color = accessor.GetRtStruct().GetStructureColor(structures[i]);
 
-        uint8_t* p = reinterpret_cast<uint8_t*>(image.GetRow(y_)) + a;
+      for (std::list< std::vector<OrthancStone::Vector> >::const_iterator
+             it = polygons.begin(); it != polygons.end(); ++it)
+      {
+        OrthancStone::PolylineSceneLayer::Chain chain;
+        chain.reserve(it->size());
 
-        for (int i = a; i <= b; i++, p++)
+        for (size_t j = 0; j < it->size(); j++)
         {
-          *p = 0xff;
+          // DICOM coordinates are expressed wrt. the CENTER of the
+          // voxels, which also corresponds to the origin of the texture
+          double x, y;
+          parameters->GetGeometry().ProjectPoint(x, y, (*it) [j]);
+          chain.push_back(OrthancStone::ScenePoint2D(x, y));
         }
+
+        layer->AddChain(chain, true /* closed */, color);
       }
     }
-  };
 
+    scene.SetLayer(LAYER_RT_STRUCT, layer.release());
+  }
 
-  DataAugmentationParameters dataAugmentation;
-  std::vector<std::string> structureNames;
-  std::string instanceId;
-  bool compress = false;
-
-  for (uint32_t i = 0; i < request->getCount; i++)
+  if (request->method == OrthancPluginHttpMethod_Post &&
+      request->bodySize > 0)
   {
-    std::string key(request->getKeys[i]);
-    std::string value(request->getValues[i]);
-
-    if (!dataAugmentation.ParseParameter(key, value))
+    Json::Value body;
+    if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize))
     {
-      if (key == "structure")
-      {
-        Orthanc::Toolbox::TokenizeString(structureNames, value, ',');
-      }
-      else if (key == "instance")
-      {
-        instanceId = value;
-      }
-      else if (key == "compress")
-      {
-        compress = ParseBoolean(key, value);
-      }
-      else
-      {
-        LOG(WARNING) << "Unsupported option: " << key;
-      }
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "The body must be a JSON object");
     }
-  }
 
-  if (structureNames.empty())
-  {
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
-                                    "Missing option \"structure\" to provide the names of the structures of interest");
+    std::unique_ptr<OrthancStone::PolylineSceneLayer> layer(new OrthancStone::PolylineSceneLayer);
+    layer->SetThickness(thickness);
+    ParseAnnotations(*layer, body, *parameters);
+    scene.SetLayer(LAYER_ANNOTATIONS, layer.release());
   }
 
-  if (instanceId.empty())
+  if (width == 0 ||
+      height == 0)
   {
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
-                                    "Missing option \"instance\" to provide the Orthanc identifier of the instance of interest");
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "Cannot render an empty image");
   }
-  
-  std::unique_ptr<OrthancStone::DicomInstanceParameters> parameters(GetInstanceParameters(instanceId));
 
-  typedef std::list< std::vector<OrthancStone::Vector> > Polygons;
+  // Zoom, rotation and pan (in pixels) are applied wrt. the center of
+  // the canvas, after the content of the scene has been fitted
+  scene.FitContent(width, height);
 
-  Polygons polygons;
+  const double cx = static_cast<double>(width) / 2.0;
+  const double cy = static_cast<double>(height) / 2.0;
 
-  {
-    DicomStructureCache::Accessor accessor(DicomStructureCache::GetSingleton(), request->groups[0]);
+  scene.SetSceneToCanvasTransform(OrthancStone::AffineTransform2D::Combine(
+    OrthancStone::AffineTransform2D::CreateOffset(cx + panX, cy + panY),
+    OrthancStone::AffineTransform2D::CreateRotation(angleRadians),
+    OrthancStone::AffineTransform2D::CreateScaling(zoom),
+    OrthancStone::AffineTransform2D::CreateOffset(-cx, -cy),
+    scene.GetSceneToCanvasTransform()));
 
-    for (size_t i = 0; i < structureNames.size(); i++)
-    {
-      size_t structureIndex;
-      if (accessor.GetRtStruct().LookupStructureName(structureIndex, structureNames[i]))
-      {
-        Polygons p;
-        accessor.GetRtStruct().GetStructurePoints(p, structureIndex, parameters->GetSopInstanceUid());
-        polygons.splice(polygons.begin(), p);
-      }
-      else
-      {
-        LOG(WARNING) << "Missing structure name \"" << structureNames[i]
-                     << "\" in RT-STRUCT: " << parameters->GetSopInstanceUid();
-      }
-    }
-  }
+  // Conversion from the BGRA32 memory layout of Cairo to RGB24. The
+  // compositor is released before the compression of the image.
+  Orthanc::Image rendered(Orthanc::PixelFormat_RGB24, width, height, false);
 
-  // We use a "XOR" filler for the polygons in order to deal with holes in the RT-STRUCT
-  XorFiller filler(parameters->GetWidth(), parameters->GetHeight());
-  OrthancStone::AffineTransform2D transform = dataAugmentation.ComputeTransform(parameters->GetWidth(), parameters->GetHeight());
-  
-  std::list<HorizontalSegment> horizontalSegments;
-  
-  for (std::list< std::vector<OrthancStone::Vector> >::const_iterator
-         it = polygons.begin(); it != polygons.end(); ++it)
   {
-    std::vector<Orthanc::ImageProcessing::ImagePoint> points;
-    points.reserve(it->size());
+    CompositorPool::Accessor accessor(CompositorPool::GetSingleton());
 
-    for (size_t i = 0; i < it->size(); i++)
-    {
-      // The (0.5, 0.5) offset is due to the fact that DICOM
-      // coordinates are expressed wrt. the CENTER of the voxels
-      
-      double x, y;
-      parameters->GetGeometry().ProjectPoint(x, y, (*it) [i]);
-      x = x / parameters->GetPixelSpacingX() + 0.5;
-      y = y / parameters->GetPixelSpacingY() + 0.5;
-      
-      transform.Apply(x, y);
+    OrthancStone::CairoCompositor& compositor = accessor.GetCompositor();
+    compositor.ResetScene();
+    compositor.SetCanvasSize(width, height);
+    compositor.Refresh(scene);
 
-      points.push_back(Orthanc::ImageProcessing::ImagePoint(std::floor(x), std::floor(y)));
-    }
-    
-    Orthanc::ImageProcessing::FillPolygon(filler, points);
+    Orthanc::ImageAccessor canvas;
+    compositor.GetCanvas().GetReadOnlyAccessor(canvas);
 
-    for (size_t i = 0; i < points.size(); i++)
+    for (unsigned int y = 0; y < height; y++)
     {
-      size_t next = (i + 1) % points.size();
-      if (points[i].GetY() == points[next].GetY())
+      const uint8_t* p = reinterpret_cast<const uint8_t*>(canvas.GetConstRow(y));
+      uint8_t* q = reinterpret_cast<uint8_t*>(rendered.GetRow(y));
+      
+      for (unsigned int x = 0; x < width; x++)
       {
-        horizontalSegments.push_back(HorizontalSegment(points[i].GetY(), points[i].GetX(), points[next].GetX()));
+        q[0] = p[2];  // R
+        q[1] = p[1];  // G
+        q[2] = p[0];  // B
+        p += 4;
+        q += 3;
       }
     }
   }
 
-  /**
-   * We repeat the filling of the horizontal segments. This is
-   * important to deal with horizontal edges that are seen in one
-   * direction, then in the reverse direction within the same polygon,
-   * which can typically be seen in RT-STRUCT with holes. If this step
-   * is not done, only the starting point and the ending point of the
-   * segments are drawn.
-   **/
-  for (std::list<HorizontalSegment>::const_iterator it = horizontalSegments.begin();
-       it != horizontalSegments.end(); ++it)
+  if (jpeg)
   {
-    it->Fill(filler.GetImage());
+    OrthancPluginCompressAndAnswerJpegImage(OrthancPlugins::GetGlobalContext(), output, OrthancPluginPixelFormat_RGB24,
+                                            rendered.GetWidth(), rendered.GetHeight(), rendered.GetPitch(),
+                                            rendered.GetConstBuffer(), static_cast<uint8_t>(quality));
+  }
+  else
+  {
+    OrthancPluginCompressAndAnswerPngImage(OrthancPlugins::GetGlobalContext(), output, OrthancPluginPixelFormat_RGB24,
+                                           rendered.GetWidth(), rendered.GetHeight(), rendered.GetPitch(),
+                                           rendered.GetConstBuffer());
   }
-  
-  AnswerNumpyImage(output, filler.GetImage(), compress);
 }
 
 
@@ -933,10 +3859,20 @@ OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeType changeType,
       if (resourceType == OrthancPluginResourceType_Instance)
       {
         DicomStructureCache::GetSingleton().Invalidate(resourceId);
+        InstanceParametersCache::GetSingleton().Invalidate(resourceId);
+      }
+      else if (resourceType == OrthancPluginResourceType_Series)
+      {
+        SeriesVolumeCache::GetSingleton().Invalidate(resourceId);
       }
       
       break;
 
+    case OrthancPluginChangeType_NewInstance:
+      // The instance might replace a previous version with the same identifier
+      InstanceParametersCache::GetSingleton().Invalidate(resourceId);
+      break;
+
     case OrthancPluginChangeType_OrthancStarted:
     {
       DicomStructureCache::Accessor accessor(DicomStructureCache::GetSingleton(), "54460695-ba3885ee-ddf61ac0-f028e31d-a6e474d9");
@@ -981,11 +3917,34 @@ extern "C"
     try
     {
       DicomStructureCache::GetSingleton().SetMaximumNumberOfItems(1024);  // Cache up to 1024 RT-STRUCT instances
+      SeriesVolumeCache::GetSingleton().SetMaximumMemory(1024 * 1024 * 1024);  // Cache up to 1GB of assembled volumes
+
+      {
+        OrthancPlugins::OrthancConfiguration configuration;
+
+        OrthancPlugins::OrthancConfiguration stone;
+        configuration.GetSection(stone, "StoneRendering");
+
+        // Cache up to 64MB of instance parameters by default
+        unsigned int size = stone.GetUnsignedIntegerValue("InstanceParametersCacheSize", 64);  // In MB
+        InstanceParametersCache::GetSingleton().SetMaximumMemory(static_cast<size_t>(size) * 1024 * 1024);
+
+        // Maximum width and height of the server-side rendered images
+        maximumRenderedSize_ = stone.GetUnsignedIntegerValue("RenderedMaximumSize", 8192);
+      }
+
+      CompositorPool::GetSingleton().SetMaximumSize(GetBatchThreadsCount());  // One compositor per core
       
       OrthancPlugins::RegisterRestCallback<RenderNumpyFrame>("/stone/instances/([^/]+)/frames/([0-9]+)/numpy", true);
+      OrthancPlugins::RegisterRestCallback<RenderNumpyFrames>("/stone/frames/numpy", true);
+      OrthancPlugins::RegisterRestCallback<RenderNumpySeries>("/stone/series/([^/]+)/numpy", true);
+      OrthancPlugins::RegisterRestCallback<RenderNumpyVolume>("/stone/series/([^/]+)/volume/numpy", true);
       OrthancPlugins::RegisterRestCallback<ListRtStruct>("/stone/rt-struct", true);
       OrthancPlugins::RegisterRestCallback<GetRtStruct>("/stone/rt-struct/([^/]+)/info", true);
       OrthancPlugins::RegisterRestCallback<RenderRtStruct>("/stone/rt-struct/([^/]+)/numpy", true);
+      OrthancPlugins::RegisterRestCallback<RenderRtStructSeries>("/stone/rt-struct/([^/]+)/series/([^/]+)/numpy", true);
+      OrthancPlugins::RegisterRestCallback<GetInstanceParametersCacheStatistics>("/stone/cache/instance-parameters", true);
+      OrthancPlugins::RegisterRestCallback<RenderImage>("/stone/instances/([^/]+)/frames/([0-9]+)/rendered", true);
       OrthancPluginRegisterOnChangeCallback(context, OnChangeCallback);
     }
     catch (...)